@@ -0,0 +1,405 @@
+/*
+ * async_stream.c - asynchronous read-ahead and write-behind stream implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "async_stream.h"
+#include "threadpool.h"
+
+/** Size of each buffer in the ring, in bytes */
+#define ASYNC_BUFFER_SIZE (1 << 20)
+
+/** State of a stream moved to a background thread */
+typedef struct _lz4ultra_async_stream_t {
+   /** Original stream, only used by the background thread */
+   lz4ultra_stream_t baseStream;
+
+   /** Single thread running the reader or writer loop */
+   lz4ultra_thread_pool_t pool;
+
+   lz4ultra_mutex_t lock;
+   lz4ultra_cond_t cond;
+
+   /** Ring of buffers, and number of bytes in each filled buffer */
+   unsigned char *pBufferData;
+   size_t *pBufferSize;
+   int nBufferCount;
+
+   /** Oldest filled buffer, and number of filled buffers; the caller (reads) or the background thread (writes) owns the first one */
+   int nFirstBuffer;
+   int nFilledBuffers;
+
+   /** Caller's position in the first filled buffer (reads), or in the first free buffer (writes) */
+   size_t nCurOffset;
+
+   int nIsOutput;
+
+   /** 1 once the original stream returned a short read, which ends read-ahead */
+   int nStreamEnd;
+
+   /** 1 once a read from the caller came up short because all the data was consumed */
+   int nEof;
+
+   /** 1 once the original stream returned a short write; the remaining data is then dropped */
+   int nWriteError;
+
+   /** 1 when the stream is being closed */
+   int nShutdown;
+} lz4ultra_async_stream_t;
+
+/**
+ * Background thread: read ahead into free buffers, until the original stream ends or the stream is closed
+ *
+ * @param pTaskArg asynchronous stream state (lz4ultra_async_stream_t)
+ */
+static void lz4ultra_asyncstream_reader_main(void *pTaskArg) {
+   lz4ultra_async_stream_t *pAsync = (lz4ultra_async_stream_t *)pTaskArg;
+
+   lz4ultra_mutex_lock(&pAsync->lock);
+
+   for (;;) {
+      while (pAsync->nFilledBuffers == pAsync->nBufferCount && !pAsync->nShutdown)
+         lz4ultra_cond_wait(&pAsync->cond, &pAsync->lock);
+      if (pAsync->nShutdown)
+         break;
+
+      int nBuffer = (pAsync->nFirstBuffer + pAsync->nFilledBuffers) % pAsync->nBufferCount;
+
+      lz4ultra_mutex_unlock(&pAsync->lock);
+      size_t nReadBytes = pAsync->baseStream.read(&pAsync->baseStream, pAsync->pBufferData + (size_t)nBuffer * ASYNC_BUFFER_SIZE, ASYNC_BUFFER_SIZE);
+      lz4ultra_mutex_lock(&pAsync->lock);
+
+      pAsync->pBufferSize[nBuffer] = nReadBytes;
+      if (nReadBytes)
+         pAsync->nFilledBuffers++;
+      if (nReadBytes < ASYNC_BUFFER_SIZE)
+         pAsync->nStreamEnd = 1;
+      lz4ultra_cond_broadcast(&pAsync->cond);
+
+      if (pAsync->nStreamEnd)
+         break;
+   }
+
+   lz4ultra_mutex_unlock(&pAsync->lock);
+}
+
+/**
+ * Background thread: write filled buffers out, until all of them are written and the stream is closed
+ *
+ * @param pTaskArg asynchronous stream state (lz4ultra_async_stream_t)
+ */
+static void lz4ultra_asyncstream_writer_main(void *pTaskArg) {
+   lz4ultra_async_stream_t *pAsync = (lz4ultra_async_stream_t *)pTaskArg;
+
+   lz4ultra_mutex_lock(&pAsync->lock);
+
+   for (;;) {
+      while (!pAsync->nFilledBuffers && !pAsync->nShutdown)
+         lz4ultra_cond_wait(&pAsync->cond, &pAsync->lock);
+      if (!pAsync->nFilledBuffers)
+         break;
+
+      int nBuffer = pAsync->nFirstBuffer;
+      size_t nBufferSize = pAsync->pBufferSize[nBuffer];
+
+      if (!pAsync->nWriteError) {
+         lz4ultra_mutex_unlock(&pAsync->lock);
+         size_t nWrittenBytes = pAsync->baseStream.write(&pAsync->baseStream, pAsync->pBufferData + (size_t)nBuffer * ASYNC_BUFFER_SIZE, nBufferSize);
+         lz4ultra_mutex_lock(&pAsync->lock);
+
+         if (nWrittenBytes != nBufferSize)
+            pAsync->nWriteError = 1;
+      }
+
+      pAsync->nFirstBuffer = (nBuffer + 1) % pAsync->nBufferCount;
+      pAsync->nFilledBuffers--;
+      lz4ultra_cond_broadcast(&pAsync->cond);
+   }
+
+   lz4ultra_mutex_unlock(&pAsync->lock);
+}
+
+/**
+ * Read from asynchronous stream
+ *
+ * @param stream stream
+ * @param ptr buffer to read into
+ * @param size number of bytes to read
+ *
+ * @return number of bytes read
+ */
+static size_t lz4ultra_asyncstream_read(lz4ultra_stream_t *stream, void *ptr, size_t size) {
+   lz4ultra_async_stream_t *pAsync = (lz4ultra_async_stream_t *)stream->obj;
+   size_t nTotalBytes = 0;
+
+   lz4ultra_mutex_lock(&pAsync->lock);
+
+   while (nTotalBytes < size) {
+      while (!pAsync->nFilledBuffers && !pAsync->nStreamEnd)
+         lz4ultra_cond_wait(&pAsync->cond, &pAsync->lock);
+      if (!pAsync->nFilledBuffers) {
+         pAsync->nEof = 1;
+         break;
+      }
+
+      /* The first filled buffer belongs to the caller until it is released, so it can be copied from without holding the lock */
+      int nBuffer = pAsync->nFirstBuffer;
+      size_t nBytes = pAsync->pBufferSize[nBuffer] - pAsync->nCurOffset;
+      if (nBytes > (size - nTotalBytes))
+         nBytes = size - nTotalBytes;
+
+      lz4ultra_mutex_unlock(&pAsync->lock);
+      memcpy((unsigned char *)ptr + nTotalBytes, pAsync->pBufferData + (size_t)nBuffer * ASYNC_BUFFER_SIZE + pAsync->nCurOffset, nBytes);
+      lz4ultra_mutex_lock(&pAsync->lock);
+
+      nTotalBytes += nBytes;
+      pAsync->nCurOffset += nBytes;
+      if (pAsync->nCurOffset == pAsync->pBufferSize[nBuffer]) {
+         pAsync->nFirstBuffer = (nBuffer + 1) % pAsync->nBufferCount;
+         pAsync->nFilledBuffers--;
+         pAsync->nCurOffset = 0;
+         lz4ultra_cond_broadcast(&pAsync->cond);
+      }
+   }
+
+   lz4ultra_mutex_unlock(&pAsync->lock);
+   return nTotalBytes;
+}
+
+/**
+ * Write to asynchronous stream
+ *
+ * @param stream stream
+ * @param ptr buffer to write from
+ * @param size number of bytes to write
+ *
+ * @return number of bytes written; short if an earlier write failed in the background
+ */
+static size_t lz4ultra_asyncstream_write(lz4ultra_stream_t *stream, void *ptr, size_t size) {
+   lz4ultra_async_stream_t *pAsync = (lz4ultra_async_stream_t *)stream->obj;
+   size_t nTotalBytes = 0;
+
+   lz4ultra_mutex_lock(&pAsync->lock);
+
+   while (nTotalBytes < size) {
+      while (pAsync->nFilledBuffers == pAsync->nBufferCount && !pAsync->nWriteError)
+         lz4ultra_cond_wait(&pAsync->cond, &pAsync->lock);
+      if (pAsync->nWriteError)
+         break;
+
+      /* The first free buffer belongs to the caller until it is handed over, so it can be copied to without holding the lock */
+      int nBuffer = (pAsync->nFirstBuffer + pAsync->nFilledBuffers) % pAsync->nBufferCount;
+      size_t nBytes = ASYNC_BUFFER_SIZE - pAsync->nCurOffset;
+      if (nBytes > (size - nTotalBytes))
+         nBytes = size - nTotalBytes;
+
+      lz4ultra_mutex_unlock(&pAsync->lock);
+      memcpy(pAsync->pBufferData + (size_t)nBuffer * ASYNC_BUFFER_SIZE + pAsync->nCurOffset, (const unsigned char *)ptr + nTotalBytes, nBytes);
+      lz4ultra_mutex_lock(&pAsync->lock);
+
+      nTotalBytes += nBytes;
+      pAsync->nCurOffset += nBytes;
+      if (pAsync->nCurOffset == ASYNC_BUFFER_SIZE) {
+         pAsync->pBufferSize[nBuffer] = ASYNC_BUFFER_SIZE;
+         pAsync->nFilledBuffers++;
+         pAsync->nCurOffset = 0;
+         lz4ultra_cond_broadcast(&pAsync->cond);
+      }
+   }
+
+   lz4ultra_mutex_unlock(&pAsync->lock);
+   return nTotalBytes;
+}
+
+/**
+ * Check if asynchronous stream has reached the end of the data
+ *
+ * @param stream stream
+ *
+ * @return nonzero if the end of the data has been reached, 0 if there is more data
+ */
+static int lz4ultra_asyncstream_eof(lz4ultra_stream_t *stream) {
+   lz4ultra_async_stream_t *pAsync = (lz4ultra_async_stream_t *)stream->obj;
+   int nEof;
+
+   lz4ultra_mutex_lock(&pAsync->lock);
+   nEof = pAsync->nEof;
+   lz4ultra_mutex_unlock(&pAsync->lock);
+
+   return nEof;
+}
+
+/**
+ * Close asynchronous stream: write any remaining data out, stop the background thread and close the original stream
+ *
+ * @param stream stream
+ */
+static void lz4ultra_asyncstream_close(lz4ultra_stream_t *stream) {
+   lz4ultra_async_stream_t *pAsync = (lz4ultra_async_stream_t *)stream->obj;
+
+   if (pAsync) {
+      lz4ultra_asyncstream_flush(stream);
+
+      lz4ultra_mutex_lock(&pAsync->lock);
+      pAsync->nShutdown = 1;
+      lz4ultra_cond_broadcast(&pAsync->cond);
+      lz4ultra_mutex_unlock(&pAsync->lock);
+
+      lz4ultra_thread_pool_destroy(&pAsync->pool);
+      lz4ultra_cond_destroy(&pAsync->cond);
+      lz4ultra_mutex_destroy(&pAsync->lock);
+
+      pAsync->baseStream.close(&pAsync->baseStream);
+
+      free(pAsync->pBufferSize);
+      free(pAsync->pBufferData);
+      free(pAsync);
+
+      stream->obj = NULL;
+      stream->read = NULL;
+      stream->write = NULL;
+      stream->eof = NULL;
+      stream->close = NULL;
+   }
+}
+
+/**
+ * Get the amount of memory that an asynchronous stream allocates, excluding the stack of its thread
+ *
+ * @param nBufferCount number of 1 Mb buffers in the ring, as passed to lz4ultra_asyncstream_open()
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_asyncstream_get_memory_size(int nBufferCount) {
+   if (nBufferCount < 2)
+      nBufferCount = 2;
+   if (nBufferCount > 64)
+      nBufferCount = 64;
+
+   return sizeof(lz4ultra_async_stream_t) + (size_t)nBufferCount * (ASYNC_BUFFER_SIZE + sizeof(size_t)) + lz4ultra_thread_pool_get_memory_size(1);
+}
+
+/**
+ * Move stream to a background thread: data is read ahead of the caller, or written behind it, through a bounded ring of buffers
+ *
+ * On success, the stream is replaced by the asynchronous stream, which takes over the original one and closes it when it is closed itself.
+ * On failure, the stream is left untouched and can still be used synchronously.
+ *
+ * @param stream stream to move to a background thread
+ * @param nIsOutput 1 if the stream is only written to, 0 if it is only read from
+ * @param nBufferCount number of 1 Mb buffers in the ring, i.e. how far reads can run ahead, or writes can lag behind (2..64)
+ *
+ * @return 0 for success, nonzero for failure
+ */
+int lz4ultra_asyncstream_open(lz4ultra_stream_t *stream, const int nIsOutput, int nBufferCount) {
+   lz4ultra_async_stream_t *pAsync;
+
+   if (nBufferCount < 2)
+      nBufferCount = 2;
+   if (nBufferCount > 64)
+      nBufferCount = 64;
+
+   pAsync = (lz4ultra_async_stream_t *)malloc(sizeof(lz4ultra_async_stream_t));
+   if (!pAsync)
+      return -1;
+
+   memset(pAsync, 0, sizeof(lz4ultra_async_stream_t));
+   pAsync->baseStream = *stream;
+   pAsync->nBufferCount = nBufferCount;
+   pAsync->nIsOutput = nIsOutput;
+   pAsync->pBufferData = (unsigned char *)malloc((size_t)nBufferCount * ASYNC_BUFFER_SIZE);
+   pAsync->pBufferSize = (size_t *)malloc(nBufferCount * sizeof(size_t));
+
+   if (!pAsync->pBufferData || !pAsync->pBufferSize || lz4ultra_thread_pool_init(&pAsync->pool, 1) != 0) {
+      free(pAsync->pBufferSize);
+      free(pAsync->pBufferData);
+      free(pAsync);
+      return -1;
+   }
+
+   lz4ultra_mutex_init(&pAsync->lock);
+   lz4ultra_cond_init(&pAsync->cond);
+
+   if (lz4ultra_thread_pool_submit(&pAsync->pool, nIsOutput ? lz4ultra_asyncstream_writer_main : lz4ultra_asyncstream_reader_main, pAsync) != 0) {
+      lz4ultra_thread_pool_destroy(&pAsync->pool);
+      lz4ultra_cond_destroy(&pAsync->cond);
+      lz4ultra_mutex_destroy(&pAsync->lock);
+      free(pAsync->pBufferSize);
+      free(pAsync->pBufferData);
+      free(pAsync);
+      return -1;
+   }
+
+   stream->obj = (void*)pAsync;
+   stream->read = lz4ultra_asyncstream_read;
+   stream->write = lz4ultra_asyncstream_write;
+   stream->eof = lz4ultra_asyncstream_eof;
+   stream->close = lz4ultra_asyncstream_close;
+   return 0;
+}
+
+/**
+ * Wait until all data written to an asynchronous stream has been handed over to the original stream
+ *
+ * @param stream stream, either opened with lz4ultra_asyncstream_open() or any other stream, for which this does nothing
+ *
+ * @return 0 for success, nonzero if some of the data written behind the caller couldn't be written out
+ */
+int lz4ultra_asyncstream_flush(lz4ultra_stream_t *stream) {
+   lz4ultra_async_stream_t *pAsync = (lz4ultra_async_stream_t *)stream->obj;
+   int nResult;
+
+   if (stream->close != lz4ultra_asyncstream_close || !pAsync->nIsOutput)
+      return 0;
+
+   lz4ultra_mutex_lock(&pAsync->lock);
+
+   /* Hand the partially filled buffer over, then wait for the background thread to write everything out */
+   if (pAsync->nCurOffset) {
+      while (pAsync->nFilledBuffers == pAsync->nBufferCount)
+         lz4ultra_cond_wait(&pAsync->cond, &pAsync->lock);
+
+      int nBuffer = (pAsync->nFirstBuffer + pAsync->nFilledBuffers) % pAsync->nBufferCount;
+      pAsync->pBufferSize[nBuffer] = pAsync->nCurOffset;
+      pAsync->nFilledBuffers++;
+      pAsync->nCurOffset = 0;
+      lz4ultra_cond_broadcast(&pAsync->cond);
+   }
+
+   while (pAsync->nFilledBuffers)
+      lz4ultra_cond_wait(&pAsync->cond, &pAsync->lock);
+
+   nResult = pAsync->nWriteError ? -1 : 0;
+   lz4ultra_mutex_unlock(&pAsync->lock);
+
+   return nResult;
+}
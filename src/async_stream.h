@@ -0,0 +1,70 @@
+/*
+ * async_stream.h - asynchronous read-ahead and write-behind stream definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _ASYNC_STREAM_H
+#define _ASYNC_STREAM_H
+
+#include "stream.h"
+
+/**
+ * Get the amount of memory that an asynchronous stream allocates, excluding the stack of its thread
+ *
+ * @param nBufferCount number of 1 Mb buffers in the ring, as passed to lz4ultra_asyncstream_open()
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_asyncstream_get_memory_size(int nBufferCount);
+
+/**
+ * Move stream to a background thread: data is read ahead of the caller, or written behind it, through a bounded ring of buffers
+ *
+ * On success, the stream is replaced by the asynchronous stream, which takes over the original one and closes it when it is closed itself.
+ * On failure, the stream is left untouched and can still be used synchronously.
+ *
+ * @param stream stream to move to a background thread
+ * @param nIsOutput 1 if the stream is only written to, 0 if it is only read from
+ * @param nBufferCount number of 1 Mb buffers in the ring, i.e. how far reads can run ahead, or writes can lag behind (2..64)
+ *
+ * @return 0 for success, nonzero for failure
+ */
+int lz4ultra_asyncstream_open(lz4ultra_stream_t *stream, const int nIsOutput, int nBufferCount);
+
+/**
+ * Wait until all data written to an asynchronous stream has been handed over to the original stream
+ *
+ * @param stream stream, either opened with lz4ultra_asyncstream_open() or any other stream, for which this does nothing
+ *
+ * @return 0 for success, nonzero if some of the data written behind the caller couldn't be written out
+ */
+int lz4ultra_asyncstream_flush(lz4ultra_stream_t *stream);
+
+#endif /* _ASYNC_STREAM_H */
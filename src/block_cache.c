@@ -0,0 +1,285 @@
+/*
+ * block_cache.c - compressed block cache implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "block_cache.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
+/** Seeds of the two window hashes; the bundled xxhash has no 128-bit hash, so two 64-bit ones are combined */
+#define BLOCK_CACHE_SEED_0 0ULL
+#define BLOCK_CACHE_SEED_1 0x9e3779b97f4a7c15ULL
+
+/** Memory budget per hash bucket; small entries, such as zeroed blocks, just make chains a little longer */
+#define BLOCK_CACHE_BYTES_PER_BUCKET 4096
+
+#define BLOCK_CACHE_MIN_BUCKETS 256
+#define BLOCK_CACHE_MAX_BUCKETS (1U << 22)
+
+/**
+ * Create cache of compressed blocks
+ *
+ * @param nMaxSize memory budget, in bytes, for the cached blocks and their bookkeeping
+ *
+ * @return cache, or NULL for failure
+ */
+lz4ultra_block_cache_t *lz4ultra_block_cache_create(const size_t nMaxSize) {
+   lz4ultra_block_cache_t *pCache;
+   unsigned int nNumBuckets = BLOCK_CACHE_MIN_BUCKETS;
+
+   while (nNumBuckets < BLOCK_CACHE_MAX_BUCKETS && (size_t)nNumBuckets * BLOCK_CACHE_BYTES_PER_BUCKET < nMaxSize)
+      nNumBuckets <<= 1;
+
+   pCache = (lz4ultra_block_cache_t *)malloc(sizeof(lz4ultra_block_cache_t));
+   if (!pCache)
+      return NULL;
+
+   pCache->buckets = (lz4ultra_block_cache_entry_t **)calloc(nNumBuckets, sizeof(lz4ultra_block_cache_entry_t *));
+   if (!pCache->buckets) {
+      free(pCache);
+      return NULL;
+   }
+
+   if (lz4ultra_mutex_init(&pCache->lock) != 0) {
+      free(pCache->buckets);
+      free(pCache);
+      return NULL;
+   }
+
+   pCache->bucket_mask = nNumBuckets - 1;
+   pCache->lru_head = NULL;
+   pCache->lru_tail = NULL;
+   pCache->max_size = nMaxSize;
+   pCache->cur_size = 0;
+   return pCache;
+}
+
+/**
+ * Free cache of compressed blocks, once no context uses it anymore
+ *
+ * @param pCache cache, or NULL
+ */
+void lz4ultra_block_cache_free(lz4ultra_block_cache_t *pCache) {
+   if (pCache) {
+      lz4ultra_block_cache_entry_t *pEntry = pCache->lru_head;
+
+      while (pEntry) {
+         lz4ultra_block_cache_entry_t *pNextEntry = pEntry->lru_next;
+         free(pEntry);
+         pEntry = pNextEntry;
+      }
+
+      lz4ultra_mutex_destroy(&pCache->lock);
+      free(pCache->buckets);
+      free(pCache);
+   }
+}
+
+/**
+ * Compute the key of a block to compress
+ *
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param nSettings hash of the compression settings
+ * @param pKey returned key
+ */
+void lz4ultra_block_cache_make_key(const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, const unsigned long long nSettings,
+                                   lz4ultra_block_cache_key_t *pKey) {
+   size_t nWindowSize = (size_t)nPreviousBlockSize + (size_t)nInDataSize;
+
+   memset(pKey, 0, sizeof(lz4ultra_block_cache_key_t));
+   pKey->hash[0] = XXH64(pInWindow, nWindowSize, BLOCK_CACHE_SEED_0);
+   pKey->hash[1] = XXH64(pInWindow, nWindowSize, BLOCK_CACHE_SEED_1);
+   pKey->settings = nSettings;
+   pKey->previous_block_size = nPreviousBlockSize;
+   pKey->in_data_size = nInDataSize;
+}
+
+/**
+ * Get the bucket that a block goes into
+ *
+ * @param pCache cache
+ * @param pKey key of block
+ *
+ * @return pointer to the head of the bucket's chain
+ */
+static lz4ultra_block_cache_entry_t **lz4ultra_block_cache_get_bucket(lz4ultra_block_cache_t *pCache, const lz4ultra_block_cache_key_t *pKey) {
+   return &pCache->buckets[(unsigned int)(pKey->hash[0] ^ pKey->settings) & pCache->bucket_mask];
+}
+
+/**
+ * Find a block in the cache; the cache must be locked
+ *
+ * @param pCache cache
+ * @param pKey key of block
+ *
+ * @return entry, or NULL if the block isn't cached
+ */
+static lz4ultra_block_cache_entry_t *lz4ultra_block_cache_find(lz4ultra_block_cache_t *pCache, const lz4ultra_block_cache_key_t *pKey) {
+   lz4ultra_block_cache_entry_t *pEntry = *lz4ultra_block_cache_get_bucket(pCache, pKey);
+
+   while (pEntry && memcmp(&pEntry->key, pKey, sizeof(lz4ultra_block_cache_key_t)))
+      pEntry = pEntry->hash_next;
+   return pEntry;
+}
+
+/**
+ * Unlink an entry from the usage order; the cache must be locked
+ *
+ * @param pCache cache
+ * @param pEntry entry to unlink
+ */
+static void lz4ultra_block_cache_unlink(lz4ultra_block_cache_t *pCache, lz4ultra_block_cache_entry_t *pEntry) {
+   if (pEntry->lru_prev)
+      pEntry->lru_prev->lru_next = pEntry->lru_next;
+   else
+      pCache->lru_head = pEntry->lru_next;
+   if (pEntry->lru_next)
+      pEntry->lru_next->lru_prev = pEntry->lru_prev;
+   else
+      pCache->lru_tail = pEntry->lru_prev;
+}
+
+/**
+ * Make an entry the most recently used one; the cache must be locked
+ *
+ * @param pCache cache
+ * @param pEntry entry, not currently in the usage order
+ */
+static void lz4ultra_block_cache_link_first(lz4ultra_block_cache_t *pCache, lz4ultra_block_cache_entry_t *pEntry) {
+   pEntry->lru_prev = NULL;
+   pEntry->lru_next = pCache->lru_head;
+   if (pCache->lru_head)
+      pCache->lru_head->lru_prev = pEntry;
+   else
+      pCache->lru_tail = pEntry;
+   pCache->lru_head = pEntry;
+}
+
+/**
+ * Evict the least recently used entry; the cache must be locked and not empty
+ *
+ * @param pCache cache
+ */
+static void lz4ultra_block_cache_evict(lz4ultra_block_cache_t *pCache) {
+   lz4ultra_block_cache_entry_t *pEntry = pCache->lru_tail;
+   lz4ultra_block_cache_entry_t **ppBucketEntry = lz4ultra_block_cache_get_bucket(pCache, &pEntry->key);
+
+   while (*ppBucketEntry != pEntry)
+      ppBucketEntry = &(*ppBucketEntry)->hash_next;
+   *ppBucketEntry = pEntry->hash_next;
+
+   lz4ultra_block_cache_unlink(pCache, pEntry);
+   pCache->cur_size -= sizeof(lz4ultra_block_cache_entry_t) + (size_t)pEntry->out_data_size;
+   free(pEntry);
+}
+
+/**
+ * Look a block up, and copy its compressed bytes out if it is in the cache
+ *
+ * @param pCache cache
+ * @param pKey key of block
+ * @param pOutData pointer to output buffer
+ * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ * @param pNumCommands pointer to returned number of commands in the compressed bytes
+ *
+ * @return size of compressed data copied to the output buffer, or -1 if the block isn't cached or doesn't fit
+ */
+int lz4ultra_block_cache_get(lz4ultra_block_cache_t *pCache, const lz4ultra_block_cache_key_t *pKey, unsigned char *pOutData, const int nMaxOutDataSize, int *pNumCommands) {
+   lz4ultra_block_cache_entry_t *pEntry;
+   int nOutDataSize = -1;
+
+   lz4ultra_mutex_lock(&pCache->lock);
+
+   pEntry = lz4ultra_block_cache_find(pCache, pKey);
+   if (pEntry && pEntry->out_data_size <= nMaxOutDataSize) {
+      /* Copy while locked, so that the entry can't be evicted by another thread in the meantime */
+      memcpy(pOutData, (const unsigned char *)(pEntry + 1), pEntry->out_data_size);
+      nOutDataSize = pEntry->out_data_size;
+      *pNumCommands = pEntry->num_commands;
+
+      lz4ultra_block_cache_unlink(pCache, pEntry);
+      lz4ultra_block_cache_link_first(pCache, pEntry);
+   }
+
+   lz4ultra_mutex_unlock(&pCache->lock);
+   return nOutDataSize;
+}
+
+/**
+ * Add a block that was just compressed to the cache, evicting the least recently used blocks if required
+ *
+ * @param pCache cache
+ * @param pKey key of block
+ * @param pOutData compressed bytes
+ * @param nOutDataSize size of compressed bytes
+ * @param nNumCommands number of commands in the compressed bytes
+ */
+void lz4ultra_block_cache_put(lz4ultra_block_cache_t *pCache, const lz4ultra_block_cache_key_t *pKey, const unsigned char *pOutData, const int nOutDataSize, const int nNumCommands) {
+   size_t nEntrySize = sizeof(lz4ultra_block_cache_entry_t) + (size_t)nOutDataSize;
+   lz4ultra_block_cache_entry_t *pEntry;
+   lz4ultra_block_cache_entry_t **ppBucket;
+
+   if (nOutDataSize < 0 || nEntrySize > pCache->max_size)
+      return;
+
+   /* Allocate and fill the entry before locking, to hold the lock for as little time as possible */
+   pEntry = (lz4ultra_block_cache_entry_t *)malloc(nEntrySize);
+   if (!pEntry)
+      return;
+   pEntry->key = *pKey;
+   pEntry->out_data_size = nOutDataSize;
+   pEntry->num_commands = nNumCommands;
+   memcpy((unsigned char *)(pEntry + 1), pOutData, nOutDataSize);
+
+   lz4ultra_mutex_lock(&pCache->lock);
+
+   if (lz4ultra_block_cache_find(pCache, pKey)) {
+      /* Another thread compressed the same block at the same time, and added it first */
+      lz4ultra_mutex_unlock(&pCache->lock);
+      free(pEntry);
+      return;
+   }
+
+   while (pCache->lru_tail && pCache->cur_size + nEntrySize > pCache->max_size)
+      lz4ultra_block_cache_evict(pCache);
+
+   ppBucket = lz4ultra_block_cache_get_bucket(pCache, pKey);
+   pEntry->hash_next = *ppBucket;
+   *ppBucket = pEntry;
+   lz4ultra_block_cache_link_first(pCache, pEntry);
+   pCache->cur_size += nEntrySize;
+
+   lz4ultra_mutex_unlock(&pCache->lock);
+}
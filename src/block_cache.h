@@ -0,0 +1,125 @@
+/*
+ * block_cache.h - compressed block cache definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _BLOCK_CACHE_H
+#define _BLOCK_CACHE_H
+
+#include <stdlib.h>
+#include "threadpool.h"
+
+/** Identity of one block to compress: its window contents and the compression settings */
+typedef struct _lz4ultra_block_cache_key_t {
+   unsigned long long hash[2];               /**< two 64-bit hashes of the window (previously compressed bytes + bytes to compress), with different seeds */
+   unsigned long long settings;              /**< hash of the context settings that the compressed bytes depend on */
+   int previous_block_size;                  /**< number of previously compressed bytes in the window */
+   int in_data_size;                         /**< number of bytes to compress */
+} lz4ultra_block_cache_key_t;
+
+/** One compressed block held by the cache, followed in memory by its compressed bytes */
+typedef struct _lz4ultra_block_cache_entry_t {
+   struct _lz4ultra_block_cache_entry_t *hash_next;  /**< next entry in the same bucket */
+   struct _lz4ultra_block_cache_entry_t *lru_prev;   /**< next more recently used entry, or NULL for the most recent one */
+   struct _lz4ultra_block_cache_entry_t *lru_next;   /**< next less recently used entry, or NULL for the least recent one */
+   lz4ultra_block_cache_key_t key;                   /**< block that was compressed */
+   int out_data_size;                                /**< size of compressed bytes */
+   int num_commands;                                 /**< number of commands in the compressed bytes */
+} lz4ultra_block_cache_entry_t;
+
+/** Cache of compressed blocks, looked up by contents, that any number of contexts and threads can share */
+typedef struct _lz4ultra_block_cache_t {
+   lz4ultra_mutex_t lock;
+   lz4ultra_block_cache_entry_t **buckets;
+   unsigned int bucket_mask;
+   lz4ultra_block_cache_entry_t *lru_head;
+   lz4ultra_block_cache_entry_t *lru_tail;
+   size_t max_size;
+   size_t cur_size;
+} lz4ultra_block_cache_t;
+
+/**
+ * Create cache of compressed blocks
+ *
+ * The cache holds the compressed bytes of the blocks compressed by the contexts it is attached to (see
+ * lz4ultra_compressor_set_block_cache()), so that byte-identical blocks, compressed with the same settings and after
+ * the same previously compressed bytes, are emitted again without running the match finder. When it is full, the
+ * least recently used blocks are evicted to make room. Any number of contexts and threads can share one cache.
+ *
+ * @param nMaxSize memory budget, in bytes, for the cached blocks and their bookkeeping
+ *
+ * @return cache, or NULL for failure
+ */
+lz4ultra_block_cache_t *lz4ultra_block_cache_create(const size_t nMaxSize);
+
+/**
+ * Free cache of compressed blocks, once no context uses it anymore
+ *
+ * @param pCache cache, or NULL
+ */
+void lz4ultra_block_cache_free(lz4ultra_block_cache_t *pCache);
+
+/**
+ * Compute the key of a block to compress
+ *
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param nSettings hash of the compression settings
+ * @param pKey returned key
+ */
+void lz4ultra_block_cache_make_key(const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, const unsigned long long nSettings,
+   lz4ultra_block_cache_key_t *pKey);
+
+/**
+ * Look a block up, and copy its compressed bytes out if it is in the cache
+ *
+ * @param pCache cache
+ * @param pKey key of block
+ * @param pOutData pointer to output buffer
+ * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ * @param pNumCommands pointer to returned number of commands in the compressed bytes
+ *
+ * @return size of compressed data copied to the output buffer, or -1 if the block isn't cached or doesn't fit
+ */
+int lz4ultra_block_cache_get(lz4ultra_block_cache_t *pCache, const lz4ultra_block_cache_key_t *pKey, unsigned char *pOutData, const int nMaxOutDataSize, int *pNumCommands);
+
+/**
+ * Add a block that was just compressed to the cache, evicting the least recently used blocks if required
+ *
+ * @param pCache cache
+ * @param pKey key of block
+ * @param pOutData compressed bytes
+ * @param nOutDataSize size of compressed bytes
+ * @param nNumCommands number of commands in the compressed bytes
+ */
+void lz4ultra_block_cache_put(lz4ultra_block_cache_t *pCache, const lz4ultra_block_cache_key_t *pKey, const unsigned char *pOutData, const int nOutDataSize, const int nNumCommands);
+
+#endif /* _BLOCK_CACHE_H */
@@ -0,0 +1,220 @@
+/*
+ * block_split.c - adaptive block splitting implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <string.h>
+#include "block_split.h"
+#include "format.h"
+
+/** Number of bits of the hash table used to find repeats */
+#define SPLIT_HASH_BITS 13
+
+/** Only one in (1 << SPLIT_SAMPLE_SHIFT) positions is entered in the hash table, so that the table holds the whole match window
+ * (MAX_OFFSET / (1 << SPLIT_SAMPLE_SHIFT) entries, half the table) instead of the last few Kb of it. Every position is still looked
+ * up, and finds an earlier occurrence of its 4 bytes if one of its occurrences is a sampled position, so that about one in
+ * (1 << SPLIT_SAMPLE_SHIFT) repeats is counted */
+#define SPLIT_SAMPLE_SHIFT 4
+
+/** Hash table entry: a sampled position, and its first MIN_MATCH_SIZE bytes, so that looking it up doesn't read the data where
+ * it is, up to a whole match window back */
+typedef struct {
+   int nPos;
+   unsigned int nValue;
+} lz4ultra_split_entry_t;
+
+/**
+ * Read the first MIN_MATCH_SIZE bytes at the specified position
+ *
+ * @param pCur pointer to bytes
+ *
+ * @return bytes, as one 32-bit value
+ */
+static inline unsigned int lz4ultra_split_read32(const unsigned char *pCur) {
+   return ((unsigned int)pCur[0]) | (((unsigned int)pCur[1]) << 8) | (((unsigned int)pCur[2]) << 16) | (((unsigned int)pCur[3]) << 24);
+}
+
+/**
+ * Count the positions in a range that repeat the 4 bytes of an earlier, sampled position that is close enough to be matched
+ *
+ * @param pData data
+ * @param nStartOffset offset of the first position to look at
+ * @param nEndOffset offset past the last position to look at
+ * @param nDataSize size of the data, in bytes
+ * @param pHashTable 1 << SPLIT_HASH_BITS last sampled positions seen for each hash, or -1, with their bytes, updated with the sampled positions looked at
+ * @param nMaxRepeats number of repeats to stop counting at
+ * @param nRunStart offset of the first position of the run of data in front of the range, that pRunRepeats counts the repeats of
+ * @param pRunRepeats pointer to number of repeats of an earlier position between nRunStart and nStartOffset, updated, or NULL not to count them
+ *
+ * @return number of repeats found, at most nMaxRepeats; about (1 << SPLIT_SAMPLE_SHIFT) times fewer than the positions that repeat
+ */
+static int lz4ultra_split_count_repeats(const unsigned char *pData, const int nStartOffset, int nEndOffset, const int nDataSize, lz4ultra_split_entry_t *pHashTable, const int nMaxRepeats,
+                                        const int nRunStart, int *pRunRepeats) {
+   int nRepeats = 0, nRunRepeats = 0;
+   int i;
+
+   if (nEndOffset > nDataSize - MIN_MATCH_SIZE + 1)
+      nEndOffset = nDataSize - MIN_MATCH_SIZE + 1;
+
+   for (i = nStartOffset; i < nEndOffset; i++) {
+      unsigned int nValue = lz4ultra_split_read32(pData + i);
+      unsigned int nHash = (nValue * 2654435761U) >> (32 - SPLIT_HASH_BITS);
+      int nPrevPos = pHashTable[nHash].nPos;
+      if (pHashTable[nHash].nValue == nValue && nPrevPos >= 0 && (i - nPrevPos) <= MAX_OFFSET) {
+         if (nPrevPos >= nRunStart && nPrevPos < nStartOffset)
+            nRunRepeats++;
+         if (++nRepeats >= nMaxRepeats)
+            break;
+      }
+
+      if ((i & ((1 << SPLIT_SAMPLE_SHIFT) - 1)) == 0) {
+         pHashTable[nHash].nPos = i;
+         pHashTable[nHash].nValue = nValue;
+      }
+   }
+
+   if (pRunRepeats)
+      *pRunRepeats += nRunRepeats;
+   return nRepeats;
+}
+
+/**
+ * Find where to end the next block, so that blocks end where the input goes from compressible to incompressible data or
+ * back, and tell whether the block is worth compressing
+ *
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes available for the block)
+ * @param nPreviousBlockSize number of previously compressed bytes that the block can refer to (or 0 for none)
+ * @param nInDataSize number of input bytes available for the block
+ * @param pIncompressible pointer to returned flag, set to 1 if the block should be stored uncompressed, 0 otherwise
+ *
+ * @return size of the block, in bytes (at most nInDataSize)
+ */
+int lz4ultra_split_block(const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, int *pIncompressible) {
+   lz4ultra_split_entry_t nHashTable[1 << SPLIT_HASH_BITS];
+   const int nEndOffset = nPreviousBlockSize + nInDataSize;
+   int nIncompressible = -1;
+   int nRunStart = nPreviousBlockSize, nRunWindows = 0;
+   int nWindowStart;
+
+   /* Repeats of the previously compressed bytes count as well */
+   memset(nHashTable, 0xff, sizeof(nHashTable));
+   if (nPreviousBlockSize) {
+      int nHistoryStart = (nPreviousBlockSize > MAX_OFFSET) ? (nPreviousBlockSize - MAX_OFFSET) : 0;
+      lz4ultra_split_count_repeats(pInWindow, nHistoryStart, nPreviousBlockSize, nEndOffset, nHashTable, nPreviousBlockSize + 1, 0, NULL);
+   }
+
+   for (nWindowStart = nPreviousBlockSize; nWindowStart < nEndOffset; nWindowStart += LZ4ULTRA_SPLIT_WINDOW_SIZE) {
+      int nWindowEnd = (nEndOffset - nWindowStart > LZ4ULTRA_SPLIT_WINDOW_SIZE) ? (nWindowStart + LZ4ULTRA_SPLIT_WINDOW_SIZE) : nEndOffset;
+      int nRunRepeats = 0;
+      int nRepeats = lz4ultra_split_count_repeats(pInWindow, nWindowStart, nWindowEnd, nEndOffset, nHashTable, LZ4ULTRA_SPLIT_WINDOW_SIZE + 1, nPreviousBlockSize, &nRunRepeats);
+      int nWindowIncompressible;
+
+      /* Data where less than 1 in 16 bytes repeats doesn't get smaller as LZ4 */
+      nWindowIncompressible = ((nRepeats << (4 + SPLIT_SAMPLE_SHIFT)) < (nWindowEnd - nWindowStart)) ? 1 : 0;
+
+      if (nIncompressible < 0) {
+         /* The block is incompressible if it starts with enough incompressible windows to end a compressible block */
+         if (!nWindowIncompressible) {
+            nIncompressible = 0;
+            nRunWindows = 0;
+         }
+         else if (++nRunWindows >= LZ4ULTRA_SPLIT_MIN_WINDOWS) {
+            nIncompressible = 1;
+         }
+      }
+      else if (nIncompressible) {
+         if (!nWindowIncompressible) {
+            if ((nRunRepeats << (4 + SPLIT_SAMPLE_SHIFT)) >= (nWindowEnd - nWindowStart)) {
+               /* The data that follows repeats the incompressible start: keep both in one block, so that it can still refer to it
+                * when blocks are independent */
+               nIncompressible = 0;
+               nRunWindows = 0;
+            }
+            else {
+               *pIncompressible = 1;
+               return nWindowStart - nPreviousBlockSize;
+            }
+         }
+      }
+      else {
+         if (nWindowIncompressible) {
+            if (!nRunWindows)
+               nRunStart = nWindowStart;
+            if (++nRunWindows >= LZ4ULTRA_SPLIT_MIN_WINDOWS) {
+               *pIncompressible = 0;
+               return nRunStart - nPreviousBlockSize;
+            }
+         }
+         else {
+            nRunWindows = 0;
+         }
+      }
+   }
+
+   /* A short input that is incompressible all the way is stored as well */
+   if (nIncompressible < 0)
+      nIncompressible = (nRunWindows > 0) ? 1 : 0;
+   *pIncompressible = nIncompressible;
+   return nInDataSize;
+}
+
+/**
+ * Check whether a block is too incompressible to be worth running the match finder and parser on
+ *
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ *
+ * @return 1 if the block should be stored uncompressed, 0 if it should be compressed
+ */
+int lz4ultra_block_is_incompressible(const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize) {
+   lz4ultra_split_entry_t nHashTable[1 << SPLIT_HASH_BITS];
+   const int nEndOffset = nPreviousBlockSize + nInDataSize;
+   const int nMinRepeats = (nInDataSize >> (6 + SPLIT_SAMPLE_SHIFT)) + 1;
+   int nHistoryStart;
+
+   if (nInDataSize < LZ4ULTRA_INCOMPRESSIBLE_MIN_SIZE)
+      return 0;
+
+   /* Look at the block by itself first: compressible data gets past the threshold after a small part of it */
+   memset(nHashTable, 0xff, sizeof(nHashTable));
+   if (lz4ultra_split_count_repeats(pInWindow, nPreviousBlockSize, nEndOffset, nEndOffset, nHashTable, nMinRepeats, 0, NULL) >= nMinRepeats)
+      return 0;
+   if (!nPreviousBlockSize)
+      return 1;
+
+   /* Then make sure that the block doesn't repeat the previously compressed bytes, such as a dictionary */
+   nHistoryStart = (nPreviousBlockSize > MAX_OFFSET) ? (nPreviousBlockSize - MAX_OFFSET) : 0;
+   memset(nHashTable, 0xff, sizeof(nHashTable));
+   lz4ultra_split_count_repeats(pInWindow, nHistoryStart, nPreviousBlockSize, nEndOffset, nHashTable, nPreviousBlockSize + 1, 0, NULL);
+   if (lz4ultra_split_count_repeats(pInWindow, nPreviousBlockSize, nEndOffset, nEndOffset, nHashTable, nMinRepeats, 0, NULL) >= nMinRepeats)
+      return 0;
+   return 1;
+}
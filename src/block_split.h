@@ -0,0 +1,77 @@
+/*
+ * block_split.h - adaptive block splitting definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _BLOCK_SPLIT_H
+#define _BLOCK_SPLIT_H
+
+/** Size of the windows that the input is classified in, as compressible or not, when splitting blocks adaptively */
+#define LZ4ULTRA_SPLIT_WINDOW_SIZE 4096
+
+/** Number of windows in a row of the other kind that end a compressible block */
+#define LZ4ULTRA_SPLIT_MIN_WINDOWS 4
+
+/**
+ * Find where to end the next block, so that blocks end where the input goes from compressible to incompressible data or
+ * back, and tell whether the block is worth compressing
+ *
+ * Each window is classified with a cheap pass that looks for 4-byte repeats within the match window, including the
+ * previously compressed bytes. A compressible block ends at the start of LZ4ULTRA_SPLIT_MIN_WINDOWS incompressible windows
+ * in a row; an incompressible block ends at the first compressible window, unless that window repeats the block, which
+ * then is compressed after all.
+ *
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes available for the block)
+ * @param nPreviousBlockSize number of previously compressed bytes that the block can refer to (or 0 for none)
+ * @param nInDataSize number of input bytes available for the block
+ * @param pIncompressible pointer to returned flag, set to 1 if the block should be stored uncompressed, 0 otherwise
+ *
+ * @return size of the block, in bytes (at most nInDataSize)
+ */
+int lz4ultra_split_block(const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, int *pIncompressible);
+
+/** Size of the smallest block that is checked for being incompressible before compressing it */
+#define LZ4ULTRA_INCOMPRESSIBLE_MIN_SIZE 16384
+
+/**
+ * Check whether a block is too incompressible to be worth running the match finder and parser on
+ *
+ * Blocks where less than 1 in 64 positions repeats 4 bytes found within the match window, including the previously
+ * compressed bytes, are considered incompressible; blocks under LZ4ULTRA_INCOMPRESSIBLE_MIN_SIZE bytes never are.
+ *
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ *
+ * @return 1 if the block should be stored uncompressed, 0 if it should be compressed
+ */
+int lz4ultra_block_is_incompressible(const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize);
+
+#endif /* _BLOCK_SPLIT_H */
@@ -31,7 +31,9 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "dictionary.h"
+#include "divsufsort.h"
 #include "format.h"
 #include "lib.h"
 
@@ -100,3 +102,159 @@ void lz4ultra_dictionary_free(void **ppDictionaryData) {
       ppDictionaryData = NULL;
    }
 }
+
+/**
+ * Get the amount of memory that a prepared dictionary holds on to until it is released
+ *
+ * @param nDictionaryDataSize size of dictionary contents, in bytes; only the last HISTORY_SIZE bytes are used
+ *
+ * @return size in bytes, or 0 for no dictionary
+ */
+size_t lz4ultra_dictionary_get_memory_size(int nDictionaryDataSize) {
+   if (nDictionaryDataSize <= 0)
+      return 0;
+   if (nDictionaryDataSize > HISTORY_SIZE)
+      nDictionaryDataSize = HISTORY_SIZE;
+   return sizeof(lz4ultra_prepared_dictionary_t) + (size_t)nDictionaryDataSize * (2 * sizeof(int) + 1);
+}
+
+/**
+ * Prepare dictionary for compressing many inputs with it
+ *
+ * @param pDictionaryData dictionary contents; only the last HISTORY_SIZE bytes are used
+ * @param nDictionaryDataSize size of dictionary contents, in bytes (must be greater than 0)
+ *
+ * @return prepared dictionary, to be released with lz4ultra_dictionary_release(), or NULL for failure
+ */
+lz4ultra_prepared_dictionary_t *lz4ultra_dictionary_prepare(const void *pDictionaryData, int nDictionaryDataSize) {
+   const unsigned char *pData = (const unsigned char *)pDictionaryData;
+   lz4ultra_prepared_dictionary_t *pDictionary;
+   divsufsort_ctx_t divsufsort_context;
+   int *pSuffixArray, *pNextLCP;
+   int nNumSorted, nMinLcp;
+   int i;
+
+   if (!pData || nDictionaryDataSize <= 0)
+      return NULL;
+   if (nDictionaryDataSize > HISTORY_SIZE) {
+      pData += nDictionaryDataSize - HISTORY_SIZE;
+      nDictionaryDataSize = HISTORY_SIZE;
+   }
+
+   /* Everything the prepared dictionary holds goes into one allocation, released at once */
+   pDictionary = (lz4ultra_prepared_dictionary_t *)malloc(sizeof(lz4ultra_prepared_dictionary_t) + (size_t)nDictionaryDataSize * (2 * sizeof(int) + 1));
+   pSuffixArray = (int *)malloc((size_t)nDictionaryDataSize * sizeof(int));
+   pNextLCP = (int *)malloc((size_t)nDictionaryDataSize * sizeof(int));
+   if (!pDictionary || !pSuffixArray || !pNextLCP || divsufsort_init(&divsufsort_context) != 0) {
+      free(pNextLCP);
+      free(pSuffixArray);
+      free(pDictionary);
+      return NULL;
+   }
+
+   pDictionary->sorted_suffixes = (int *)(pDictionary + 1);
+   pDictionary->sorted_lcp = pDictionary->sorted_suffixes + nDictionaryDataSize;
+   pDictionary->data = (unsigned char *)(pDictionary->sorted_lcp + nDictionaryDataSize);
+   pDictionary->size = nDictionaryDataSize;
+   memcpy(pDictionary->data, pData, nDictionaryDataSize);
+   pData = pDictionary->data;
+
+   if (divsufsort_build_array(&divsufsort_context, pData, (saidx_t *)pSuffixArray, nDictionaryDataSize) != 0) {
+      divsufsort_destroy(&divsufsort_context);
+      free(pNextLCP);
+      free(pSuffixArray);
+      free(pDictionary);
+      return NULL;
+   }
+   divsufsort_destroy(&divsufsort_context);
+
+   /* Get the common prefix length of each suffix with the next one in sorted order, by position (Karkkainen's method,
+    * with the next suffix instead of the previous one) */
+   int *pNext = pNextLCP;  /* Links to the next suffix first, overwritten in place with the lengths */
+   int nCurLen = 0;
+
+   for (i = 0; i < nDictionaryDataSize - 1; i++)
+      pNext[pSuffixArray[i]] = pSuffixArray[i + 1];
+   pNext[pSuffixArray[nDictionaryDataSize - 1]] = -1;
+   for (i = 0; i < nDictionaryDataSize; i++) {
+      int nNextPos = pNext[i];
+
+      if (nNextPos == -1) {
+         pNextLCP[i] = 0;
+         nCurLen = 0;
+         continue;
+      }
+      int nMaxLen = nDictionaryDataSize - ((i > nNextPos) ? i : nNextPos);
+      while (nCurLen < nMaxLen && pData[i + nCurLen] == pData[nNextPos + nCurLen]) nCurLen++;
+      pNextLCP[i] = nCurLen;
+      if (nCurLen > 0)
+         nCurLen--;
+   }
+
+   /* A suffix that is the start of the next one in sorted order extends into whatever follows the dictionary when comparing
+    * them, so its place depends on that data. If a suffix is open in this way, so is the one right after it, and the open
+    * suffixes are all at the end. */
+   pDictionary->num_open_suffixes = 0;
+   for (i = nDictionaryDataSize - 1; i >= 0 && pNextLCP[i] == (nDictionaryDataSize - i); i--)
+      pDictionary->num_open_suffixes++;
+
+   /* Keep the other suffixes in sorted order: their order stays the same whatever follows the dictionary, as they differ from
+    * each other within it. The common prefix of two of them is the shortest common prefix between them in the full order. */
+   nNumSorted = 0;
+   nMinLcp = 0;
+   for (i = 0; i < nDictionaryDataSize; i++) {
+      int nPos = pSuffixArray[i];
+
+      if (i > 0 && nMinLcp > pNextLCP[pSuffixArray[i - 1]])
+         nMinLcp = pNextLCP[pSuffixArray[i - 1]];
+
+      if (nPos < (nDictionaryDataSize - pDictionary->num_open_suffixes)) {
+         pDictionary->sorted_suffixes[nNumSorted] = nPos;
+         pDictionary->sorted_lcp[nNumSorted] = nNumSorted ? nMinLcp : 0;
+         nNumSorted++;
+         nMinLcp = nDictionaryDataSize;
+      }
+   }
+
+   free(pNextLCP);
+   free(pSuffixArray);
+   return pDictionary;
+}
+
+/**
+ * Load dictionary file and prepare it for compressing many inputs with it
+ *
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param ppDictionary pointer to returned prepared dictionary, or NULL for none
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+int lz4ultra_dictionary_prepare_file(const char *pszDictionaryFilename, lz4ultra_prepared_dictionary_t **ppDictionary) {
+   void *pDictionaryData = NULL;
+   int nDictionaryDataSize = 0;
+   int nStatus;
+
+   *ppDictionary = NULL;
+
+   nStatus = lz4ultra_dictionary_load(pszDictionaryFilename, &pDictionaryData, &nDictionaryDataSize);
+   if (nStatus)
+      return nStatus;
+
+   if (nDictionaryDataSize > 0) {
+      *ppDictionary = lz4ultra_dictionary_prepare(pDictionaryData, nDictionaryDataSize);
+      if (!*ppDictionary)
+         nStatus = LZ4ULTRA_ERROR_MEMORY;
+   }
+
+   lz4ultra_dictionary_free(&pDictionaryData);
+   return nStatus;
+}
+
+/**
+ * Release prepared dictionary
+ *
+ * @param pDictionary prepared dictionary, or NULL
+ */
+void lz4ultra_dictionary_release(lz4ultra_prepared_dictionary_t *pDictionary) {
+   free(pDictionary);
+}
@@ -33,6 +33,31 @@
 #ifndef _DICTIONARY_H
 #define _DICTIONARY_H
 
+/**
+ * Dictionary prepared once for compressing many inputs
+ *
+ * Besides the dictionary contents, it holds the dictionary's suffixes in sorted order, so that the suffix array of the
+ * dictionary followed by a block can be built by merging the block's own suffixes in, rather than sorting everything
+ * again. Once prepared, it is never modified and can be shared by any number of compression contexts and threads.
+ */
+typedef struct _lz4ultra_prepared_dictionary_t {
+   /** Dictionary contents (the last HISTORY_SIZE bytes at most) */
+   unsigned char *data;
+
+   /** Size of dictionary contents, in bytes */
+   int size;
+
+   /** Number of suffixes at the end of the dictionary that are also the start of another suffix; they can only be
+    *  sorted once the following data is known */
+   int num_open_suffixes;
+
+   /** Positions of all other suffixes, in sorted order (size - num_open_suffixes entries) */
+   int *sorted_suffixes;
+
+   /** Length of the common prefix of each sorted suffix with the previous one (0 for the first) */
+   int *sorted_lcp;
+} lz4ultra_prepared_dictionary_t;
+
 /**
  * Load dictionary contents
  *
@@ -51,4 +76,40 @@ int lz4ultra_dictionary_load(const char *pszDictionaryFilename, void **ppDiction
  */
 void lz4ultra_dictionary_free(void **ppDictionaryData);
 
+/**
+ * Get the amount of memory that a prepared dictionary holds on to until it is released
+ *
+ * @param nDictionaryDataSize size of dictionary contents, in bytes; only the last HISTORY_SIZE bytes are used
+ *
+ * @return size in bytes, or 0 for no dictionary
+ */
+size_t lz4ultra_dictionary_get_memory_size(int nDictionaryDataSize);
+
+/**
+ * Prepare dictionary for compressing many inputs with it
+ *
+ * @param pDictionaryData dictionary contents; only the last HISTORY_SIZE bytes are used
+ * @param nDictionaryDataSize size of dictionary contents, in bytes (must be greater than 0)
+ *
+ * @return prepared dictionary, to be released with lz4ultra_dictionary_release(), or NULL for failure
+ */
+lz4ultra_prepared_dictionary_t *lz4ultra_dictionary_prepare(const void *pDictionaryData, int nDictionaryDataSize);
+
+/**
+ * Load dictionary file and prepare it for compressing many inputs with it
+ *
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param ppDictionary pointer to returned prepared dictionary, or NULL for none
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+int lz4ultra_dictionary_prepare_file(const char *pszDictionaryFilename, lz4ultra_prepared_dictionary_t **ppDictionary);
+
+/**
+ * Release prepared dictionary
+ *
+ * @param pDictionary prepared dictionary, or NULL
+ */
+void lz4ultra_dictionary_release(lz4ultra_prepared_dictionary_t *pDictionary);
+
 #endif /* _DICTIONARY_H */
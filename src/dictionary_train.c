@@ -0,0 +1,335 @@
+/*
+ * dictionary_train.c - build a dictionary from sample data
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "dictionary_train.h"
+#include "format.h"
+#include "lib.h"
+#include "divsufsort.h"
+
+/** Length of the substrings that are counted (k-mers), in bytes */
+#define TRAIN_KMER_SIZE 8
+
+/** Length of the segments that are picked out of the samples, in bytes */
+#define TRAIN_SEGMENT_SIZE 256
+
+/** One segment picked for the dictionary */
+typedef struct {
+   int nStart;
+   int nLength;
+   long long nScore;
+} lz4ultra_train_segment_t;
+
+/**
+ * Compare two picked segments, for sorting them by increasing score (and position, for a stable order)
+ *
+ * @param pLeft first segment
+ * @param pRight second segment
+ *
+ * @return <0, 0 or >0
+ */
+static int lz4ultra_train_compare_segments(const void *pLeft, const void *pRight) {
+   const lz4ultra_train_segment_t *pLeftSegment = (const lz4ultra_train_segment_t *)pLeft;
+   const lz4ultra_train_segment_t *pRightSegment = (const lz4ultra_train_segment_t *)pRight;
+
+   if (pLeftSegment->nScore != pRightSegment->nScore)
+      return (pLeftSegment->nScore < pRightSegment->nScore) ? -1 : 1;
+   return pLeftSegment->nStart - pRightSegment->nStart;
+}
+
+/**
+ * Get the sample that a position belongs to
+ *
+ * @param pSampleStarts offset of each sample, followed by the total size
+ * @param nNumSamples number of samples
+ * @param nPos position in the samples
+ *
+ * @return sample index
+ */
+static int lz4ultra_train_get_sample(const int *pSampleStarts, const int nNumSamples, const int nPos) {
+   int nLow = 0, nHigh = nNumSamples - 1;
+
+   while (nLow < nHigh) {
+      int nMid = (nLow + nHigh + 1) >> 1;
+
+      if (pSampleStarts[nMid] <= nPos)
+         nLow = nMid;
+      else
+         nHigh = nMid - 1;
+   }
+
+   return nLow;
+}
+
+/**
+ * Give each k-mer of the samples an id, and count how many samples hold each of them
+ *
+ * Suffixes that start with the same k-mer are next to each other in sorted order. K-mers that would straddle two
+ * samples aren't counted.
+ *
+ * @param pData samples, one after the other
+ * @param nDataSize total size of samples
+ * @param pSampleStarts offset of each sample, followed by the total size
+ * @param nNumSamples number of samples
+ * @param pSuffixArray sorted suffixes of the samples
+ * @param pKmerIds returned k-mer id for each position, or -1 for none
+ * @param pKmerScores returned value of each k-mer id
+ * @param pSampleStamps scratch with room for one value per sample
+ *
+ * @return number of k-mer ids
+ */
+static int lz4ultra_train_count_kmers(const unsigned char *pData, const int nDataSize, const int *pSampleStarts, const int nNumSamples,
+                                      const int *pSuffixArray, int *pKmerIds, int *pKmerScores, int *pSampleStamps) {
+   int nNumIds = 0;
+   int nCurId = -1;
+   int i;
+
+   for (i = 0; i < nDataSize; i++)
+      pKmerIds[i] = -1;
+   for (i = 0; i < nNumSamples; i++)
+      pSampleStamps[i] = -1;
+
+   for (i = 0; i < nDataSize; i++) {
+      int nPos = pSuffixArray[i];
+
+      if (i > 0) {
+         int nPrevPos = pSuffixArray[i - 1];
+
+         if (nPos > (nDataSize - TRAIN_KMER_SIZE) || nPrevPos > (nDataSize - TRAIN_KMER_SIZE) || memcmp(pData + nPos, pData + nPrevPos, TRAIN_KMER_SIZE))
+            nCurId = -1;
+      }
+
+      int nSample = lz4ultra_train_get_sample(pSampleStarts, nNumSamples, nPos);
+      if ((nPos + TRAIN_KMER_SIZE) > pSampleStarts[nSample + 1])
+         continue;
+
+      if (nCurId < 0) {
+         nCurId = nNumIds++;
+         pKmerScores[nCurId] = -1;
+      }
+      pKmerIds[nPos] = nCurId;
+
+      /* With several samples, a k-mer is worth as many other samples as hold it; with a single sample, as many other
+       * occurrences as it has */
+      if (nNumSamples == 1 || pSampleStamps[nSample] != nCurId) {
+         pKmerScores[nCurId]++;
+         pSampleStamps[nSample] = nCurId;
+      }
+   }
+
+   return nNumIds;
+}
+
+/**
+ * Build a dictionary out of samples of the data that is going to be compressed with it
+ *
+ * Substrings that are repeated across the samples are found by suffix-sorting them, and the segments of the samples that
+ * hold the most of them are picked. As only the last 64 Kb of a dictionary can be referenced, and closer matches cost
+ * less, the most valuable segments are placed at the end of the dictionary.
+ *
+ * @param pDictionaryData buffer for the dictionary
+ * @param nMaxDictionarySize capacity of the dictionary buffer; dictionaries are at most 64 Kb
+ * @param pSamplesData all samples, one after the other
+ * @param pSampleSizes size of each sample, in bytes
+ * @param nNumSamples number of samples
+ *
+ * @return size of the dictionary, or -1 for error
+ */
+int lz4ultra_dictionary_train(void *pDictionaryData, int nMaxDictionarySize, const void *pSamplesData, const size_t *pSampleSizes, int nNumSamples) {
+   const unsigned char *pData = (const unsigned char *)pSamplesData;
+   unsigned char *pOutData = (unsigned char *)pDictionaryData;
+   divsufsort_ctx_t divsufsort_context;
+   lz4ultra_train_segment_t *pSegments;
+   int *pSampleStarts, *pSuffixArray, *pKmerIds, *pKmerScores;
+   int *pWindowCounts;
+   int nDataSize = 0;
+   int nNumSegments = 0;
+   int nNumEpochs, nEpochSize;
+   int nDictionarySize;
+   int i;
+
+   if (!pDictionaryData || nMaxDictionarySize <= 0 || !pSamplesData || !pSampleSizes || nNumSamples <= 0)
+      return -1;
+   if (nMaxDictionarySize > HISTORY_SIZE)
+      nMaxDictionarySize = HISTORY_SIZE;
+
+   /* Only use the samples that fit in the maximum training size */
+   for (i = 0; i < nNumSamples; i++) {
+      if (pSampleSizes[i] > (size_t)(LZ4ULTRA_TRAIN_MAX_SAMPLES_SIZE - nDataSize))
+         break;
+      nDataSize += (int)pSampleSizes[i];
+   }
+   nNumSamples = i;
+
+   if (nDataSize <= nMaxDictionarySize) {
+      /* Everything fits */
+      if (nDataSize)
+         memcpy(pOutData, pData, nDataSize);
+      return nDataSize;
+   }
+
+   /* Offset of each sample and total size, followed by scratch for counting k-mers once per sample */
+   pSampleStarts = (int *)malloc(((size_t)nNumSamples + 1) * 2 * sizeof(int));
+   pSuffixArray = (int *)malloc((size_t)nDataSize * sizeof(int));
+   pKmerIds = (int *)malloc((size_t)nDataSize * sizeof(int));
+   pKmerScores = (int *)malloc((size_t)nDataSize * sizeof(int));
+   if (!pSampleStarts || !pSuffixArray || !pKmerIds || !pKmerScores || divsufsort_init(&divsufsort_context) != 0) {
+      free(pKmerScores);
+      free(pKmerIds);
+      free(pSuffixArray);
+      free(pSampleStarts);
+      return -1;
+   }
+
+   pSampleStarts[0] = 0;
+   for (i = 0; i < nNumSamples; i++)
+      pSampleStarts[i + 1] = pSampleStarts[i] + (int)pSampleSizes[i];
+
+   if (divsufsort_build_array(&divsufsort_context, pData, (saidx_t *)pSuffixArray, nDataSize) != 0) {
+      divsufsort_destroy(&divsufsort_context);
+      free(pKmerScores);
+      free(pKmerIds);
+      free(pSuffixArray);
+      free(pSampleStarts);
+      return -1;
+   }
+   divsufsort_destroy(&divsufsort_context);
+
+   lz4ultra_train_count_kmers(pData, nDataSize, pSampleStarts, nNumSamples, pSuffixArray, pKmerIds, pKmerScores, pSampleStarts + nNumSamples + 1);
+
+   /* The suffix array is only needed to count the k-mers: its room is then used for counting them in each segment */
+   pWindowCounts = pSuffixArray;
+   memset(pWindowCounts, 0, (size_t)nDataSize * sizeof(int));
+
+   /* Split the samples into as many epochs as there are segments in the dictionary, and pick the segment holding the most
+    * valuable k-mers that haven't been picked yet in each of them */
+   nNumEpochs = (nMaxDictionarySize + TRAIN_SEGMENT_SIZE - 1) / TRAIN_SEGMENT_SIZE;
+   nEpochSize = nDataSize / nNumEpochs;
+   if (nEpochSize < TRAIN_SEGMENT_SIZE) {
+      nEpochSize = TRAIN_SEGMENT_SIZE;
+      nNumEpochs = nDataSize / nEpochSize;
+   }
+
+   pSegments = (lz4ultra_train_segment_t *)malloc((size_t)nNumEpochs * sizeof(lz4ultra_train_segment_t));
+   if (!pSegments) {
+      free(pKmerScores);
+      free(pKmerIds);
+      free(pSuffixArray);
+      free(pSampleStarts);
+      return -1;
+   }
+
+   for (i = 0; i < nNumEpochs; i++) {
+      const int nEpochStart = i * nEpochSize;
+      const int nEpochEnd = nEpochStart + nEpochSize;
+      const int nKmersPerSegment = TRAIN_SEGMENT_SIZE - TRAIN_KMER_SIZE + 1;
+      long long nScore = 0, nBestScore = 0;
+      int nBestStart = -1;
+      int nPos;
+
+      /* Slide the segment over the epoch, counting each k-mer once per segment */
+      for (nPos = nEpochStart; nPos < nEpochEnd; nPos++) {
+         int nId = pKmerIds[nPos];
+
+         if (nId >= 0 && pWindowCounts[nId]++ == 0)
+            nScore += pKmerScores[nId];
+
+         if (nPos >= (nEpochStart + nKmersPerSegment)) {
+            nId = pKmerIds[nPos - nKmersPerSegment];
+            if (nId >= 0 && --pWindowCounts[nId] == 0)
+               nScore -= pKmerScores[nId];
+         }
+
+         if (nPos >= (nEpochStart + nKmersPerSegment - 1) && nScore > nBestScore) {
+            nBestScore = nScore;
+            nBestStart = nPos - nKmersPerSegment + 1;
+         }
+      }
+
+      for (nPos = nEpochEnd - nKmersPerSegment; nPos < nEpochEnd; nPos++) {
+         if (nPos >= nEpochStart && pKmerIds[nPos] >= 0)
+            pWindowCounts[pKmerIds[nPos]]--;
+      }
+
+      if (nBestStart >= 0) {
+         int nFirstPos = -1, nLastPos = -1;
+
+         /* Trim k-mers that add nothing off both ends, and don't count the others again for the next segments */
+         for (nPos = nBestStart; nPos < (nBestStart + nKmersPerSegment) && nPos < nDataSize; nPos++) {
+            int nId = pKmerIds[nPos];
+
+            if (nId >= 0 && pKmerScores[nId] > 0) {
+               if (nFirstPos < 0)
+                  nFirstPos = nPos;
+               nLastPos = nPos;
+               pKmerScores[nId] = 0;
+            }
+         }
+
+         if (nFirstPos >= 0) {
+            pSegments[nNumSegments].nStart = nFirstPos;
+            pSegments[nNumSegments].nLength = nLastPos + TRAIN_KMER_SIZE - nFirstPos;
+            pSegments[nNumSegments].nScore = nBestScore;
+            nNumSegments++;
+         }
+      }
+   }
+
+   /* Keep the best segments that fit, and write them with the most valuable last, where the offsets to them are the smallest */
+   qsort(pSegments, nNumSegments, sizeof(lz4ultra_train_segment_t), lz4ultra_train_compare_segments);
+
+   nDictionarySize = 0;
+   for (i = nNumSegments - 1; i >= 0 && nDictionarySize < nMaxDictionarySize; i--) {
+      int nLength = pSegments[i].nLength;
+
+      if (nLength > (nMaxDictionarySize - nDictionarySize))
+         nLength = nMaxDictionarySize - nDictionarySize;
+      nDictionarySize += nLength;
+      memcpy(pOutData + nMaxDictionarySize - nDictionarySize, pData + pSegments[i].nStart + pSegments[i].nLength - nLength, nLength);
+   }
+   if (nDictionarySize < nMaxDictionarySize) {
+      /* Repeated substrings were all picked before the dictionary was full: fill the rest, where the offsets are the largest,
+       * with the end of the samples, which still has common context for the picked segments */
+      int nFillSize = nMaxDictionarySize - nDictionarySize;
+
+      memcpy(pOutData, pData + nDataSize - nFillSize, nFillSize);
+      nDictionarySize = nMaxDictionarySize;
+   }
+
+   free(pSegments);
+   free(pKmerScores);
+   free(pKmerIds);
+   free(pSuffixArray);
+   free(pSampleStarts);
+   return nDictionarySize;
+}
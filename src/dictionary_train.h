@@ -0,0 +1,56 @@
+/*
+ * dictionary_train.h - dictionary training definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _DICTIONARY_TRAIN_H
+#define _DICTIONARY_TRAIN_H
+
+#include <stdlib.h>
+#include "lz4ultra.h"
+
+/**
+ * Build a dictionary out of samples of the data that is going to be compressed with it
+ *
+ * Substrings that are repeated across the samples are found by suffix-sorting them, and the segments of the samples that
+ * hold the most of them are picked. As only the last 64 Kb of a dictionary can be referenced, and closer matches cost
+ * less, the most valuable segments are placed at the end of the dictionary.
+ *
+ * @param pDictionaryData buffer for the dictionary
+ * @param nMaxDictionarySize capacity of the dictionary buffer; dictionaries are at most 64 Kb
+ * @param pSamplesData all samples, one after the other
+ * @param pSampleSizes size of each sample, in bytes
+ * @param nNumSamples number of samples
+ *
+ * @return size of the dictionary, or -1 for error
+ */
+int lz4ultra_dictionary_train(void *pDictionaryData, int nMaxDictionarySize, const void *pSamplesData, const size_t *pSampleSizes, int nNumSamples);
+
+#endif /* _DICTIONARY_TRAIN_H */
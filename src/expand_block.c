@@ -35,7 +35,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "format.h"
+#include "stats.h"
 #include "expand_block.h"
+#include "expand_copy.h"
 
 #if defined(__GNUC__) || defined(__clang__)
 #define likely(x)       __builtin_expect(!!(x), 1)
@@ -45,47 +47,124 @@
 #define unlikely(x)     (x)
 #endif
 
+/* Each decoding phase is specialized by inlining the sequence loop into it, and then kept out of line and aligned, so
+ * that every phase loop is laid out on its own and doesn't change speed with the placement of the surrounding code */
+#if defined(__GNUC__) || defined(__clang__)
+#define FORCE_INLINE    inline __attribute__((always_inline))
+#define OUT_OF_LINE     __attribute__((noinline, aligned(64)))
+#elif defined(_MSC_VER)
+#define FORCE_INLINE    __forceinline
+#define OUT_OF_LINE     __declspec(noinline)
+#else
+#define FORCE_INLINE    inline
+#define OUT_OF_LINE
+#endif
+
+/* Validate untrusted data; skipped by the unchecked decoder */
+#define LZ4ULTRA_DECOMPRESSOR_CHECK(__cond) { \
+   if (nChecked && unlikely(__cond)) return -1; \
+}
+
 #define LZ4ULTRA_DECOMPRESSOR_BUILD_LEN(__len) { \
    unsigned int byte; \
    do { \
-      if (unlikely(pInBlock >= pInBlockEnd)) return -1; \
+      LZ4ULTRA_DECOMPRESSOR_CHECK(pInBlock >= pInBlockEnd); \
       byte = (unsigned int)*pInBlock++; \
       __len += byte; \
    } while (unlikely(byte == 255)); \
 }
 
+/* Count a literal run or a match in the statistics, if they are being collected */
+#define LZ4ULTRA_DECOMPRESSOR_COUNT_LITERALS(__path, __len) { \
+   if (pStats) { \
+      pStats->literals_histogram[lz4ultra_get_histogram_index(__len)]++; \
+      if (__len) { \
+         pStats->path_count[__path]++; \
+         pStats->path_bytes[__path] += (__len); \
+      } \
+   } \
+}
+
+#define LZ4ULTRA_DECOMPRESSOR_COUNT_MATCH(__path, __len, __offset) { \
+   if (pStats) { \
+      pStats->path_count[__path]++; \
+      pStats->path_bytes[__path] += (__len); \
+      pStats->match_len_histogram[lz4ultra_get_histogram_index(__len)]++; \
+      pStats->offset_histogram[lz4ultra_get_histogram_index(__offset)]++; \
+   } \
+}
+
 /**
- * Decompress one data block
+ * Get the histogram entry that a value is counted in, for decompression statistics
  *
- * @param pInBlock pointer to compressed data
- * @param nBlockSize size of compressed data, in bytes
- * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
- * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
- * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ * @param nValue value to count
  *
- * @return size of decompressed data in bytes, or -1 for error
+ * @return 0 for 0, n for 2^(n-1)..2^n - 1, capped at the last entry
  */
-int lz4ultra_decompressor_expand_block(const unsigned char *pInBlock, int nBlockSize, unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize) {
-   const unsigned char *pInBlockEnd = pInBlock + nBlockSize;
-   unsigned char *pCurOutData = pOutData + nOutDataOffset;
-   const unsigned char *pOutDataEnd = pCurOutData + nBlockMaxSize;
+static inline int lz4ultra_get_histogram_index(unsigned int nValue) {
+   int nIndex = 0;
+
+   while (nValue && nIndex < (LZ4ULTRA_HISTOGRAM_SIZE - 1)) {
+      nValue >>= 1;
+      nIndex++;
+   }
+   return nIndex;
+}
+
+/**
+ * Decode sequences of one data block, for one phase of decompressing it
+ *
+ * A block is decoded in two phases. While less than MAX_OFFSET bytes of output precede the current position, a match
+ * may reach back before the output buffer, into the dictionary or out of bounds, and each match has to be tested for
+ * that (the head phase, nNearStart = 1). Past that point no offset can reach before the output buffer anymore, and
+ * the remaining sequences are decoded without these tests (the body phase, nNearStart = 0), so that the hot loop
+ * doesn't test for the decompression mode at all.
+ *
+ * @param ppInBlock pointer to compressed data pointer, updated with where this phase stopped
+ * @param pInBlockEnd pointer to the end of the compressed data
+ * @param pDictionaryEnd pointer to the end of the dictionary that virtually precedes the output buffer, or NULL for none (ignored in the body phase)
+ * @param nDictionarySize size of the dictionary, in bytes, or 0
+ * @param pOutData pointer to the start of the output buffer, including previously decompressed bytes
+ * @param ppCurOutData pointer to current output pointer, updated with where this phase stopped
+ * @param pOutDataEnd pointer to the end of the output buffer
+ * @param nChecked 1 to check that the data doesn't read or write out of bounds, 0 to trust it
+ * @param nNearStart 1 to decode the head phase, that stops once MAX_OFFSET bytes of output are available, 0 for the body phase
+ * @param pStats statistics to update with the paths taken, or NULL for none (a constant NULL compiles the counting out)
+ *
+ * @return 0 for success, -1 for error
+ */
+static FORCE_INLINE int lz4ultra_decompressor_expand_sequences(const unsigned char **ppInBlock, const unsigned char *pInBlockEnd, const unsigned char *pDictionaryEnd, const int nDictionarySize,
+                                                               unsigned char *pOutData, unsigned char **ppCurOutData, const unsigned char *pOutDataEnd, const int nChecked, const int nNearStart,
+                                                               lz4ultra_decompression_stats_t *pStats) {
+   const unsigned char *pInBlock = *ppInBlock;
+   unsigned char *pCurOutData = *ppCurOutData;
    const unsigned char *pOutDataFastEnd = pOutDataEnd - 18;
+   const unsigned char *pOutDataRepeatEnd = pOutDataEnd - REPEAT_COPY_SLACK;
+   const lz4ultra_copy_repeat_fn copyRepeat = lz4ultra_get_copy_repeat();
 
-   while (likely(pInBlock < pInBlockEnd)) {
+   if (!nNearStart)
+      pDictionaryEnd = NULL;
+
+   while (likely(pInBlock < pInBlockEnd) && (!nNearStart || (size_t)(pCurOutData - pOutData) < MAX_OFFSET)) {
       const unsigned int token = (unsigned int)*pInBlock++;
       unsigned int nLiterals = ((token & 0xf0) >> 4);
 
+      if (pStats)
+         pStats->num_tokens++;
+
       if (nLiterals != LITERALS_RUN_LEN && pCurOutData <= pOutDataFastEnd && (pInBlock + 16) <= pInBlockEnd) {
          memcpy(pCurOutData, pInBlock, 16);
+         LZ4ULTRA_DECOMPRESSOR_COUNT_LITERALS(LZ4ULTRA_DECODE_LITERALS_FAST, nLiterals);
       }
       else {
          if (likely(nLiterals == LITERALS_RUN_LEN))
             LZ4ULTRA_DECOMPRESSOR_BUILD_LEN(nLiterals);
 
-         if (unlikely((pInBlock + nLiterals) > pInBlockEnd)) return -1;
-         if (unlikely((pCurOutData + nLiterals) > pOutDataEnd)) return -1;
+         LZ4ULTRA_DECOMPRESSOR_CHECK((pInBlock + nLiterals) > pInBlockEnd);
+         LZ4ULTRA_DECOMPRESSOR_CHECK((pCurOutData + nLiterals) > pOutDataEnd);
 
          memcpy(pCurOutData, pInBlock, nLiterals);
+         LZ4ULTRA_DECOMPRESSOR_COUNT_LITERALS(LZ4ULTRA_DECODE_LITERALS_SLOW, nLiterals);
       }
 
       pInBlock += nLiterals;
@@ -100,14 +179,17 @@ int lz4ultra_decompressor_expand_block(const unsigned char *pInBlock, int nBlock
          unsigned int nMatchLen = (token & 0x0f);
 
          nMatchLen += MIN_MATCH_SIZE;
-         if (nMatchLen != (MATCH_RUN_LEN + MIN_MATCH_SIZE) && nMatchOffset >= 8 && pCurOutData <= pOutDataFastEnd) {
+         if (nMatchLen != (MATCH_RUN_LEN + MIN_MATCH_SIZE) && nMatchOffset >= 8 && pCurOutData <= pOutDataFastEnd &&
+             (!pDictionaryEnd || (size_t)(pCurOutData - pOutData) >= nMatchOffset)) {
             const unsigned char *pSrc = pCurOutData - nMatchOffset;
 
-            if (unlikely(pSrc < pOutData)) return -1;
+            if (nNearStart)
+               LZ4ULTRA_DECOMPRESSOR_CHECK(pSrc < pOutData);
 
             memcpy(pCurOutData, pSrc, 8);
             memcpy(pCurOutData + 8, pSrc + 8, 8);
             memcpy(pCurOutData + 16, pSrc + 16, 2);
+            LZ4ULTRA_DECOMPRESSOR_COUNT_MATCH(LZ4ULTRA_DECODE_MATCH_FAST, nMatchLen, nMatchOffset);
 
             pCurOutData += nMatchLen;
          }
@@ -115,10 +197,31 @@ int lz4ultra_decompressor_expand_block(const unsigned char *pInBlock, int nBlock
             if (likely(nMatchLen == (MATCH_RUN_LEN + MIN_MATCH_SIZE)))
                LZ4ULTRA_DECOMPRESSOR_BUILD_LEN(nMatchLen);
 
-            if (unlikely((pCurOutData + nMatchLen) > pOutDataEnd)) return -1;
+            LZ4ULTRA_DECOMPRESSOR_CHECK((pCurOutData + nMatchLen) > pOutDataEnd);
 
             const unsigned char *pSrc = pCurOutData - nMatchOffset;
-            if (unlikely(pSrc < pOutData)) return -1;
+
+            if (pDictionaryEnd && (size_t)(pCurOutData - pOutData) < nMatchOffset) {
+               /* Match starts in the dictionary, and may continue into the output */
+               unsigned int nDictionaryOffset = nMatchOffset - (unsigned int)(pCurOutData - pOutData);
+               unsigned int nDictionaryLen = (nMatchLen < nDictionaryOffset) ? nMatchLen : nDictionaryOffset;
+
+               LZ4ULTRA_DECOMPRESSOR_CHECK(nDictionaryOffset > (unsigned int)nDictionarySize);
+               LZ4ULTRA_DECOMPRESSOR_COUNT_MATCH(LZ4ULTRA_DECODE_MATCH_DICTIONARY, nMatchLen, nMatchOffset);
+
+               memcpy(pCurOutData, pDictionaryEnd - nDictionaryOffset, nDictionaryLen);
+               pCurOutData += nDictionaryLen;
+               nMatchLen -= nDictionaryLen;
+
+               pSrc = pOutData;
+               while (nMatchLen--) {
+                  *pCurOutData++ = *pSrc++;
+               }
+               continue;
+            }
+
+            if (nNearStart)
+               LZ4ULTRA_DECOMPRESSOR_CHECK(pSrc < pOutData);
 
             if (nMatchOffset >= 16 && (pCurOutData + nMatchLen) <= pOutDataFastEnd) {
                const unsigned char *pCopySrc = pSrc;
@@ -130,10 +233,18 @@ int lz4ultra_decompressor_expand_block(const unsigned char *pInBlock, int nBlock
                   pCopySrc += 16;
                   pCopyDst += 16;
                } while (pCopyDst < pCopyEndDst);
+               LZ4ULTRA_DECOMPRESSOR_COUNT_MATCH(LZ4ULTRA_DECODE_MATCH_LOOP, nMatchLen, nMatchOffset);
 
                pCurOutData += nMatchLen;
             }
+            else if (nMatchOffset != 0 && nMatchOffset < 16 && (pCurOutData + nMatchLen) <= pOutDataRepeatEnd) {
+               /* Short offset, replicate the pattern with wide copies instead of byte after byte */
+               copyRepeat(pCurOutData, nMatchOffset, nMatchLen);
+               LZ4ULTRA_DECOMPRESSOR_COUNT_MATCH(LZ4ULTRA_DECODE_MATCH_REPEAT, nMatchLen, nMatchOffset);
+               pCurOutData += nMatchLen;
+            }
             else {
+               LZ4ULTRA_DECOMPRESSOR_COUNT_MATCH(LZ4ULTRA_DECODE_MATCH_BYTES, nMatchLen, nMatchOffset);
                while (nMatchLen--) {
                   *pCurOutData++ = *pSrc++;
                }
@@ -142,5 +253,151 @@ int lz4ultra_decompressor_expand_block(const unsigned char *pInBlock, int nBlock
       }
    }
 
+   *ppInBlock = pInBlock;
+   *ppCurOutData = pCurOutData;
+   return 0;
+}
+
+/** Decoding phase, as generated by LZ4ULTRA_DECOMPRESSOR_PHASE() */
+typedef int (*lz4ultra_expand_phase_fn)(const unsigned char **ppInBlock, const unsigned char *pInBlockEnd, const unsigned char *pDictionaryEnd, const int nDictionarySize,
+                                        unsigned char *pOutData, unsigned char **ppCurOutData, const unsigned char *pOutDataEnd, lz4ultra_decompression_stats_t *pStats);
+
+/* Generate a decoding phase for one mode: with or without a dictionary, checked or not, head or body phase, with or without statistics */
+#define LZ4ULTRA_DECOMPRESSOR_PHASE(__name, __dictionary, __checked, __near_start, __stats) \
+static OUT_OF_LINE int __name(const unsigned char **ppInBlock, const unsigned char *pInBlockEnd, const unsigned char *pDictionaryEnd, const int nDictionarySize, \
+                            unsigned char *pOutData, unsigned char **ppCurOutData, const unsigned char *pOutDataEnd, lz4ultra_decompression_stats_t *pStats) { \
+   return lz4ultra_decompressor_expand_sequences(ppInBlock, pInBlockEnd, (__dictionary) ? pDictionaryEnd : NULL, (__dictionary) ? nDictionarySize : 0, \
+                                                 pOutData, ppCurOutData, pOutDataEnd, __checked, __near_start, (__stats) ? pStats : NULL); \
+}
+
+LZ4ULTRA_DECOMPRESSOR_PHASE(lz4ultra_decompressor_expand_head, 0, 1, 1, 0)
+LZ4ULTRA_DECOMPRESSOR_PHASE(lz4ultra_decompressor_expand_body, 0, 1, 0, 0)
+LZ4ULTRA_DECOMPRESSOR_PHASE(lz4ultra_decompressor_expand_unchecked_body, 0, 0, 0, 0)
+LZ4ULTRA_DECOMPRESSOR_PHASE(lz4ultra_decompressor_expand_dictionary_head, 1, 1, 1, 0)
+LZ4ULTRA_DECOMPRESSOR_PHASE(lz4ultra_decompressor_expand_stats_head, 1, 1, 1, 1)
+LZ4ULTRA_DECOMPRESSOR_PHASE(lz4ultra_decompressor_expand_stats_body, 0, 1, 0, 1)
+
+/**
+ * Decompress one data block, with the decoding phases of one mode
+ *
+ * The head phase is only run when less than MAX_OFFSET bytes of history precede the block; a block that follows a
+ * full 64 KB prefix is entirely decoded by the body phase.
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pDictionaryEnd pointer to the end of the dictionary that virtually precedes the output buffer, or NULL for none
+ * @param nDictionarySize size of the dictionary, in bytes, or 0
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ * @param pHead head phase, or NULL if the mode has nothing to check near the start (trusted data without a dictionary)
+ * @param pBody body phase
+ * @param pStats statistics to update with the paths taken, or NULL for none
+ *
+ * @return size of decompressed data in bytes, or -1 for error
+ */
+static FORCE_INLINE int lz4ultra_decompressor_expand_block_generic(const unsigned char *pInBlock, int nBlockSize, const unsigned char *pDictionaryEnd, const int nDictionarySize,
+                                                                   unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize,
+                                                                   const lz4ultra_expand_phase_fn pHead, const lz4ultra_expand_phase_fn pBody,
+                                                                   lz4ultra_decompression_stats_t *pStats) {
+   const unsigned char *pInBlockEnd = pInBlock + nBlockSize;
+   unsigned char *pCurOutData = pOutData + nOutDataOffset;
+   const unsigned char *pOutDataEnd = pCurOutData + nBlockMaxSize;
+
+   if (pHead && nOutDataOffset < MAX_OFFSET) {
+      if (pHead(&pInBlock, pInBlockEnd, pDictionaryEnd, nDictionarySize, pOutData, &pCurOutData, pOutDataEnd, pStats) < 0)
+         return -1;
+   }
+
+   if (pBody(&pInBlock, pInBlockEnd, NULL, 0, pOutData, &pCurOutData, pOutDataEnd, pStats) < 0)
+      return -1;
+
    return (int)(pCurOutData - (pOutData + nOutDataOffset));
 }
+
+/**
+ * Decompress one data block
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ *
+ * @return size of decompressed data in bytes, or -1 for error
+ */
+int lz4ultra_decompressor_expand_block(const unsigned char *pInBlock, int nBlockSize, unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize) {
+   return lz4ultra_decompressor_expand_block_generic(pInBlock, nBlockSize, NULL, 0, pOutData, nOutDataOffset, nBlockMaxSize,
+                                                     lz4ultra_decompressor_expand_head, lz4ultra_decompressor_expand_body, NULL);
+}
+
+/**
+ * Decompress one data block that is known to be valid, without bounds checks
+ *
+ * Only use this for trusted data, for instance data that was checksummed after compressing it; corrupted data
+ * makes this function read and write out of bounds. The output buffer size is still used to decide where wide
+ * copies can be used safely.
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ *
+ * @return size of decompressed data in bytes
+ */
+int lz4ultra_decompressor_expand_block_unchecked(const unsigned char *pInBlock, int nBlockSize, unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize) {
+   return lz4ultra_decompressor_expand_block_generic(pInBlock, nBlockSize, NULL, 0, pOutData, nOutDataOffset, nBlockMaxSize,
+                                                     NULL, lz4ultra_decompressor_expand_unchecked_body, NULL);
+}
+
+/**
+ * Decompress one data block that may reference a dictionary, which virtually precedes the output buffer
+ *
+ * The dictionary only needs to be in memory, not in front of the output, so that no concatenated dictionary + output
+ * buffer has to be assembled. Matches that reach back before pOutData are read from the end of the dictionary.
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pDictionaryData dictionary contents
+ * @param nDictionaryDataSize size of dictionary contents, in bytes
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ *
+ * @return size of decompressed data in bytes, or -1 for error
+ */
+int lz4ultra_decompressor_expand_block_with_dictionary(const unsigned char *pInBlock, int nBlockSize, const unsigned char *pDictionaryData, int nDictionaryDataSize,
+                                                       unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize) {
+   if (!pDictionaryData || nDictionaryDataSize <= 0)
+      return lz4ultra_decompressor_expand_block_generic(pInBlock, nBlockSize, NULL, 0, pOutData, nOutDataOffset, nBlockMaxSize,
+                                                        lz4ultra_decompressor_expand_head, lz4ultra_decompressor_expand_body, NULL);
+   return lz4ultra_decompressor_expand_block_generic(pInBlock, nBlockSize, pDictionaryData + nDictionaryDataSize, nDictionaryDataSize, pOutData, nOutDataOffset, nBlockMaxSize,
+                                                     lz4ultra_decompressor_expand_dictionary_head, lz4ultra_decompressor_expand_body, NULL);
+}
+
+/**
+ * Decompress one data block, that may reference a dictionary, and count the decoder paths that it takes
+ *
+ * This is slower than the other block decoders, and meant for analyzing how compressed data decodes.
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, in bytes, or 0
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ * @param pStats statistics to add the block's paths to
+ *
+ * @return size of decompressed data in bytes, or -1 for error
+ */
+int lz4ultra_decompressor_expand_block_with_stats(const unsigned char *pInBlock, int nBlockSize, const unsigned char *pDictionaryData, int nDictionaryDataSize,
+                                                  unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize, lz4ultra_decompression_stats_t *pStats) {
+   pStats->num_blocks++;
+   if (!pDictionaryData || nDictionaryDataSize <= 0)
+      return lz4ultra_decompressor_expand_block_generic(pInBlock, nBlockSize, NULL, 0, pOutData, nOutDataOffset, nBlockMaxSize,
+                                                        lz4ultra_decompressor_expand_stats_head, lz4ultra_decompressor_expand_stats_body, pStats);
+   return lz4ultra_decompressor_expand_block_generic(pInBlock, nBlockSize, pDictionaryData + nDictionaryDataSize, nDictionaryDataSize, pOutData, nOutDataOffset, nBlockMaxSize,
+                                                     lz4ultra_decompressor_expand_stats_head, lz4ultra_decompressor_expand_stats_body, pStats);
+}
@@ -33,6 +33,9 @@
 #ifndef _EXPAND_BLOCK_H
 #define _EXPAND_BLOCK_H
 
+/* Forward declarations */
+typedef struct _lz4ultra_decompression_stats_t lz4ultra_decompression_stats_t;
+
 /**
  * Decompress one data block
  *
@@ -46,4 +49,59 @@
  */
 int lz4ultra_decompressor_expand_block(const unsigned char *pInBlock, int nBlockSize, unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize);
 
+/**
+ * Decompress one data block that is known to be valid, without bounds checks
+ *
+ * Only use this for trusted data, for instance data that was checksummed after compressing it; corrupted data
+ * makes this function read and write out of bounds. The output buffer size is still used to decide where wide
+ * copies can be used safely.
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ *
+ * @return size of decompressed data in bytes
+ */
+int lz4ultra_decompressor_expand_block_unchecked(const unsigned char *pInBlock, int nBlockSize, unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize);
+
+/**
+ * Decompress one data block that may reference a dictionary, which virtually precedes the output buffer
+ *
+ * The dictionary only needs to be in memory, not in front of the output, so that no concatenated dictionary + output
+ * buffer has to be assembled. Matches that reach back before pOutData are read from the end of the dictionary.
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pDictionaryData dictionary contents
+ * @param nDictionaryDataSize size of dictionary contents, in bytes
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ *
+ * @return size of decompressed data in bytes, or -1 for error
+ */
+int lz4ultra_decompressor_expand_block_with_dictionary(const unsigned char *pInBlock, int nBlockSize, const unsigned char *pDictionaryData, int nDictionaryDataSize,
+                                                       unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize);
+
+/**
+ * Decompress one data block, that may reference a dictionary, and count the decoder paths that it takes
+ *
+ * This is slower than the other block decoders, and meant for analyzing how compressed data decodes.
+ *
+ * @param pInBlock pointer to compressed data
+ * @param nBlockSize size of compressed data, in bytes
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, in bytes, or 0
+ * @param pOutData pointer to output decompression buffer (previously decompressed bytes + room for decompressing this block)
+ * @param nOutDataOffset starting index of where to store decompressed bytes in output buffer (and size of previously decompressed bytes)
+ * @param nBlockMaxSize total size of output decompression buffer, in bytes
+ * @param pStats statistics to add the block's paths to
+ *
+ * @return size of decompressed data in bytes, or -1 for error
+ */
+int lz4ultra_decompressor_expand_block_with_stats(const unsigned char *pInBlock, int nBlockSize, const unsigned char *pDictionaryData, int nDictionaryDataSize,
+                                                  unsigned char *pOutData, int nOutDataOffset, int nBlockMaxSize, lz4ultra_decompression_stats_t *pStats);
+
 #endif /* _EXPAND_BLOCK_H */
@@ -0,0 +1,238 @@
+/*
+ * expand_copy.c - overlap-safe match copies for the decompressor
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "expand_copy.h"
+
+#if !defined(LZ4ULTRA_NO_SIMD)
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define LZ4ULTRA_X86_SIMD
+#define LZ4ULTRA_TARGET(__target) __attribute__((target(__target)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define LZ4ULTRA_X86_SIMD
+#define LZ4ULTRA_TARGET(__target)
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define LZ4ULTRA_NEON_SIMD
+#include <arm_neon.h>
+#endif
+#endif /* !LZ4ULTRA_NO_SIMD */
+
+/**
+ * Copy a match that overlaps its own output, portable version
+ *
+ * Each copy takes the bytes from the start of the match up to the current output position, so it never overlaps
+ * itself, and doubles the length of the run copied so far.
+ *
+ * @param pDst pointer to where to start copying the match to
+ * @param nOffset match offset, 1..15
+ * @param nLen match length in bytes, at least 1
+ */
+static void lz4ultra_copy_repeat_portable(unsigned char *pDst, const unsigned int nOffset, const unsigned int nLen) {
+   const unsigned char *pSrc = pDst - nOffset;
+   unsigned int nChunk = nOffset;
+   unsigned int nLeft = nLen;
+
+   while (nLeft) {
+      if (nChunk > nLeft)
+         nChunk = nLeft;
+      memcpy(pDst, pSrc, nChunk);
+      pDst += nChunk;
+      nLeft -= nChunk;
+      nChunk = (unsigned int)(pDst - pSrc);
+   }
+}
+
+#if defined(LZ4ULTRA_X86_SIMD) || defined(LZ4ULTRA_NEON_SIMD)
+
+/** For each offset, indices that replicate the nOffset bytes before the match over 32 bytes */
+static const unsigned char g_repeatShuffle[16][32] = {
+   { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+   { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+   { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 },
+   { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1 },
+   { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 },
+   { 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1 },
+   { 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 0, 1 },
+   { 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0, 1, 2, 3, 4 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 0, 1, 2, 3 },
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 0, 1 }
+};
+
+#if defined(LZ4ULTRA_X86_SIMD)
+/**
+ * Copy a match that overlaps its own output, 16 bytes at a time
+ *
+ * The pattern is expanded to 16 bytes once; it is then stored repeatedly, advancing by the largest multiple of the
+ * offset that fits in 16 bytes so that the pattern always stays in phase.
+ *
+ * @param pDst pointer to where to start copying the match to; there must be at least REPEAT_COPY_SLACK bytes of room after the match
+ * @param nOffset match offset, 1..15
+ * @param nLen match length in bytes, at least 1
+ */
+LZ4ULTRA_TARGET("ssse3") static void lz4ultra_copy_repeat_ssse3(unsigned char *pDst, const unsigned int nOffset, const unsigned int nLen) {
+   const __m128i pattern = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(pDst - nOffset)), _mm_loadu_si128((const __m128i *)g_repeatShuffle[nOffset]));
+   const unsigned int nStep = 16 - (16 % nOffset);
+   const unsigned char *pDstEnd = pDst + nLen;
+
+   do {
+      _mm_storeu_si128((__m128i *)pDst, pattern);
+      pDst += nStep;
+   } while (pDst < pDstEnd);
+}
+
+/**
+ * Copy a match that overlaps its own output, 32 bytes at a time
+ *
+ * The 16 bytes before the match are broadcasted to both 128-bit lanes, so that the in-lane shuffle can expand the
+ * pattern over the whole 32 bytes.
+ *
+ * @param pDst pointer to where to start copying the match to; there must be at least REPEAT_COPY_SLACK bytes of room after the match
+ * @param nOffset match offset, 1..15
+ * @param nLen match length in bytes, at least 1
+ */
+LZ4ULTRA_TARGET("avx2") static void lz4ultra_copy_repeat_avx2(unsigned char *pDst, const unsigned int nOffset, const unsigned int nLen) {
+   const __m256i source = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(pDst - nOffset)));
+   const __m256i pattern = _mm256_shuffle_epi8(source, _mm256_loadu_si256((const __m256i *)g_repeatShuffle[nOffset]));
+   const unsigned int nStep = 32 - (32 % nOffset);
+   const unsigned char *pDstEnd = pDst + nLen;
+
+   do {
+      _mm256_storeu_si256((__m256i *)pDst, pattern);
+      pDst += nStep;
+   } while (pDst < pDstEnd);
+}
+#else
+/**
+ * Copy a match that overlaps its own output, 16 bytes at a time
+ *
+ * The pattern is expanded to 16 bytes once; it is then stored repeatedly, advancing by the largest multiple of the
+ * offset that fits in 16 bytes so that the pattern always stays in phase.
+ *
+ * @param pDst pointer to where to start copying the match to; there must be at least REPEAT_COPY_SLACK bytes of room after the match
+ * @param nOffset match offset, 1..15
+ * @param nLen match length in bytes, at least 1
+ */
+static void lz4ultra_copy_repeat_neon(unsigned char *pDst, const unsigned int nOffset, const unsigned int nLen) {
+   const uint8x16_t pattern = vqtbl1q_u8(vld1q_u8(pDst - nOffset), vld1q_u8(g_repeatShuffle[nOffset]));
+   const unsigned int nStep = 16 - (16 % nOffset);
+   const unsigned char *pDstEnd = pDst + nLen;
+
+   do {
+      vst1q_u8(pDst, pattern);
+      pDst += nStep;
+   } while (pDst < pDstEnd);
+}
+#endif
+
+#endif /* LZ4ULTRA_X86_SIMD || LZ4ULTRA_NEON_SIMD */
+
+#if defined(LZ4ULTRA_X86_SIMD)
+/**
+ * Check which of the x86 vector extensions used by the match copies are supported by the CPU and the OS
+ *
+ * @param pHasSSSE3 pointer to returned flag, set to 1 if SSSE3 is supported
+ * @param pHasAVX2 pointer to returned flag, set to 1 if AVX2 is supported
+ */
+static void lz4ultra_detect_x86_features(int *pHasSSSE3, int *pHasAVX2) {
+#if defined(_MSC_VER)
+   int info[4];
+
+   *pHasSSSE3 = 0;
+   *pHasAVX2 = 0;
+
+   __cpuid(info, 0);
+   if (info[0] >= 1) {
+      __cpuid(info, 1);
+      *pHasSSSE3 = (info[2] & (1 << 9)) ? 1 : 0;
+
+      /* AVX2 also needs the OS to save the YMM registers */
+      if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+         __cpuid(info, 0);
+         if (info[0] >= 7) {
+            __cpuidex(info, 7, 0);
+            *pHasAVX2 = (info[1] & (1 << 5)) ? 1 : 0;
+         }
+      }
+   }
+#else
+   __builtin_cpu_init();
+   *pHasSSSE3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+   *pHasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+}
+#endif /* LZ4ULTRA_X86_SIMD */
+
+/** Selected short-offset match copy, or NULL if not selected yet */
+static lz4ultra_copy_repeat_fn g_copyRepeat = NULL;
+
+/**
+ * Get the fastest short-offset match copy for the CPU the code runs on
+ *
+ * The choice is made once, on first call, by checking CPU features: AVX2 or SSSE3 on x86, NEON on 64-bit ARM; the
+ * portable version is used otherwise, or if the code is built with LZ4ULTRA_NO_SIMD defined.
+ *
+ * @return match copy function
+ */
+lz4ultra_copy_repeat_fn lz4ultra_get_copy_repeat(void) {
+   lz4ultra_copy_repeat_fn copyRepeat = g_copyRepeat;
+
+   if (!copyRepeat) {
+      /* Racing threads all pick the same function, so no locking is needed */
+      copyRepeat = lz4ultra_copy_repeat_portable;
+
+#if defined(LZ4ULTRA_X86_SIMD)
+      int nHasSSSE3, nHasAVX2;
+
+      lz4ultra_detect_x86_features(&nHasSSSE3, &nHasAVX2);
+      if (nHasAVX2)
+         copyRepeat = lz4ultra_copy_repeat_avx2;
+      else if (nHasSSSE3)
+         copyRepeat = lz4ultra_copy_repeat_ssse3;
+#elif defined(LZ4ULTRA_NEON_SIMD)
+      copyRepeat = lz4ultra_copy_repeat_neon;
+#endif
+
+      g_copyRepeat = copyRepeat;
+   }
+
+   return copyRepeat;
+}
@@ -0,0 +1,58 @@
+/*
+ * expand_copy.h - overlap-safe match copies for the decompressor, definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _EXPAND_COPY_H
+#define _EXPAND_COPY_H
+
+/** Number of bytes that lz4ultra_copy_repeat_fn implementations may write past the end of the copied match */
+#define REPEAT_COPY_SLACK 32
+
+/**
+ * Copy a match that overlaps its own output, replicating the last (nOffset) bytes before pDst
+ *
+ * @param pDst pointer to where to start copying the match to; there must be at least REPEAT_COPY_SLACK bytes of room after the match
+ * @param nOffset match offset, 1..15
+ * @param nLen match length in bytes, at least 1
+ */
+typedef void (*lz4ultra_copy_repeat_fn)(unsigned char *pDst, const unsigned int nOffset, const unsigned int nLen);
+
+/**
+ * Get the fastest short-offset match copy for the CPU the code runs on
+ *
+ * The choice is made once, on first call, by checking CPU features: AVX2 or SSSE3 on x86, NEON on 64-bit ARM; the
+ * portable version is used otherwise, or if the code is built with LZ4ULTRA_NO_SIMD defined.
+ *
+ * @return match copy function
+ */
+lz4ultra_copy_repeat_fn lz4ultra_get_copy_repeat(void);
+
+#endif /* _EXPAND_COPY_H */
@@ -0,0 +1,478 @@
+/*
+ * expand_incremental.c - incremental decompression implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "expand_incremental.h"
+#include "expand_block.h"
+#include "format.h"
+#include "frame.h"
+#include "lib.h"
+
+/* Decompression stages */
+#define STAGE_HEADER           0
+#define STAGE_BLOCK_FRAME      1
+#define STAGE_BLOCK_DATA       2
+#define STAGE_CONTENT_CHECKSUM 3
+#define STAGE_DONE             4
+
+/**
+ * Initialize incremental decompression context, without allocating anything yet
+ *
+ * @param pCtx context to initialize
+ */
+void lz4ultra_incremental_decompressor_init(lz4ultra_incremental_decompressor_t *pCtx) {
+   memset(pCtx, 0, sizeof(lz4ultra_incremental_decompressor_t));
+   pCtx->nError = LZ4ULTRA_ERROR_DECOMPRESSION;
+}
+
+/**
+ * Free incremental decompression context buffers
+ *
+ * @param pCtx context
+ */
+void lz4ultra_incremental_decompressor_destroy(lz4ultra_incremental_decompressor_t *pCtx) {
+   if (pCtx->pOutData) {
+      free(pCtx->pOutData);
+      pCtx->pOutData = NULL;
+   }
+   pCtx->nOutDataSize = 0;
+
+   if (pCtx->pInBlock) {
+      free(pCtx->pInBlock);
+      pCtx->pInBlock = NULL;
+   }
+   pCtx->nInBlockSize = 0;
+}
+
+/**
+ * Create incremental decompression context, without allocating anything else yet
+ *
+ * @return context, to be freed with lz4ultra_incremental_decompressor_free(), or NULL for failure
+ */
+lz4ultra_incremental_decompressor_t *lz4ultra_incremental_decompressor_create(void) {
+   lz4ultra_incremental_decompressor_t *pCtx = (lz4ultra_incremental_decompressor_t *)malloc(sizeof(lz4ultra_incremental_decompressor_t));
+
+   if (pCtx)
+      lz4ultra_incremental_decompressor_init(pCtx);
+   return pCtx;
+}
+
+/**
+ * Free incremental decompression context and its buffers
+ *
+ * @param pCtx context, or NULL
+ */
+void lz4ultra_incremental_decompressor_free(lz4ultra_incremental_decompressor_t *pCtx) {
+   if (pCtx) {
+      lz4ultra_incremental_decompressor_destroy(pCtx);
+      free(pCtx);
+   }
+}
+
+/**
+ * Gather bytes that may straddle input spans
+ *
+ * @param pDst buffer to gather bytes into
+ * @param pGatheredSize pointer to number of bytes gathered so far, updated
+ * @param nNeededSize total number of bytes to gather
+ * @param pInData input span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to number of input bytes consumed so far, updated
+ *
+ * @return nonzero if all the bytes are gathered, 0 if more input is needed
+ */
+static int lz4ultra_decompress_gather(unsigned char *pDst, int *pGatheredSize, const int nNeededSize, const unsigned char *pInData, const size_t nInDataSize, size_t *pInConsumed) {
+   size_t nCopySize = (size_t)(nNeededSize - *pGatheredSize);
+
+   if (nCopySize > (nInDataSize - *pInConsumed))
+      nCopySize = nInDataSize - *pInConsumed;
+   if (nCopySize) {
+      memcpy(pDst + *pGatheredSize, pInData + *pInConsumed, nCopySize);
+      *pGatheredSize += (int)nCopySize;
+      *pInConsumed += nCopySize;
+   }
+
+   return (*pGatheredSize == nNeededSize) ? 1 : 0;
+}
+
+/**
+ * Start decompressing a new frame
+ *
+ * @param pCtx context
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0; raw blocks aren't supported)
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_decompress_begin(lz4ultra_incremental_decompressor_t *pCtx, unsigned int nFlags) {
+   if (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) {
+      pCtx->nError = LZ4ULTRA_ERROR_FORMAT;
+      return LZ4ULTRA_ERROR_FORMAT;
+   }
+
+   /* Pick the decoder before the frame header replaces the flags */
+   if (nFlags & LZ4ULTRA_FLAG_TRUSTED_INPUT)
+      pCtx->expand_block = lz4ultra_decompressor_expand_block_unchecked;
+   else
+      pCtx->expand_block = lz4ultra_decompressor_expand_block;
+
+   pCtx->nFlags = nFlags;
+   pCtx->nStage = STAGE_HEADER;
+   pCtx->nError = LZ4ULTRA_OK;
+   pCtx->nFrameDataSize = 0;
+   pCtx->nFrameDataNeeded = LZ4ULTRA_HEADER_SIZE;
+   pCtx->nBlockMaxSize = 0;
+   pCtx->nPendingInDataSize = 0;
+   pCtx->nPendingOutDataOffset = 0;
+   pCtx->nPendingOutDataSize = 0;
+   pCtx->nPreviousBlockSize = 0;
+   pCtx->nContentSize = 0;
+   pCtx->nOriginalSize = 0;
+   pCtx->nCompressedSize = 0;
+   XXH32_reset(&pCtx->contentChecksum, 0);
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Decode frame header once it is gathered, and get buffers for the frame's block size
+ *
+ * @param pCtx context
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_decompress_frame_header(lz4ultra_incremental_decompressor_t *pCtx) {
+   int nBlockMaxCode = 7;
+   int nBlockMaxBits;
+   int nSuccess;
+
+   nSuccess = lz4ultra_decode_header(pCtx->cFrameData, pCtx->nFrameDataSize, &nBlockMaxCode, &pCtx->nFlags, &pCtx->nContentSize);
+   if (nSuccess < 0)
+      return (nSuccess == LZ4ULTRA_DECODE_ERR_SUM) ? LZ4ULTRA_ERROR_CHECKSUM : LZ4ULTRA_ERROR_FORMAT;
+
+   if (pCtx->nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
+      nBlockMaxBits = 23;
+   else
+      nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+   pCtx->nBlockMaxSize = 1 << nBlockMaxBits;
+
+   if (pCtx->nInBlockSize < pCtx->nBlockMaxSize + LZ4ULTRA_BLOCK_CHECKSUM_SIZE) {
+      if (pCtx->pInBlock)
+         free(pCtx->pInBlock);
+      pCtx->nInBlockSize = 0;
+
+      pCtx->pInBlock = (unsigned char*)malloc(pCtx->nBlockMaxSize + LZ4ULTRA_BLOCK_CHECKSUM_SIZE);
+      if (!pCtx->pInBlock)
+         return LZ4ULTRA_ERROR_MEMORY;
+      pCtx->nInBlockSize = pCtx->nBlockMaxSize + LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+   }
+
+   if (pCtx->nOutDataSize < HISTORY_SIZE + pCtx->nBlockMaxSize) {
+      if (pCtx->pOutData)
+         free(pCtx->pOutData);
+      pCtx->nOutDataSize = 0;
+
+      pCtx->pOutData = (unsigned char*)malloc(HISTORY_SIZE + pCtx->nBlockMaxSize);
+      if (!pCtx->pOutData)
+         return LZ4ULTRA_ERROR_MEMORY;
+      pCtx->nOutDataSize = HISTORY_SIZE + pCtx->nBlockMaxSize;
+   }
+
+   pCtx->nCompressedSize += (long long)pCtx->nFrameDataSize;
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Decompress more input
+ *
+ * Input is consumed until the output span is full or the end of the frame is reached; anything after the frame is left
+ * unconsumed. The buffers for the frame's block size are allocated when its header is decoded, unless the context
+ * already has large enough ones from a previous frame.
+ *
+ * @param pCtx context
+ * @param pInData input(compressed) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(decompressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_decompress_update(lz4ultra_incremental_decompressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                             unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced) {
+   const unsigned char *pHistoryEnd = NULL;
+   size_t nInConsumed = 0, nOutProduced = 0;
+   int nError = pCtx->nError;
+   int nDone = 0;
+
+   while (!nError && !nDone) {
+      /* Hand out what was decompressed into the context first */
+      if (pCtx->nPendingOutDataSize) {
+         size_t nCopySize = (size_t)pCtx->nPendingOutDataSize;
+
+         if (nCopySize > (nOutDataSize - nOutProduced))
+            nCopySize = nOutDataSize - nOutProduced;
+         memcpy(pOutData + nOutProduced, pCtx->pOutData + HISTORY_SIZE + pCtx->nPendingOutDataOffset, nCopySize);
+         nOutProduced += nCopySize;
+         pCtx->nPendingOutDataOffset += (int)nCopySize;
+         pCtx->nPendingOutDataSize -= (int)nCopySize;
+
+         if (pCtx->nPendingOutDataSize)
+            break;
+      }
+
+      switch (pCtx->nStage) {
+      case STAGE_HEADER:
+         if (!lz4ultra_decompress_gather(pCtx->cFrameData, &pCtx->nFrameDataSize, pCtx->nFrameDataNeeded, pInData, nInDataSize, &nInConsumed)) {
+            nDone = 1;
+            break;
+         }
+
+         if (pCtx->nFrameDataSize == LZ4ULTRA_HEADER_SIZE) {
+            /* Magic number: find out how much more of the header there is */
+            int nExtraHeaderSize = lz4ultra_check_header(pCtx->cFrameData, LZ4ULTRA_HEADER_SIZE);
+            if (nExtraHeaderSize < 0) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            pCtx->nFrameDataNeeded = LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize;
+            if (nExtraHeaderSize)
+               break;
+         }
+
+         if (pCtx->nFrameDataSize < LZ4ULTRA_MAX_HEADER_SIZE) {
+            int nHeaderSize = lz4ultra_get_header_size(pCtx->cFrameData, pCtx->nFrameDataSize);
+            if (nHeaderSize < 0) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            if (nHeaderSize > pCtx->nFrameDataSize) {
+               /* The content size follows */
+               pCtx->nFrameDataNeeded = nHeaderSize;
+               break;
+            }
+         }
+
+         nError = lz4ultra_decompress_frame_header(pCtx);
+         if (!nError) {
+            pCtx->nStage = STAGE_BLOCK_FRAME;
+            pCtx->nFrameDataSize = 0;
+         }
+         break;
+
+      case STAGE_BLOCK_FRAME:
+         if (!lz4ultra_decompress_gather(pCtx->cFrameData, &pCtx->nFrameDataSize, LZ4ULTRA_FRAME_SIZE, pInData, nInDataSize, &nInConsumed)) {
+            nDone = 1;
+            break;
+         }
+         pCtx->nFrameDataSize = 0;
+         pCtx->nCompressedSize += (long long)LZ4ULTRA_FRAME_SIZE;
+
+         if (lz4ultra_decode_frame(pCtx->cFrameData, LZ4ULTRA_FRAME_SIZE, pCtx->nFlags, &pCtx->nBlockSize, &pCtx->nIsUncompressed) < 0)
+            pCtx->nBlockSize = 0;
+
+         if (pCtx->nBlockSize == 0) {
+            /* End of frame */
+            if ((pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) && pCtx->nContentSize != (unsigned long long)pCtx->nOriginalSize) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            pCtx->nStage = (pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? STAGE_CONTENT_CHECKSUM : STAGE_DONE;
+         }
+         else {
+            if ((int)pCtx->nBlockSize > pCtx->nBlockMaxSize) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            pCtx->nPendingInDataSize = 0;
+            pCtx->nStage = STAGE_BLOCK_DATA;
+         }
+         break;
+
+      case STAGE_BLOCK_DATA: {
+         const int nBlockSize = (int)pCtx->nBlockSize;
+         const int nBlockInputSize = nBlockSize + ((pCtx->nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? LZ4ULTRA_BLOCK_CHECKSUM_SIZE : 0);
+         const unsigned char *pInBlock;
+         int nDecompressedSize;
+
+         /* Decompressing needs room for a whole block, wherever it goes */
+         if (nOutProduced && (nOutDataSize - nOutProduced) < (size_t)pCtx->nBlockMaxSize) {
+            nDone = 1;
+            break;
+         }
+
+         if (!pCtx->nPendingInDataSize && (nInDataSize - nInConsumed) >= (size_t)nBlockInputSize) {
+            /* The whole block is in the input span: use it where it is */
+            pInBlock = pInData + nInConsumed;
+            nInConsumed += nBlockInputSize;
+         }
+         else {
+            if (!lz4ultra_decompress_gather(pCtx->pInBlock, &pCtx->nPendingInDataSize, nBlockInputSize, pInData, nInDataSize, &nInConsumed)) {
+               nDone = 1;
+               break;
+            }
+            pInBlock = pCtx->pInBlock;
+         }
+         pCtx->nCompressedSize += (long long)nBlockInputSize;
+
+         if (pCtx->nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) {
+            /* Check block before decompressing it */
+            if (lz4ultra_decode_block_checksum(pInBlock + nBlockSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pInBlock, nBlockSize) != LZ4ULTRA_DECODE_OK) {
+               nError = LZ4ULTRA_ERROR_CHECKSUM;
+               break;
+            }
+         }
+
+         if ((nOutDataSize - nOutProduced) >= (size_t)pCtx->nBlockMaxSize &&
+             (!pCtx->nPreviousBlockSize || (pHistoryEnd && pHistoryEnd == (pOutData + nOutProduced)))) {
+            /* Decompress straight into the output span, after the previous block */
+            unsigned char *pCurOutData = pOutData + nOutProduced;
+
+            if (pCtx->nIsUncompressed) {
+               memcpy(pCurOutData, pInBlock, nBlockSize);
+               nDecompressedSize = nBlockSize;
+            }
+            else {
+               nDecompressedSize = pCtx->expand_block(pInBlock, nBlockSize, pCurOutData - pCtx->nPreviousBlockSize, pCtx->nPreviousBlockSize, pCtx->nBlockMaxSize);
+               if (nDecompressedSize < 0) {
+                  nError = LZ4ULTRA_ERROR_DECOMPRESSION;
+                  break;
+               }
+            }
+
+            if (pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+               XXH32_update(&pCtx->contentChecksum, pCurOutData, nDecompressedSize);
+            nOutProduced += nDecompressedSize;
+            pHistoryEnd = pOutData + nOutProduced;
+         }
+         else {
+            /* Decompress into the context, after the history */
+            if (pHistoryEnd && pCtx->nPreviousBlockSize)
+               memcpy(pCtx->pOutData + HISTORY_SIZE - pCtx->nPreviousBlockSize, pHistoryEnd - pCtx->nPreviousBlockSize, pCtx->nPreviousBlockSize);
+            pHistoryEnd = NULL;
+
+            if (pCtx->nIsUncompressed) {
+               memcpy(pCtx->pOutData + HISTORY_SIZE, pInBlock, nBlockSize);
+               nDecompressedSize = nBlockSize;
+            }
+            else {
+               nDecompressedSize = pCtx->expand_block(pInBlock, nBlockSize, pCtx->pOutData + HISTORY_SIZE - pCtx->nPreviousBlockSize, pCtx->nPreviousBlockSize, pCtx->nBlockMaxSize);
+               if (nDecompressedSize < 0) {
+                  nError = LZ4ULTRA_ERROR_DECOMPRESSION;
+                  break;
+               }
+            }
+
+            if (pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+               XXH32_update(&pCtx->contentChecksum, pCtx->pOutData + HISTORY_SIZE, nDecompressedSize);
+            pCtx->nPendingOutDataOffset = 0;
+            pCtx->nPendingOutDataSize = nDecompressedSize;
+         }
+
+         pCtx->nOriginalSize += (long long)nDecompressedSize;
+
+         if (!(pCtx->nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS)) {
+            pCtx->nPreviousBlockSize = nDecompressedSize;
+            if (pCtx->nPreviousBlockSize > HISTORY_SIZE)
+               pCtx->nPreviousBlockSize = HISTORY_SIZE;
+
+            if (!pHistoryEnd && pCtx->nPreviousBlockSize) {
+               /* Keep the end of the block as history for the next one; this doesn't touch the block itself */
+               memcpy(pCtx->pOutData + HISTORY_SIZE - pCtx->nPreviousBlockSize, pCtx->pOutData + HISTORY_SIZE + nDecompressedSize - pCtx->nPreviousBlockSize, pCtx->nPreviousBlockSize);
+            }
+         }
+         else {
+            pCtx->nPreviousBlockSize = 0;
+         }
+
+         pCtx->nStage = STAGE_BLOCK_FRAME;
+         break;
+      }
+
+      case STAGE_CONTENT_CHECKSUM:
+         if (!lz4ultra_decompress_gather(pCtx->cFrameData, &pCtx->nFrameDataSize, LZ4ULTRA_CONTENT_CHECKSUM_SIZE, pInData, nInDataSize, &nInConsumed)) {
+            nDone = 1;
+            break;
+         }
+         pCtx->nFrameDataSize = 0;
+         pCtx->nCompressedSize += (long long)LZ4ULTRA_CONTENT_CHECKSUM_SIZE;
+
+         if (lz4ultra_decode_content_checksum(pCtx->cFrameData, LZ4ULTRA_CONTENT_CHECKSUM_SIZE, XXH32_digest(&pCtx->contentChecksum)) != LZ4ULTRA_DECODE_OK) {
+            nError = LZ4ULTRA_ERROR_CHECKSUM;
+            break;
+         }
+         pCtx->nStage = STAGE_DONE;
+         break;
+
+      default:
+         nDone = 1;
+         break;
+      }
+   }
+
+   /* The output span goes back to the caller: keep the history that the next block needs */
+   if (!nError && pHistoryEnd && pCtx->nPreviousBlockSize)
+      memcpy(pCtx->pOutData + HISTORY_SIZE - pCtx->nPreviousBlockSize, pHistoryEnd - pCtx->nPreviousBlockSize, pCtx->nPreviousBlockSize);
+
+   pCtx->nError = nError;
+   *pInConsumed = nInConsumed;
+   *pOutProduced = nOutProduced;
+   return nError;
+}
+
+/**
+ * Check that the whole frame was decompressed and handed out
+ *
+ * @param pCtx context
+ * @param pOriginalSize pointer to returned output(decompressed) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_SRC if the frame is truncated, LZ4ULTRA_ERROR_DST if decompressed data is still waiting for output room, or the error that stopped decompression
+ */
+lz4ultra_status_t lz4ultra_decompress_end(lz4ultra_incremental_decompressor_t *pCtx, long long *pOriginalSize, long long *pCompressedSize) {
+   if (pCtx->nError)
+      return pCtx->nError;
+
+   /* Legacy frames have no end marker; they end with the data */
+   if (pCtx->nStage != STAGE_DONE &&
+       !(pCtx->nStage == STAGE_BLOCK_FRAME && pCtx->nFrameDataSize == 0 && (pCtx->nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)))
+      return LZ4ULTRA_ERROR_SRC;
+
+   if (pCtx->nPendingOutDataSize)
+      return LZ4ULTRA_ERROR_DST;
+
+   if (pOriginalSize)
+      *pOriginalSize = pCtx->nOriginalSize;
+   if (pCompressedSize)
+      *pCompressedSize = pCtx->nCompressedSize;
+   return LZ4ULTRA_OK;
+}
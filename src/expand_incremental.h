@@ -0,0 +1,146 @@
+/*
+ * expand_incremental.h - incremental decompression definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _EXPAND_INCREMENTAL_H
+#define _EXPAND_INCREMENTAL_H
+
+#include <stddef.h>
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
+/* Forward declaration */
+typedef enum _lz4ultra_status_t lz4ultra_status_t;
+
+/**
+ * Incremental decompression context, fed with caller-owned input spans and writing to caller-owned output spans
+ *
+ * Headers and blocks are decoded straight from the input span when they are entirely in it, and are only gathered in the
+ * context when they straddle spans. Blocks are decompressed straight into the output span when it has room for a full
+ * block and the previous block, if they depend on it, was decompressed into the same span just in front. Otherwise, they
+ * are decompressed in the context and handed out as the output spans allow. At the end of each call, the last 64 Kb of
+ * output are copied back into the context for the next block to refer to.
+ */
+typedef struct _lz4ultra_incremental_decompressor_t {
+   unsigned char *pInBlock;
+   int nInBlockSize;
+   unsigned char *pOutData;
+   int nOutDataSize;
+   int (*expand_block)(const unsigned char *, int, unsigned char *, int, int);
+   unsigned int nFlags;
+   int nStage;
+   int nError;
+   unsigned char cFrameData[16];
+   int nFrameDataSize;
+   int nFrameDataNeeded;
+   int nBlockMaxSize;
+   unsigned int nBlockSize;
+   int nIsUncompressed;
+   int nPendingInDataSize;
+   int nPendingOutDataOffset;
+   int nPendingOutDataSize;
+   int nPreviousBlockSize;
+   unsigned long long nContentSize;
+   long long nOriginalSize;
+   long long nCompressedSize;
+   XXH32_state_t contentChecksum;
+} lz4ultra_incremental_decompressor_t;
+
+/**
+ * Initialize incremental decompression context, without allocating anything yet
+ *
+ * @param pCtx context to initialize
+ */
+void lz4ultra_incremental_decompressor_init(lz4ultra_incremental_decompressor_t *pCtx);
+
+/**
+ * Free incremental decompression context buffers
+ *
+ * @param pCtx context
+ */
+void lz4ultra_incremental_decompressor_destroy(lz4ultra_incremental_decompressor_t *pCtx);
+
+/**
+ * Create incremental decompression context, without allocating anything else yet
+ *
+ * @return context, to be freed with lz4ultra_incremental_decompressor_free(), or NULL for failure
+ */
+lz4ultra_incremental_decompressor_t *lz4ultra_incremental_decompressor_create(void);
+
+/**
+ * Free incremental decompression context and its buffers
+ *
+ * @param pCtx context, or NULL
+ */
+void lz4ultra_incremental_decompressor_free(lz4ultra_incremental_decompressor_t *pCtx);
+
+/**
+ * Start decompressing a new frame
+ *
+ * @param pCtx context
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0; raw blocks aren't supported)
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_decompress_begin(lz4ultra_incremental_decompressor_t *pCtx, unsigned int nFlags);
+
+/**
+ * Decompress more input
+ *
+ * Input is consumed until the output span is full or the end of the frame is reached; anything after the frame is left
+ * unconsumed. The buffers for the frame's block size are allocated when its header is decoded, unless the context
+ * already has large enough ones from a previous frame.
+ *
+ * @param pCtx context
+ * @param pInData input(compressed) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(decompressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_decompress_update(lz4ultra_incremental_decompressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                             unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Check that the whole frame was decompressed and handed out
+ *
+ * @param pCtx context
+ * @param pOriginalSize pointer to returned output(decompressed) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_SRC if the frame is truncated, LZ4ULTRA_ERROR_DST if decompressed data is still waiting for output room, or the error that stopped decompression
+ */
+lz4ultra_status_t lz4ultra_decompress_end(lz4ultra_incremental_decompressor_t *pCtx, long long *pOriginalSize, long long *pCompressedSize);
+
+#endif /* _EXPAND_INCREMENTAL_H */
@@ -35,6 +35,10 @@
 #include "expand_inmem.h"
 #include "lib.h"
 #include "frame.h"
+#include "format.h"
+#include "threadpool.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
 
 /**
  * Get maximum decompressed size of compressed data
@@ -42,7 +46,7 @@
  * @param pFileData compressed data
  * @param nFileSize compressed size in bytes
  *
- * @return maximum decompressed size
+ * @return exact decompressed size if the frame header stores it, otherwise maximum decompressed size
  */
 size_t lz4ultra_inmem_get_max_decompressed_size(const unsigned char *pFileData, size_t nFileSize) {
    const unsigned char *pCurFileData = pFileData;
@@ -50,6 +54,7 @@ size_t lz4ultra_inmem_get_max_decompressed_size(const unsigned char *pFileData,
    int nBlockMaxCode = 0;
    unsigned int nFlags = 0;
    int nBlockMaxBits, nBlockMaxSize;
+   unsigned long long nContentSize = 0;
    size_t nMaxDecompressedSize = 0;
 
    /* Check header */
@@ -60,17 +65,28 @@ size_t lz4ultra_inmem_get_max_decompressed_size(const unsigned char *pFileData,
    if (nExtraHeaderSize < 0)
       return -1;
 
-   if (((pCurFileData + LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize) > pEndFileData) || 
-       lz4ultra_decode_header(pCurFileData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize, &nBlockMaxCode, &nFlags) != LZ4ULTRA_DECODE_OK)
+   if ((pCurFileData + LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize) > pEndFileData)
       return -1;
 
+   int nHeaderSize = lz4ultra_get_header_size(pCurFileData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+   if (nHeaderSize < 0 || (pCurFileData + nHeaderSize) > pEndFileData ||
+       lz4ultra_decode_header(pCurFileData, nHeaderSize, &nBlockMaxCode, &nFlags, &nContentSize) != LZ4ULTRA_DECODE_OK)
+      return -1;
+
+   if (nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) {
+      /* The header has the exact size, no need to walk the blocks */
+      if (nContentSize > (unsigned long long)((size_t)-1))
+         return -1;
+      return (size_t)nContentSize;
+   }
+
    if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
       nBlockMaxBits = 23;
    else
       nBlockMaxBits = 8 + (nBlockMaxCode << 1);
    nBlockMaxSize = 1 << nBlockMaxBits;
 
-   pCurFileData += (LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+   pCurFileData += nHeaderSize;
 
    while (pCurFileData < pEndFileData) {
       unsigned int nBlockDataSize = 0;
@@ -88,6 +104,8 @@ size_t lz4ultra_inmem_get_max_decompressed_size(const unsigned char *pFileData,
       /* Add one potentially full block to the decompressed size */
       nMaxDecompressedSize += nBlockMaxSize;
 
+      if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM)
+         nBlockDataSize += LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
       if ((pCurFileData + nBlockDataSize) > pEndFileData)
          return -1;
 
@@ -98,26 +116,80 @@ size_t lz4ultra_inmem_get_max_decompressed_size(const unsigned char *pFileData,
 }
 
 /**
- * Decompress data in memory
+ * Check the decompressed data against the content size and checksum stored in the frame, if any
+ *
+ * @param pCurFileData current position in the compressed data, right after the EOD frame
+ * @param pEndFileData end of the compressed data
+ * @param nFlags compression flags, as decoded from the frame header
+ * @param nContentSize content size, as decoded from the frame header
+ * @param nContentChecksum XXH32 checksum of the decompressed data
+ * @param nDecompressedSize actual decompressed size
+ *
+ * @return 0 for success, -1 for a mismatch
+ */
+static int lz4ultra_inmem_check_content(const unsigned char *pCurFileData, const unsigned char *pEndFileData, const unsigned int nFlags,
+                                        const unsigned long long nContentSize, const unsigned int nContentChecksum, const size_t nDecompressedSize) {
+   if ((nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) && nContentSize != (unsigned long long)nDecompressedSize)
+      return -1;
+
+   if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) {
+      if ((pCurFileData + LZ4ULTRA_CONTENT_CHECKSUM_SIZE) > pEndFileData ||
+          lz4ultra_decode_content_checksum(pCurFileData, LZ4ULTRA_CONTENT_CHECKSUM_SIZE, nContentChecksum) != LZ4ULTRA_DECODE_OK)
+         return -1;
+   }
+
+   return 0;
+}
+
+/**
+ * Decompress data in memory, optionally counting the decoder paths taken
  *
  * @param pFileData compressed data
  * @param pOutBuffer buffer for decompressed data
  * @param nFileSize compressed size in bytes
  * @param nMaxOutBufferSize maximum capacity of decompression buffer
- * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid)
+ * @param pStats decompression statistics to add to, or NULL for none (all blocks are then bounds-checked)
  *
  * @return actual decompressed size, or -1 for error
  */
-size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize, unsigned int nFlags) {
+static size_t lz4ultra_decompress_inmem_data(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize,
+                                             const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, lz4ultra_decompression_stats_t *pStats) {
    const unsigned char *pCurFileData = pFileData;
    const unsigned char *pEndFileData = pCurFileData + nFileSize;
    unsigned char *pCurOutBuffer = pOutBuffer;
    const unsigned char *pEndOutBuffer = pCurOutBuffer + nMaxOutBufferSize;
    int nBlockMaxCode = 0;
    int nBlockMaxBits, nBlockMaxSize, nPreviousBlockSize;
+   unsigned long long nContentSize = 0;
+   XXH32_state_t contentChecksum;
+   int (*expand_block)(const unsigned char *, int, unsigned char *, int, int);
+
+   if (nFlags & LZ4ULTRA_FLAG_TRUSTED_INPUT)
+      expand_block = lz4ultra_decompressor_expand_block_unchecked;
+   else
+      expand_block = lz4ultra_decompressor_expand_block;
+
+   if (!pDictionaryData || nDictionaryDataSize <= 0) {
+      pDictionaryData = NULL;
+      nDictionaryDataSize = 0;
+   }
+   else if (nDictionaryDataSize > HISTORY_SIZE) {
+      /* Only the last HISTORY_SIZE bytes of the dictionary can be referenced */
+      pDictionaryData = (const unsigned char *)pDictionaryData + nDictionaryDataSize - HISTORY_SIZE;
+      nDictionaryDataSize = HISTORY_SIZE;
+   }
 
    if (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) {
-      return (size_t)lz4ultra_decompressor_expand_block(pFileData, (int)nFileSize - 2 /* EOD marker */, pOutBuffer, 0, (int)nMaxOutBufferSize);
+      if (pStats)
+         return (size_t)lz4ultra_decompressor_expand_block_with_stats(pFileData, (int)nFileSize - 2 /* EOD marker */, (const unsigned char *)pDictionaryData, nDictionaryDataSize,
+                                                                      pOutBuffer, 0, (int)nMaxOutBufferSize, pStats);
+      if (pDictionaryData)
+         return (size_t)lz4ultra_decompressor_expand_block_with_dictionary(pFileData, (int)nFileSize - 2 /* EOD marker */, (const unsigned char *)pDictionaryData, nDictionaryDataSize,
+                                                                           pOutBuffer, 0, (int)nMaxOutBufferSize);
+      return (size_t)expand_block(pFileData, (int)nFileSize - 2 /* EOD marker */, pOutBuffer, 0, (int)nMaxOutBufferSize);
    }
 
    /* Check header */
@@ -128,8 +200,12 @@ size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *
    if (nExtraHeaderSize < 0)
       return -1;
 
-   if (((pCurFileData + LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize) > pEndFileData) ||
-       lz4ultra_decode_header(pCurFileData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize, &nBlockMaxCode, &nFlags) != LZ4ULTRA_DECODE_OK)
+   if ((pCurFileData + LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize) > pEndFileData)
+      return -1;
+
+   int nHeaderSize = lz4ultra_get_header_size(pCurFileData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+   if (nHeaderSize < 0 || (pCurFileData + nHeaderSize) > pEndFileData ||
+       lz4ultra_decode_header(pCurFileData, nHeaderSize, &nBlockMaxCode, &nFlags, &nContentSize) != LZ4ULTRA_DECODE_OK)
       return -1;
 
    if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
@@ -138,8 +214,9 @@ size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *
       nBlockMaxBits = 8 + (nBlockMaxCode << 1);
    nBlockMaxSize = 1 << nBlockMaxBits;
 
-   pCurFileData += (LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+   pCurFileData += nHeaderSize;
    nPreviousBlockSize = 0;
+   XXH32_reset(&contentChecksum, 0);
 
    while (pCurFileData < pEndFileData) {
       unsigned int nBlockDataSize = 0;
@@ -154,6 +231,13 @@ size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *
       if (!nBlockDataSize)
          break;
 
+      if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) {
+         /* Check block before decompressing it */
+         if ((pCurFileData + nBlockDataSize + LZ4ULTRA_BLOCK_CHECKSUM_SIZE) > pEndFileData ||
+             lz4ultra_decode_block_checksum(pCurFileData + nBlockDataSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pCurFileData, nBlockDataSize) != LZ4ULTRA_DECODE_OK)
+            return -1;
+      }
+
       if (!nIsUncompressed) {
          int nDecompressedSize;
 
@@ -161,13 +245,24 @@ size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *
          if ((pCurFileData + nBlockDataSize) > pEndFileData)
             return -1;
 
-         if ((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) || (nPreviousBlockSize == 0))
-            nDecompressedSize = lz4ultra_decompressor_expand_block(pCurFileData, nBlockDataSize, pCurOutBuffer, 0, (int)(pEndOutBuffer - pCurOutBuffer));
+         if (pStats && ((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) || (nPreviousBlockSize == 0)))
+            nDecompressedSize = lz4ultra_decompressor_expand_block_with_stats(pCurFileData, nBlockDataSize, (const unsigned char *)pDictionaryData, nDictionaryDataSize,
+                                                                              pCurOutBuffer, 0, (int)(pEndOutBuffer - pCurOutBuffer), pStats);
+         else if (pStats)
+            nDecompressedSize = lz4ultra_decompressor_expand_block_with_stats(pCurFileData, nBlockDataSize, NULL, 0,
+                                                                              pCurOutBuffer - nPreviousBlockSize, nPreviousBlockSize, (int)(pEndOutBuffer - pCurOutBuffer), pStats);
+         else if (((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) || (nPreviousBlockSize == 0)) && pDictionaryData)
+            nDecompressedSize = lz4ultra_decompressor_expand_block_with_dictionary(pCurFileData, nBlockDataSize, (const unsigned char *)pDictionaryData, nDictionaryDataSize,
+                                                                                   pCurOutBuffer, 0, (int)(pEndOutBuffer - pCurOutBuffer));
+         else if ((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) || (nPreviousBlockSize == 0))
+            nDecompressedSize = expand_block(pCurFileData, nBlockDataSize, pCurOutBuffer, 0, (int)(pEndOutBuffer - pCurOutBuffer));
          else
-            nDecompressedSize = lz4ultra_decompressor_expand_block(pCurFileData, nBlockDataSize, pCurOutBuffer - nPreviousBlockSize, nPreviousBlockSize, (int)(pEndOutBuffer - pCurOutBuffer + nPreviousBlockSize));
+            nDecompressedSize = expand_block(pCurFileData, nBlockDataSize, pCurOutBuffer - nPreviousBlockSize, nPreviousBlockSize, (int)(pEndOutBuffer - pCurOutBuffer));
          if (nDecompressedSize < 0)
             return -1;
 
+         if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+            XXH32_update(&contentChecksum, pCurOutBuffer, nDecompressedSize);
          pCurOutBuffer += nDecompressedSize;
          nPreviousBlockSize = nDecompressedSize;
       }
@@ -178,11 +273,325 @@ size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *
          if ((pCurOutBuffer + nBlockDataSize) > pEndOutBuffer)
             return -1;
          memcpy(pCurOutBuffer, pCurFileData, nBlockDataSize);
+         if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+            XXH32_update(&contentChecksum, pCurOutBuffer, nBlockDataSize);
          pCurOutBuffer += nBlockDataSize;
+         nPreviousBlockSize = nBlockDataSize;
       }
 
       pCurFileData += nBlockDataSize;
+      if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM)
+         pCurFileData += LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
    }
 
+   if (lz4ultra_inmem_check_content(pCurFileData, pEndFileData, nFlags, nContentSize, XXH32_digest(&contentChecksum), pCurOutBuffer - pOutBuffer) != 0)
+      return -1;
+
    return (int)(pCurOutBuffer - pOutBuffer);
 }
+
+/**
+ * Decompress data in memory
+ *
+ * The dictionary, if any, virtually precedes the output buffer: it doesn't need to be copied in front of the output.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize,
+                                 const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags) {
+   return lz4ultra_decompress_inmem_data(pFileData, pOutBuffer, nFileSize, nMaxOutBufferSize, pDictionaryData, nDictionaryDataSize, nFlags, NULL);
+}
+
+/**
+ * Decompress data in memory, counting the decoder paths, match offsets and lengths, and literal run lengths
+ *
+ * This is slower than lz4ultra_decompress_inmem(), and meant for analyzing how compressed data decodes, for instance
+ * to check that data compressed for decompression speed takes the decoder's fast paths. All blocks are bounds-checked.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block)
+ * @param pStats decompression statistics to add to
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t lz4ultra_decompress_inmem_with_stats(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize,
+                                            const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, lz4ultra_decompression_stats_t *pStats) {
+   return lz4ultra_decompress_inmem_data(pFileData, pOutBuffer, nFileSize, nMaxOutBufferSize, pDictionaryData, nDictionaryDataSize, nFlags, pStats);
+}
+
+/** One block located in the frame, for parallel decompression */
+typedef struct _lz4ultra_inmem_dec_block_t {
+   const unsigned char *pInData;
+   int nInDataSize;
+   int nIsUncompressed;
+   int nHasChecksum;
+   size_t nOutDataOffset;
+   int nMaxOutDataSize;
+   int nOutDataSize;
+} lz4ultra_inmem_dec_block_t;
+
+/** Shared state of parallel in-memory decompression */
+typedef struct _lz4ultra_inmem_dec_parallel_t {
+   lz4ultra_mutex_t lock;
+   lz4ultra_cond_t cond;
+   lz4ultra_inmem_dec_block_t *pBlocks;
+   size_t nNumBlocks;
+   size_t nNextBlock;
+   int nRunningWorkers;
+   int nError;
+   unsigned char *pOutBuffer;
+   int (*expand_block)(const unsigned char *, int, unsigned char *, int, int);
+} lz4ultra_inmem_dec_parallel_t;
+
+/**
+ * Decompress blocks until there are none left, picking the next block to decompress each time
+ *
+ * @param pTaskArg shared decompression state (lz4ultra_inmem_dec_parallel_t)
+ */
+static void lz4ultra_decompress_inmem_worker(void *pTaskArg) {
+   lz4ultra_inmem_dec_parallel_t *pState = (lz4ultra_inmem_dec_parallel_t *)pTaskArg;
+
+   lz4ultra_mutex_lock(&pState->lock);
+
+   while (pState->nNextBlock < pState->nNumBlocks && !pState->nError) {
+      lz4ultra_inmem_dec_block_t *pBlock = &pState->pBlocks[pState->nNextBlock++];
+      unsigned char *pOutData = pState->pOutBuffer + pBlock->nOutDataOffset;
+
+      lz4ultra_mutex_unlock(&pState->lock);
+
+      if (pBlock->nHasChecksum &&
+          lz4ultra_decode_block_checksum(pBlock->pInData + pBlock->nInDataSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pBlock->pInData, pBlock->nInDataSize) != LZ4ULTRA_DECODE_OK) {
+         pBlock->nOutDataSize = -1;
+      }
+      else if (pBlock->nIsUncompressed) {
+         if (pBlock->nInDataSize <= pBlock->nMaxOutDataSize) {
+            memcpy(pOutData, pBlock->pInData, pBlock->nInDataSize);
+            pBlock->nOutDataSize = pBlock->nInDataSize;
+         }
+         else {
+            pBlock->nOutDataSize = -1;
+         }
+      }
+      else {
+         pBlock->nOutDataSize = pState->expand_block(pBlock->pInData, pBlock->nInDataSize, pOutData, 0, pBlock->nMaxOutDataSize);
+      }
+
+      lz4ultra_mutex_lock(&pState->lock);
+      if (pBlock->nOutDataSize < 0)
+         pState->nError = 1;
+   }
+
+   pState->nRunningWorkers--;
+   lz4ultra_cond_broadcast(&pState->cond);
+   lz4ultra_mutex_unlock(&pState->lock);
+}
+
+/**
+ * Submit task to the internal thread pool
+ *
+ * @param pExecutor thread pool (lz4ultra_thread_pool_t)
+ * @param task task function
+ * @param pTaskArg argument passed to task function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_dec_submit_to_thread_pool(void *pExecutor, lz4ultra_task_fn task, void *pTaskArg) {
+   return lz4ultra_thread_pool_submit((lz4ultra_thread_pool_t *)pExecutor, task, pTaskArg);
+}
+
+/**
+ * Decompress data in memory, decompressing several blocks concurrently when they are independent
+ *
+ * The blocks are located by scanning the frame first, and then decompressed straight into the output buffer, each at
+ * the offset it would have if all the blocks before it were full. Frames with dependent blocks, raw blocks and data
+ * that doesn't have room for full blocks in the output buffer are decompressed serially.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid)
+ * @param nThreads maximum number of blocks decompressed at the same time
+ * @param submit function to queue decompression tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t lz4ultra_decompress_inmem_parallel(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize, unsigned int nFlags,
+                                          int nThreads, lz4ultra_submit_fn submit, void *pExecutor) {
+   const unsigned char *pCurFileData = pFileData;
+   const unsigned char *pEndFileData = pCurFileData + nFileSize;
+   const unsigned int nCallerFlags = nFlags;
+   lz4ultra_inmem_dec_parallel_t state;
+   lz4ultra_thread_pool_t pool;
+   int nBlockMaxCode = 0;
+   int nBlockMaxBits, nBlockMaxSize;
+   size_t nMaxBlocks, nNumBlocks = 0;
+   size_t nOutDataOffset = 0;
+   unsigned long long nContentSize = 0;
+   size_t i;
+
+   if (nThreads <= 1 || (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK))
+      return lz4ultra_decompress_inmem(pFileData, pOutBuffer, nFileSize, nMaxOutBufferSize, NULL, 0, nFlags);
+
+   /* Check header */
+   if ((pCurFileData + LZ4ULTRA_HEADER_SIZE) > pEndFileData)
+      return -1;
+
+   int nExtraHeaderSize = lz4ultra_check_header(pCurFileData, LZ4ULTRA_HEADER_SIZE);
+   if (nExtraHeaderSize < 0)
+      return -1;
+
+   if ((pCurFileData + LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize) > pEndFileData)
+      return -1;
+
+   int nHeaderSize = lz4ultra_get_header_size(pCurFileData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+   if (nHeaderSize < 0 || (pCurFileData + nHeaderSize) > pEndFileData ||
+       lz4ultra_decode_header(pCurFileData, nHeaderSize, &nBlockMaxCode, &nFlags, &nContentSize) != LZ4ULTRA_DECODE_OK)
+      return -1;
+
+   /* Legacy frames always have independent blocks */
+   if ((nFlags & (LZ4ULTRA_FLAG_INDEP_BLOCKS | LZ4ULTRA_FLAG_LEGACY_FRAMES)) == 0)
+      return lz4ultra_decompress_inmem(pFileData, pOutBuffer, nFileSize, nMaxOutBufferSize, NULL, 0, nCallerFlags);
+
+   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
+      nBlockMaxBits = 23;
+   else
+      nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+   nBlockMaxSize = 1 << nBlockMaxBits;
+
+   pCurFileData += nHeaderSize;
+
+   /* Each block takes at least a frame header */
+   nMaxBlocks = (size_t)(pEndFileData - pCurFileData) / LZ4ULTRA_FRAME_SIZE + 1;
+   state.pBlocks = (lz4ultra_inmem_dec_block_t *)malloc(nMaxBlocks * sizeof(lz4ultra_inmem_dec_block_t));
+   if (!state.pBlocks)
+      return -1;
+
+   /* Locate all blocks, and give each of them a full block of output */
+   while (pCurFileData < pEndFileData) {
+      unsigned int nBlockDataSize = 0;
+      int nIsUncompressed = 0;
+
+      if ((pCurFileData + LZ4ULTRA_FRAME_SIZE) > pEndFileData ||
+          lz4ultra_decode_frame(pCurFileData, LZ4ULTRA_FRAME_SIZE, nFlags, &nBlockDataSize, &nIsUncompressed) != LZ4ULTRA_DECODE_OK) {
+         free(state.pBlocks);
+         return -1;
+      }
+      pCurFileData += LZ4ULTRA_FRAME_SIZE;
+
+      if (!nBlockDataSize)
+         break;
+
+      if ((pCurFileData + nBlockDataSize + ((nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? LZ4ULTRA_BLOCK_CHECKSUM_SIZE : 0)) > pEndFileData) {
+         free(state.pBlocks);
+         return -1;
+      }
+
+      lz4ultra_inmem_dec_block_t *pBlock = &state.pBlocks[nNumBlocks++];
+      pBlock->pInData = pCurFileData;
+      pBlock->nInDataSize = (int)nBlockDataSize;
+      pBlock->nIsUncompressed = nIsUncompressed;
+      pBlock->nHasChecksum = (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? 1 : 0;
+      pBlock->nOutDataOffset = nOutDataOffset;
+      if (nOutDataOffset >= nMaxOutBufferSize)
+         pBlock->nMaxOutDataSize = 0;
+      else if ((nMaxOutBufferSize - nOutDataOffset) < (size_t)nBlockMaxSize)
+         pBlock->nMaxOutDataSize = (int)(nMaxOutBufferSize - nOutDataOffset);
+      else
+         pBlock->nMaxOutDataSize = nBlockMaxSize;
+      pBlock->nOutDataSize = -1;
+
+      nOutDataOffset += nBlockMaxSize;
+      pCurFileData += nBlockDataSize;
+      if (pBlock->nHasChecksum)
+         pCurFileData += LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+   }
+
+   for (i = 0; i + 1 < nNumBlocks; i++) {
+      if (state.pBlocks[i].nMaxOutDataSize != nBlockMaxSize) {
+         /* Not enough room to give each block but the last its own full block of output */
+         free(state.pBlocks);
+         return lz4ultra_decompress_inmem(pFileData, pOutBuffer, nFileSize, nMaxOutBufferSize, NULL, 0, nCallerFlags);
+      }
+   }
+
+   if (nThreads > nNumBlocks)
+      nThreads = (int)nNumBlocks;
+
+   state.nNumBlocks = nNumBlocks;
+   state.nNextBlock = 0;
+   state.nRunningWorkers = 0;
+   state.nError = 0;
+   state.pOutBuffer = pOutBuffer;
+   if (nCallerFlags & LZ4ULTRA_FLAG_TRUSTED_INPUT)
+      state.expand_block = lz4ultra_decompressor_expand_block_unchecked;
+   else
+      state.expand_block = lz4ultra_decompressor_expand_block;
+
+   pool.threads = NULL;
+   if (!submit && nThreads > 1) {
+      if (lz4ultra_thread_pool_init(&pool, nThreads) == 0) {
+         submit = lz4ultra_dec_submit_to_thread_pool;
+         pExecutor = &pool;
+      }
+   }
+
+   lz4ultra_mutex_init(&state.lock);
+   lz4ultra_cond_init(&state.cond);
+
+   /* Start the workers; if a worker can't be queued, run it right away */
+   for (int nWorker = 0; nWorker < nThreads; nWorker++) {
+      lz4ultra_mutex_lock(&state.lock);
+      state.nRunningWorkers++;
+      lz4ultra_mutex_unlock(&state.lock);
+
+      if (!submit || submit(pExecutor, lz4ultra_decompress_inmem_worker, &state) != 0)
+         lz4ultra_decompress_inmem_worker(&state);
+   }
+
+   lz4ultra_mutex_lock(&state.lock);
+   while (state.nRunningWorkers)
+      lz4ultra_cond_wait(&state.cond, &state.lock);
+   lz4ultra_mutex_unlock(&state.lock);
+   lz4ultra_cond_destroy(&state.cond);
+   lz4ultra_mutex_destroy(&state.lock);
+
+   if (pool.threads)
+      lz4ultra_thread_pool_destroy(&pool);
+
+   /* Close the gaps left by blocks that weren't full, if any */
+   nOutDataOffset = 0;
+   for (i = 0; i < nNumBlocks && !state.nError; i++) {
+      lz4ultra_inmem_dec_block_t *pBlock = &state.pBlocks[i];
+
+      if (pBlock->nOutDataOffset != nOutDataOffset)
+         memmove(pOutBuffer + nOutDataOffset, pOutBuffer + pBlock->nOutDataOffset, pBlock->nOutDataSize);
+      nOutDataOffset += pBlock->nOutDataSize;
+   }
+
+   free(state.pBlocks);
+
+   if (state.nError)
+      return -1;
+
+   /* Blocks finish out of order, so checksum the whole output at once */
+   if (lz4ultra_inmem_check_content(pCurFileData, pEndFileData, nFlags, nContentSize,
+                                    (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? XXH32(pOutBuffer, nOutDataOffset, 0) : 0, nOutDataOffset) != 0)
+      return -1;
+
+   return nOutDataOffset;
+}
@@ -34,6 +34,7 @@
 #define _EXPAND_INMEM_H
 
 #include <stdio.h>
+#include "lz4ultra.h"
 
 /**
  * Get maximum decompressed size of compressed data
@@ -48,14 +49,61 @@ size_t lz4ultra_inmem_get_max_decompressed_size(const unsigned char *pFileData,
 /**
  * Decompress data in memory
  *
+ * The dictionary, if any, virtually precedes the output buffer: it doesn't need to be copied in front of the output.
+ * Blocks that reference the dictionary are always bounds-checked, even with LZ4ULTRA_FLAG_TRUSTED_INPUT.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize,
+   const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags);
+
+/**
+ * Decompress data in memory, counting the decoder paths, match offsets and lengths, and literal run lengths
+ *
+ * This is slower than lz4ultra_decompress_inmem(), and meant for analyzing how compressed data decodes, for instance
+ * to check that data compressed for decompression speed takes the decoder's fast paths. All blocks are bounds-checked.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block)
+ * @param pStats decompression statistics to add to
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+size_t lz4ultra_decompress_inmem_with_stats(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize,
+   const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, lz4ultra_decompression_stats_t *pStats);
+
+/**
+ * Decompress data in memory, decompressing several blocks concurrently when they are independent
+ *
+ * The blocks are located by scanning the frame first, and then decompressed straight into the output buffer, each at
+ * the offset it would have if all the blocks before it were full. Frames with dependent blocks, raw blocks and data
+ * that doesn't have room for full blocks in the output buffer are decompressed serially.
+ *
  * @param pFileData compressed data
  * @param pOutBuffer buffer for decompressed data
  * @param nFileSize compressed size in bytes
  * @param nMaxOutBufferSize maximum capacity of decompression buffer
- * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid)
+ * @param nThreads maximum number of blocks decompressed at the same time
+ * @param submit function to queue decompression tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
  *
  * @return actual decompressed size, or -1 for error
  */
-size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize, unsigned int nFlags);
+size_t lz4ultra_decompress_inmem_parallel(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize, unsigned int nFlags,
+                                          int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
 
 #endif /* _EXPAND_INMEM_H */
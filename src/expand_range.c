@@ -0,0 +1,299 @@
+/*
+ * expand_range.c - random access decompressor implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "expand_range.h"
+#include "expand_block.h"
+#include "format.h"
+#include "frame.h"
+#include "lib.h"
+#include "mapped_file.h"
+#include "seek_table.h"
+
+/**
+ * Decompress one block of a seekable frame
+ *
+ * @param pFrame seekable frame
+ * @param nBlock index of block to decompress
+ * @param pOutData buffer for the decompressed block, with room for its decompressed size as listed in the seek table
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param expand_block block decompressor to use when there is no dictionary
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_expand_seekable_block(const lz4ultra_seekable_frame_t *pFrame, const int nBlock, unsigned char *pOutData,
+                                                        const unsigned char *pDictionaryData, const int nDictionaryDataSize,
+                                                        int (*expand_block)(const unsigned char *, int, unsigned char *, int, int)) {
+   const unsigned char *pBlockFrame = pFrame->frame_data + pFrame->block_offset[nBlock];
+   const unsigned char *pBlockData = pBlockFrame + LZ4ULTRA_FRAME_SIZE;
+   int nStoredSize = (int)(pFrame->block_offset[nBlock + 1] - pFrame->block_offset[nBlock]);
+   int nExpectedSize = (int)(pFrame->data_offset[nBlock + 1] - pFrame->data_offset[nBlock]);
+   unsigned int nBlockDataSize = 0;
+   int nIsUncompressed = 0;
+   int nDecompressedSize;
+
+   /* The block frame header must agree with the seek table */
+   if (lz4ultra_decode_frame(pBlockFrame, LZ4ULTRA_FRAME_SIZE, pFrame->flags, &nBlockDataSize, &nIsUncompressed) != LZ4ULTRA_DECODE_OK || !nBlockDataSize ||
+       (LZ4ULTRA_FRAME_SIZE + (long long)nBlockDataSize + ((pFrame->flags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? LZ4ULTRA_BLOCK_CHECKSUM_SIZE : 0)) != nStoredSize)
+      return LZ4ULTRA_ERROR_FORMAT;
+
+   if ((pFrame->flags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) &&
+       lz4ultra_decode_block_checksum(pBlockData + nBlockDataSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pBlockData, nBlockDataSize) != LZ4ULTRA_DECODE_OK)
+      return LZ4ULTRA_ERROR_CHECKSUM;
+
+   if (nIsUncompressed) {
+      if ((int)nBlockDataSize != nExpectedSize)
+         return LZ4ULTRA_ERROR_FORMAT;
+      memcpy(pOutData, pBlockData, nBlockDataSize);
+      return LZ4ULTRA_OK;
+   }
+
+   if (pDictionaryData)
+      nDecompressedSize = lz4ultra_decompressor_expand_block_with_dictionary(pBlockData, nBlockDataSize, pDictionaryData, nDictionaryDataSize, pOutData, 0, nExpectedSize);
+   else
+      nDecompressedSize = expand_block(pBlockData, nBlockDataSize, pOutData, 0, nExpectedSize);
+
+   return (nDecompressedSize == nExpectedSize) ? LZ4ULTRA_OK : LZ4ULTRA_ERROR_DECOMPRESSION;
+}
+
+/**
+ * Decompress a range of bytes out of a seekable frame, into a buffer or a stream
+ *
+ * @param pFrame seekable frame
+ * @param nOffset offset of the first decompressed byte to output
+ * @param nSize number of decompressed bytes to output
+ * @param pOutBuffer buffer for decompressed data, or NULL to write to pOutStream
+ * @param pOutStream output(decompressed) stream to write to, when pOutBuffer is NULL
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ * @param pOriginalSize pointer to returned number of decompressed bytes output
+ * @param pCompressedSize pointer to returned size of the compressed blocks that were decompressed
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_decompress_range_data(const lz4ultra_seekable_frame_t *pFrame, const unsigned long long nOffset, const unsigned long long nSize,
+                                                        unsigned char *pOutBuffer, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize,
+                                                        const unsigned int nFlags, long long *pOriginalSize, long long *pCompressedSize) {
+   const unsigned long long nTotalSize = (unsigned long long)pFrame->data_offset[pFrame->num_blocks];
+   unsigned long long nEnd;
+   unsigned char *pBlockBuffer = NULL;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   lz4ultra_status_t nStatus = LZ4ULTRA_OK;
+   int (*expand_block)(const unsigned char *, int, unsigned char *, int, int);
+   int nBlock;
+
+   *pOriginalSize = 0LL;
+   *pCompressedSize = 0LL;
+   if (nOffset >= nTotalSize || !nSize)
+      return LZ4ULTRA_OK;
+   nEnd = (nSize > (nTotalSize - nOffset)) ? nTotalSize : (nOffset + nSize);
+
+   if (nFlags & LZ4ULTRA_FLAG_TRUSTED_INPUT)
+      expand_block = lz4ultra_decompressor_expand_block_unchecked;
+   else
+      expand_block = lz4ultra_decompressor_expand_block;
+
+   if (!pDictionaryData || nDictionaryDataSize <= 0) {
+      pDictionaryData = NULL;
+      nDictionaryDataSize = 0;
+   }
+   else if (nDictionaryDataSize > HISTORY_SIZE) {
+      /* Only the last HISTORY_SIZE bytes of the dictionary can be referenced */
+      pDictionaryData = (const unsigned char *)pDictionaryData + nDictionaryDataSize - HISTORY_SIZE;
+      nDictionaryDataSize = HISTORY_SIZE;
+   }
+
+   for (nBlock = lz4ultra_seekable_frame_find_block(pFrame, nOffset); nBlock < pFrame->num_blocks && (unsigned long long)pFrame->data_offset[nBlock] < nEnd; nBlock++) {
+      const unsigned long long nBlockStart = (unsigned long long)pFrame->data_offset[nBlock];
+      const unsigned long long nBlockEnd = (unsigned long long)pFrame->data_offset[nBlock + 1];
+      const int nCopyStart = (nOffset > nBlockStart) ? (int)(nOffset - nBlockStart) : 0;
+      const int nCopyEnd = (nEnd < nBlockEnd) ? (int)(nEnd - nBlockStart) : (int)(nBlockEnd - nBlockStart);
+      unsigned char *pBlockOut;
+
+      if (pOutBuffer && nCopyStart == 0 && nCopyEnd == (int)(nBlockEnd - nBlockStart)) {
+         /* The whole block is in the range: decompress it in place */
+         pBlockOut = pOutBuffer + nOriginalSize;
+      }
+      else {
+         if (!pBlockBuffer) {
+            pBlockBuffer = (unsigned char *)malloc(pFrame->block_max_size);
+            if (!pBlockBuffer) {
+               nStatus = LZ4ULTRA_ERROR_MEMORY;
+               break;
+            }
+         }
+         pBlockOut = pBlockBuffer;
+      }
+
+      nStatus = lz4ultra_expand_seekable_block(pFrame, nBlock, pBlockOut, (const unsigned char *)pDictionaryData, nDictionaryDataSize, expand_block);
+      if (nStatus != LZ4ULTRA_OK)
+         break;
+
+      if (pBlockOut == pBlockBuffer) {
+         if (pOutBuffer)
+            memcpy(pOutBuffer + nOriginalSize, pBlockBuffer + nCopyStart, nCopyEnd - nCopyStart);
+         else if (pOutStream->write(pOutStream, pBlockBuffer + nCopyStart, nCopyEnd - nCopyStart) != (size_t)(nCopyEnd - nCopyStart)) {
+            nStatus = LZ4ULTRA_ERROR_DST;
+            break;
+         }
+      }
+
+      nOriginalSize += (long long)(nCopyEnd - nCopyStart);
+      nCompressedSize += pFrame->block_offset[nBlock + 1] - pFrame->block_offset[nBlock];
+   }
+
+   if (pBlockBuffer)
+      free(pBlockBuffer);
+
+   *pOriginalSize = nOriginalSize;
+   *pCompressedSize = nCompressedSize;
+   return nStatus;
+}
+
+/**
+ * Get decompressed size of data that ends with a seek table (see LZ4ULTRA_FLAG_SEEK_TABLE)
+ *
+ * @param pFileData compressed data
+ * @param nFileSize compressed size in bytes
+ *
+ * @return decompressed size of the frame that the seek table belongs to, or -1 if the data doesn't end with a valid seek table
+ */
+long long lz4ultra_inmem_get_seekable_size(const unsigned char *pFileData, size_t nFileSize) {
+   lz4ultra_seekable_frame_t frame;
+   long long nDecompressedSize;
+
+   if (lz4ultra_seekable_frame_open(&frame, pFileData, nFileSize) != LZ4ULTRA_OK)
+      return -1;
+
+   nDecompressedSize = frame.data_offset[frame.num_blocks];
+   lz4ultra_seekable_frame_close(&frame);
+   return nDecompressedSize;
+}
+
+/**
+ * Decompress a range of bytes out of data that ends with a seek table, decompressing only the blocks that cover the range
+ *
+ * The block checksums, if any, of the decompressed blocks are verified; the content checksum, which covers all blocks, isn't.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data, of at least nSize bytes
+ * @param nFileSize compressed size in bytes
+ * @param nOffset offset of the first decompressed byte to return
+ * @param nSize number of decompressed bytes to return
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ *
+ * @return number of decompressed bytes returned, less than nSize if the range goes past the end of the data, or -1 for error
+ */
+size_t lz4ultra_decompress_range_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, unsigned long long nOffset, size_t nSize,
+                                       const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags) {
+   lz4ultra_seekable_frame_t frame;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   lz4ultra_status_t nStatus;
+
+   if (lz4ultra_seekable_frame_open(&frame, pFileData, nFileSize) != LZ4ULTRA_OK)
+      return -1;
+
+   nStatus = lz4ultra_decompress_range_data(&frame, nOffset, nSize, pOutBuffer, NULL, pDictionaryData, nDictionaryDataSize, nFlags, &nOriginalSize, &nCompressedSize);
+   lz4ultra_seekable_frame_close(&frame);
+
+   if (nStatus != LZ4ULTRA_OK)
+      return -1;
+   return (size_t)nOriginalSize;
+}
+
+/**
+ * Decompress a range of bytes out of a file that ends with a seek table, decompressing only the blocks that cover the range
+ *
+ * The input file is mapped into memory. The block checksums, if any, of the decompressed blocks are verified; the content
+ * checksum, which covers all blocks, isn't.
+ *
+ * @param pszInFilename name of input(compressed) file
+ * @param pszOutFilename name of output(decompressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ * @param nOffset offset of the first decompressed byte to write
+ * @param nSize number of decompressed bytes to write, or -1 for all bytes up to the end
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned size of the compressed blocks that were decompressed, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t (LZ4ULTRA_ERROR_FORMAT if the file has no seek table)
+ */
+lz4ultra_status_t lz4ultra_decompress_range_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags,
+                                                 long long nOffset, long long nSize, long long *pOriginalSize, long long *pCompressedSize) {
+   lz4ultra_mapped_file_t inMappedFile;
+   lz4ultra_seekable_frame_t frame;
+   lz4ultra_stream_t outStream;
+   void *pDictionaryData = NULL;
+   int nDictionaryDataSize = 0;
+   lz4ultra_status_t nStatus;
+
+   if (nOffset < 0)
+      return LZ4ULTRA_ERROR_SRC;
+
+   if (lz4ultra_mapped_file_open(&inMappedFile, pszInFilename) != 0)
+      return LZ4ULTRA_ERROR_SRC;
+
+   nStatus = lz4ultra_seekable_frame_open(&frame, inMappedFile.pData, inMappedFile.nSize);
+   if (nStatus) {
+      lz4ultra_mapped_file_close(&inMappedFile);
+      return nStatus;
+   }
+
+   nStatus = lz4ultra_dictionary_load(pszDictionaryFilename, &pDictionaryData, &nDictionaryDataSize);
+   if (nStatus) {
+      lz4ultra_seekable_frame_close(&frame);
+      lz4ultra_mapped_file_close(&inMappedFile);
+      return nStatus;
+   }
+
+   if (lz4ultra_filestream_open(&outStream, pszOutFilename, "wb") < 0) {
+      lz4ultra_dictionary_free(&pDictionaryData);
+      lz4ultra_seekable_frame_close(&frame);
+      lz4ultra_mapped_file_close(&inMappedFile);
+      return LZ4ULTRA_ERROR_DST;
+   }
+
+   nStatus = lz4ultra_decompress_range_data(&frame, (unsigned long long)nOffset, (nSize < 0) ? (unsigned long long)-1LL : (unsigned long long)nSize, NULL, &outStream,
+                                            pDictionaryData, nDictionaryDataSize, nFlags, pOriginalSize, pCompressedSize);
+
+   outStream.close(&outStream);
+   lz4ultra_dictionary_free(&pDictionaryData);
+   lz4ultra_seekable_frame_close(&frame);
+   lz4ultra_mapped_file_close(&inMappedFile);
+
+   return nStatus;
+}
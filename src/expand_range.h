@@ -0,0 +1,87 @@
+/*
+ * expand_range.h - random access decompressor definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _EXPAND_RANGE_H
+#define _EXPAND_RANGE_H
+
+#include "lz4ultra.h"
+
+/**
+ * Get decompressed size of data that ends with a seek table (see LZ4ULTRA_FLAG_SEEK_TABLE)
+ *
+ * @param pFileData compressed data
+ * @param nFileSize compressed size in bytes
+ *
+ * @return decompressed size of the frame that the seek table belongs to, or -1 if the data doesn't end with a valid seek table
+ */
+long long lz4ultra_inmem_get_seekable_size(const unsigned char *pFileData, size_t nFileSize);
+
+/**
+ * Decompress a range of bytes out of data that ends with a seek table, decompressing only the blocks that cover the range
+ *
+ * The block checksums, if any, of the decompressed blocks are verified; the content checksum, which covers all blocks, isn't.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data, of at least nSize bytes
+ * @param nFileSize compressed size in bytes
+ * @param nOffset offset of the first decompressed byte to return
+ * @param nSize number of decompressed bytes to return
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ *
+ * @return number of decompressed bytes returned, less than nSize if the range goes past the end of the data, or -1 for error
+ */
+size_t lz4ultra_decompress_range_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, unsigned long long nOffset, size_t nSize,
+                                       const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags);
+
+/**
+ * Decompress a range of bytes out of a file that ends with a seek table, decompressing only the blocks that cover the range
+ *
+ * The input file is mapped into memory. The block checksums, if any, of the decompressed blocks are verified; the content
+ * checksum, which covers all blocks, isn't.
+ *
+ * @param pszInFilename name of input(compressed) file
+ * @param pszOutFilename name of output(decompressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ * @param nOffset offset of the first decompressed byte to write
+ * @param nSize number of decompressed bytes to write, or -1 for all bytes up to the end
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned size of the compressed blocks that were decompressed, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t (LZ4ULTRA_ERROR_FORMAT if the file has no seek table)
+ */
+lz4ultra_status_t lz4ultra_decompress_range_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags,
+                                                 long long nOffset, long long nSize, long long *pOriginalSize, long long *pCompressedSize);
+
+#endif /* _EXPAND_RANGE_H */
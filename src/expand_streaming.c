@@ -35,29 +35,116 @@
 #include "expand_streaming.h"
 #include "format.h"
 #include "frame.h"
+#include "expand_inmem.h"
+#include "expand_window.h"
 #include "lib.h"
+#include "async_stream.h"
+#include "mapped_file.h"
+#include "threadpool.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
+/** Size of the input and output buffers of the windowed stream decompressor, in bytes */
+#define WINDOW_IO_SIZE 16384
 
 /*-------------- File API -------------- */
 
+/**
+ * Decompress mapped file straight into a mapped output file, if the frame stores the decompressed size
+ *
+ * @param pInMappedFile input(compressed) file, mapped into memory
+ * @param pszOutFilename name of output(decompressed) file to generate
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ * @param nThreads number of independent blocks to decompress concurrently (1 to decompress serially)
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
+ *
+ * @return 0 for success, or -1 if the data must be decompressed as a stream instead (no content size, output can't be mapped, or decompression error)
+ */
+static int lz4ultra_decompress_mapped_file(const lz4ultra_mapped_file_t *pInMappedFile, const char *pszOutFilename, const unsigned int nFlags, int nThreads,
+                                           long long *pOriginalSize, long long *pCompressedSize) {
+   lz4ultra_mapped_file_t outMappedFile;
+   const unsigned char *pFileData = pInMappedFile->pData;
+   size_t nFileSize = pInMappedFile->nSize;
+   int nBlockMaxCode = 0;
+   unsigned int nFrameFlags = 0;
+   unsigned long long nContentSize = 0;
+   size_t nDecompressedSize;
+
+   if (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK)
+      return -1;
+
+   /* Only frames that store the decompressed size can go straight into a pre-sized output */
+   if (nFileSize < LZ4ULTRA_HEADER_SIZE)
+      return -1;
+
+   int nExtraHeaderSize = lz4ultra_check_header(pFileData, LZ4ULTRA_HEADER_SIZE);
+   if (nExtraHeaderSize < 0 || nFileSize < (size_t)(LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize))
+      return -1;
+
+   int nHeaderSize = lz4ultra_get_header_size(pFileData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+   if (nHeaderSize < 0 || nFileSize < (size_t)nHeaderSize ||
+       lz4ultra_decode_header(pFileData, nHeaderSize, &nBlockMaxCode, &nFrameFlags, &nContentSize) != LZ4ULTRA_DECODE_OK)
+      return -1;
+
+   if ((nFrameFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) == 0 || nContentSize == 0 || nContentSize > (unsigned long long)((size_t)-1))
+      return -1;
+
+   if (lz4ultra_mapped_file_create(&outMappedFile, pszOutFilename, (size_t)nContentSize) != 0)
+      return -1;
+
+   if (nThreads > 1)
+      nDecompressedSize = lz4ultra_decompress_inmem_parallel(pFileData, outMappedFile.pData, nFileSize, (size_t)nContentSize, nFlags & LZ4ULTRA_FLAG_TRUSTED_INPUT, nThreads, NULL, NULL);
+   else
+      nDecompressedSize = lz4ultra_decompress_inmem(pFileData, outMappedFile.pData, nFileSize, (size_t)nContentSize, NULL, 0, nFlags & LZ4ULTRA_FLAG_TRUSTED_INPUT);
+
+   lz4ultra_mapped_file_close(&outMappedFile);
+
+   if (nDecompressedSize != (size_t)nContentSize)
+      return -1;
+
+   *pOriginalSize = (long long)nContentSize;
+   *pCompressedSize = (long long)nFileSize;
+   return 0;
+}
+
 /**
  * Decompress file
  *
+ * Regular files holding a frame that stores the decompressed size are mapped into memory, and decompressed straight into
+ * an output file of that size, mapped as well, unless LZ4ULTRA_FLAG_LOW_MEMORY is set; everything else is decompressed as a
+ * stream. With LZ4ULTRA_FLAG_ASYNC_IO, the stream is read ahead and the output is written behind on background threads.
+ *
  * @param pszInFilename name of input(compressed) file to decompress
  * @param pszOutFilename name of output(decompressed) file to generate
  * @param pszDictionaryFilename name of dictionary file, or NULL for none
- * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, or 0)
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, LZ4ULTRA_FLAG_ASYNC_IO to overlap I/O with decompression, LZ4ULTRA_FLAG_LOW_MEMORY to decompress through a 64 Kb window, or 0)
+ * @param nThreads number of independent blocks to decompress concurrently (1 to decompress serially)
  * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
  * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
-lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags,
+lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags, int nThreads,
                                            long long *pOriginalSize, long long *pCompressedSize) {
    lz4ultra_stream_t inStream, outStream;
+   lz4ultra_mapped_file_t inMappedFile;
    void *pDictionaryData = NULL;
    int nDictionaryDataSize = 0;
+   /* Read one batch of blocks ahead, and let a whole batch be written behind */
+   int nAsyncBufferCount = 4 * ((nThreads > 1) ? nThreads : 1) + 4;
    lz4ultra_status_t nStatus;
 
+   if (!pszDictionaryFilename && (nFlags & LZ4ULTRA_FLAG_LOW_MEMORY) == 0 && lz4ultra_mapped_file_open(&inMappedFile, pszInFilename) == 0) {
+      int nResult = lz4ultra_decompress_mapped_file(&inMappedFile, pszOutFilename, nFlags, nThreads, pOriginalSize, pCompressedSize);
+
+      lz4ultra_mapped_file_close(&inMappedFile);
+      if (nResult == 0)
+         return LZ4ULTRA_OK;
+
+      /* Otherwise, decompress as a stream; on errors, this also finds out exactly what went wrong */
+   }
+
    if (lz4ultra_filestream_open(&inStream, pszInFilename, "rb") < 0) {
       return LZ4ULTRA_ERROR_SRC;
    }
@@ -75,7 +162,14 @@ lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char
       return nStatus;
    }
 
-   nStatus = lz4ultra_decompress_stream(&inStream, &outStream, pDictionaryData, nDictionaryDataSize, nFlags, pOriginalSize, pCompressedSize);
+   if (nFlags & LZ4ULTRA_FLAG_ASYNC_IO) {
+      lz4ultra_asyncstream_open(&inStream, 0, nAsyncBufferCount);
+      lz4ultra_asyncstream_open(&outStream, 1, nAsyncBufferCount);
+   }
+
+   nStatus = lz4ultra_decompress_stream(&inStream, &outStream, pDictionaryData, nDictionaryDataSize, nFlags, nThreads, pOriginalSize, pCompressedSize);
+   if (!nStatus && lz4ultra_asyncstream_flush(&outStream) != 0)
+      nStatus = LZ4ULTRA_ERROR_DST;
 
    lz4ultra_dictionary_free(&pDictionaryData);
    outStream.close(&outStream);
@@ -84,28 +178,374 @@ lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char
    return nStatus;
 }
 
+/**
+ * Verify compressed file, without writing the decompressed data anywhere
+ *
+ * @param pszInFilename name of input(compressed) file to verify
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to verify a raw block, LZ4ULTRA_FLAG_ASYNC_IO to read ahead on a background thread, LZ4ULTRA_FLAG_LOW_MEMORY to decompress everything through a 64 Kb window, or 0)
+ * @param nThreads number of blocks to verify concurrently (1 to verify serially)
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_verify_file(const char *pszInFilename, const char *pszDictionaryFilename, const unsigned int nFlags, int nThreads,
+                                       long long *pOriginalSize, long long *pCompressedSize) {
+   lz4ultra_stream_t inStream;
+   void *pDictionaryData = NULL;
+   int nDictionaryDataSize = 0;
+   lz4ultra_status_t nStatus;
+
+   if (lz4ultra_filestream_open(&inStream, pszInFilename, "rb") < 0) {
+      return LZ4ULTRA_ERROR_SRC;
+   }
+
+   nStatus = lz4ultra_dictionary_load(pszDictionaryFilename, &pDictionaryData, &nDictionaryDataSize);
+   if (nStatus) {
+      inStream.close(&inStream);
+      return nStatus;
+   }
+
+   if (nFlags & LZ4ULTRA_FLAG_ASYNC_IO)
+      lz4ultra_asyncstream_open(&inStream, 0, 4 * ((nThreads > 1) ? nThreads : 1) + 4);
+
+   nStatus = lz4ultra_decompress_stream(&inStream, NULL, pDictionaryData, nDictionaryDataSize, nFlags, nThreads, pOriginalSize, pCompressedSize);
+
+   lz4ultra_dictionary_free(&pDictionaryData);
+   inStream.close(&inStream);
+
+   return nStatus;
+}
+
 /*-------------- Streaming API -------------- */
 
+/** One block of a batch being decompressed in parallel */
+typedef struct _lz4ultra_stream_dec_job_t {
+   unsigned char *pInBlock;
+   int nBlockSize;
+   int nIsUncompressed;
+   int nHasChecksum;
+   int nChecksumError;
+   unsigned char *pOutData;
+   int nBlockMaxSize;
+   int nDecompressedSize;
+   int (*expand_block)(const unsigned char *, int, unsigned char *, int, int);
+} lz4ultra_stream_dec_job_t;
+
 /**
- * Decompress stream
+ * Check and decompress one block of a batch, after the history (dictionary, if any) in its output slot
+ *
+ * @param pTaskArg block job (lz4ultra_stream_dec_job_t); the block is only checked if it has no output slot
+ */
+static void lz4ultra_decompress_stream_block_job(void *pTaskArg) {
+   lz4ultra_stream_dec_job_t *pJob = (lz4ultra_stream_dec_job_t *)pTaskArg;
+
+   if (pJob->nHasChecksum &&
+       lz4ultra_decode_block_checksum(pJob->pInBlock + pJob->nBlockSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pJob->pInBlock, pJob->nBlockSize) != LZ4ULTRA_DECODE_OK) {
+      pJob->nChecksumError = 1;
+      pJob->nDecompressedSize = -1;
+   }
+   else if (!pJob->pOutData) {
+      /* Verifying only */
+      pJob->nDecompressedSize = 0;
+   }
+   else if (pJob->nIsUncompressed) {
+      memcpy(pJob->pOutData + HISTORY_SIZE, pJob->pInBlock, pJob->nBlockSize);
+      pJob->nDecompressedSize = pJob->nBlockSize;
+   }
+   else {
+      pJob->nDecompressedSize = pJob->expand_block(pJob->pInBlock, pJob->nBlockSize, pJob->pOutData, HISTORY_SIZE, pJob->nBlockMaxSize);
+   }
+}
+
+/**
+ * Decompress the blocks of a stream whose blocks are all independent, reading and decompressing nThreads blocks at a time
+ *
+ * @param pInStream input(compressed) stream, positioned after the stream header
+ * @param pOutStream output(decompressed) stream to write to, or NULL to only check the block checksums
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags, as decoded from the stream header
+ * @param nBlockMaxSize maximum decompressed size of a block, in bytes
+ * @param nThreads number of blocks to decompress concurrently
+ * @param expand_block block decompression function
+ * @param pContentChecksum content checksum state, updated as blocks are written if LZ4ULTRA_FLAG_CONTENT_CHECKSUM is set
+ * @param pOriginalSize pointer to output(decompressed) size, updated as blocks are written
+ * @param pCompressedSize pointer to input(compressed) size, updated as blocks are read
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_decompress_stream_blocks_parallel(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize,
+                                                                    const unsigned int nFlags, const int nBlockMaxSize, const int nThreads,
+                                                                    int (*expand_block)(const unsigned char *, int, unsigned char *, int, int),
+                                                                    XXH32_state_t *pContentChecksum, long long *pOriginalSize, long long *pCompressedSize) {
+   lz4ultra_stream_dec_job_t *pJobs;
+   unsigned char *pInBlocks;
+   unsigned char *pOutSlots;
+   lz4ultra_thread_pool_t pool;
+   unsigned char cFrameData[16];
+   int nDecompressionError = 0;
+   int nEndOfData = 0;
+   int i;
+
+   const int nInBlockSize = nBlockMaxSize + LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+
+   pJobs = (lz4ultra_stream_dec_job_t *)malloc(nThreads * sizeof(lz4ultra_stream_dec_job_t));
+   pInBlocks = (unsigned char *)malloc((size_t)nThreads * nInBlockSize);
+   pOutSlots = pOutStream ? (unsigned char *)malloc((size_t)nThreads * (HISTORY_SIZE + nBlockMaxSize)) : NULL;
+   if (!pJobs || !pInBlocks || (pOutStream && !pOutSlots) || lz4ultra_thread_pool_init(&pool, nThreads) != 0) {
+      if (pOutSlots) free(pOutSlots);
+      if (pInBlocks) free(pInBlocks);
+      if (pJobs) free(pJobs);
+      return LZ4ULTRA_ERROR_MEMORY;
+   }
+
+   for (i = 0; i < nThreads; i++) {
+      pJobs[i].pInBlock = pInBlocks + (size_t)i * nInBlockSize;
+      pJobs[i].pOutData = pOutSlots ? (pOutSlots + (size_t)i * (HISTORY_SIZE + nBlockMaxSize)) : NULL;
+      pJobs[i].nBlockMaxSize = nBlockMaxSize;
+      pJobs[i].nHasChecksum = (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? 1 : 0;
+      pJobs[i].expand_block = expand_block;
+
+      /* Every block sees the dictionary, and only the dictionary, as its history */
+      if (pOutSlots && nDictionaryDataSize != 0)
+         memcpy(pJobs[i].pOutData + HISTORY_SIZE - nDictionaryDataSize, pDictionaryData, nDictionaryDataSize);
+   }
+
+   while (!nEndOfData && !nDecompressionError) {
+      int nNumJobs = 0;
+
+      /* Read the next batch of blocks */
+      while (nNumJobs < nThreads && !pInStream->eof(pInStream)) {
+         lz4ultra_stream_dec_job_t *pJob = &pJobs[nNumJobs];
+         unsigned int nBlockSize = 0;
+         int nIsUncompressed = 0;
+
+         memset(cFrameData, 0, 16);
+         if (pInStream->read(pInStream, cFrameData, LZ4ULTRA_FRAME_SIZE) == LZ4ULTRA_FRAME_SIZE) {
+            if (lz4ultra_decode_frame(cFrameData, LZ4ULTRA_FRAME_SIZE, nFlags, &nBlockSize, &nIsUncompressed) < 0)
+               nBlockSize = 0;
+
+            *pCompressedSize += (long long)LZ4ULTRA_FRAME_SIZE;
+         }
+
+         if (nBlockSize == 0) {
+            nEndOfData = 1;
+            break;
+         }
+         if ((int)nBlockSize > nBlockMaxSize) {
+            nDecompressionError = LZ4ULTRA_ERROR_FORMAT;
+            break;
+         }
+         if (pJob->nHasChecksum)
+            nBlockSize += LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+         if (pInStream->read(pInStream, pJob->pInBlock, nBlockSize) != nBlockSize) {
+            nEndOfData = 1;
+            break;
+         }
+         *pCompressedSize += (long long)nBlockSize;
+         if (pJob->nHasChecksum)
+            nBlockSize -= LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+
+         pJob->nBlockSize = (int)nBlockSize;
+         pJob->nIsUncompressed = nIsUncompressed;
+         pJob->nChecksumError = 0;
+         pJob->nDecompressedSize = -1;
+         nNumJobs++;
+      }
+
+      if (nNumJobs == 0)
+         break;
+
+      /* Decompress the batch */
+      for (i = 0; i < nNumJobs; i++) {
+         if (lz4ultra_thread_pool_submit(&pool, lz4ultra_decompress_stream_block_job, &pJobs[i]) != 0)
+            lz4ultra_decompress_stream_block_job(&pJobs[i]);
+      }
+      lz4ultra_thread_pool_wait(&pool);
+
+      /* Write it out in order */
+      for (i = 0; i < nNumJobs; i++) {
+         lz4ultra_stream_dec_job_t *pJob = &pJobs[i];
+
+         if (pJob->nChecksumError) {
+            nDecompressionError = LZ4ULTRA_ERROR_CHECKSUM;
+            break;
+         }
+         if (pJob->nDecompressedSize < 0) {
+            nDecompressionError = LZ4ULTRA_ERROR_DECOMPRESSION;
+            break;
+         }
+
+         if (pJob->nDecompressedSize != 0) {
+            *pOriginalSize += (long long)pJob->nDecompressedSize;
+            if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+               XXH32_update(pContentChecksum, pJob->pOutData + HISTORY_SIZE, pJob->nDecompressedSize);
+
+            if (pOutStream->write(pOutStream, pJob->pOutData + HISTORY_SIZE, pJob->nDecompressedSize) != pJob->nDecompressedSize) {
+               nDecompressionError = LZ4ULTRA_ERROR_DST;
+               break;
+            }
+         }
+      }
+   }
+
+   lz4ultra_thread_pool_destroy(&pool);
+   if (pOutSlots)
+      free(pOutSlots);
+   free(pInBlocks);
+   free(pJobs);
+
+   return nDecompressionError;
+}
+
+/**
+ * Discard decompressed data, when verifying a stream without block checksums
+ *
+ * @param stream stream
+ * @param ptr buffer to write from
+ * @param size number of bytes to write
+ *
+ * @return number of bytes written
+ */
+static size_t lz4ultra_discard_stream_write(lz4ultra_stream_t *stream, void *ptr, size_t size) {
+   return size;
+}
+
+/**
+ * Check the decompressed data against the content size and checksum stored in the frame, if any
+ *
+ * @param pInStream input(compressed) stream, positioned right after the EOD frame
+ * @param nFlags compression flags, as decoded from the stream header
+ * @param nContentSize content size, as decoded from the stream header
+ * @param nOriginalSize actual decompressed size
+ * @param nContentChecksum XXH32 checksum of the decompressed data
+ * @param pCompressedSize pointer to input(compressed) size, updated with the bytes read
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_decompress_stream_check_content(lz4ultra_stream_t *pInStream, const unsigned int nFlags, const unsigned long long nContentSize,
+                                                                  const long long nOriginalSize, const unsigned int nContentChecksum, long long *pCompressedSize) {
+   unsigned char cChecksumData[LZ4ULTRA_CONTENT_CHECKSUM_SIZE];
+
+   if ((nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) && nContentSize != (unsigned long long)nOriginalSize)
+      return LZ4ULTRA_ERROR_FORMAT;
+
+   if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) {
+      if (pInStream->read(pInStream, cChecksumData, LZ4ULTRA_CONTENT_CHECKSUM_SIZE) != LZ4ULTRA_CONTENT_CHECKSUM_SIZE)
+         return LZ4ULTRA_ERROR_SRC;
+      *pCompressedSize += (long long)LZ4ULTRA_CONTENT_CHECKSUM_SIZE;
+
+      if (lz4ultra_decode_content_checksum(cChecksumData, LZ4ULTRA_CONTENT_CHECKSUM_SIZE, nContentChecksum) != LZ4ULTRA_DECODE_OK)
+         return LZ4ULTRA_ERROR_CHECKSUM;
+   }
+
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Decompress stream through a 64 Kb window, reading and writing it in small chunks
  *
  * @param pInStream input(compressed) stream to decompress
  * @param pOutStream output(decompressed) stream to write to
  * @param pDictionaryData dictionary contents, or NULL for none
  * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags
  * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
  * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
-lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags,
+static lz4ultra_status_t lz4ultra_decompress_stream_windowed(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize,
+                                                             const unsigned int nFlags, long long *pOriginalSize, long long *pCompressedSize) {
+   lz4ultra_window_decompressor_t ctx;
+   unsigned char *pBuffers;
+   size_t nInDataOffset = 0, nInDataSize = 0;
+   lz4ultra_status_t nStatus;
+
+   pBuffers = (unsigned char*)malloc(2 * WINDOW_IO_SIZE);
+   if (!pBuffers)
+      return LZ4ULTRA_ERROR_MEMORY;
+
+   lz4ultra_window_decompressor_init(&ctx);
+   nStatus = lz4ultra_window_decompress_begin(&ctx, pDictionaryData, nDictionaryDataSize, nFlags);
+
+   while (!nStatus && !lz4ultra_window_decompress_done(&ctx)) {
+      size_t nInConsumed = 0, nOutProduced = 0;
+
+      if (nInDataOffset == nInDataSize) {
+         if (pInStream->eof(pInStream))
+            break;
+         nInDataSize = pInStream->read(pInStream, pBuffers, WINDOW_IO_SIZE);
+         nInDataOffset = 0;
+         if (nInDataSize == 0)
+            break;
+      }
+
+      nStatus = lz4ultra_window_decompress_update(&ctx, pBuffers + nInDataOffset, nInDataSize - nInDataOffset, &nInConsumed,
+                                                  pBuffers + WINDOW_IO_SIZE, WINDOW_IO_SIZE, &nOutProduced);
+      nInDataOffset += nInConsumed;
+
+      if (nOutProduced && pOutStream->write(pOutStream, pBuffers + WINDOW_IO_SIZE, nOutProduced) != nOutProduced)
+         nStatus = LZ4ULTRA_ERROR_DST;
+   }
+
+   if (!nStatus)
+      nStatus = lz4ultra_window_decompress_end(&ctx, pOriginalSize, pCompressedSize);
+
+   lz4ultra_window_decompressor_destroy(&ctx);
+   free(pBuffers);
+
+   return nStatus;
+}
+
+/**
+ * Decompress stream
+ *
+ * @param pInStream input(compressed) stream to decompress
+ * @param pOutStream output(decompressed) stream to write to, or NULL to only verify the input stream (see lz4ultra_verify_file())
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, LZ4ULTRA_FLAG_LOW_MEMORY to decompress through a 64 Kb window, or 0)
+ * @param nThreads number of independent blocks to decompress concurrently (1 to decompress serially)
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, int nThreads,
                                              long long *pOriginalSize, long long *pCompressedSize) {
    long long nOriginalSize = 0LL;
    long long nCompressedSize = 0LL;
    int nBlockMaxCode = 7;
+   unsigned long long nContentSize = 0;
+   XXH32_state_t contentChecksum;
+   lz4ultra_stream_t discardStream;
    unsigned char cFrameData[16];
    unsigned char *pInBlock;
    unsigned char *pOutData;
+   int (*expand_block)(const unsigned char *, int, unsigned char *, int, int);
+
+   if ((nFlags & LZ4ULTRA_FLAG_LOW_MEMORY) && (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0) {
+      /* Decode blocks as they are read, without holding any of them whole */
+      if (!pOutStream) {
+         discardStream.obj = NULL;
+         discardStream.read = NULL;
+         discardStream.write = lz4ultra_discard_stream_write;
+         discardStream.eof = NULL;
+         discardStream.close = NULL;
+         pOutStream = &discardStream;
+      }
+
+      return lz4ultra_decompress_stream_windowed(pInStream, pOutStream, pDictionaryData, nDictionaryDataSize, nFlags, pOriginalSize, pCompressedSize);
+   }
+
+   /* Pick the decoder before the frame header replaces the flags */
+   if (nFlags & LZ4ULTRA_FLAG_TRUSTED_INPUT)
+      expand_block = lz4ultra_decompressor_expand_block_unchecked;
+   else
+      expand_block = lz4ultra_decompressor_expand_block;
 
    if ((nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0) {
       memset(cFrameData, 0, 16);
@@ -122,7 +562,16 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
          return LZ4ULTRA_ERROR_SRC;
       }
 
-      int nSuccess = lz4ultra_decode_header(cFrameData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize, &nBlockMaxCode, &nFlags);
+      int nHeaderSize = lz4ultra_get_header_size(cFrameData, LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+      if (nHeaderSize < 0)
+         return LZ4ULTRA_ERROR_FORMAT;
+
+      nExtraHeaderSize = nHeaderSize - (LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+      if (pInStream->read(pInStream, cFrameData + nHeaderSize - nExtraHeaderSize, nExtraHeaderSize) != nExtraHeaderSize) {
+         return LZ4ULTRA_ERROR_SRC;
+      }
+
+      int nSuccess = lz4ultra_decode_header(cFrameData, nHeaderSize, &nBlockMaxCode, &nFlags, &nContentSize);
       if (nSuccess < 0) {
          if (nSuccess == LZ4ULTRA_DECODE_ERR_SUM)
             return LZ4ULTRA_ERROR_CHECKSUM;
@@ -130,9 +579,11 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
             return LZ4ULTRA_ERROR_FORMAT;
       }
 
-      nCompressedSize += (long long)(LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize);
+      nCompressedSize += (long long)nHeaderSize;
    }
 
+   XXH32_reset(&contentChecksum, 0);
+
    int nBlockMaxBits;
    if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
       nBlockMaxBits = 23;
@@ -140,7 +591,49 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
       nBlockMaxBits = 8 + (nBlockMaxCode << 1);
    int nBlockMaxSize = 1 << nBlockMaxBits;
 
-   pInBlock = (unsigned char*)malloc(nBlockMaxSize);
+   if (!pOutStream) {
+      if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) {
+         /* Check every block against its checksum, without decompressing anything */
+         unsigned char cChecksumData[LZ4ULTRA_CONTENT_CHECKSUM_SIZE];
+
+         int nVerifyError = lz4ultra_decompress_stream_blocks_parallel(pInStream, NULL, NULL, 0, nFlags, nBlockMaxSize, (nThreads > 1) ? nThreads : 1, expand_block,
+                                                                       &contentChecksum, &nOriginalSize, &nCompressedSize);
+         if (!nVerifyError && (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)) {
+            /* The content checksum can only be checked against decompressed data; skip it */
+            if (pInStream->read(pInStream, cChecksumData, LZ4ULTRA_CONTENT_CHECKSUM_SIZE) != LZ4ULTRA_CONTENT_CHECKSUM_SIZE)
+               nVerifyError = LZ4ULTRA_ERROR_SRC;
+            nCompressedSize += (long long)LZ4ULTRA_CONTENT_CHECKSUM_SIZE;
+         }
+
+         *pOriginalSize = (nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) ? (long long)nContentSize : 0LL;
+         *pCompressedSize = nCompressedSize;
+         return nVerifyError;
+      }
+      else {
+         /* No block checksums: decompress everything, to check it, and throw it away */
+         discardStream.obj = NULL;
+         discardStream.read = NULL;
+         discardStream.write = lz4ultra_discard_stream_write;
+         discardStream.eof = NULL;
+         discardStream.close = NULL;
+         pOutStream = &discardStream;
+      }
+   }
+
+   if (nThreads > 1 && (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0 &&
+       ((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) || ((nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) && nDictionaryDataSize == 0))) {
+      /* Independent blocks: decompress them in batches */
+      int nDecompressionError = lz4ultra_decompress_stream_blocks_parallel(pInStream, pOutStream, pDictionaryData, nDictionaryDataSize, nFlags, nBlockMaxSize, nThreads, expand_block,
+                                                                           &contentChecksum, &nOriginalSize, &nCompressedSize);
+      if (!nDecompressionError)
+         nDecompressionError = lz4ultra_decompress_stream_check_content(pInStream, nFlags, nContentSize, nOriginalSize, XXH32_digest(&contentChecksum), &nCompressedSize);
+
+      *pOriginalSize = nOriginalSize;
+      *pCompressedSize = nCompressedSize;
+      return nDecompressionError;
+   }
+
+   pInBlock = (unsigned char*)malloc(nBlockMaxSize + LZ4ULTRA_BLOCK_CHECKSUM_SIZE);
    if (!pInBlock) {
       return LZ4ULTRA_ERROR_MEMORY;
    }
@@ -155,6 +648,7 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
 
    int nDecompressionError = 0;
    int nPrevDecompressedSize = 0;
+   int nPrevBlockEnd = 0;
    int nNumBlocks = 0;
 
    while (!pInStream->eof(pInStream) && !nDecompressionError) {
@@ -162,7 +656,8 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
       int nIsUncompressed = 0;
 
       if (nPrevDecompressedSize != 0) {
-         memcpy(pOutData + HISTORY_SIZE - nPrevDecompressedSize, pOutData + HISTORY_SIZE + (nBlockMaxSize - nPrevDecompressedSize), nPrevDecompressedSize);
+         /* Blocks may end before the maximum block size; keep the end of the previous one, wherever it is */
+         memcpy(pOutData + HISTORY_SIZE - nPrevDecompressedSize, pOutData + HISTORY_SIZE + (nPrevBlockEnd - nPrevDecompressedSize), nPrevDecompressedSize);
       }
       else if (nDictionaryDataSize != 0) {
          memcpy(pOutData + HISTORY_SIZE - nDictionaryDataSize, pDictionaryData, nDictionaryDataSize);
@@ -211,12 +706,26 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
          if (nReadBytes == nBlockSize) {
             nCompressedSize += (long long)nReadBytes;
 
+            if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) {
+               /* Check block before decompressing it */
+               if (pInStream->read(pInStream, pInBlock + nBlockSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE) != LZ4ULTRA_BLOCK_CHECKSUM_SIZE) {
+                  nDecompressionError = LZ4ULTRA_ERROR_SRC;
+                  break;
+               }
+               nCompressedSize += (long long)LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+
+               if (lz4ultra_decode_block_checksum(pInBlock + nBlockSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pInBlock, nBlockSize) != LZ4ULTRA_DECODE_OK) {
+                  nDecompressionError = LZ4ULTRA_ERROR_CHECKSUM;
+                  break;
+               }
+            }
+
             if (nIsUncompressed) {
                memcpy(pOutData + HISTORY_SIZE, pInBlock, nBlockSize);
                nDecompressedSize = nBlockSize;
             }
             else {
-               nDecompressedSize = lz4ultra_decompressor_expand_block(pInBlock, nBlockSize, pOutData, HISTORY_SIZE, nBlockMaxSize);
+               nDecompressedSize = expand_block(pInBlock, nBlockSize, pOutData, HISTORY_SIZE, nBlockMaxSize);
                if (nDecompressedSize < 0) {
                   nDecompressionError = LZ4ULTRA_ERROR_DECOMPRESSION;
                   break;
@@ -225,6 +734,8 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
 
             if (nDecompressedSize != 0) {
                nOriginalSize += (long long)nDecompressedSize;
+               if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+                  XXH32_update(&contentChecksum, pOutData + HISTORY_SIZE, nDecompressedSize);
 
                if (pOutStream->write(pOutStream, pOutData + HISTORY_SIZE, nDecompressedSize) != nDecompressedSize)
                   nDecompressionError = LZ4ULTRA_ERROR_DST;
@@ -233,6 +744,7 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
                   nPrevDecompressedSize = nDecompressedSize;
                   if (nPrevDecompressedSize > HISTORY_SIZE)
                      nPrevDecompressedSize = HISTORY_SIZE;
+                  nPrevBlockEnd = nDecompressedSize;
                }
                else {
                   nPrevDecompressedSize = 0;
@@ -257,6 +769,9 @@ lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ul
    free(pInBlock);
    pInBlock = NULL;
 
+   if (!nDecompressionError && (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0)
+      nDecompressionError = lz4ultra_decompress_stream_check_content(pInStream, nFlags, nContentSize, nOriginalSize, XXH32_digest(&contentChecksum), &nCompressedSize);
+
    *pOriginalSize = nOriginalSize;
    *pCompressedSize = nCompressedSize;
    return nDecompressionError;
@@ -35,9 +35,6 @@
 
 #include "stream.h"
 
-/* Forward declaration */
-typedef enum _lz4ultra_status_t lz4ultra_status_t;
-
 /*-------------- File API -------------- */
 
 /**
@@ -46,13 +43,33 @@ typedef enum _lz4ultra_status_t lz4ultra_status_t;
  * @param pszInFilename name of input(compressed) file to decompress
  * @param pszOutFilename name of output(decompressed) file to generate
  * @param pszDictionaryFilename name of dictionary file, or NULL for none
- * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, or 0)
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, LZ4ULTRA_FLAG_ASYNC_IO to overlap I/O with decompression, LZ4ULTRA_FLAG_LOW_MEMORY to decompress through a 64 Kb window, or 0)
+ * @param nThreads number of independent blocks to decompress concurrently (1 to decompress serially)
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags, int nThreads,
+   long long *pOriginalSize, long long *pCompressedSize);
+
+/**
+ * Verify compressed file, without writing the decompressed data anywhere
+ *
+ * Frames with block checksums are verified by checking every block against its checksum, without decompressing it;
+ * other frames are decompressed and the output is thrown away.
+ *
+ * @param pszInFilename name of input(compressed) file to verify
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to verify a raw block, LZ4ULTRA_FLAG_ASYNC_IO to read ahead on a background thread, LZ4ULTRA_FLAG_LOW_MEMORY to decompress everything through a 64 Kb window, or 0)
+ * @param nThreads number of blocks to verify concurrently (1 to verify serially)
  * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ *        (when only checking block checksums, this is the size stored in the frame header, or 0 if there is none)
  * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
-lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags,
+lz4ultra_status_t lz4ultra_verify_file(const char *pszInFilename, const char *pszDictionaryFilename, const unsigned int nFlags, int nThreads,
    long long *pOriginalSize, long long *pCompressedSize);
 
 /*-------------- Streaming API -------------- */
@@ -61,16 +78,17 @@ lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char
  * Decompress stream
  *
  * @param pInStream input(compressed) stream to decompress
- * @param pOutStream output(decompressed) stream to write to
+ * @param pOutStream output(decompressed) stream to write to, or NULL to only verify the input stream (see lz4ultra_verify_file())
  * @param pDictionaryData dictionary contents, or NULL for none
  * @param nDictionaryDataSize size of dictionary contents, or 0
- * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, or 0)
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, LZ4ULTRA_FLAG_LOW_MEMORY to decompress through a 64 Kb window, or 0)
+ * @param nThreads number of independent blocks to decompress concurrently (1 to decompress serially)
  * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
  * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
-lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags,
+lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, int nThreads,
    long long *pOriginalSize, long long *pCompressedSize);
 
 #endif /* _EXPAND_STREAMING_H */
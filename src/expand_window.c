@@ -0,0 +1,675 @@
+/*
+ * expand_window.c - windowed streaming decompression implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "expand_window.h"
+#include "format.h"
+#include "frame.h"
+#include "lib.h"
+
+/* Decompression stages */
+#define STAGE_HEADER           0
+#define STAGE_BLOCK_FRAME      1
+#define STAGE_BLOCK_DATA       2
+#define STAGE_BLOCK_CHECKSUM   3
+#define STAGE_CONTENT_CHECKSUM 4
+#define STAGE_DONE             5
+
+/* Sequence decoding stages, within a block */
+#define SEQ_TOKEN              0
+#define SEQ_LITERALS_LEN       1
+#define SEQ_LITERALS           2
+#define SEQ_OFFSET_LO          3
+#define SEQ_OFFSET_HI          4
+#define SEQ_MATCH_LEN          5
+#define SEQ_MATCH              6
+#define SEQ_STORED             7
+#define SEQ_END                8
+
+#define WINDOW_MASK            (HISTORY_SIZE - 1)
+
+/**
+ * Initialize windowed decompression context, without allocating anything yet
+ *
+ * @param pCtx context to initialize
+ */
+void lz4ultra_window_decompressor_init(lz4ultra_window_decompressor_t *pCtx) {
+   memset(pCtx, 0, sizeof(lz4ultra_window_decompressor_t));
+   pCtx->nError = LZ4ULTRA_ERROR_DECOMPRESSION;
+}
+
+/**
+ * Free windowed decompression context window
+ *
+ * @param pCtx context
+ */
+void lz4ultra_window_decompressor_destroy(lz4ultra_window_decompressor_t *pCtx) {
+   if (pCtx->pWindow) {
+      free(pCtx->pWindow);
+      pCtx->pWindow = NULL;
+   }
+}
+
+/**
+ * Create windowed decompression context, without allocating the window yet
+ *
+ * @return context, to be freed with lz4ultra_window_decompressor_free(), or NULL for failure
+ */
+lz4ultra_window_decompressor_t *lz4ultra_window_decompressor_create(void) {
+   lz4ultra_window_decompressor_t *pCtx = (lz4ultra_window_decompressor_t *)malloc(sizeof(lz4ultra_window_decompressor_t));
+
+   if (pCtx)
+      lz4ultra_window_decompressor_init(pCtx);
+   return pCtx;
+}
+
+/**
+ * Free windowed decompression context and its window
+ *
+ * @param pCtx context, or NULL
+ */
+void lz4ultra_window_decompressor_free(lz4ultra_window_decompressor_t *pCtx) {
+   if (pCtx) {
+      lz4ultra_window_decompressor_destroy(pCtx);
+      free(pCtx);
+   }
+}
+
+/**
+ * Gather bytes that may straddle input spans
+ *
+ * @param pDst buffer to gather bytes into
+ * @param pGatheredSize pointer to number of bytes gathered so far, updated
+ * @param nNeededSize total number of bytes to gather
+ * @param pInData input span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to number of input bytes consumed so far, updated
+ *
+ * @return nonzero if all the bytes are gathered, 0 if more input is needed
+ */
+static int lz4ultra_window_gather(unsigned char *pDst, int *pGatheredSize, const int nNeededSize, const unsigned char *pInData, const size_t nInDataSize, size_t *pInConsumed) {
+   size_t nCopySize = (size_t)(nNeededSize - *pGatheredSize);
+
+   if (nCopySize > (nInDataSize - *pInConsumed))
+      nCopySize = nInDataSize - *pInConsumed;
+   if (nCopySize) {
+      memcpy(pDst + *pGatheredSize, pInData + *pInConsumed, nCopySize);
+      *pGatheredSize += (int)nCopySize;
+      *pInConsumed += nCopySize;
+   }
+
+   return (*pGatheredSize == nNeededSize) ? 1 : 0;
+}
+
+/**
+ * Append bytes to the window, wrapping around its end
+ *
+ * @param pCtx context
+ * @param pSrc bytes to append
+ * @param nLength number of bytes to append (HISTORY_SIZE at most)
+ */
+static void lz4ultra_window_put(lz4ultra_window_decompressor_t *pCtx, const unsigned char *pSrc, unsigned int nLength) {
+   unsigned int nPos = pCtx->nWindowPos;
+
+   while (nLength) {
+      unsigned int nChunk = HISTORY_SIZE - nPos;
+
+      if (nChunk > nLength)
+         nChunk = nLength;
+      memcpy(pCtx->pWindow + nPos, pSrc, nChunk);
+      pSrc += nChunk;
+      nLength -= nChunk;
+      nPos = (nPos + nChunk) & WINDOW_MASK;
+   }
+
+   pCtx->nWindowPos = nPos;
+}
+
+/**
+ * Copy a match from the window to the end of the window, wrapping around its end
+ *
+ * @param pCtx context
+ * @param nOffset match offset (1..HISTORY_SIZE-1)
+ * @param nLength number of bytes to copy (HISTORY_SIZE at most)
+ */
+static void lz4ultra_window_copy_match(lz4ultra_window_decompressor_t *pCtx, const unsigned int nOffset, unsigned int nLength) {
+   unsigned char *pWindow = pCtx->pWindow;
+   unsigned int nPos = pCtx->nWindowPos;
+
+   while (nLength) {
+      unsigned int nSrcPos = (nPos - nOffset) & WINDOW_MASK;
+      unsigned int nChunk = nLength;
+
+      if (nChunk > (HISTORY_SIZE - nPos))
+         nChunk = HISTORY_SIZE - nPos;
+      if (nChunk > (HISTORY_SIZE - nSrcPos))
+         nChunk = HISTORY_SIZE - nSrcPos;
+
+      if (nSrcPos < nPos) {
+         /* The source is nOffset bytes behind: copy spans that don't overlap, doubling as the pattern repeats */
+         const unsigned char *pSrc = pWindow + nSrcPos;
+         unsigned char *pDst = pWindow + nPos;
+         unsigned int nLeft = nChunk;
+
+         while (nLeft) {
+            unsigned int nSpan = (unsigned int)(pDst - pSrc);
+
+            if (nSpan > nLeft)
+               nSpan = nLeft;
+            memcpy(pDst, pSrc, nSpan);
+            pDst += nSpan;
+            nLeft -= nSpan;
+         }
+      }
+      else {
+         /* The source wrapped around to the end of the window, ahead of the destination; it can't catch up with it within the chunk */
+         memmove(pWindow + nPos, pWindow + nSrcPos, nChunk);
+      }
+
+      nLength -= nChunk;
+      nPos = (nPos + nChunk) & WINDOW_MASK;
+   }
+
+   pCtx->nWindowPos = nPos;
+}
+
+/**
+ * Reset the history that the next block refers to: the dictionary, if any, or nothing
+ *
+ * @param pCtx context
+ */
+static void lz4ultra_window_start_history(lz4ultra_window_decompressor_t *pCtx) {
+   if (pCtx->nDictionaryDataSize) {
+      lz4ultra_window_put(pCtx, pCtx->pDictionaryData, (unsigned int)pCtx->nDictionaryDataSize);
+      pCtx->nHistorySize = (unsigned int)pCtx->nDictionaryDataSize;
+   }
+   else {
+      pCtx->nHistorySize = 0;
+   }
+}
+
+/**
+ * Decode the sequences of the current block from an input span, into the window
+ *
+ * @param pCtx context
+ * @param pInData input span, positioned in the block
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param nOutRoom maximum number of bytes to decompress (HISTORY_SIZE at most, so that they can all be handed out from the window)
+ * @param pOutProduced pointer to returned number of bytes decompressed to the window
+ *
+ * @return LZ4ULTRA_OK for success, or LZ4ULTRA_ERROR_FORMAT for invalid block data
+ */
+static lz4ultra_status_t lz4ultra_window_decompress_sequences(lz4ultra_window_decompressor_t *pCtx, const unsigned char *pInData, const size_t nInDataSize, size_t *pInConsumed,
+                                                              const unsigned int nOutRoom, unsigned int *pOutProduced) {
+   const unsigned char *pCurInData = pInData;
+   const unsigned char *pInDataEnd;
+   unsigned int nInLeft = pCtx->nBlockInputLeft;
+   unsigned int nOutLeft = pCtx->nBlockOutputLeft;
+   unsigned int nProduced = 0;
+   int nStage = pCtx->nSequenceStage;
+   lz4ultra_status_t nError = LZ4ULTRA_OK;
+
+   pInDataEnd = pInData + ((nInDataSize < (size_t)nInLeft) ? nInDataSize : (size_t)nInLeft);
+
+   while (!nError && nStage != SEQ_END) {
+      if (nStage == SEQ_LITERALS || nStage == SEQ_STORED) {
+         /* Copy as many literals as there are, and as there is room for */
+         unsigned int nLength = pCtx->nLength;
+
+         if ((size_t)nLength > (size_t)(pInDataEnd - pCurInData))
+            nLength = (unsigned int)(pInDataEnd - pCurInData);
+         if (nLength > (nOutRoom - nProduced))
+            nLength = nOutRoom - nProduced;
+
+         lz4ultra_window_put(pCtx, pCurInData, nLength);
+         pCurInData += nLength;
+         nInLeft -= nLength;
+         nOutLeft -= nLength;
+         nProduced += nLength;
+         pCtx->nLength -= nLength;
+         pCtx->nHistorySize += nLength;
+
+         if (pCtx->nLength) {
+            /* More input or room is needed */
+            break;
+         }
+
+         if (nInLeft == 0 || nStage == SEQ_STORED)
+            nStage = SEQ_END;
+         else
+            nStage = SEQ_OFFSET_LO;
+      }
+      else if (nStage == SEQ_MATCH) {
+         unsigned int nLength = pCtx->nLength;
+
+         if (nLength > (nOutRoom - nProduced))
+            nLength = nOutRoom - nProduced;
+
+         lz4ultra_window_copy_match(pCtx, pCtx->nMatchOffset, nLength);
+         nOutLeft -= nLength;
+         nProduced += nLength;
+         pCtx->nLength -= nLength;
+         pCtx->nHistorySize += nLength;
+
+         if (pCtx->nLength) {
+            /* More room is needed */
+            break;
+         }
+
+         nStage = SEQ_TOKEN;
+      }
+      else {
+         unsigned int nByte;
+
+         /* Every other stage reads one byte */
+         if (nInLeft == 0) {
+            /* A block may end after a match, but not in the middle of a sequence */
+            if (nStage == SEQ_TOKEN)
+               nStage = SEQ_END;
+            else
+               nError = LZ4ULTRA_ERROR_FORMAT;
+            break;
+         }
+         if (pCurInData == pInDataEnd)
+            break;
+
+         nByte = (unsigned int)*pCurInData++;
+         nInLeft--;
+
+         switch (nStage) {
+         case SEQ_TOKEN:
+            pCtx->nToken = nByte;
+            pCtx->nLength = nByte >> 4;
+            nStage = (pCtx->nLength == LITERALS_RUN_LEN) ? SEQ_LITERALS_LEN : SEQ_LITERALS;
+            break;
+
+         case SEQ_LITERALS_LEN:
+            pCtx->nLength += nByte;
+            if (nByte != 255)
+               nStage = SEQ_LITERALS;
+            break;
+
+         case SEQ_OFFSET_LO:
+            pCtx->nMatchOffset = nByte;
+            nStage = SEQ_OFFSET_HI;
+            break;
+
+         case SEQ_OFFSET_HI:
+            pCtx->nMatchOffset |= nByte << 8;
+            if (pCtx->nMatchOffset < MIN_OFFSET || pCtx->nMatchOffset > pCtx->nHistorySize) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            pCtx->nLength = (pCtx->nToken & 0x0f) + MIN_MATCH_SIZE;
+            nStage = ((pCtx->nToken & 0x0f) == MATCH_RUN_LEN) ? SEQ_MATCH_LEN : SEQ_MATCH;
+            break;
+
+         case SEQ_MATCH_LEN:
+            pCtx->nLength += nByte;
+            if (nByte != 255)
+               nStage = SEQ_MATCH;
+            break;
+
+         default:
+            nError = LZ4ULTRA_ERROR_FORMAT;
+            break;
+         }
+
+         /* Runs must fit in the rest of the block; checking as they grow also keeps the lengths from overflowing */
+         if (!nError) {
+            if ((nStage == SEQ_LITERALS || nStage == SEQ_LITERALS_LEN) && (pCtx->nLength > nInLeft || pCtx->nLength > nOutLeft))
+               nError = LZ4ULTRA_ERROR_FORMAT;
+            else if ((nStage == SEQ_MATCH || nStage == SEQ_MATCH_LEN) && pCtx->nLength > nOutLeft)
+               nError = LZ4ULTRA_ERROR_FORMAT;
+         }
+      }
+   }
+
+   if (pCtx->nHistorySize > HISTORY_SIZE)
+      pCtx->nHistorySize = HISTORY_SIZE;
+
+   pCtx->nSequenceStage = nStage;
+   pCtx->nBlockInputLeft = nInLeft;
+   pCtx->nBlockOutputLeft = nOutLeft;
+   *pInConsumed = (size_t)(pCurInData - pInData);
+   *pOutProduced = nProduced;
+   return nError;
+}
+
+/**
+ * Start decompressing a new frame
+ *
+ * The window is allocated the first time a frame is started with the context, and is reused for the frames that follow.
+ *
+ * @param pCtx context
+ * @param pDictionaryData dictionary contents, that must stay valid until the frame is decompressed, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (0; raw blocks aren't supported, and the input is always checked, so that LZ4ULTRA_FLAG_TRUSTED_INPUT makes no difference)
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_window_decompress_begin(lz4ultra_window_decompressor_t *pCtx, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags) {
+   if (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) {
+      pCtx->nError = LZ4ULTRA_ERROR_FORMAT;
+      return LZ4ULTRA_ERROR_FORMAT;
+   }
+
+   if (!pCtx->pWindow) {
+      pCtx->pWindow = (unsigned char*)malloc(HISTORY_SIZE);
+      if (!pCtx->pWindow) {
+         pCtx->nError = LZ4ULTRA_ERROR_MEMORY;
+         return LZ4ULTRA_ERROR_MEMORY;
+      }
+   }
+
+   /* Only the last 64 Kb of the dictionary can be referred to */
+   if (nDictionaryDataSize > HISTORY_SIZE) {
+      pDictionaryData = (const unsigned char*)pDictionaryData + (nDictionaryDataSize - HISTORY_SIZE);
+      nDictionaryDataSize = HISTORY_SIZE;
+   }
+   pCtx->pDictionaryData = (const unsigned char*)pDictionaryData;
+   pCtx->nDictionaryDataSize = pDictionaryData ? nDictionaryDataSize : 0;
+
+   pCtx->nFlags = nFlags;
+   pCtx->nStage = STAGE_HEADER;
+   pCtx->nError = LZ4ULTRA_OK;
+   pCtx->nFrameDataSize = 0;
+   pCtx->nFrameDataNeeded = LZ4ULTRA_HEADER_SIZE;
+   pCtx->nBlockMaxSize = 0;
+   pCtx->nWindowPos = 0;
+   pCtx->nHistorySize = 0;
+   pCtx->nContentSize = 0;
+   pCtx->nOriginalSize = 0;
+   pCtx->nCompressedSize = 0;
+   XXH32_reset(&pCtx->contentChecksum, 0);
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Decode frame header once it is gathered
+ *
+ * @param pCtx context
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_window_decompress_frame_header(lz4ultra_window_decompressor_t *pCtx) {
+   int nBlockMaxCode = 7;
+   int nBlockMaxBits;
+   int nSuccess;
+
+   nSuccess = lz4ultra_decode_header(pCtx->cFrameData, pCtx->nFrameDataSize, &nBlockMaxCode, &pCtx->nFlags, &pCtx->nContentSize);
+   if (nSuccess < 0)
+      return (nSuccess == LZ4ULTRA_DECODE_ERR_SUM) ? LZ4ULTRA_ERROR_CHECKSUM : LZ4ULTRA_ERROR_FORMAT;
+
+   if (pCtx->nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
+      nBlockMaxBits = 23;
+   else
+      nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+   pCtx->nBlockMaxSize = 1 << nBlockMaxBits;
+
+   /* The first block sees the dictionary as its history */
+   lz4ultra_window_start_history(pCtx);
+
+   pCtx->nCompressedSize += (long long)pCtx->nFrameDataSize;
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Decompress more input
+ *
+ * Input is consumed until it runs out, the output span is full or the end of the frame is reached; anything after the frame
+ * is left unconsumed. Everything that is decompressed is written to the output span before returning.
+ *
+ * @param pCtx context
+ * @param pInData input(compressed) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(decompressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_window_decompress_update(lz4ultra_window_decompressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                                    unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced) {
+   size_t nInConsumed = 0, nOutProduced = 0;
+   int nError = pCtx->nError;
+   int nDone = 0;
+
+   while (!nError && !nDone) {
+      switch (pCtx->nStage) {
+      case STAGE_HEADER:
+         if (!lz4ultra_window_gather(pCtx->cFrameData, &pCtx->nFrameDataSize, pCtx->nFrameDataNeeded, pInData, nInDataSize, &nInConsumed)) {
+            nDone = 1;
+            break;
+         }
+
+         if (pCtx->nFrameDataSize == LZ4ULTRA_HEADER_SIZE) {
+            /* Magic number: find out how much more of the header there is */
+            int nExtraHeaderSize = lz4ultra_check_header(pCtx->cFrameData, LZ4ULTRA_HEADER_SIZE);
+            if (nExtraHeaderSize < 0) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            pCtx->nFrameDataNeeded = LZ4ULTRA_HEADER_SIZE + nExtraHeaderSize;
+            if (nExtraHeaderSize)
+               break;
+         }
+
+         if (pCtx->nFrameDataSize < LZ4ULTRA_MAX_HEADER_SIZE) {
+            int nHeaderSize = lz4ultra_get_header_size(pCtx->cFrameData, pCtx->nFrameDataSize);
+            if (nHeaderSize < 0) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            if (nHeaderSize > pCtx->nFrameDataSize) {
+               /* The content size follows */
+               pCtx->nFrameDataNeeded = nHeaderSize;
+               break;
+            }
+         }
+
+         nError = lz4ultra_window_decompress_frame_header(pCtx);
+         if (!nError) {
+            pCtx->nStage = STAGE_BLOCK_FRAME;
+            pCtx->nFrameDataSize = 0;
+         }
+         break;
+
+      case STAGE_BLOCK_FRAME:
+         if (!lz4ultra_window_gather(pCtx->cFrameData, &pCtx->nFrameDataSize, LZ4ULTRA_FRAME_SIZE, pInData, nInDataSize, &nInConsumed)) {
+            nDone = 1;
+            break;
+         }
+         pCtx->nFrameDataSize = 0;
+         pCtx->nCompressedSize += (long long)LZ4ULTRA_FRAME_SIZE;
+
+         if (lz4ultra_decode_frame(pCtx->cFrameData, LZ4ULTRA_FRAME_SIZE, pCtx->nFlags, &pCtx->nBlockSize, &pCtx->nIsUncompressed) < 0)
+            pCtx->nBlockSize = 0;
+
+         if (pCtx->nBlockSize == 0) {
+            /* End of frame */
+            if ((pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) && pCtx->nContentSize != (unsigned long long)pCtx->nOriginalSize) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+            pCtx->nStage = (pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? STAGE_CONTENT_CHECKSUM : STAGE_DONE;
+         }
+         else {
+            if ((int)pCtx->nBlockSize > pCtx->nBlockMaxSize) {
+               nError = LZ4ULTRA_ERROR_FORMAT;
+               break;
+            }
+
+            pCtx->nBlockInputLeft = pCtx->nBlockSize;
+            pCtx->nBlockOutputLeft = (unsigned int)pCtx->nBlockMaxSize;
+            if (pCtx->nIsUncompressed) {
+               pCtx->nSequenceStage = SEQ_STORED;
+               pCtx->nLength = pCtx->nBlockSize;
+            }
+            else {
+               pCtx->nSequenceStage = SEQ_TOKEN;
+            }
+            if (pCtx->nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM)
+               XXH32_reset(&pCtx->blockChecksum, 0);
+            pCtx->nStage = STAGE_BLOCK_DATA;
+         }
+         break;
+
+      case STAGE_BLOCK_DATA: {
+         const unsigned int nStartPos = pCtx->nWindowPos;
+         size_t nOutRoom = nOutDataSize - nOutProduced;
+         size_t nBlockInConsumed = 0;
+         unsigned int nDecompressedSize = 0;
+
+         /* Decompress no more than the window holds, so that all of it can be handed out right away */
+         if (nOutRoom > HISTORY_SIZE)
+            nOutRoom = HISTORY_SIZE;
+
+         nError = lz4ultra_window_decompress_sequences(pCtx, pInData + nInConsumed, nInDataSize - nInConsumed, &nBlockInConsumed, (unsigned int)nOutRoom, &nDecompressedSize);
+
+         if (pCtx->nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM)
+            XXH32_update(&pCtx->blockChecksum, pInData + nInConsumed, nBlockInConsumed);
+         nInConsumed += nBlockInConsumed;
+         pCtx->nCompressedSize += (long long)nBlockInConsumed;
+
+         if (nDecompressedSize) {
+            /* Hand out what was just decompressed, wherever it wrapped around the window */
+            unsigned int nFirstSize = HISTORY_SIZE - nStartPos;
+
+            if (nFirstSize > nDecompressedSize)
+               nFirstSize = nDecompressedSize;
+            memcpy(pOutData + nOutProduced, pCtx->pWindow + nStartPos, nFirstSize);
+            memcpy(pOutData + nOutProduced + nFirstSize, pCtx->pWindow, nDecompressedSize - nFirstSize);
+
+            if (pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+               XXH32_update(&pCtx->contentChecksum, pOutData + nOutProduced, nDecompressedSize);
+            nOutProduced += nDecompressedSize;
+            pCtx->nOriginalSize += (long long)nDecompressedSize;
+         }
+
+         if (nError)
+            break;
+
+         if (pCtx->nSequenceStage == SEQ_END) {
+            /* Independent blocks start over from the dictionary */
+            if (pCtx->nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS)
+               lz4ultra_window_start_history(pCtx);
+
+            pCtx->nStage = (pCtx->nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? STAGE_BLOCK_CHECKSUM : STAGE_BLOCK_FRAME;
+         }
+         else if (!nBlockInConsumed && !nDecompressedSize) {
+            /* More input or output room is needed */
+            nDone = 1;
+         }
+         break;
+      }
+
+      case STAGE_BLOCK_CHECKSUM:
+         if (!lz4ultra_window_gather(pCtx->cFrameData, &pCtx->nFrameDataSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pInData, nInDataSize, &nInConsumed)) {
+            nDone = 1;
+            break;
+         }
+         pCtx->nFrameDataSize = 0;
+         pCtx->nCompressedSize += (long long)LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+
+         if (lz4ultra_decode_content_checksum(pCtx->cFrameData, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, XXH32_digest(&pCtx->blockChecksum)) != LZ4ULTRA_DECODE_OK) {
+            nError = LZ4ULTRA_ERROR_CHECKSUM;
+            break;
+         }
+         pCtx->nStage = STAGE_BLOCK_FRAME;
+         break;
+
+      case STAGE_CONTENT_CHECKSUM:
+         if (!lz4ultra_window_gather(pCtx->cFrameData, &pCtx->nFrameDataSize, LZ4ULTRA_CONTENT_CHECKSUM_SIZE, pInData, nInDataSize, &nInConsumed)) {
+            nDone = 1;
+            break;
+         }
+         pCtx->nFrameDataSize = 0;
+         pCtx->nCompressedSize += (long long)LZ4ULTRA_CONTENT_CHECKSUM_SIZE;
+
+         if (lz4ultra_decode_content_checksum(pCtx->cFrameData, LZ4ULTRA_CONTENT_CHECKSUM_SIZE, XXH32_digest(&pCtx->contentChecksum)) != LZ4ULTRA_DECODE_OK) {
+            nError = LZ4ULTRA_ERROR_CHECKSUM;
+            break;
+         }
+         pCtx->nStage = STAGE_DONE;
+         break;
+
+      default:
+         nDone = 1;
+         break;
+      }
+   }
+
+   pCtx->nError = nError;
+   *pInConsumed = nInConsumed;
+   *pOutProduced = nOutProduced;
+   return nError;
+}
+
+/**
+ * Check whether the end of the frame was reached
+ *
+ * @param pCtx context
+ *
+ * @return nonzero if the whole frame was decompressed, 0 if more input is needed
+ */
+int lz4ultra_window_decompress_done(const lz4ultra_window_decompressor_t *pCtx) {
+   return (pCtx->nStage == STAGE_DONE) ? 1 : 0;
+}
+
+/**
+ * Check that the whole frame was decompressed
+ *
+ * @param pCtx context
+ * @param pOriginalSize pointer to returned output(decompressed) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_SRC if the frame is truncated, or the error that stopped decompression
+ */
+lz4ultra_status_t lz4ultra_window_decompress_end(lz4ultra_window_decompressor_t *pCtx, long long *pOriginalSize, long long *pCompressedSize) {
+   if (pCtx->nError)
+      return pCtx->nError;
+
+   /* Legacy frames have no end marker; they end with the data */
+   if (pCtx->nStage != STAGE_DONE &&
+       !(pCtx->nStage == STAGE_BLOCK_FRAME && pCtx->nFrameDataSize == 0 && (pCtx->nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)))
+      return LZ4ULTRA_ERROR_SRC;
+
+   if (pOriginalSize)
+      *pOriginalSize = pCtx->nOriginalSize;
+   if (pCompressedSize)
+      *pCompressedSize = pCtx->nCompressedSize;
+   return LZ4ULTRA_OK;
+}
@@ -0,0 +1,161 @@
+/*
+ * expand_window.h - windowed streaming decompression definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _EXPAND_WINDOW_H
+#define _EXPAND_WINDOW_H
+
+#include <stddef.h>
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
+/* Forward declaration */
+typedef enum _lz4ultra_status_t lz4ultra_status_t;
+
+/**
+ * Windowed decompression context, fed with caller-owned input spans of any size and writing to caller-owned output spans of any size
+ *
+ * Unlike lz4ultra_incremental_decompressor_t, blocks are never gathered or decompressed as a whole: sequences are decoded one
+ * after the other as their bytes arrive, into a 64 Kb ring that matches refer to in place, and the ring is handed out to the
+ * output spans as it fills. The context only ever holds the 64 Kb window, whatever the frame's block size.
+ *
+ * As a block is handed out before all of it is received, a block checksum error is only reported after the block's data.
+ */
+typedef struct _lz4ultra_window_decompressor_t {
+   unsigned char *pWindow;
+   const unsigned char *pDictionaryData;
+   int nDictionaryDataSize;
+   unsigned int nFlags;
+   int nStage;
+   int nError;
+   unsigned char cFrameData[16];
+   int nFrameDataSize;
+   int nFrameDataNeeded;
+   int nBlockMaxSize;
+   unsigned int nBlockSize;
+   int nIsUncompressed;
+   unsigned int nBlockInputLeft;
+   unsigned int nBlockOutputLeft;
+   int nSequenceStage;
+   unsigned int nToken;
+   unsigned int nLength;
+   unsigned int nMatchOffset;
+   unsigned int nWindowPos;
+   unsigned int nHistorySize;
+   unsigned long long nContentSize;
+   long long nOriginalSize;
+   long long nCompressedSize;
+   XXH32_state_t blockChecksum;
+   XXH32_state_t contentChecksum;
+} lz4ultra_window_decompressor_t;
+
+/**
+ * Initialize windowed decompression context, without allocating anything yet
+ *
+ * @param pCtx context to initialize
+ */
+void lz4ultra_window_decompressor_init(lz4ultra_window_decompressor_t *pCtx);
+
+/**
+ * Free windowed decompression context window
+ *
+ * @param pCtx context
+ */
+void lz4ultra_window_decompressor_destroy(lz4ultra_window_decompressor_t *pCtx);
+
+/**
+ * Create windowed decompression context, without allocating the window yet
+ *
+ * @return context, to be freed with lz4ultra_window_decompressor_free(), or NULL for failure
+ */
+lz4ultra_window_decompressor_t *lz4ultra_window_decompressor_create(void);
+
+/**
+ * Free windowed decompression context and its window
+ *
+ * @param pCtx context, or NULL
+ */
+void lz4ultra_window_decompressor_free(lz4ultra_window_decompressor_t *pCtx);
+
+/**
+ * Start decompressing a new frame
+ *
+ * The window is allocated the first time a frame is started with the context, and is reused for the frames that follow.
+ *
+ * @param pCtx context
+ * @param pDictionaryData dictionary contents, that must stay valid until the frame is decompressed, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (0; raw blocks aren't supported, and the input is always checked, so that LZ4ULTRA_FLAG_TRUSTED_INPUT makes no difference)
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_window_decompress_begin(lz4ultra_window_decompressor_t *pCtx, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags);
+
+/**
+ * Decompress more input
+ *
+ * Input is consumed until it runs out, the output span is full or the end of the frame is reached; anything after the frame
+ * is left unconsumed. Everything that is decompressed is written to the output span before returning.
+ *
+ * @param pCtx context
+ * @param pInData input(compressed) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(decompressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_window_decompress_update(lz4ultra_window_decompressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                                    unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Check whether the end of the frame was reached
+ *
+ * @param pCtx context
+ *
+ * @return nonzero if the whole frame was decompressed, 0 if more input is needed
+ */
+int lz4ultra_window_decompress_done(const lz4ultra_window_decompressor_t *pCtx);
+
+/**
+ * Check that the whole frame was decompressed
+ *
+ * @param pCtx context
+ * @param pOriginalSize pointer to returned output(decompressed) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_SRC if the frame is truncated, or the error that stopped decompression
+ */
+lz4ultra_status_t lz4ultra_window_decompress_end(lz4ultra_window_decompressor_t *pCtx, long long *pOriginalSize, long long *pCompressedSize);
+
+#endif /* _EXPAND_WINDOW_H */
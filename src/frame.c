@@ -41,10 +41,11 @@
  * @param nMaxFrameDataSize max encoding buffer size, in bytes
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode max block size code (4-7)
+ * @param nContentSize size of the uncompressed data, written out if LZ4ULTRA_FLAG_CONTENT_SIZE is set
  *
  * @return number of encoded bytes, or -1 for failure
  */
-int lz4ultra_encode_header(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, int nBlockMaxCode) {
+int lz4ultra_encode_header(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, int nBlockMaxCode, const unsigned long long nContentSize) {
    if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) {
       if (nMaxFrameDataSize >= 4) {
          pFrameData[0] = 0x02;                              /* Legacy magic number: 0x184D2204 */
@@ -59,7 +60,9 @@ int lz4ultra_encode_header(unsigned char *pFrameData, const int nMaxFrameDataSiz
       }
    }
    else {
-      if (nMaxFrameDataSize >= 7) {
+      int nHeaderSize = (nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) ? 15 : 7;
+
+      if (nMaxFrameDataSize >= nHeaderSize) {
          pFrameData[0] = 0x04;                              /* Magic number: 0x184D2204 */
          pFrameData[1] = 0x22;
          pFrameData[2] = 0x4D;
@@ -68,12 +71,25 @@ int lz4ultra_encode_header(unsigned char *pFrameData, const int nMaxFrameDataSiz
          pFrameData[4] = 0b01000000;                        /* Version.Hi Version.Lo !B.Indep B.Checksum Content.Size Content.Checksum Reserved.Hi Reserved.Lo */
          if (nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS)
             pFrameData[4] |= 0b00100000;                    /*                       B.Indep */
+         if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM)
+            pFrameData[4] |= 0b00010000;                    /*                               B.Checksum */
+         if (nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE)
+            pFrameData[4] |= 0b00001000;                    /*                                          Content.Size */
+         if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+            pFrameData[4] |= 0b00000100;                    /*                                                       Content.Checksum */
          pFrameData[5] = nBlockMaxCode << 4;                /* Block MaxSize */
 
-         XXH32_hash_t headerSum = XXH32(pFrameData + 4, 2, 0);
-         pFrameData[6] = (headerSum >> 8) & 0xff;           /* Header checksum */
+         if (nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) {
+            int i;
+
+            for (i = 0; i < 8; i++)
+               pFrameData[6 + i] = (nContentSize >> (i << 3)) & 0xff;  /* Content size, little-endian */
+         }
+
+         XXH32_hash_t headerSum = XXH32(pFrameData + 4, nHeaderSize - 5, 0);
+         pFrameData[nHeaderSize - 1] = (headerSum >> 8) & 0xff;        /* Header checksum */
 
-         return 7;
+         return nHeaderSize;
       }
       else {
          return LZ4ULTRA_ENCODE_ERR;
@@ -130,25 +146,64 @@ int lz4ultra_encode_uncompressed_block_frame(unsigned char *pFrameData, const in
    }
 }
 
+/**
+ * Encode block checksum, stored after the block data when LZ4ULTRA_FLAG_BLOCK_CHECKSUM is set
+ *
+ * @param pFrameData encoding buffer
+ * @param nMaxFrameDataSize max encoding buffer size, in bytes
+ * @param nFlags compression flags
+ * @param pBlockData block data, as stored in the frame (compressed or not)
+ * @param nBlockDataSize block data size, in bytes
+ *
+ * @return number of encoded bytes (0 if the frame has no block checksums), or -1 for failure
+ */
+int lz4ultra_encode_block_checksum(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, const unsigned char *pBlockData, const int nBlockDataSize) {
+   if ((nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) == 0 || (nFlags & (LZ4ULTRA_FLAG_RAW_BLOCK | LZ4ULTRA_FLAG_LEGACY_FRAMES)) != 0)
+      return 0;
+
+   if (nMaxFrameDataSize >= LZ4ULTRA_BLOCK_CHECKSUM_SIZE) {
+      XXH32_hash_t blockSum = XXH32(pBlockData, nBlockDataSize, 0);
+
+      pFrameData[0] = blockSum & 0xff;
+      pFrameData[1] = (blockSum >> 8) & 0xff;
+      pFrameData[2] = (blockSum >> 16) & 0xff;
+      pFrameData[3] = (blockSum >> 24) & 0xff;
+      return LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+   }
+   else {
+      return LZ4ULTRA_ENCODE_ERR;
+   }
+}
+
 /**
  * Encode terminal frame header
  *
  * @param pFrameData encoding buffer
  * @param nMaxFrameDataSize max encoding buffer size, in bytes
  * @param nFlags compression flags
+ * @param nContentChecksum XXH32 checksum of the uncompressed data, written out after the EOD frame if LZ4ULTRA_FLAG_CONTENT_CHECKSUM is set
  *
  * @return number of encoded bytes, or -1 for failure
  */
-int lz4ultra_encode_footer_frame(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags) {
+int lz4ultra_encode_footer_frame(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, const unsigned int nContentChecksum) {
    if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
       return 0;
 
-   if (nMaxFrameDataSize >= 4) {
+   int nFooterSize = (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? (4 + LZ4ULTRA_CONTENT_CHECKSUM_SIZE) : 4;
+
+   if (nMaxFrameDataSize >= nFooterSize) {
       pFrameData[0] = 0x00;         /* EOD frame */
       pFrameData[1] = 0x00;
       pFrameData[2] = 0x00;
       pFrameData[3] = 0x00;
-      return 4;
+
+      if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) {
+         pFrameData[4] = nContentChecksum & 0xff;           /* Content checksum */
+         pFrameData[5] = (nContentChecksum >> 8) & 0xff;
+         pFrameData[6] = (nContentChecksum >> 16) & 0xff;
+         pFrameData[7] = (nContentChecksum >> 24) & 0xff;
+      }
+      return nFooterSize;
    }
    else {
       return LZ4ULTRA_ENCODE_ERR;
@@ -185,35 +240,71 @@ int lz4ultra_check_header(const unsigned char *pFrameData, const int nFrameDataS
    return LZ4ULTRA_DECODE_ERR_FORMAT;
 }
 
+/**
+ * Get full size of compressed stream header, once the bytes checked by lz4ultra_check_header() and the extra bytes it asked for are read
+ *
+ * @param pFrameData data bytes
+ * @param nFrameDataSize number of bytes read so far
+ *
+ * @return total header size in bytes (at least nFrameDataSize), or LZ4ULTRA_DECODE_ERR_FORMAT for failure
+ */
+int lz4ultra_get_header_size(const unsigned char *pFrameData, const int nFrameDataSize) {
+   if (nFrameDataSize == 7) {
+      /* The optional content size sits between the block descriptor and the header checksum */
+      return (pFrameData[4] & 0b00001000) ? 15 : 7;
+   }
+   else if (nFrameDataSize == 4) {
+      return 4;
+   }
+   else {
+      return LZ4ULTRA_DECODE_ERR_FORMAT;
+   }
+}
+
 /**
  * Decode compressed stream header
  *
  * @param pFrameData data bytes
- * @param nFrameDataSize number of bytes to decode
+ * @param nFrameDataSize number of bytes to decode, as returned by lz4ultra_get_header_size()
  * @param nBlockMaxCode pointer to max block size code (4-7), updated if this function succeeds
  * @param nFlags returned compression flags
+ * @param pContentSize pointer to returned size of the uncompressed data, if the header has one (LZ4ULTRA_FLAG_CONTENT_SIZE is then set in nFlags)
  *
  * @return LZ4ULTRA_DECODE_OK for success, or LZ4ULTRA_DECODE_ERR_xxx for failure
  */
-int lz4ultra_decode_header(const unsigned char *pFrameData, const int nFrameDataSize, int *nBlockMaxCode, unsigned int *nFlags) {
-   if (nFrameDataSize == 7) {
+int lz4ultra_decode_header(const unsigned char *pFrameData, const int nFrameDataSize, int *nBlockMaxCode, unsigned int *nFlags, unsigned long long *pContentSize) {
+   if (nFrameDataSize == 7 || nFrameDataSize == 15) {
       if (pFrameData[0] != 0x04 ||
          pFrameData[1] != 0x22 ||
          pFrameData[2] != 0x4D ||
          pFrameData[3] != 0x18 ||
-         (pFrameData[4] & 0xc0) != 0b01000000 ||
-         (pFrameData[5] & 0x0f) != 0) {
+         (pFrameData[4] & 0b11000011) != 0b01000000 ||     /* Version 01, no reserved bit or dictionary ID */
+         (pFrameData[5] & 0x0f) != 0 ||
+         ((pFrameData[4] & 0b00001000) ? 15 : 7) != nFrameDataSize) {
          return LZ4ULTRA_DECODE_ERR_FORMAT;
       }
 
-      XXH32_hash_t headerSum = XXH32(pFrameData + 4, 2, 0);
-      if (((headerSum >> 8) & 0xff) != pFrameData[6]) {
+      XXH32_hash_t headerSum = XXH32(pFrameData + 4, nFrameDataSize - 5, 0);
+      if (((headerSum >> 8) & 0xff) != pFrameData[nFrameDataSize - 1]) {
          return LZ4ULTRA_DECODE_ERR_SUM;
       }
 
       *nFlags = (pFrameData[4] & 0x20) ? LZ4ULTRA_FLAG_INDEP_BLOCKS : 0;
+      if (pFrameData[4] & 0b00010000)
+         *nFlags |= LZ4ULTRA_FLAG_BLOCK_CHECKSUM;
+      if (pFrameData[4] & 0b00000100)
+         *nFlags |= LZ4ULTRA_FLAG_CONTENT_CHECKSUM;
       *nBlockMaxCode = (pFrameData[5] >> 4);
 
+      *pContentSize = 0;
+      if (pFrameData[4] & 0b00001000) {
+         int i;
+
+         for (i = 0; i < 8; i++)
+            *pContentSize |= ((unsigned long long)pFrameData[6 + i]) << (i << 3);
+         *nFlags |= LZ4ULTRA_FLAG_CONTENT_SIZE;
+      }
+
       return LZ4ULTRA_DECODE_OK;
    }
    else if (nFrameDataSize == 4) {
@@ -226,6 +317,7 @@ int lz4ultra_decode_header(const unsigned char *pFrameData, const int nFrameData
 
       *nFlags = LZ4ULTRA_FLAG_LEGACY_FRAMES;
       *nBlockMaxCode = 0;
+      *pContentSize = 0;
 
       return LZ4ULTRA_DECODE_OK;
    }
@@ -260,3 +352,50 @@ int lz4ultra_decode_frame(const unsigned char *pFrameData, const int nFrameDataS
       return LZ4ULTRA_DECODE_ERR_FORMAT;
    }
 }
+
+/**
+ * Check block checksum, stored after the block data when LZ4ULTRA_FLAG_BLOCK_CHECKSUM is set
+ *
+ * @param pFrameData data bytes
+ * @param nFrameDataSize number of bytes to decode
+ * @param pBlockData block data, as stored in the frame
+ * @param nBlockDataSize block data size, in bytes
+ *
+ * @return LZ4ULTRA_DECODE_OK for success, or LZ4ULTRA_DECODE_ERR_xxx for failure
+ */
+int lz4ultra_decode_block_checksum(const unsigned char *pFrameData, const int nFrameDataSize, const unsigned char *pBlockData, const int nBlockDataSize) {
+   if (nFrameDataSize == LZ4ULTRA_BLOCK_CHECKSUM_SIZE) {
+      unsigned int nStoredChecksum = ((unsigned int)pFrameData[0]) |
+         (((unsigned int)pFrameData[1]) << 8) |
+         (((unsigned int)pFrameData[2]) << 16) |
+         (((unsigned int)pFrameData[3]) << 24);
+
+      return (nStoredChecksum == XXH32(pBlockData, nBlockDataSize, 0)) ? LZ4ULTRA_DECODE_OK : LZ4ULTRA_DECODE_ERR_SUM;
+   }
+   else {
+      return LZ4ULTRA_DECODE_ERR_FORMAT;
+   }
+}
+
+/**
+ * Check content checksum, stored after the EOD frame
+ *
+ * @param pFrameData data bytes
+ * @param nFrameDataSize number of bytes to decode
+ * @param nContentChecksum XXH32 checksum of the decompressed data
+ *
+ * @return LZ4ULTRA_DECODE_OK for success, or LZ4ULTRA_DECODE_ERR_xxx for failure
+ */
+int lz4ultra_decode_content_checksum(const unsigned char *pFrameData, const int nFrameDataSize, const unsigned int nContentChecksum) {
+   if (nFrameDataSize == LZ4ULTRA_CONTENT_CHECKSUM_SIZE) {
+      unsigned int nStoredChecksum = ((unsigned int)pFrameData[0]) |
+         (((unsigned int)pFrameData[1]) << 8) |
+         (((unsigned int)pFrameData[2]) << 16) |
+         (((unsigned int)pFrameData[3]) << 24);
+
+      return (nStoredChecksum == nContentChecksum) ? LZ4ULTRA_DECODE_OK : LZ4ULTRA_DECODE_ERR_SUM;
+   }
+   else {
+      return LZ4ULTRA_DECODE_ERR_FORMAT;
+   }
+}
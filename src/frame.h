@@ -34,10 +34,12 @@
 #define _FRAME_H
 
 #include <stdio.h>
+#include "lz4ultra.h"
 
 #define LZ4ULTRA_HEADER_SIZE        4
-#define LZ4ULTRA_MAX_HEADER_SIZE    7
 #define LZ4ULTRA_FRAME_SIZE         4
+#define LZ4ULTRA_BLOCK_CHECKSUM_SIZE 4
+#define LZ4ULTRA_CONTENT_CHECKSUM_SIZE 4
 
 #define LZ4ULTRA_ENCODE_ERR         (-1)
 
@@ -52,10 +54,11 @@
  * @param nMaxFrameDataSize max encoding buffer size, in bytes
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode max block size code (4-7)
+ * @param nContentSize size of the uncompressed data, written out if LZ4ULTRA_FLAG_CONTENT_SIZE is set
  *
  * @return number of encoded bytes, or -1 for failure
  */
-int lz4ultra_encode_header(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, int nBlockMaxCode);
+int lz4ultra_encode_header(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, int nBlockMaxCode, const unsigned long long nContentSize);
 
 /**
  * Encode compressed block frame header
@@ -81,16 +84,30 @@ int lz4ultra_encode_compressed_block_frame(unsigned char *pFrameData, const int
  */
 int lz4ultra_encode_uncompressed_block_frame(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, const int nBlockDataSize);
 
+/**
+ * Encode block checksum, stored after the block data when LZ4ULTRA_FLAG_BLOCK_CHECKSUM is set
+ *
+ * @param pFrameData encoding buffer
+ * @param nMaxFrameDataSize max encoding buffer size, in bytes
+ * @param nFlags compression flags
+ * @param pBlockData block data, as stored in the frame (compressed or not)
+ * @param nBlockDataSize block data size, in bytes
+ *
+ * @return number of encoded bytes (0 if the frame has no block checksums), or -1 for failure
+ */
+int lz4ultra_encode_block_checksum(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, const unsigned char *pBlockData, const int nBlockDataSize);
+
 /**
  * Encode terminal frame header
  *
  * @param pFrameData encoding buffer
  * @param nMaxFrameDataSize max encoding buffer size, in bytes
  * @param nFlags compression flags
+ * @param nContentChecksum XXH32 checksum of the uncompressed data, written out after the EOD frame if LZ4ULTRA_FLAG_CONTENT_CHECKSUM is set
  *
  * @return number of encoded bytes, or -1 for failure
  */
-int lz4ultra_encode_footer_frame(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags);
+int lz4ultra_encode_footer_frame(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, const unsigned int nContentChecksum);
 
 /**
  * Check compressed stream header
@@ -102,17 +119,28 @@ int lz4ultra_encode_footer_frame(unsigned char *pFrameData, const int nMaxFrameD
  */
 int lz4ultra_check_header(const unsigned char *pFrameData, const int nFrameDataSize);
 
+/**
+ * Get full size of compressed stream header, once the bytes checked by lz4ultra_check_header() and the extra bytes it asked for are read
+ *
+ * @param pFrameData data bytes
+ * @param nFrameDataSize number of bytes read so far
+ *
+ * @return total header size in bytes (at least nFrameDataSize), or LZ4ULTRA_DECODE_ERR_FORMAT for failure
+ */
+int lz4ultra_get_header_size(const unsigned char *pFrameData, const int nFrameDataSize);
+
 /**
  * Decode compressed stream header
  *
  * @param pFrameData data bytes
- * @param nFrameDataSize number of bytes to decode
+ * @param nFrameDataSize number of bytes to decode, as returned by lz4ultra_get_header_size()
  * @param nBlockMaxCode pointer to max block size code (4-7), updated if this function succeeds
  * @param nFlags returned compression flags
+ * @param pContentSize pointer to returned size of the uncompressed data, if the header has one (LZ4ULTRA_FLAG_CONTENT_SIZE is then set in nFlags)
  *
  * @return LZ4ULTRA_DECODE_OK for success, or LZ4ULTRA_DECODE_ERR_xxx for failure
  */
-int lz4ultra_decode_header(const unsigned char *pFrameData, const int nFrameDataSize, int *nBlockMaxCode, unsigned int *nFlags);
+int lz4ultra_decode_header(const unsigned char *pFrameData, const int nFrameDataSize, int *nBlockMaxCode, unsigned int *nFlags, unsigned long long *pContentSize);
 
 /**
  * Decode frame header
@@ -127,4 +155,27 @@ int lz4ultra_decode_header(const unsigned char *pFrameData, const int nFrameData
  */
 int lz4ultra_decode_frame(const unsigned char *pFrameData, const int nFrameDataSize, const unsigned int nFlags, unsigned int *nBlockSize, int *nIsUncompressed);
 
+/**
+ * Check block checksum, stored after the block data when LZ4ULTRA_FLAG_BLOCK_CHECKSUM is set
+ *
+ * @param pFrameData data bytes
+ * @param nFrameDataSize number of bytes to decode
+ * @param pBlockData block data, as stored in the frame
+ * @param nBlockDataSize block data size, in bytes
+ *
+ * @return LZ4ULTRA_DECODE_OK for success, or LZ4ULTRA_DECODE_ERR_xxx for failure
+ */
+int lz4ultra_decode_block_checksum(const unsigned char *pFrameData, const int nFrameDataSize, const unsigned char *pBlockData, const int nBlockDataSize);
+
+/**
+ * Check content checksum, stored after the EOD frame
+ *
+ * @param pFrameData data bytes
+ * @param nFrameDataSize number of bytes to decode
+ * @param nContentChecksum XXH32 checksum of the decompressed data
+ *
+ * @return LZ4ULTRA_DECODE_OK for success, or LZ4ULTRA_DECODE_ERR_xxx for failure
+ */
+int lz4ultra_decode_content_checksum(const unsigned char *pFrameData, const int nFrameDataSize, const unsigned int nContentChecksum);
+
 #endif /* _FRAME_H */
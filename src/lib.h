@@ -33,38 +33,26 @@
 #ifndef _LIB_H
 #define _LIB_H
 
+#include "lz4ultra.h"
 #include "stream.h"
+#include "async_stream.h"
+#include "threadpool.h"
+#include "stats.h"
+#include "block_cache.h"
 #include "dictionary.h"
+#include "dictionary_train.h"
 #include "shrink_context.h"
 #include "shrink_streaming.h"
 #include "shrink_inmem.h"
+#include "shrink_incremental.h"
+#include "shrink_batch.h"
+#include "shrink_files.h"
+#include "transcode.h"
 #include "expand_block.h"
 #include "expand_streaming.h"
 #include "expand_inmem.h"
-
-/** High level status for compression and decompression */
-typedef enum _lz4ultra_status_t {
-   LZ4ULTRA_OK = 0,                          /**< Success */
-   LZ4ULTRA_ERROR_SRC,                       /**< Error reading input */
-   LZ4ULTRA_ERROR_DST,                       /**< Error reading output */
-   LZ4ULTRA_ERROR_DICTIONARY,                /**< Error reading dictionary */
-   LZ4ULTRA_ERROR_MEMORY,                    /**< Out of memory */
-
-   /* Compression-specific status codes */
-   LZ4ULTRA_ERROR_COMPRESSION,               /**< Internal compression error */
-   LZ4ULTRA_ERROR_RAW_TOOLARGE,              /**< Input is too large to be compressed to a raw block */
-   LZ4ULTRA_ERROR_RAW_UNCOMPRESSED,          /**< Input is incompressible and raw blocks don't support uncompressed data */
-
-   /* Decompression-specific status codes */
-   LZ4ULTRA_ERROR_FORMAT,                    /**< Invalid input format or magic number when decompressing */
-   LZ4ULTRA_ERROR_CHECKSUM,                  /**< Invalid checksum when decompressing */
-   LZ4ULTRA_ERROR_DECOMPRESSION,             /**< Internal decompression error */
-} lz4ultra_status_t;
-
-/* Compression flags */
-#define LZ4ULTRA_FLAG_FAVOR_RATIO    (1<<0)           /**< 1 to compress with the best ratio, 0 to trade some compression ratio for extra decompression speed */
-#define LZ4ULTRA_FLAG_RAW_BLOCK      (1<<1)           /**< 1 to emit raw block */
-#define LZ4ULTRA_FLAG_INDEP_BLOCKS   (1<<2)           /**< 1 if blocks are independent, 0 if using inter-block back references */
-#define LZ4ULTRA_FLAG_LEGACY_FRAMES  (1<<3)           /**< 1 if using the legacy frames format, 0 if using the modern lz4 frame format */
+#include "expand_incremental.h"
+#include "expand_window.h"
+#include "expand_range.h"
 
 #endif /* _LIB_H */
@@ -50,10 +50,19 @@ typedef int saidx_t;
 #define PRIdSAIDX_T "d"
 #endif
 
+/*- Task run concurrently with others while sorting: index is 0..count-1 */
+typedef void (*divsufsort_task_fn)(void *arg, int index);
+
+/*- Executor hook: run task(arg, 0) .. task(arg, count - 1) concurrently, and only return once all of them have returned */
+typedef void (*divsufsort_parallel_fn)(void *user, divsufsort_task_fn task, void *arg, int count);
+
 /*- divsufsort context */
 typedef struct _divsufsort_ctx_t {
    saidx_t *bucket_A;
    saidx_t *bucket_B;
+   divsufsort_parallel_fn parallel;  /* executor for sorting the type B* buckets concurrently, or NULL to sort serially */
+   void *parallel_user;              /* opaque pointer passed to the executor */
+   int num_threads;                  /* number of tasks to split the type B* buckets into, when there is an executor */
 } divsufsort_ctx_t;
 
 /*- Prototypes -*/
@@ -32,10 +32,48 @@
 
 /*- Private Functions -*/
 
+/* Minimum number of type B* suffixes for sorting them concurrently. */
+#define SS_PARALLEL_MIN_SIZE (65536)
+
+/* Shared state for sorting the type B* buckets concurrently. */
+typedef struct _sssort_parallel_t {
+  const sauchar_t *T;
+  saidx_t *SA, *PAb, *bucket_B, *buf;
+  saidx_t bufsize, n, m;
+  int count;
+} sssort_parallel_t;
+
+/* Sorts the type B* buckets that start in one slice of SA[0..m-1], with one
+   slice of the free space of SA as scratch buffer. The slices are split
+   evenly by number of suffixes; buckets are never split, so the work of each
+   task is the same as in the serial loop, and so is the result. */
+static
+void
+sort_typeBstar_task(void *arg, int index) {
+  sssort_parallel_t *job = (sssort_parallel_t *)arg;
+  const sauchar_t *T = job->T;
+  saidx_t *SA = job->SA, *bucket_B = job->bucket_B;
+  saidx_t *curbuf = job->buf + index * job->bufsize;
+  saidx_t lo = (saidx_t)(((long long)job->m * index) / job->count);
+  saidx_t hi = (saidx_t)(((long long)job->m * (index + 1)) / job->count);
+  saidx_t i, j;
+  saint_t c0, c1;
+
+  for(c0 = ALPHABET_SIZE - 2, j = job->m; lo < j; --c0) {
+    for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
+      i = BUCKET_BSTAR(c0, c1);
+      if((1 < (j - i)) && (lo <= i) && (i < hi)) {
+        sssort(T, job->PAb, SA + i, SA + j,
+               curbuf, job->bufsize, 2, job->n, *(SA + i) == (job->m - 1));
+      }
+    }
+  }
+}
+
 /* Sorts suffixes of type B*. */
 static
 saidx_t
-sort_typeBstar(const sauchar_t *T, saidx_t *SA,
+sort_typeBstar(divsufsort_ctx_t *ctx, const sauchar_t *T, saidx_t *SA,
                saidx_t *bucket_A, saidx_t *bucket_B,
                saidx_t n) {
   saidx_t *PAb, *ISAb, *buf;
@@ -130,13 +168,22 @@ note:
       }
     }
 #else
-    buf = SA + m, bufsize = n - (2 * m);
-    for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
-      for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
-        i = BUCKET_BSTAR(c0, c1);
-        if(1 < (j - i)) {
-          sssort(T, PAb, SA + i, SA + j,
-                 buf, bufsize, 2, n, *(SA + i) == (m - 1));
+    if((ctx->parallel != NULL) && (1 < ctx->num_threads) && (SS_PARALLEL_MIN_SIZE <= m)) {
+      sssort_parallel_t job;
+
+      job.T = T, job.SA = SA, job.PAb = PAb, job.bucket_B = bucket_B;
+      job.buf = SA + m, job.bufsize = (n - (2 * m)) / ctx->num_threads;
+      job.n = n, job.m = m, job.count = ctx->num_threads;
+      ctx->parallel(ctx->parallel_user, sort_typeBstar_task, &job, job.count);
+    } else {
+      buf = SA + m, bufsize = n - (2 * m);
+      for(c0 = ALPHABET_SIZE - 2, j = m; 0 < j; --c0) {
+        for(c1 = ALPHABET_SIZE - 1; c0 < c1; j = i, --c1) {
+          i = BUCKET_BSTAR(c0, c1);
+          if(1 < (j - i)) {
+            sssort(T, PAb, SA + i, SA + j,
+                   buf, bufsize, 2, n, *(SA + i) == (m - 1));
+          }
         }
       }
     }
@@ -335,6 +382,9 @@ construct_BWT(const sauchar_t *T, saidx_t *SA,
 int divsufsort_init(divsufsort_ctx_t *ctx) {
    ctx->bucket_A = (saidx_t *)malloc(BUCKET_A_SIZE * sizeof(saidx_t));
    ctx->bucket_B = NULL;
+   ctx->parallel = NULL;
+   ctx->parallel_user = NULL;
+   ctx->num_threads = 1;
 
    if (ctx->bucket_A) {
       ctx->bucket_B = (saidx_t *)malloc(BUCKET_B_SIZE * sizeof(saidx_t));
@@ -379,7 +429,7 @@ divsufsort_build_array(divsufsort_ctx_t *ctx, const sauchar_t *T, saidx_t *SA, s
 
   /* Suffixsort. */
   if((ctx->bucket_A != NULL) && (ctx->bucket_B != NULL)) {
-    m = sort_typeBstar(T, SA, ctx->bucket_A, ctx->bucket_B, n);
+    m = sort_typeBstar(ctx, T, SA, ctx->bucket_A, ctx->bucket_B, n);
     construct_SA(T, SA, ctx->bucket_A, ctx->bucket_B, n, m);
   } else {
     err = -2;
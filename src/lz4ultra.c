@@ -34,11 +34,14 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifdef _WIN32
 #include <windows.h>
 #include <sys/timeb.h>
 #else
 #include <sys/time.h>
+#include <dirent.h>
 #endif
 #include "lib.h"
 #include "format.h"
@@ -49,6 +52,19 @@
 #define OPT_RAW            4
 #define OPT_INDEP_BLOCKS   8
 #define OPT_LEGACY_FRAMES  16
+#define OPT_BT_MATCHFINDER 32
+#define OPT_HC_MATCHFINDER 64
+#define OPT_CLOSER_OFFSETS 128
+#define OPT_TRUSTED_INPUT  256
+#define OPT_CONTENT_SIZE   512
+#define OPT_CONTENT_CHECKSUM 1024
+#define OPT_BLOCK_CHECKSUM 2048
+#define OPT_ASYNC_IO       4096
+#define OPT_ADAPTIVE_BLOCKS 8192
+#define OPT_SEEK_TABLE     16384
+#define OPT_LOW_MEMORY     32768
+#define OPT_HUGE_PAGES     65536
+#define OPT_VERIFY         131072
 
 #define TOOL_VERSION "1.3.0"
 
@@ -106,14 +122,38 @@ static void compression_progress(long long nOriginalSize, long long nCompressedS
    fflush(stdout);
 }
 
-static int do_compress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nBlockMaxCode) {
-   long long nStartTime = 0LL, nEndTime = 0LL;
-   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
-   lz4ultra_status_t nStatus;
-   int nCommandCount = 0;
-   int nFlags;
+static void print_stage_time(const char *pszStage, const long long nStageTime, const long long nTotalTime) {
+   if (nStageTime)
+      fprintf(stdout, "  %-10s %10.3f ms  %5.1f %%\n", pszStage, (double)nStageTime / 1000000.0, nTotalTime ? ((double)nStageTime * 100.0 / (double)nTotalTime) : 0.0);
+}
+
+static void print_compression_stats(const lz4ultra_stats_t *pStats) {
+   long long nTotalTime = pStats->check_time + pStats->sort_time + pStats->lcp_time + pStats->intervals_time + pStats->skip_time +
+      pStats->find_time + pStats->parse_time + pStats->reduce_time + pStats->write_time;
+
+   fprintf(stdout, "Compression stages:\n");
+   print_stage_time("check", pStats->check_time, nTotalTime);
+   print_stage_time("sort", pStats->sort_time, nTotalTime);
+   print_stage_time("lcp", pStats->lcp_time, nTotalTime);
+   print_stage_time("intervals", pStats->intervals_time, nTotalTime);
+   print_stage_time("skip", pStats->skip_time, nTotalTime);
+   print_stage_time("find", pStats->find_time, nTotalTime);
+   print_stage_time("parse", pStats->parse_time, nTotalTime);
+   print_stage_time("reduce", pStats->reduce_time, nTotalTime);
+   print_stage_time("write", pStats->write_time, nTotalTime);
+   fprintf(stdout, "  %-10s %10.3f ms\n", "total", (double)nTotalTime / 1000000.0);
+
+   fprintf(stdout, "Compression counters:\n");
+   fprintf(stdout, "  blocks: %lld (%lld stored uncompressed, %lld of them without running the match finder, %lld found in the block cache)\n",
+      pStats->num_blocks, pStats->num_uncompressed_blocks, pStats->num_skipped_blocks, pStats->num_cached_blocks);
+   fprintf(stdout, "  input bytes: %lld, compressed block bytes: %lld\n", pStats->num_input_bytes, pStats->num_output_bytes);
+   fprintf(stdout, "  matches found: %lld, joined: %lld, commands reduced: %lld\n", pStats->num_matches, pStats->num_joined_matches, pStats->num_reduced_commands);
+   fprintf(stdout, "  commands: %lld, literal bytes: %lld\n", pStats->num_commands, pStats->num_literals);
+}
+
+static unsigned int get_compression_flags(const unsigned int nOptions) {
+   unsigned int nFlags = 0;
 
-   nFlags = 0;
    if (nOptions & OPT_FAVOR_RATIO)
       nFlags |= LZ4ULTRA_FLAG_FAVOR_RATIO;
    if (nOptions & OPT_RAW)
@@ -122,14 +162,33 @@ static int do_compress(const char *pszInFilename, const char *pszOutFilename, co
       nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
    if (nOptions & OPT_LEGACY_FRAMES)
       nFlags |= LZ4ULTRA_FLAG_LEGACY_FRAMES;
+   if (nOptions & OPT_BT_MATCHFINDER)
+      nFlags |= LZ4ULTRA_FLAG_BT_MATCHFINDER;
+   if (nOptions & OPT_HC_MATCHFINDER)
+      nFlags |= LZ4ULTRA_FLAG_HC_MATCHFINDER;
+   if (nOptions & OPT_CLOSER_OFFSETS)
+      nFlags |= LZ4ULTRA_FLAG_MATCH_CANDIDATES;
+   if (nOptions & OPT_CONTENT_SIZE)
+      nFlags |= LZ4ULTRA_FLAG_CONTENT_SIZE;
+   if (nOptions & OPT_CONTENT_CHECKSUM)
+      nFlags |= LZ4ULTRA_FLAG_CONTENT_CHECKSUM;
+   if (nOptions & OPT_BLOCK_CHECKSUM)
+      nFlags |= LZ4ULTRA_FLAG_BLOCK_CHECKSUM;
+   if (nOptions & OPT_ASYNC_IO)
+      nFlags |= LZ4ULTRA_FLAG_ASYNC_IO;
+   if (nOptions & OPT_ADAPTIVE_BLOCKS)
+      nFlags |= LZ4ULTRA_FLAG_ADAPTIVE_BLOCKS;
+   if (nOptions & OPT_SEEK_TABLE)
+      nFlags |= LZ4ULTRA_FLAG_SEEK_TABLE;
+   if (nOptions & OPT_HUGE_PAGES)
+      nFlags |= LZ4ULTRA_FLAG_HUGE_PAGES;
+   if (nOptions & OPT_VERIFY)
+      nFlags |= LZ4ULTRA_FLAG_VERIFY;
+
+   return nFlags;
+}
 
-   if (nOptions & OPT_VERBOSE) {
-      nStartTime = do_get_time();
-   }
-
-   nStatus = lz4ultra_compress_file(pszInFilename, pszOutFilename, pszDictionaryFilename, nFlags, nBlockMaxCode,
-      (nOptions & OPT_VERBOSE) ? compression_start : NULL, compression_progress,
-      &nOriginalSize, &nCompressedSize, &nCommandCount);
+static void print_compression_error(lz4ultra_status_t nStatus, const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename) {
    switch (nStatus) {
    case LZ4ULTRA_ERROR_SRC: fprintf(stderr, "error reading '%s'\n", pszInFilename); break;
    case LZ4ULTRA_ERROR_DST: fprintf(stderr, "error writing '%s'\n", pszOutFilename); break;
@@ -138,9 +197,75 @@ static int do_compress(const char *pszInFilename, const char *pszOutFilename, co
    case LZ4ULTRA_ERROR_COMPRESSION: fprintf(stderr, "internal compression error\n"); break;
    case LZ4ULTRA_ERROR_RAW_TOOLARGE: fprintf(stderr, "error: raw blocks can only be used with files <= 4 Mb\n"); break;
    case LZ4ULTRA_ERROR_RAW_UNCOMPRESSED: fprintf(stderr, "error: data is incompressible, raw blocks only support compressed data\n"); break;
+   case LZ4ULTRA_ERROR_VERIFY: fprintf(stderr, "error: compressed block doesn't decompress back to the data in '%s'\n", pszInFilename); break;
    case LZ4ULTRA_OK: break;
    default: fprintf(stderr, "unknown compression error %d\n", nStatus); break;
    }
+}
+
+static void print_memory_fit(const unsigned int nFlags, const int nBlockMaxCode, const int nLevel, const int nThreads, const int nDictionarySize, const long long nInputSize, const size_t nMaxMemory) {
+   fprintf(stdout, "Fit in %llu Mb: -B%d -T%d%s%s, %llu bytes\n", (unsigned long long)(nMaxMemory >> 20), nBlockMaxCode, nThreads,
+      (nFlags & LZ4ULTRA_FLAG_BT_MATCHFINDER) ? " --mf=bt" : "", (nFlags & LZ4ULTRA_FLAG_MATCH_CANDIDATES) ? " --closer-offsets" : "",
+      (unsigned long long)lz4ultra_compress_get_memory_size(nFlags, nBlockMaxCode, nLevel, nThreads, nDictionarySize, nInputSize));
+}
+
+static int do_compress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads,
+                       size_t nBlockCacheSize, size_t nMaxMemory) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   lz4ultra_status_t nStatus;
+   int nCommandCount = 0;
+   lz4ultra_stats_t stats;
+   unsigned int nFlags = get_compression_flags(nOptions);
+
+   if (nMaxMemory) {
+      /* The block cache comes out of the same budget */
+      struct stat st;
+      long long nInputSize = (stat(pszInFilename, &st) == 0 && (st.st_mode & S_IFREG)) ? (long long)st.st_size : -1LL;
+      int nDictionarySize = pszDictionaryFilename ? HISTORY_SIZE : 0;
+
+      if (nMaxMemory <= nBlockCacheSize ||
+          lz4ultra_compress_fit_memory(nMaxMemory - nBlockCacheSize, &nFlags, &nBlockMaxCode, nLevel, &nThreads, nDictionarySize, nInputSize) != LZ4ULTRA_OK) {
+         fprintf(stderr, "error: '%s' can't be compressed within %llu Mb of memory\n", pszInFilename, (unsigned long long)(nMaxMemory >> 20));
+         return 100;
+      }
+      if (nOptions & OPT_VERBOSE)
+         print_memory_fit(nFlags, nBlockMaxCode, nLevel, nThreads, nDictionarySize, nInputSize, nMaxMemory - nBlockCacheSize);
+   }
+
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   if (nBlockCacheSize) {
+      /* Compress with a long-lived context, to attach the cache to it */
+      lz4ultra_prepared_dictionary_t *pDictionary = NULL;
+      lz4ultra_block_cache_t *pBlockCache = lz4ultra_block_cache_create(nBlockCacheSize);
+      lz4ultra_compressor *pCompressor = lz4ultra_compressor_create(0, nFlags, NULL, 0);
+
+      if (!pBlockCache || !pCompressor)
+         nStatus = LZ4ULTRA_ERROR_MEMORY;
+      else if (pszDictionaryFilename)
+         nStatus = (lz4ultra_status_t)lz4ultra_dictionary_prepare_file(pszDictionaryFilename, &pDictionary);
+      else
+         nStatus = LZ4ULTRA_OK;
+
+      if (nStatus == LZ4ULTRA_OK) {
+         lz4ultra_compressor_set_block_cache(pCompressor, pBlockCache);
+         nStatus = lz4ultra_compress_file_with_context(pCompressor, pszInFilename, pszOutFilename, pDictionary, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads,
+            &nOriginalSize, &nCompressedSize, &nCommandCount, (nOptions & OPT_VERBOSE) ? &stats : NULL);
+      }
+
+      lz4ultra_dictionary_release(pDictionary);
+      lz4ultra_compressor_free(pCompressor);
+      lz4ultra_block_cache_free(pBlockCache);
+   }
+   else {
+      nStatus = lz4ultra_compress_file(pszInFilename, pszOutFilename, pszDictionaryFilename, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads,
+         (nOptions & OPT_VERBOSE) ? compression_start : NULL, compression_progress,
+         &nOriginalSize, &nCompressedSize, &nCommandCount, (nOptions & OPT_VERBOSE) ? &stats : NULL);
+   }
+   print_compression_error(nStatus, pszInFilename, pszOutFilename, pszDictionaryFilename);
 
    if (nStatus)
       return 100;
@@ -153,6 +278,7 @@ static int do_compress(const char *pszInFilename, const char *pszOutFilename, co
       fprintf(stdout, "\rCompressed '%s' in %g seconds, %.02g Mb/s, %d tokens (%lld bytes/token), %lld into %lld bytes ==> %g %%\n",
          pszInFilename, fDelta, fSpeed, nCommandCount, nCommandCount ? (nOriginalSize / ((long long)nCommandCount)) : 0,
          nOriginalSize, nCompressedSize, nOriginalSize ? (double)(nCompressedSize * 100.0 / nOriginalSize) : 100.0);
+      print_compression_stats(&stats);
    }
 
    return 0;
@@ -160,7 +286,340 @@ static int do_compress(const char *pszInFilename, const char *pszOutFilename, co
 
 /*---------------------------------------------------------------------------*/
 
-static int do_decompress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+static int do_transcode(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nBlockMaxCode,
+                        int nIndependentBlocks, int nLevel, int nDecodeCost, int nThreads) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   lz4ultra_status_t nStatus;
+   int nCommandCount = 0;
+   lz4ultra_stats_t stats;
+
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   nStatus = lz4ultra_transcode_file(pszInFilename, pszOutFilename, pszDictionaryFilename, get_compression_flags(nOptions), nBlockMaxCode, nIndependentBlocks, nLevel, nDecodeCost, nThreads,
+      (nOptions & OPT_VERBOSE) ? compression_start : NULL, compression_progress,
+      &nOriginalSize, &nCompressedSize, &nCommandCount, (nOptions & OPT_VERBOSE) ? &stats : NULL);
+
+   switch (nStatus) {
+   case LZ4ULTRA_ERROR_FORMAT: fprintf(stderr, "invalid magic number, version, flags, or block size in input file\n"); break;
+   case LZ4ULTRA_ERROR_CHECKSUM: fprintf(stderr, "invalid checksum in input file\n"); break;
+   case LZ4ULTRA_ERROR_DECOMPRESSION: fprintf(stderr, "invalid compressed data in input file\n"); break;
+   default: print_compression_error(nStatus, pszInFilename, pszOutFilename, pszDictionaryFilename); break;
+   }
+
+   if (nStatus)
+      return 100;
+
+   if (nOptions & OPT_VERBOSE) {
+      nEndTime = do_get_time();
+
+      double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+      double fSpeed = ((double)nOriginalSize / 1048576.0) / fDelta;
+      fprintf(stdout, "\rTranscoded '%s' in %g seconds, %.02g Mb/s, %d tokens (%lld bytes/token), %lld into %lld bytes ==> %g %%\n",
+         pszInFilename, fDelta, fSpeed, nCommandCount, nCommandCount ? (nOriginalSize / ((long long)nCommandCount)) : 0,
+         nOriginalSize, nCompressedSize, nOriginalSize ? (double)(nCompressedSize * 100.0 / nOriginalSize) : 100.0);
+      print_compression_stats(&stats);
+   }
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/** Files to compress in one go, along with where to compress them to */
+typedef struct _files_list_t {
+   lz4ultra_file_item_t *pItems;
+   int nNumItems;
+   int nMaxItems;
+} files_list_t;
+
+static void free_files_list(files_list_t *pList) {
+   int i;
+
+   for (i = 0; i < pList->nNumItems; i++) {
+      free((char *)pList->pItems[i].pszInFilename);
+      free((char *)pList->pItems[i].pszOutFilename);
+   }
+   if (pList->pItems)
+      free(pList->pItems);
+   pList->pItems = NULL;
+   pList->nNumItems = 0;
+   pList->nMaxItems = 0;
+}
+
+static int add_file_to_list(files_list_t *pList, const char *pszInFilename, const char *pszOutFilename, long long nInputSize) {
+   lz4ultra_file_item_t *pItem;
+   char *pszIn, *pszOut;
+
+   if (pList->nNumItems == pList->nMaxItems) {
+      int nNewMaxItems = pList->nMaxItems ? (pList->nMaxItems * 2) : 64;
+      lz4ultra_file_item_t *pNewItems = (lz4ultra_file_item_t *)realloc(pList->pItems, nNewMaxItems * sizeof(lz4ultra_file_item_t));
+      if (!pNewItems) {
+         fprintf(stderr, "out of memory\n");
+         return -1;
+      }
+      pList->pItems = pNewItems;
+      pList->nMaxItems = nNewMaxItems;
+   }
+
+   /* Unless told otherwise, write each file next to its input, with the .lz4 extension appended */
+   pszIn = (char *)malloc(strlen(pszInFilename) + 1);
+   pszOut = (char *)malloc((pszOutFilename ? strlen(pszOutFilename) : (strlen(pszInFilename) + 4)) + 1);
+   if (!pszIn || !pszOut) {
+      if (pszIn)
+         free(pszIn);
+      if (pszOut)
+         free(pszOut);
+      fprintf(stderr, "out of memory\n");
+      return -1;
+   }
+   strcpy(pszIn, pszInFilename);
+   if (pszOutFilename)
+      strcpy(pszOut, pszOutFilename);
+   else {
+      strcpy(pszOut, pszInFilename);
+      strcat(pszOut, ".lz4");
+   }
+
+   pItem = &pList->pItems[pList->nNumItems++];
+   memset(pItem, 0, sizeof(lz4ultra_file_item_t));
+   pItem->pszInFilename = pszIn;
+   pItem->pszOutFilename = pszOut;
+   pItem->nInputSize = nInputSize;
+   return 0;
+}
+
+static bool is_compressed_filename(const char *pszFilename) {
+   size_t nLen = strlen(pszFilename);
+
+   return nLen >= 4 && !strcmp(pszFilename + nLen - 4, ".lz4");
+}
+
+static int add_path_to_list(files_list_t *pList, const char *pszPath) {
+   struct stat st;
+
+   if (stat(pszPath, &st) != 0) {
+      fprintf(stderr, "error opening '%s'\n", pszPath);
+      return -1;
+   }
+
+   if (!(st.st_mode & S_IFDIR))
+      return add_file_to_list(pList, pszPath, NULL, (long long)st.st_size);
+
+   /* Descend into directories, leaving out hidden entries and files that are already compressed */
+#ifdef _WIN32
+   {
+      char szPattern[MAX_PATH];
+      WIN32_FIND_DATAA findData;
+      HANDLE hFind;
+
+      snprintf(szPattern, sizeof(szPattern), "%s\\*", pszPath);
+      hFind = FindFirstFileA(szPattern, &findData);
+      if (hFind == INVALID_HANDLE_VALUE) {
+         fprintf(stderr, "error opening directory '%s'\n", pszPath);
+         return -1;
+      }
+
+      do {
+         char szFilename[MAX_PATH];
+
+         if (findData.cFileName[0] == '.')
+            continue;
+         if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && is_compressed_filename(findData.cFileName))
+            continue;
+         snprintf(szFilename, sizeof(szFilename), "%s\\%s", pszPath, findData.cFileName);
+         if (add_path_to_list(pList, szFilename) != 0) {
+            FindClose(hFind);
+            return -1;
+         }
+      } while (FindNextFileA(hFind, &findData));
+
+      FindClose(hFind);
+   }
+#else
+   {
+      DIR *pDir = opendir(pszPath);
+      struct dirent *pEntry;
+
+      if (!pDir) {
+         fprintf(stderr, "error opening directory '%s'\n", pszPath);
+         return -1;
+      }
+
+      while ((pEntry = readdir(pDir)) != NULL) {
+         size_t nFilenameSize;
+         char *pszFilename;
+         int nResult = 0;
+
+         if (pEntry->d_name[0] == '.')
+            continue;
+
+         nFilenameSize = strlen(pszPath) + strlen(pEntry->d_name) + 2;
+         pszFilename = (char *)malloc(nFilenameSize);
+         if (!pszFilename) {
+            closedir(pDir);
+            fprintf(stderr, "out of memory\n");
+            return -1;
+         }
+         snprintf(pszFilename, nFilenameSize, "%s/%s", pszPath, pEntry->d_name);
+
+         if (stat(pszFilename, &st) == 0 && (S_ISDIR(st.st_mode) || (S_ISREG(st.st_mode) && !is_compressed_filename(pEntry->d_name))))
+            nResult = add_path_to_list(pList, pszFilename);
+         free(pszFilename);
+
+         if (nResult != 0) {
+            closedir(pDir);
+            return -1;
+         }
+      }
+
+      closedir(pDir);
+   }
+#endif
+
+   return 0;
+}
+
+static int read_files_list(files_list_t *pList, const char *pszListFilename) {
+   FILE *f_list;
+   char szLine[4096];
+   int nResult = 0;
+
+   /* One input file per line, optionally followed by a tab and the output file; '-' reads the list from stdin */
+   if (!strcmp(pszListFilename, "-"))
+      f_list = stdin;
+   else
+      f_list = fopen(pszListFilename, "r");
+   if (!f_list) {
+      fprintf(stderr, "error opening '%s' for reading\n", pszListFilename);
+      return -1;
+   }
+
+   while (!nResult && fgets(szLine, sizeof(szLine), f_list)) {
+      size_t nLen = strlen(szLine);
+      char *pszOutFilename;
+      struct stat st;
+
+      while (nLen > 0 && (szLine[nLen - 1] == '\n' || szLine[nLen - 1] == '\r'))
+         szLine[--nLen] = 0;
+      if (nLen == 0)
+         continue;
+
+      pszOutFilename = strchr(szLine, '\t');
+      if (pszOutFilename)
+         *pszOutFilename++ = 0;
+      if (pszOutFilename && !pszOutFilename[0])
+         pszOutFilename = NULL;
+
+      /* Files that can't be looked at now are still listed, and fail to compress with the error they get then */
+      nResult = add_file_to_list(pList, szLine, pszOutFilename, (stat(szLine, &st) == 0) ? (long long)st.st_size : 0LL);
+   }
+
+   if (f_list != stdin)
+      fclose(f_list);
+   return nResult;
+}
+
+static void compression_file_done(const lz4ultra_file_item_t *pItem) {
+   if (pItem->nStatus == LZ4ULTRA_OK) {
+      fprintf(stdout, "Compressed '%s' to '%s', %lld into %lld bytes ==> %g %%\n", pItem->pszInFilename, pItem->pszOutFilename,
+         pItem->nOriginalSize, pItem->nCompressedSize, pItem->nOriginalSize ? (double)(pItem->nCompressedSize * 100.0 / pItem->nOriginalSize) : 100.0);
+   }
+}
+
+static int do_compress_files(files_list_t *pList, const char *pszDictionaryFilename, const unsigned int nOptions, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads,
+                             size_t nBlockCacheSize, size_t nMaxMemory) {
+   long long nStartTime, nEndTime;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   lz4ultra_prepared_dictionary_t *pDictionary = NULL;
+   lz4ultra_block_cache_t *pBlockCache = NULL;
+   lz4ultra_stats_t stats;
+   unsigned int nFlags = get_compression_flags(nOptions);
+   int nNumFailed;
+   int i;
+
+   if (nMaxMemory) {
+      /* Each thread compresses a file of its own, or a block of a large file: give each one an equal share of the budget,
+       * running fewer threads before settling for a smaller configuration */
+      int nDictionarySize = pszDictionaryFilename ? HISTORY_SIZE : 0;
+      int nOneThread = 1;
+      size_t nFileMemory = lz4ultra_compress_get_memory_size(nFlags, nBlockMaxCode, nLevel, 1, nDictionarySize, -1LL);
+
+      while (nThreads > 1 && (nMaxMemory <= nBlockCacheSize || nFileMemory > (nMaxMemory - nBlockCacheSize) / nThreads))
+         nThreads >>= 1;
+      if (nMaxMemory <= nBlockCacheSize ||
+          lz4ultra_compress_fit_memory((nMaxMemory - nBlockCacheSize) / nThreads, &nFlags, &nBlockMaxCode, nLevel, &nOneThread, nDictionarySize, -1LL) != LZ4ULTRA_OK) {
+         fprintf(stderr, "error: files can't be compressed within %llu Mb of memory\n", (unsigned long long)(nMaxMemory >> 20));
+         return 100;
+      }
+      if (nOptions & OPT_VERBOSE)
+         print_memory_fit(nFlags, nBlockMaxCode, nLevel, nThreads, nDictionarySize, -1LL, nMaxMemory - nBlockCacheSize);
+   }
+
+   nStartTime = do_get_time();
+
+   /* Sort the dictionary once for all the files */
+   if (pszDictionaryFilename) {
+      lz4ultra_status_t nStatus = (lz4ultra_status_t)lz4ultra_dictionary_prepare_file(pszDictionaryFilename, &pDictionary);
+      if (nStatus) {
+         print_compression_error(nStatus, NULL, NULL, pszDictionaryFilename);
+         return 100;
+      }
+   }
+
+   /* One cache for all the files, so that a file that repeats another one is found in it too */
+   if (nBlockCacheSize) {
+      pBlockCache = lz4ultra_block_cache_create(nBlockCacheSize);
+      if (!pBlockCache) {
+         lz4ultra_dictionary_release(pDictionary);
+         fprintf(stderr, "out of memory\n");
+         return 100;
+      }
+   }
+
+   nNumFailed = lz4ultra_compress_files(pList->pItems, pList->nNumItems, pDictionary, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads, pBlockCache,
+      (nOptions & OPT_VERBOSE) ? compression_file_done : NULL, (nOptions & OPT_VERBOSE) ? &stats : NULL);
+   lz4ultra_block_cache_free(pBlockCache);
+   lz4ultra_dictionary_release(pDictionary);
+
+   nEndTime = do_get_time();
+
+   if (nNumFailed < 0) {
+      fprintf(stderr, "out of memory\n");
+      return 100;
+   }
+
+   for (i = 0; i < pList->nNumItems; i++) {
+      const lz4ultra_file_item_t *pItem = &pList->pItems[i];
+
+      if (pItem->nStatus == LZ4ULTRA_OK) {
+         nOriginalSize += pItem->nOriginalSize;
+         nCompressedSize += pItem->nCompressedSize;
+      }
+      else
+         print_compression_error(pItem->nStatus, pItem->pszInFilename, pItem->pszOutFilename, pszDictionaryFilename);
+   }
+
+   double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+   double fSpeed = (fDelta > 0.0) ? (((double)nOriginalSize / 1048576.0) / fDelta) : 0.0;
+   fprintf(stdout, "Compressed %d files in %g seconds, %.02f Mb/s, %lld into %lld bytes ==> %g %%\n",
+      pList->nNumItems - nNumFailed, fDelta, fSpeed, nOriginalSize, nCompressedSize, nOriginalSize ? (double)(nCompressedSize * 100.0 / nOriginalSize) : 100.0);
+   if (nOptions & OPT_VERBOSE)
+      print_compression_stats(&stats);
+
+   if (nNumFailed) {
+      fprintf(stderr, "%d of %d files failed to compress\n", nNumFailed, pList->nNumItems);
+      return 100;
+   }
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int do_decompress(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nThreads) {
    long long nStartTime = 0LL, nEndTime = 0LL;
    long long nOriginalSize = 0LL, nCompressedSize = 0LL;
    lz4ultra_status_t nStatus;
@@ -169,12 +628,18 @@ static int do_decompress(const char *pszInFilename, const char *pszOutFilename,
    nFlags = 0;
    if (nOptions & OPT_RAW)
       nFlags |= LZ4ULTRA_FLAG_RAW_BLOCK;
+   if (nOptions & OPT_TRUSTED_INPUT)
+      nFlags |= LZ4ULTRA_FLAG_TRUSTED_INPUT;
+   if (nOptions & OPT_ASYNC_IO)
+      nFlags |= LZ4ULTRA_FLAG_ASYNC_IO;
+   if (nOptions & OPT_LOW_MEMORY)
+      nFlags |= LZ4ULTRA_FLAG_LOW_MEMORY;
 
    if (nOptions & OPT_VERBOSE) {
       nStartTime = do_get_time();
    }
 
-   nStatus = lz4ultra_decompress_file(pszInFilename, pszOutFilename, pszDictionaryFilename, nFlags, &nOriginalSize, &nCompressedSize);
+   nStatus = lz4ultra_decompress_file(pszInFilename, pszOutFilename, pszDictionaryFilename, nFlags, nThreads, &nOriginalSize, &nCompressedSize);
 
    switch (nStatus) {
    case LZ4ULTRA_ERROR_SRC: fprintf(stderr, "error reading '%s'\n", pszInFilename); break;
@@ -207,6 +672,103 @@ static int do_decompress(const char *pszInFilename, const char *pszOutFilename,
 
 /*---------------------------------------------------------------------------*/
 
+static int do_decompress_range(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions,
+                               long long nRangeOffset, long long nRangeSize) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   lz4ultra_status_t nStatus;
+   int nFlags;
+
+   nFlags = 0;
+   if (nOptions & OPT_TRUSTED_INPUT)
+      nFlags |= LZ4ULTRA_FLAG_TRUSTED_INPUT;
+
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   nStatus = lz4ultra_decompress_range_file(pszInFilename, pszOutFilename, pszDictionaryFilename, nFlags, nRangeOffset, nRangeSize, &nOriginalSize, &nCompressedSize);
+
+   switch (nStatus) {
+   case LZ4ULTRA_ERROR_SRC: fprintf(stderr, "error reading '%s'\n", pszInFilename); break;
+   case LZ4ULTRA_ERROR_DST: fprintf(stderr, "error writing '%s'\n", pszOutFilename); break;
+   case LZ4ULTRA_ERROR_DICTIONARY: fprintf(stderr, "error reading dictionary '%s'\n", pszDictionaryFilename); break;
+   case LZ4ULTRA_ERROR_MEMORY: fprintf(stderr, "out of memory\n"); break;
+   case LZ4ULTRA_ERROR_FORMAT: fprintf(stderr, "no valid seek table in input file, or invalid block in range (compress with --seekable)\n"); break;
+   case LZ4ULTRA_ERROR_CHECKSUM: fprintf(stderr, "invalid checksum in input file\n"); break;
+   case LZ4ULTRA_ERROR_DECOMPRESSION: fprintf(stderr, "internal decompression error\n"); break;
+   case LZ4ULTRA_OK: break;
+   default: fprintf(stderr, "unknown decompression error %d\n", nStatus); break;
+   }
+
+   if (nStatus) {
+      fprintf(stderr, "decompression error for '%s'\n", pszInFilename);
+      return 100;
+   }
+   else {
+      if (nOptions & OPT_VERBOSE) {
+         nEndTime = do_get_time();
+         double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+         fprintf(stdout, "Decompressed %lld bytes at offset %lld out of '%s', from %lld compressed bytes, in %g seconds\n",
+            nOriginalSize, nRangeOffset, pszInFilename, nCompressedSize, fDelta);
+      }
+
+      return 0;
+   }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int do_verify(const char *pszInFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nThreads) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   lz4ultra_status_t nStatus;
+   int nFlags;
+
+   nFlags = 0;
+   if (nOptions & OPT_RAW)
+      nFlags |= LZ4ULTRA_FLAG_RAW_BLOCK;
+   if (nOptions & OPT_ASYNC_IO)
+      nFlags |= LZ4ULTRA_FLAG_ASYNC_IO;
+   if (nOptions & OPT_LOW_MEMORY)
+      nFlags |= LZ4ULTRA_FLAG_LOW_MEMORY;
+
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   nStatus = lz4ultra_verify_file(pszInFilename, pszDictionaryFilename, nFlags, nThreads, &nOriginalSize, &nCompressedSize);
+
+   switch (nStatus) {
+   case LZ4ULTRA_ERROR_SRC: fprintf(stderr, "error reading '%s'\n", pszInFilename); break;
+   case LZ4ULTRA_ERROR_DICTIONARY: fprintf(stderr, "error reading dictionary '%s'\n", pszDictionaryFilename); break;
+   case LZ4ULTRA_ERROR_MEMORY: fprintf(stderr, "out of memory\n"); break;
+   case LZ4ULTRA_ERROR_FORMAT: fprintf(stderr, "invalid magic number, version, flags, or block size in input file\n"); break;
+   case LZ4ULTRA_ERROR_CHECKSUM: fprintf(stderr, "invalid checksum in input file\n"); break;
+   case LZ4ULTRA_ERROR_DECOMPRESSION: fprintf(stderr, "internal decompression error\n"); break;
+   case LZ4ULTRA_OK: break;
+   default: fprintf(stderr, "unknown verification error %d\n", nStatus); break;
+   }
+
+   if (nStatus) {
+      fprintf(stderr, "verification failed for '%s'\n", pszInFilename);
+      return 100;
+   }
+   else {
+      if (nOptions & OPT_VERBOSE) {
+         nEndTime = do_get_time();
+         double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+         double fSpeed = ((double)nCompressedSize / 1048576.0) / fDelta;
+         fprintf(stdout, "Verified '%s' (%lld bytes) in %g seconds, %g Mb/s\n",
+            pszInFilename, nCompressedSize, fDelta, fSpeed);
+      }
+
+      return 0;
+   }
+}
+
+/*---------------------------------------------------------------------------*/
+
 typedef struct {
    FILE *f;
    void *pCompareDataBuf;
@@ -322,7 +884,7 @@ static int do_compare(const char *pszInFilename, const char *pszOutFilename, con
       nStartTime = do_get_time();
    }
 
-   nStatus = lz4ultra_decompress_stream(&inStream, &compareStream, pDictionaryData, nDictionaryDataSize, nFlags, &nOriginalSize, &nCompressedSize);
+   nStatus = lz4ultra_decompress_stream(&inStream, &compareStream, pDictionaryData, nDictionaryDataSize, nFlags, 1, &nOriginalSize, &nCompressedSize);
    switch (nStatus) {
    case LZ4ULTRA_ERROR_SRC: fprintf(stderr, "error reading '%s'\n", pszInFilename); break;
    case LZ4ULTRA_ERROR_DST: fprintf(stderr, "error comparing compressed file '%s' with original '%s'\n", pszInFilename, pszOutFilename); break;
@@ -412,7 +974,7 @@ static void xor_data(unsigned char *pBuffer, size_t nBufferSize, unsigned int nS
    }
 }
 
-static int do_self_test(const unsigned int nOptions, int nBlockMaxCode) {
+static int do_self_test(const unsigned int nOptions, int nBlockMaxCode, int nLevel) {
    unsigned char *pGeneratedData;
    unsigned char *pCompressedData;
    unsigned char *pTmpCompressedData;
@@ -432,6 +994,18 @@ static int do_self_test(const unsigned int nOptions, int nBlockMaxCode) {
       nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
    if (nOptions & OPT_LEGACY_FRAMES)
       nFlags |= LZ4ULTRA_FLAG_LEGACY_FRAMES;
+   if (nOptions & OPT_BT_MATCHFINDER)
+      nFlags |= LZ4ULTRA_FLAG_BT_MATCHFINDER;
+   if (nOptions & OPT_HC_MATCHFINDER)
+      nFlags |= LZ4ULTRA_FLAG_HC_MATCHFINDER;
+   if (nOptions & OPT_CLOSER_OFFSETS)
+      nFlags |= LZ4ULTRA_FLAG_MATCH_CANDIDATES;
+   if (nOptions & OPT_CONTENT_SIZE)
+      nFlags |= LZ4ULTRA_FLAG_CONTENT_SIZE;
+   if (nOptions & OPT_CONTENT_CHECKSUM)
+      nFlags |= LZ4ULTRA_FLAG_CONTENT_CHECKSUM;
+   if (nOptions & OPT_BLOCK_CHECKSUM)
+      nFlags |= LZ4ULTRA_FLAG_BLOCK_CHECKSUM;
 
    pGeneratedData = (unsigned char*)malloc(4 * HISTORY_SIZE);
    if (!pGeneratedData) {
@@ -480,7 +1054,44 @@ static int do_self_test(const unsigned int nOptions, int nBlockMaxCode) {
    /* Test compressing with a too small buffer to do anything, expect to fail cleanly */
    for (i = 0; i < 12; i++) {
       generate_compressible_data(pGeneratedData, i, nSeed, 256, 0.5f);
-      lz4ultra_compress_inmem(pGeneratedData, pCompressedData, i, i, nFlags, nBlockMaxCode);
+      lz4ultra_compress_inmem(pGeneratedData, pCompressedData, i, i, NULL, 0, nFlags, nBlockMaxCode, nLevel);
+   }
+
+   /* Test compressing random data that repeats a whole match window or almost that far back, expect it to be compressed and not stored */
+   for (i = 0; i < 2; i++) {
+      const int nPeriod = i ? 65000 : 32768;
+      size_t nIndex;
+
+      /* Independent blocks too short to hold a few periods can't be compressed */
+      if ((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) && (1 << (8 + (nBlockMaxCode << 1))) < (4 * nPeriod))
+         continue;
+
+      nGeneratedDataSize = 4 * HISTORY_SIZE;
+      srand(nSeed);
+      for (nIndex = 0; nIndex < nPeriod; nIndex++)
+         pGeneratedData[nIndex] = rand() & 0xff;
+      for (; nIndex < nGeneratedDataSize; nIndex++)
+         pGeneratedData[nIndex] = pGeneratedData[nIndex - nPeriod];
+
+      size_t nActualCompressedSize = lz4ultra_compress_inmem(pGeneratedData, pCompressedData, nGeneratedDataSize, lz4ultra_get_max_compressed_size_inmem(nGeneratedDataSize, nFlags, nBlockMaxCode),
+         NULL, 0, nFlags, nBlockMaxCode, nLevel);
+      size_t nActualDecompressedSize = -1;
+      if (nActualCompressedSize != -1)
+         nActualDecompressedSize = lz4ultra_decompress_inmem(pCompressedData, pTmpDecompressedData, nActualCompressedSize, nGeneratedDataSize, NULL, 0, nFlags);
+      if (nActualCompressedSize == -1 || nActualCompressedSize >= (nGeneratedDataSize >> 1) ||
+         nActualDecompressedSize != nGeneratedDataSize || memcmp(pGeneratedData, pTmpDecompressedData, nGeneratedDataSize)) {
+         free(pTmpDecompressedData);
+         pTmpDecompressedData = NULL;
+         free(pTmpCompressedData);
+         pTmpCompressedData = NULL;
+         free(pCompressedData);
+         pCompressedData = NULL;
+         free(pGeneratedData);
+         pGeneratedData = NULL;
+
+         fprintf(stderr, "\nself-test: error compressing data repeating every %d bytes, size %zd, compressed to %zd bytes\n", nPeriod, nGeneratedDataSize, nActualCompressedSize);
+         return 100;
+      }
    }
 
    size_t nDataSizeStep = 128;
@@ -503,7 +1114,7 @@ static int do_self_test(const unsigned int nOptions, int nBlockMaxCode) {
 
             /* Try to compress it, expected to succeed */
             size_t nActualCompressedSize = lz4ultra_compress_inmem(pGeneratedData, pCompressedData, nGeneratedDataSize, lz4ultra_get_max_compressed_size_inmem(nGeneratedDataSize, nFlags, nBlockMaxCode), 
-               nFlags, nBlockMaxCode);
+               NULL, 0, nFlags, nBlockMaxCode, nLevel);
             if (nActualCompressedSize == -1 || nActualCompressedSize < (LZ4ULTRA_HEADER_SIZE + LZ4ULTRA_FRAME_SIZE + LZ4ULTRA_FRAME_SIZE /* footer */)) {
                free(pTmpDecompressedData);
                pTmpDecompressedData = NULL;
@@ -520,7 +1131,7 @@ static int do_self_test(const unsigned int nOptions, int nBlockMaxCode) {
 
             /* Try to decompress it, expected to succeed */
             size_t nActualDecompressedSize;
-            nActualDecompressedSize = lz4ultra_decompress_inmem(pCompressedData, pTmpDecompressedData, nActualCompressedSize, nGeneratedDataSize, nFlags);
+            nActualDecompressedSize = lz4ultra_decompress_inmem(pCompressedData, pTmpDecompressedData, nActualCompressedSize, nGeneratedDataSize, NULL, 0, nFlags);
             if (nActualDecompressedSize == -1) {
                free(pTmpDecompressedData);
                pTmpDecompressedData = NULL;
@@ -553,7 +1164,7 @@ static int do_self_test(const unsigned int nOptions, int nBlockMaxCode) {
             for (fXorProbability = 0.05f; fXorProbability <= 0.5f; fXorProbability += 0.05f) {
                memcpy(pTmpCompressedData, pCompressedData, nActualCompressedSize);
                xor_data(pTmpCompressedData + LZ4ULTRA_HEADER_SIZE + LZ4ULTRA_FRAME_SIZE, nActualCompressedSize - LZ4ULTRA_HEADER_SIZE - LZ4ULTRA_FRAME_SIZE - LZ4ULTRA_FRAME_SIZE /* footer */, nSeed, fXorProbability);
-               lz4ultra_decompress_inmem(pTmpCompressedData, pGeneratedData, nActualCompressedSize, nGeneratedDataSize, nFlags);
+               lz4ultra_decompress_inmem(pTmpCompressedData, pGeneratedData, nActualCompressedSize, nGeneratedDataSize, NULL, 0, nFlags);
             }
          }
 
@@ -589,7 +1200,7 @@ static int do_self_test(const unsigned int nOptions, int nBlockMaxCode) {
 
 /*---------------------------------------------------------------------------*/
 
-static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nBlockMaxCode) {
+static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads) {
    size_t nFileSize, nMaxCompressedSize;
    unsigned char *pFileData;
    unsigned char *pCompressedData;
@@ -605,9 +1216,30 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
       nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
    if (nOptions & OPT_LEGACY_FRAMES)
       nFlags |= LZ4ULTRA_FLAG_LEGACY_FRAMES;
+   if (nOptions & OPT_BT_MATCHFINDER)
+      nFlags |= LZ4ULTRA_FLAG_BT_MATCHFINDER;
+   if (nOptions & OPT_HC_MATCHFINDER)
+      nFlags |= LZ4ULTRA_FLAG_HC_MATCHFINDER;
+   if (nOptions & OPT_CLOSER_OFFSETS)
+      nFlags |= LZ4ULTRA_FLAG_MATCH_CANDIDATES;
+   if (nOptions & OPT_CONTENT_SIZE)
+      nFlags |= LZ4ULTRA_FLAG_CONTENT_SIZE;
+   if (nOptions & OPT_CONTENT_CHECKSUM)
+      nFlags |= LZ4ULTRA_FLAG_CONTENT_CHECKSUM;
+   if (nOptions & OPT_BLOCK_CHECKSUM)
+      nFlags |= LZ4ULTRA_FLAG_BLOCK_CHECKSUM;
+   if (nOptions & OPT_HUGE_PAGES)
+      nFlags |= LZ4ULTRA_FLAG_HUGE_PAGES;
+
+   if (pszDictionaryFilename && nThreads > 1) {
+      fprintf(stderr, "parallel in-memory benchmarking does not support dictionaries\n");
+      return 100;
+   }
 
-   if (pszDictionaryFilename) {
-      fprintf(stderr, "in-memory benchmarking does not support dictionaries\n");
+   /* Prepare the dictionary once, like a caller compressing many inputs with it would */
+   lz4ultra_prepared_dictionary_t *pDictionary = NULL;
+   if (lz4ultra_dictionary_prepare_file(pszDictionaryFilename, &pDictionary) != 0) {
+      fprintf(stderr, "error reading dictionary '%s'\n", pszDictionaryFilename);
       return 100;
    }
 
@@ -615,6 +1247,7 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
 
    FILE *f_in = fopen(pszInFilename, "rb");
    if (!f_in) {
+      lz4ultra_dictionary_release(pDictionary);
       fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
       return 100;
    }
@@ -626,12 +1259,14 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
    pFileData = (unsigned char*)malloc(nFileSize);
    if (!pFileData) {
       fclose(f_in);
+      lz4ultra_dictionary_release(pDictionary);
       fprintf(stderr, "out of memory for reading '%s', %zd bytes needed\n", pszInFilename, nFileSize);
       return 100;
    }
 
    if (fread(pFileData, 1, nFileSize, f_in) != nFileSize) {
       free(pFileData);
+      lz4ultra_dictionary_release(pDictionary);
       fclose(f_in);
       fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
       return 100;
@@ -646,6 +1281,7 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
    pCompressedData = (unsigned char*)malloc(nMaxCompressedSize + 2048);
    if (!pCompressedData) {
       free(pFileData);
+      lz4ultra_dictionary_release(pDictionary);
       fprintf(stderr, "out of memory for compressing '%s', %zd bytes needed\n", pszInFilename, nMaxCompressedSize);
       return 100;
    }
@@ -657,6 +1293,18 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
    size_t nActualCompressedSize = 0;
    size_t nRightGuardPos = nMaxCompressedSize;
 
+   /* Reuse the same context for all runs, like a long-running caller would */
+   lz4ultra_compressor *pCompressor = lz4ultra_compressor_create(0, nFlags, NULL, 0);
+   if (!pCompressor) {
+      free(pCompressedData);
+      free(pFileData);
+      lz4ultra_dictionary_release(pDictionary);
+      fprintf(stderr, "out of memory for compressing '%s'\n", pszInFilename);
+      return 100;
+   }
+   lz4ultra_compressor_set_decode_cost(pCompressor, nDecodeCost, NULL);
+   lz4ultra_compressor_set_stats(pCompressor, (nOptions & OPT_VERBOSE) ? 1 : 0);
+
    for (i = 0; i < 5; i++) {
       unsigned char nGuard = 0x33 + i;
       int j;
@@ -666,11 +1314,16 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
       memset(pCompressedData + 1024 + nRightGuardPos, nGuard, 1024);
 
       long long t0 = do_get_time();
-      nActualCompressedSize = lz4ultra_compress_inmem(pFileData, pCompressedData + 1024, nFileSize, nRightGuardPos, nFlags, nBlockMaxCode);
+      if (nThreads > 1)
+         nActualCompressedSize = lz4ultra_compress_inmem_parallel(pFileData, pCompressedData + 1024, nFileSize, nRightGuardPos, nFlags, nBlockMaxCode, nLevel, nThreads, NULL, NULL);
+      else
+         nActualCompressedSize = lz4ultra_compress_inmem_with_dictionary(pCompressor, pDictionary, pFileData, pCompressedData + 1024, nFileSize, nRightGuardPos, nFlags, nBlockMaxCode, nLevel);
       long long t1 = do_get_time();
       if (nActualCompressedSize == -1) {
+         lz4ultra_compressor_free(pCompressor);
          free(pCompressedData);
          free(pFileData);
+         lz4ultra_dictionary_release(pDictionary);
          fprintf(stderr, "compression error\n");
          return 100;
       }
@@ -682,8 +1335,10 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
       /* Check guard bytes before the output buffer */
       for (j = 0; j < 1024; j++) {
          if (pCompressedData[j] != nGuard) {
+            lz4ultra_compressor_free(pCompressor);
             free(pCompressedData);
             free(pFileData);
+            lz4ultra_dictionary_release(pDictionary);
             fprintf(stderr, "error, wrote outside of output buffer at %d!\n", j - 1024);
             return 100;
          }
@@ -692,8 +1347,10 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
       /* Check guard bytes after the output buffer */
       for (j = 0; j < 1024; j++) {
          if (pCompressedData[1024 + nRightGuardPos + j] != nGuard) {
+            lz4ultra_compressor_free(pCompressor);
             free(pCompressedData);
             free(pFileData);
+            lz4ultra_dictionary_release(pDictionary);
             fprintf(stderr, "error, wrote outside of output buffer at %d!\n", j);
             return 100;
          }
@@ -714,18 +1371,72 @@ static int do_compr_benchmark(const char *pszInFilename, const char *pszOutFilen
       }
    }
 
+   int nSkippedBlocks = lz4ultra_compressor_get_skipped_block_count(pCompressor);
+   lz4ultra_stats_t stats = *lz4ultra_compressor_get_stats(pCompressor);
+
+   lz4ultra_compressor_free(pCompressor);
    free(pCompressedData);
    free(pFileData);
+   lz4ultra_dictionary_release(pDictionary);
 
    fprintf(stdout, "compressed size: %zd bytes\n", nActualCompressedSize);
+   if (nThreads <= 1)
+      fprintf(stdout, "incompressible blocks stored without compressing: %d\n", nSkippedBlocks);
    fprintf(stdout, "compression time: %lld microseconds (%g Mb/s)\n", nBestCompTime, ((double)nActualCompressedSize / 1024.0) / ((double)nBestCompTime / 1000.0));
 
+   /* Statistics of the last run */
+   if ((nOptions & OPT_VERBOSE) && nThreads <= 1)
+      print_compression_stats(&stats);
+
    return 0;
 }
 
 /*---------------------------------------------------------------------------*/
 
-static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions) {
+static void print_histogram(const char *pszName, const long long *pHistogram) {
+   long long nTotal = 0;
+   int i;
+
+   for (i = 0; i < LZ4ULTRA_HISTOGRAM_SIZE; i++)
+      nTotal += pHistogram[i];
+
+   fprintf(stdout, "%s:\n", pszName);
+   for (i = 0; i < LZ4ULTRA_HISTOGRAM_SIZE; i++) {
+      if (pHistogram[i]) {
+         char szRange[32];
+
+         if (i <= 1)
+            snprintf(szRange, sizeof(szRange), "%d", i);
+         else if (i == LZ4ULTRA_HISTOGRAM_SIZE - 1)
+            snprintf(szRange, sizeof(szRange), "%u+", 1U << (i - 1));
+         else
+            snprintf(szRange, sizeof(szRange), "%u-%u", 1U << (i - 1), (1U << i) - 1);
+         fprintf(stdout, "  %-20s %12lld  %5.1f %%\n", szRange, pHistogram[i], (double)pHistogram[i] * 100.0 / (double)nTotal);
+      }
+   }
+}
+
+static void print_decompression_stats(const lz4ultra_decompression_stats_t *pStats) {
+   static const char *g_pszPathNames[LZ4ULTRA_DECODE_NUM_PATHS] = {
+      "literals, 16-byte copy", "literals, exact copy", "match, 18-byte copy", "match, 16-byte loop", "match, short offset repeat", "match, byte copy", "match, from dictionary"
+   };
+   long long nTotalBytes = 0;
+   int i;
+
+   for (i = 0; i < LZ4ULTRA_DECODE_NUM_PATHS; i++)
+      nTotalBytes += pStats->path_bytes[i];
+
+   fprintf(stdout, "Decoder paths (%lld blocks, %lld tokens):\n", pStats->num_blocks, pStats->num_tokens);
+   for (i = 0; i < LZ4ULTRA_DECODE_NUM_PATHS; i++) {
+      fprintf(stdout, "  %-27s %12lld times %14lld bytes  %5.1f %%\n", g_pszPathNames[i], pStats->path_count[i], pStats->path_bytes[i],
+         nTotalBytes ? ((double)pStats->path_bytes[i] * 100.0 / (double)nTotalBytes) : 0.0);
+   }
+   print_histogram("Literal run lengths", pStats->literals_histogram);
+   print_histogram("Match lengths", pStats->match_len_histogram);
+   print_histogram("Match offsets", pStats->offset_histogram);
+}
+
+static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nOptions, int nThreads) {
    size_t nFileSize, nMaxDecompressedSize;
    unsigned char *pFileData;
    unsigned char *pDecompressedData;
@@ -735,9 +1446,18 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
    nFlags = 0;
    if (nOptions & OPT_RAW)
       nFlags |= LZ4ULTRA_FLAG_RAW_BLOCK;
+   if (nOptions & OPT_TRUSTED_INPUT)
+      nFlags |= LZ4ULTRA_FLAG_TRUSTED_INPUT;
 
-   if (pszDictionaryFilename) {
-      fprintf(stderr, "in-memory benchmarking does not support dictionaries\n");
+   if (pszDictionaryFilename && nThreads > 1) {
+      fprintf(stderr, "parallel in-memory benchmarking does not support dictionaries\n");
+      return 100;
+   }
+
+   void *pDictionaryData = NULL;
+   int nDictionaryDataSize = 0;
+   if (lz4ultra_dictionary_load(pszDictionaryFilename, &pDictionaryData, &nDictionaryDataSize) != 0) {
+      fprintf(stderr, "error reading dictionary '%s'\n", pszDictionaryFilename);
       return 100;
    }
    
@@ -745,6 +1465,7 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
 
    FILE *f_in = fopen(pszInFilename, "rb");
    if (!f_in) {
+      lz4ultra_dictionary_free(&pDictionaryData);
       fprintf(stderr, "error opening '%s' for reading\n", pszInFilename);
       return 100;
    }
@@ -756,12 +1477,14 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
    pFileData = (unsigned char*)malloc(nFileSize);
    if (!pFileData) {
       fclose(f_in);
+      lz4ultra_dictionary_free(&pDictionaryData);
       fprintf(stderr, "out of memory for reading '%s', %zd bytes needed\n", pszInFilename, nFileSize);
       return 100;
    }
 
    if (fread(pFileData, 1, nFileSize, f_in) != nFileSize) {
       free(pFileData);
+      lz4ultra_dictionary_free(&pDictionaryData);
       fclose(f_in);
       fprintf(stderr, "I/O error while reading '%s'\n", pszInFilename);
       return 100;
@@ -777,6 +1500,7 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
       nMaxDecompressedSize = lz4ultra_inmem_get_max_decompressed_size(pFileData, nFileSize);
    if (nMaxDecompressedSize == -1) {
       free(pFileData);
+      lz4ultra_dictionary_free(&pDictionaryData);
       fprintf(stderr, "invalid compressed format for file '%s'\n", pszInFilename);
       return 100;
    }
@@ -784,6 +1508,7 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
    pDecompressedData = (unsigned char*)malloc(nMaxDecompressedSize);
    if (!pDecompressedData) {
       free(pFileData);
+      lz4ultra_dictionary_free(&pDictionaryData);
       fprintf(stderr, "out of memory for decompressing '%s', %zd bytes needed\n", pszInFilename, nMaxDecompressedSize);
       return 100;
    }
@@ -795,11 +1520,15 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
    size_t nActualDecompressedSize = 0;
    for (i = 0; i < 50; i++) {
       long long t0 = do_get_time();
-      nActualDecompressedSize = lz4ultra_decompress_inmem(pFileData, pDecompressedData, nFileSize, nMaxDecompressedSize, nFlags);
+      if (nThreads > 1)
+         nActualDecompressedSize = lz4ultra_decompress_inmem_parallel(pFileData, pDecompressedData, nFileSize, nMaxDecompressedSize, nFlags, nThreads, NULL, NULL);
+      else
+         nActualDecompressedSize = lz4ultra_decompress_inmem(pFileData, pDecompressedData, nFileSize, nMaxDecompressedSize, pDictionaryData, nDictionaryDataSize, nFlags);
       long long t1 = do_get_time();
       if (nActualDecompressedSize == -1) {
          free(pDecompressedData);
          free(pFileData);
+         lz4ultra_dictionary_free(&pDictionaryData);
          fprintf(stderr, "decompression error\n");
          return 100;
       }
@@ -809,6 +1538,17 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
          nBestDecTime = nCurDecTime;
    }
 
+   /* Run the instrumented decoder once more, outside of the timed runs */
+   lz4ultra_decompression_stats_t stats;
+   memset(&stats, 0, sizeof(stats));
+   if ((nOptions & OPT_VERBOSE) && lz4ultra_decompress_inmem_with_stats(pFileData, pDecompressedData, nFileSize, nMaxDecompressedSize, pDictionaryData, nDictionaryDataSize, nFlags, &stats) != nActualDecompressedSize) {
+      free(pDecompressedData);
+      free(pFileData);
+      lz4ultra_dictionary_free(&pDictionaryData);
+      fprintf(stderr, "decompression error\n");
+      return 100;
+   }
+
    if (pszOutFilename) {
       FILE *f_out;
 
@@ -823,9 +1563,122 @@ static int do_dec_benchmark(const char *pszInFilename, const char *pszOutFilenam
 
    free(pDecompressedData);
    free(pFileData);
+   lz4ultra_dictionary_free(&pDictionaryData);
 
    fprintf(stdout, "decompressed size: %zd bytes\n", nActualDecompressedSize);
    fprintf(stdout, "decompression time: %lld microseconds (%g Mb/s)\n", nBestDecTime, ((double)nActualDecompressedSize / 1024.0) / ((double)nBestDecTime / 1000.0));
+   if (nOptions & OPT_VERBOSE)
+      print_decompression_stats(&stats);
+
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static int do_train(const char **ppszSampleFilenames, const int nNumSampleFiles, const char *pszOutFilename, const unsigned int nOptions) {
+   long long nStartTime = 0LL, nEndTime = 0LL;
+   unsigned char *pSamplesData = NULL;
+   size_t *pSampleSizes;
+   size_t nSamplesDataSize = 0;
+   unsigned char pDictionaryData[HISTORY_SIZE];
+   int nNumSamples = 0;
+   int nDictionarySize;
+   int i;
+
+   pSampleSizes = (size_t *)malloc(nNumSampleFiles * sizeof(size_t));
+   if (!pSampleSizes) {
+      fprintf(stderr, "out of memory\n");
+      return 100;
+   }
+
+   /* Read all samples in memory, one after the other */
+
+   for (i = 0; i < nNumSampleFiles; i++) {
+      FILE *f_in = fopen(ppszSampleFilenames[i], "rb");
+      if (!f_in) {
+         if (pSamplesData)
+            free(pSamplesData);
+         free(pSampleSizes);
+         fprintf(stderr, "error opening '%s' for reading\n", ppszSampleFilenames[i]);
+         return 100;
+      }
+
+      fseek(f_in, 0, SEEK_END);
+      size_t nFileSize = (size_t)ftell(f_in);
+      fseek(f_in, 0, SEEK_SET);
+
+      if (nFileSize > (LZ4ULTRA_TRAIN_MAX_SAMPLES_SIZE - nSamplesDataSize)) {
+         /* Training wouldn't look at this sample or the next ones */
+         fclose(f_in);
+         break;
+      }
+
+      unsigned char *pNewSamplesData = (unsigned char *)realloc(pSamplesData, nSamplesDataSize + nFileSize + 1);
+      if (!pNewSamplesData) {
+         fclose(f_in);
+         if (pSamplesData)
+            free(pSamplesData);
+         free(pSampleSizes);
+         fprintf(stderr, "out of memory for reading '%s', %zd bytes needed\n", ppszSampleFilenames[i], nFileSize);
+         return 100;
+      }
+      pSamplesData = pNewSamplesData;
+
+      if (fread(pSamplesData + nSamplesDataSize, 1, nFileSize, f_in) != nFileSize) {
+         fclose(f_in);
+         free(pSamplesData);
+         free(pSampleSizes);
+         fprintf(stderr, "I/O error while reading '%s'\n", ppszSampleFilenames[i]);
+         return 100;
+      }
+
+      fclose(f_in);
+
+      nSamplesDataSize += nFileSize;
+      pSampleSizes[nNumSamples++] = nFileSize;
+   }
+
+   if ((nOptions & OPT_VERBOSE) && nNumSamples < nNumSampleFiles) {
+      fprintf(stdout, "only using the first %d samples (%d Mb max.)\n", nNumSamples, LZ4ULTRA_TRAIN_MAX_SAMPLES_SIZE >> 20);
+   }
+
+   if (nOptions & OPT_VERBOSE) {
+      nStartTime = do_get_time();
+   }
+
+   nDictionarySize = lz4ultra_dictionary_train(pDictionaryData, HISTORY_SIZE, pSamplesData, pSampleSizes, nNumSamples);
+
+   if (pSamplesData)
+      free(pSamplesData);
+   free(pSampleSizes);
+
+   if (nDictionarySize < 0) {
+      fprintf(stderr, "training error\n");
+      return 100;
+   }
+
+   /* Write dictionary out */
+
+   FILE *f_out = fopen(pszOutFilename, "wb");
+   if (!f_out) {
+      fprintf(stderr, "error opening '%s' for writing\n", pszOutFilename);
+      return 100;
+   }
+
+   if (fwrite(pDictionaryData, 1, nDictionarySize, f_out) != (size_t)nDictionarySize) {
+      fclose(f_out);
+      fprintf(stderr, "I/O error while writing '%s'\n", pszOutFilename);
+      return 100;
+   }
+
+   fclose(f_out);
+
+   if (nOptions & OPT_VERBOSE) {
+      nEndTime = do_get_time();
+
+      double fDelta = ((double)(nEndTime - nStartTime)) / 1000000.0;
+      fprintf(stdout, "Trained %d byte dictionary from %d samples (%zd bytes) in %g seconds\n", nDictionarySize, nNumSamples, nSamplesDataSize, fDelta);
+   }
 
    return 0;
 }
@@ -840,11 +1693,34 @@ int main(int argc, char **argv) {
    bool bArgsError = false;
    bool bCommandDefined = false;
    bool bVerifyCompression = false;
+   bool bRecheckCompression = false;
    int nBlockMaxCode = 7;
    bool bBlockCodeDefined = false;
+   int nLevel = LZ4ULTRA_MAX_LEVEL;
+   bool bLevelDefined = false;
+   int nThreads = 1;
+   bool bThreadsDefined = false;
+   int nDecodeCost = 0;
+   bool bDecodeCostDefined = false;
    bool bBlockDependenceDefined = false;
+   long long nRangeOffset = 0LL, nRangeSize = -1LL;
+   bool bRangeDefined = false;
+   bool bMultipleFiles = false;
+   int nBlockCacheMb = 0;
+   bool bBlockCacheDefined = false;
+   int nMaxMemoryMb = 0;
+   bool bMaxMemoryDefined = false;
+   const char *pszFilesFromFilename = NULL;
    char cCommand = 'z';
    unsigned int nOptions = OPT_FAVOR_RATIO;
+   const char **ppszFilenames;
+   int nNumFilenames = 0;
+
+   ppszFilenames = (const char **)malloc(argc * sizeof(const char *));
+   if (!ppszFilenames) {
+      fprintf(stderr, "out of memory\n");
+      return 100;
+   }
 
    for (i = 1; i < argc; i++) {
       if (!strcmp(argv[i], "-d")) {
@@ -866,6 +1742,14 @@ int main(int argc, char **argv) {
       else if (!strcmp(argv[i], "-c")) {
          if (!bVerifyCompression) {
             bVerifyCompression = true;
+            nOptions |= OPT_VERIFY;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--recheck")) {
+         if (!bRecheckCompression) {
+            bRecheckCompression = true;
          }
          else
             bArgsError = true;
@@ -886,6 +1770,30 @@ int main(int argc, char **argv) {
          else
             bArgsError = true;
       }
+      else if (!strcmp(argv[i], "-verify")) {
+         if (!bCommandDefined) {
+            bCommandDefined = true;
+            cCommand = 'V';
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "-train")) {
+         if (!bCommandDefined) {
+            bCommandDefined = true;
+            cCommand = 'T';
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "-transcode")) {
+         if (!bCommandDefined) {
+            bCommandDefined = true;
+            cCommand = 'x';
+         }
+         else
+            bArgsError = true;
+      }
       else if (!strcmp(argv[i], "-test")) {
          if (!bCommandDefined) {
             bCommandDefined = true;
@@ -894,6 +1802,21 @@ int main(int argc, char **argv) {
          else
             bArgsError = true;
       }
+      else if (!strcmp(argv[i], "-m")) {
+         if (!bMultipleFiles) {
+            bMultipleFiles = true;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strncmp(argv[i], "--files-from=", 13)) {
+         if (!pszFilesFromFilename && argv[i][13]) {
+            pszFilesFromFilename = argv[i] + 13;
+            bMultipleFiles = true;
+         }
+         else
+            bArgsError = true;
+      }
       else if (!strcmp(argv[i], "-D")) {
          if (!pszDictionaryFilename && (i + 1) < argc) {
             pszDictionaryFilename = argv[i + 1];
@@ -927,6 +1850,7 @@ int main(int argc, char **argv) {
       }
       else if (!strncmp(argv[i], "-B", 2)) {
          if (!bBlockCodeDefined) {
+            bBlockCodeDefined = true;
             nBlockMaxCode = atoi(argv[i] + 2);
             if (nBlockMaxCode < 4 || nBlockMaxCode > 7)
                bArgsError = true;
@@ -934,6 +1858,28 @@ int main(int argc, char **argv) {
          else
             bArgsError = true;
       }
+      else if (!strncmp(argv[i], "-T", 2)) {
+         if (!bThreadsDefined) {
+            bThreadsDefined = true;
+            nThreads = atoi(argv[i] + 2);
+            if (nThreads == 0)
+               nThreads = lz4ultra_get_cpu_count();
+            if (nThreads < 1 || nThreads > 256)
+               bArgsError = true;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (argv[i][0] == '-' && argv[i][1] >= '0' && argv[i][1] <= '9' && argv[i][2] == 0) {
+         if (!bLevelDefined) {
+            bLevelDefined = true;
+            nLevel = argv[i][1] - '0';
+            if (nLevel < LZ4ULTRA_MIN_LEVEL || nLevel > LZ4ULTRA_MAX_LEVEL)
+               bArgsError = true;
+         }
+         else
+            bArgsError = true;
+      }
       else if (!strcmp(argv[i], "-l")) {
          if ((nOptions & OPT_LEGACY_FRAMES) == 0) {
             nOptions |= OPT_LEGACY_FRAMES;
@@ -955,6 +1901,134 @@ int main(int argc, char **argv) {
          else
             bArgsError = true;
       }
+      else if (!strcmp(argv[i], "--mf=bt")) {
+         if ((nOptions & (OPT_BT_MATCHFINDER | OPT_HC_MATCHFINDER)) == 0) {
+            nOptions |= OPT_BT_MATCHFINDER;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--mf=hc")) {
+         if ((nOptions & (OPT_BT_MATCHFINDER | OPT_HC_MATCHFINDER)) == 0) {
+            nOptions |= OPT_HC_MATCHFINDER;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--trusted-input")) {
+         if ((nOptions & OPT_TRUSTED_INPUT) == 0) {
+            nOptions |= OPT_TRUSTED_INPUT;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--closer-offsets")) {
+         if ((nOptions & OPT_CLOSER_OFFSETS) == 0) {
+            nOptions |= OPT_CLOSER_OFFSETS;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--content-size")) {
+         if ((nOptions & OPT_CONTENT_SIZE) == 0) {
+            nOptions |= OPT_CONTENT_SIZE;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--content-checksum")) {
+         if ((nOptions & OPT_CONTENT_CHECKSUM) == 0) {
+            nOptions |= OPT_CONTENT_CHECKSUM;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--block-checksum")) {
+         if ((nOptions & OPT_BLOCK_CHECKSUM) == 0) {
+            nOptions |= OPT_BLOCK_CHECKSUM;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--adaptive-blocks")) {
+         if ((nOptions & OPT_ADAPTIVE_BLOCKS) == 0) {
+            nOptions |= OPT_ADAPTIVE_BLOCKS;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--low-memory")) {
+         if ((nOptions & OPT_LOW_MEMORY) == 0) {
+            nOptions |= OPT_LOW_MEMORY;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--huge-pages")) {
+         if ((nOptions & OPT_HUGE_PAGES) == 0) {
+            nOptions |= OPT_HUGE_PAGES;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--seekable")) {
+         if ((nOptions & OPT_SEEK_TABLE) == 0) {
+            nOptions |= OPT_SEEK_TABLE;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strncmp(argv[i], "--range=", 8)) {
+         if (!bRangeDefined) {
+            char *pszEnd = NULL;
+
+            bRangeDefined = true;
+            nRangeOffset = strtoll(argv[i] + 8, &pszEnd, 10);
+            if (pszEnd && *pszEnd == ',')
+               nRangeSize = strtoll(pszEnd + 1, &pszEnd, 10);
+            if (!pszEnd || *pszEnd || nRangeOffset < 0 || nRangeSize < -1)
+               bArgsError = true;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strcmp(argv[i], "--async-io")) {
+         if ((nOptions & OPT_ASYNC_IO) == 0) {
+            nOptions |= OPT_ASYNC_IO;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strncmp(argv[i], "--dec-cost=", 11)) {
+         if (!bDecodeCostDefined) {
+            bDecodeCostDefined = true;
+            nDecodeCost = atoi(argv[i] + 11);
+            if (nDecodeCost < 0 || nDecodeCost > 1024)
+               bArgsError = true;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strncmp(argv[i], "--block-cache=", 14)) {
+         if (!bBlockCacheDefined) {
+            bBlockCacheDefined = true;
+            nBlockCacheMb = atoi(argv[i] + 14);
+            if (nBlockCacheMb < 1 || nBlockCacheMb > 65536)
+               bArgsError = true;
+         }
+         else
+            bArgsError = true;
+      }
+      else if (!strncmp(argv[i], "--max-memory=", 13)) {
+         if (!bMaxMemoryDefined) {
+            bMaxMemoryDefined = true;
+            nMaxMemoryMb = atoi(argv[i] + 13);
+            if (nMaxMemoryMb < 1 || nMaxMemoryMb > 65536)
+               bArgsError = true;
+         }
+         else
+            bArgsError = true;
+      }
       else if (!strcmp(argv[i], "--favor-decSpeed")) {
          if ((nOptions & OPT_FAVOR_RATIO) != 0) {
             nOptions &= (~OPT_FAVOR_RATIO);
@@ -963,56 +2037,144 @@ int main(int argc, char **argv) {
             bArgsError = true;
       }
       else {
-         if (!pszInFilename)
-            pszInFilename = argv[i];
-         else {
-            if (!pszOutFilename)
-               pszOutFilename = argv[i];
-            else
-               bArgsError = true;
-         }
+         ppszFilenames[nNumFilenames++] = argv[i];
+      }
+   }
+
+   if (nNumFilenames > 0)
+      pszInFilename = ppszFilenames[0];
+   if (nNumFilenames > 1)
+      pszOutFilename = ppszFilenames[1];
+   if (nNumFilenames > 2 && cCommand != 'T' && !bMultipleFiles)
+      bArgsError = true;
+
+   if (nOptions & OPT_SEEK_TABLE) {
+      /* Blocks can only be decompressed on their own if they are independent */
+      if ((bBlockDependenceDefined && (nOptions & OPT_INDEP_BLOCKS) == 0) || (nOptions & (OPT_RAW | OPT_LEGACY_FRAMES)) != 0)
+         bArgsError = true;
+      nOptions |= OPT_INDEP_BLOCKS;
+   }
+   if (bRangeDefined && (cCommand != 'd' || (nOptions & OPT_RAW) != 0))
+      bArgsError = true;
+   if (bRecheckCompression && (!bVerifyCompression || cCommand == 'x'))
+      bArgsError = true;
+   if ((bBlockCacheDefined || bMaxMemoryDefined) && cCommand != 'z')
+      bArgsError = true;
+   if (bMultipleFiles && (cCommand != 'z' || bRecheckCompression || (nNumFilenames == 0 && !pszFilesFromFilename)))
+      bArgsError = true;
+
+   if (!bArgsError && cCommand == 'T' && nNumFilenames >= 2) {
+      /* The last name is the dictionary to write, the others are the samples to train it with */
+      do_init_time();
+      int nResult = do_train(ppszFilenames, nNumFilenames - 1, ppszFilenames[nNumFilenames - 1], nOptions);
+      free(ppszFilenames);
+      return nResult;
+   }
+   if (!bArgsError && bMultipleFiles) {
+      /* Every name is an input, compressed next to itself; directories are descended into */
+      files_list_t list;
+      int nResult = 0;
+
+      memset(&list, 0, sizeof(list));
+      for (i = 0; i < nNumFilenames && !nResult; i++) {
+         if (add_path_to_list(&list, ppszFilenames[i]) != 0)
+            nResult = 100;
       }
+      if (!nResult && pszFilesFromFilename) {
+         if (read_files_list(&list, pszFilesFromFilename) != 0)
+            nResult = 100;
+      }
+      free(ppszFilenames);
+
+      if (!nResult) {
+         do_init_time();
+         nResult = do_compress_files(&list, pszDictionaryFilename, nOptions, nBlockMaxCode, nLevel, nDecodeCost, nThreads, (size_t)nBlockCacheMb << 20, (size_t)nMaxMemoryMb << 20);
+      }
+      free_files_list(&list);
+      return nResult;
    }
+   free(ppszFilenames);
+   ppszFilenames = NULL;
 
    if (!bArgsError && cCommand == 't') {
-      return do_self_test(nOptions, nBlockMaxCode);
+      return do_self_test(nOptions, nBlockMaxCode, nLevel);
+   }
+
+   if (!bArgsError && cCommand == 'V' && pszInFilename && !pszOutFilename) {
+      return do_verify(pszInFilename, pszDictionaryFilename, nOptions, nThreads);
    }
 
    if (bArgsError || !pszInFilename || !pszOutFilename) {
       fprintf(stderr, "lz4ultra v" TOOL_VERSION " by Emmanuel Marty and spke\n");
       fprintf(stderr, "usage: %s [-c] [-d] [-v] [-r] <infile> <outfile>\n", argv[0]);
-      fprintf(stderr, "              -c: check resulting stream after compressing\n");
+      fprintf(stderr, "       %s -verify [-v] [-r] [-T<n>] <infile>\n", argv[0]);
+      fprintf(stderr, "       %s -train [-v] <sample> [<sample>...] <dictionary>\n", argv[0]);
+      fprintf(stderr, "       %s -transcode [-c] [-v] [-T<n>] <infile.lz4> <outfile>\n", argv[0]);
+      fprintf(stderr, "       %s -m [-c] [-v] [-T<n>] [--files-from=<list>] <file|dir> [<file|dir>...]\n", argv[0]);
+      fprintf(stderr, "              -c: check each block right after compressing it, by decompressing it and comparing it with the input\n");
       fprintf(stderr, "              -d: decompress (default: compress)\n");
       fprintf(stderr, "         -cbench: benchmark in-memory compression\n");
       fprintf(stderr, "         -dbench: benchmark in-memory decompression\n");
+      fprintf(stderr, "         -verify: check <infile> without writing any output (blocks are only checksummed if the file has block checksums)\n");
+      fprintf(stderr, "      -transcode: recompress the LZ4 frame in <infile.lz4> in a single pass, keeping its block size and -BD/-BI unless given\n");
+      fprintf(stderr, "          -train: build a 64 Kb dictionary out of sample files, for use with -D\n");
       fprintf(stderr, "           -test: run automated self-tests\n");
       fprintf(stderr, "          -B4..7: compress with 64, 256, 1024 or 4096 Kb blocks (defaults to -B7)\n");
       fprintf(stderr, "             -BD: use block-dependent compression (default)\n");
       fprintf(stderr, "             -BI: use block-independent compression\n");
-      fprintf(stderr, "              -v: be verbose\n");
+      fprintf(stderr, "          -%d..%d: compression level, from fastest to best ratio (defaults to -%d)\n", LZ4ULTRA_MIN_LEVEL, LZ4ULTRA_MAX_LEVEL, LZ4ULTRA_MAX_LEVEL);
+      fprintf(stderr, "           -T<n>: compress <n> blocks (or suffix-sort a lone block with <n> threads), or decompress <n> independent blocks, in parallel (-T0: one per processor, defaults to -T1)\n");
+      fprintf(stderr, "              -v: be verbose, and print compression stage statistics, or decoder path statistics with -dbench\n");
       fprintf(stderr, "              -r: raw block format (max. 4 Mb files)\n");
       fprintf(stderr, "              -l: legacy format compression\n");
       fprintf(stderr, "--favor-decSpeed: trade some ratio for faster decompression\n");
+      fprintf(stderr, "  --dec-cost=<n>: trade ratio for decompression speed with a model of the decoder, giving up n/16 bits of output per cycle saved (0..1024)\n");
+      fprintf(stderr, "        --mf=bt: find matches with a sliding binary tree instead of suffix-sorting each block\n");
+      fprintf(stderr, "        --mf=hc: find matches with a sliding hash chain (fastest, lower ratio)\n");
+      fprintf(stderr, "--closer-offsets: prefer closer matches when they cost the same (more memory, same ratio)\n");
+      fprintf(stderr, " --trusted-input: decompress without bounds checks, for data known to be valid\n");
+      fprintf(stderr, "  --content-size: store the original size in the frame header\n");
+      fprintf(stderr, "--content-checksum: store a checksum of the original data, verified when decompressing\n");
+      fprintf(stderr, "--block-checksum: store a checksum after each block, verified before decompressing it\n");
+      fprintf(stderr, "--adaptive-blocks: end blocks where the data turns incompressible or compressible, and store incompressible ones as is\n");
+      fprintf(stderr, "      --async-io: read ahead and write behind on background threads, to overlap I/O with (de)compression\n");
+      fprintf(stderr, "    --low-memory: decompress or verify through a 64 Kb window, whatever the block size\n");
+      fprintf(stderr, "    --huge-pages: map compression buffers from 2 Mb pages where available, placed on each worker's NUMA node\n");
+      fprintf(stderr, "      --seekable: append a block index, so that byte ranges can be decompressed on their own (implies -BI)\n");
+      fprintf(stderr, "--range=<offset>[,<size>]: with -d, only decompress <size> bytes (or up to the end) starting at <offset>, out of a --seekable file\n");
+      fprintf(stderr, "       --recheck: with -c, also decompress the whole output file again once written, and compare it with the input\n");
       fprintf(stderr, "   -D <filename>: use dictionary file\n");
+      fprintf(stderr, "              -m: compress each file, and each file under each directory except .lz4 files, to <name>.lz4, spread over -T<n> threads\n");
+      fprintf(stderr, "--max-memory=<n>: compress within <n> Mb of memory, including the block cache, with fewer threads, then without --closer-offsets, then with --mf=bt, then with smaller blocks\n");
+      fprintf(stderr, "--block-cache=<n>: keep up to <n> Mb of compressed blocks, and reuse them for identical blocks instead of compressing again (with -m, across all files)\n");
+      fprintf(stderr, "--files-from=<list>: with -m, also compress the files listed in <list> ('-' for stdin), one per line, each optionally followed by a tab and its output file\n");
       return 100;
    }
 
    do_init_time();
 
    if (cCommand == 'z') {
-      int nResult = do_compress(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nBlockMaxCode);
-      if (nResult == 0 && bVerifyCompression) {
+      int nResult = do_compress(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nBlockMaxCode, nLevel, nDecodeCost, nThreads, (size_t)nBlockCacheMb << 20, (size_t)nMaxMemoryMb << 20);
+      if (nResult == 0 && bVerifyCompression && bRecheckCompression) {
          nResult = do_compare(pszOutFilename, pszInFilename, pszDictionaryFilename, nOptions);
       }
+      return nResult;
+   }
+   else if (cCommand == 'x') {
+      return do_transcode(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, bBlockCodeDefined ? nBlockMaxCode : 0,
+                          (bBlockDependenceDefined || (nOptions & OPT_SEEK_TABLE) != 0) ? (((nOptions & OPT_INDEP_BLOCKS) != 0) ? 1 : 0) : -1, nLevel, nDecodeCost, nThreads);
+   }
+   else if (cCommand == 'd' && bRangeDefined) {
+      return do_decompress_range(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nRangeOffset, nRangeSize);
    }
    else if (cCommand == 'd') {
-      return do_decompress(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions);
+      return do_decompress(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nThreads);
    }
    else if (cCommand == 'B') {
-      return do_compr_benchmark(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nBlockMaxCode);
+      return do_compr_benchmark(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nBlockMaxCode, nLevel, nDecodeCost, nThreads);
    }
    else if (cCommand == 'b') {
-      return do_dec_benchmark(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions);
+      return do_dec_benchmark(pszInFilename, pszOutFilename, pszDictionaryFilename, nOptions, nThreads);
    }
    else {
       return 100;
@@ -0,0 +1,1303 @@
+/*
+ * lz4ultra.h - lz4ultra public API
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _LZ4ULTRA_H
+#define _LZ4ULTRA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Exported functions; the shared library is built with all other symbols hidden */
+#if defined(__GNUC__) || defined(__clang__)
+#define LZ4ULTRA_API __attribute__((visibility("default")))
+#else
+#define LZ4ULTRA_API
+#endif
+
+/** High level status for compression and decompression */
+typedef enum _lz4ultra_status_t {
+   LZ4ULTRA_OK = 0,                          /**< Success */
+   LZ4ULTRA_ERROR_SRC,                       /**< Error reading input */
+   LZ4ULTRA_ERROR_DST,                       /**< Error reading output */
+   LZ4ULTRA_ERROR_DICTIONARY,                /**< Error reading dictionary */
+   LZ4ULTRA_ERROR_MEMORY,                    /**< Out of memory */
+
+   /* Compression-specific status codes */
+   LZ4ULTRA_ERROR_COMPRESSION,               /**< Internal compression error */
+   LZ4ULTRA_ERROR_RAW_TOOLARGE,              /**< Input is too large to be compressed to a raw block */
+   LZ4ULTRA_ERROR_RAW_UNCOMPRESSED,          /**< Input is incompressible and raw blocks don't support uncompressed data */
+
+   /* Decompression-specific status codes */
+   LZ4ULTRA_ERROR_FORMAT,                    /**< Invalid input format or magic number when decompressing */
+   LZ4ULTRA_ERROR_CHECKSUM,                  /**< Invalid checksum when decompressing */
+   LZ4ULTRA_ERROR_DECOMPRESSION,             /**< Internal decompression error */
+
+   /* Compression-specific status codes, continued */
+   LZ4ULTRA_ERROR_VERIFY,                    /**< A compressed block doesn't decompress back to its input (see LZ4ULTRA_FLAG_VERIFY) */
+} lz4ultra_status_t;
+
+/* Compression flags */
+#define LZ4ULTRA_FLAG_FAVOR_RATIO    (1<<0)           /**< 1 to compress with the best ratio, 0 to trade some compression ratio for extra decompression speed */
+#define LZ4ULTRA_FLAG_RAW_BLOCK      (1<<1)           /**< 1 to emit raw block */
+#define LZ4ULTRA_FLAG_INDEP_BLOCKS   (1<<2)           /**< 1 if blocks are independent, 0 if using inter-block back references */
+#define LZ4ULTRA_FLAG_LEGACY_FRAMES  (1<<3)           /**< 1 if using the legacy frames format, 0 if using the modern lz4 frame format */
+#define LZ4ULTRA_FLAG_BT_MATCHFINDER (1<<4)           /**< 1 to find matches with a binary tree that slides across dependent blocks compressed serially, 0 to suffix-sort each block and its history */
+#define LZ4ULTRA_FLAG_HC_MATCHFINDER (1<<5)           /**< 1 to find matches with a hash chain that slides across dependent blocks (lower ratio; only faster than the suffix array with a lower search depth than the default, as the first levels use) */
+#define LZ4ULTRA_FLAG_MATCH_CANDIDATES (1<<6)         /**< 1 to also keep shorter, closer matches for each position, so that the parser can favor closer offsets (not for arena-backed contexts) */
+#define LZ4ULTRA_FLAG_TRUSTED_INPUT  (1<<7)           /**< 1 to decompress trusted, already validated data without bounds checks (faster, unsafe for corrupted data) */
+#define LZ4ULTRA_FLAG_CONTENT_SIZE   (1<<8)           /**< 1 to store the uncompressed size in the frame header (lz4 frame format only) */
+#define LZ4ULTRA_FLAG_CONTENT_CHECKSUM (1<<9)         /**< 1 to store an XXH32 checksum of the uncompressed data after the last block, and verify it when decompressing (lz4 frame format only) */
+#define LZ4ULTRA_FLAG_BLOCK_CHECKSUM (1<<10)          /**< 1 to store an XXH32 checksum after each block, and verify it before decompressing the block (lz4 frame format only) */
+#define LZ4ULTRA_FLAG_STABLE_INPUT   (1<<11)          /**< 1 if the input spans passed to lz4ultra_compress_update() stay intact until lz4ultra_compress_end(), so that spans that follow each other in memory are compressed without copying any input */
+#define LZ4ULTRA_FLAG_ASYNC_IO       (1<<12)          /**< 1 to read input ahead and write output behind on background threads in the file API, so that I/O overlaps with (de)compression */
+#define LZ4ULTRA_FLAG_ADAPTIVE_BLOCKS (1<<13)         /**< 1 to end blocks early where the input turns incompressible or compressible again, and store incompressible blocks without compressing them, in the file and stream APIs (lz4 frame format only) */
+#define LZ4ULTRA_FLAG_SEEK_TABLE     (1<<14)          /**< 1 to append a seek table listing the size of each block, in a skippable frame after the frame, so that byte ranges can be decompressed without decompressing everything before them (lz4 frame format with independent blocks only; not for the incremental API) */
+#define LZ4ULTRA_FLAG_LOW_MEMORY     (1<<15)          /**< 1 to decompress streams and files through a 64 Kb window, decoding blocks as they are read instead of whole, so that memory use doesn't grow with the block size (serial, and never maps files) */
+#define LZ4ULTRA_FLAG_HUGE_PAGES     (1<<16)          /**< 1 to map the suffix array and match buffers of each compression context from huge pages where the system provides them, placed on the NUMA node of the thread that compresses with it (the hash chain and binary tree matchfinders stay on regular pages) */
+#define LZ4ULTRA_FLAG_VERIFY         (1<<17)          /**< 1 to decompress each block right after compressing it, while its input is still in memory, and fail with LZ4ULTRA_ERROR_VERIFY if it doesn't come back identical, in the file and stream APIs */
+
+/* Compression levels */
+#define LZ4ULTRA_MIN_LEVEL           1                /**< Fastest compression, lowest ratio (about 3.5 to 5 times as fast as LZ4ULTRA_MAX_LEVEL; the optimal parse is kept) */
+#define LZ4ULTRA_MAX_LEVEL           5                /**< Slowest compression, best ratio (optimal parse over all matches) */
+
+/* Largest frame header, in bytes */
+#define LZ4ULTRA_MAX_HEADER_SIZE     15
+
+/* Maximum amount of sample data that dictionary training looks at, in bytes; samples past it are ignored */
+#define LZ4ULTRA_TRAIN_MAX_SAMPLES_SIZE (256 * 1024 * 1024)
+
+/* Opaque types */
+typedef struct _lz4ultra_compressor lz4ultra_compressor;
+typedef struct _lz4ultra_prepared_dictionary_t lz4ultra_prepared_dictionary_t;
+typedef struct _lz4ultra_block_cache_t lz4ultra_block_cache_t;
+typedef struct _lz4ultra_incremental_compressor_t lz4ultra_incremental_compressor_t;
+typedef struct _lz4ultra_incremental_decompressor_t lz4ultra_incremental_decompressor_t;
+typedef struct _lz4ultra_window_decompressor_t lz4ultra_window_decompressor_t;
+
+/* Forward declaration */
+typedef struct _lz4ultra_stream_t lz4ultra_stream_t;
+
+/* I/O stream */
+struct _lz4ultra_stream_t {
+   /** Opaque stream-specific pointer */
+   void *obj;
+
+   /**
+    * Read from stream
+    *
+    * @param stream stream
+    * @param ptr buffer to read into
+    * @param size number of bytes to read
+    *
+    * @return number of bytes read
+    */
+   size_t(*read)(lz4ultra_stream_t *stream, void *ptr, size_t size);
+
+   /**
+    * Write to stream
+    *
+    * @param stream stream
+    * @param ptr buffer to write from
+    * @param size number of bytes to write
+    *
+    * @return number of bytes written
+    */
+   size_t(*write)(lz4ultra_stream_t *stream, void *ptr, size_t size);
+
+
+   /**
+    * Check if stream has reached the end of the data
+    *
+    * @param stream stream
+    *
+    * @return nonzero if the end of the data has been reached, 0 if there is more data
+    */
+   int(*eof)(lz4ultra_stream_t *stream);
+
+   /**
+    * Close stream
+    *
+    * @param stream stream
+    */
+   void(*close)(lz4ultra_stream_t *stream);
+};
+
+/** Task function, run on a worker thread */
+typedef void (*lz4ultra_task_fn)(void *pTaskArg);
+
+/** Executor hook: queue task for running on some thread, and return 0 for success or non-zero if it can't be queued */
+typedef int (*lz4ultra_submit_fn)(void *pExecutor, lz4ultra_task_fn task, void *pTaskArg);
+
+/**
+ * Compression statistics, for one block or accumulated over several
+ *
+ * Times are in nanoseconds, and are only measured when statistics are enabled for the compression context. Stages that
+ * a match finder doesn't have are left at 0: the binary tree and hash chain match finders only have find_time.
+ */
+typedef struct _lz4ultra_stats_t {
+   long long check_time;               /**< checking whether the block is incompressible */
+   long long sort_time;                /**< suffix sorting (divsufsort, or merging into the suffixes of a prepared dictionary) */
+   long long lcp_time;                 /**< computing the common prefix lengths of the sorted suffixes */
+   long long intervals_time;           /**< building the LCP intervals */
+   long long skip_time;                /**< walking the intervals over the history that precedes the block */
+   long long find_time;                /**< finding the matches of each position of the block */
+   long long parse_time;               /**< selecting matches with the optimal parser */
+   long long reduce_time;              /**< reducing the command count */
+   long long write_time;               /**< emitting the compressed block */
+
+   long long num_blocks;               /**< number of blocks */
+   long long num_input_bytes;          /**< number of input bytes in the blocks */
+   long long num_output_bytes;         /**< number of compressed bytes emitted, for blocks that were not left uncompressed */
+   long long num_matches;              /**< number of positions where the match finder found a match */
+   long long num_joined_matches;       /**< number of matches extended over the next one when reducing the command count */
+   long long num_reduced_commands;     /**< number of match commands turned into literals when reducing the command count */
+   long long num_commands;             /**< number of commands emitted */
+   long long num_literals;             /**< number of literal bytes emitted */
+   long long num_uncompressed_blocks;  /**< number of blocks left to be stored uncompressed */
+   long long num_skipped_blocks;       /**< number of those blocks that were found incompressible before running the match finder */
+   long long num_cached_blocks;        /**< number of blocks emitted from a block cache, without running the match finder */
+} lz4ultra_stats_t;
+
+/* Paths taken by the block decoder, for decompression statistics */
+#define LZ4ULTRA_DECODE_LITERALS_FAST    0    /**< 14 literals or less, copied 16 bytes at once */
+#define LZ4ULTRA_DECODE_LITERALS_SLOW    1    /**< 15 literals or more, or too close to the end of a buffer for the fast copy */
+#define LZ4ULTRA_DECODE_MATCH_FAST       2    /**< match of 18 bytes or less with an offset of 8 or more, copied 18 bytes at once */
+#define LZ4ULTRA_DECODE_MATCH_LOOP       3    /**< longer match with an offset of 16 or more, copied 16 bytes at a time */
+#define LZ4ULTRA_DECODE_MATCH_REPEAT     4    /**< match with an offset under 16, replicated with wide copies */
+#define LZ4ULTRA_DECODE_MATCH_BYTES      5    /**< match copied one byte at a time, close to the end of the output buffer */
+#define LZ4ULTRA_DECODE_MATCH_DICTIONARY 6    /**< match that starts in the dictionary */
+#define LZ4ULTRA_DECODE_NUM_PATHS        7
+
+/** Number of entries in each histogram of the decompression statistics */
+#define LZ4ULTRA_HISTOGRAM_SIZE 24
+
+/**
+ * Decompression statistics, accumulated over any number of blocks
+ *
+ * Histogram entry 0 counts values of 0, and entry n counts values from 2^(n-1) to 2^n - 1; the last entry also counts
+ * all larger values.
+ */
+typedef struct _lz4ultra_decompression_stats_t {
+   long long num_blocks;                                    /**< number of compressed blocks decoded */
+   long long num_tokens;                                    /**< number of tokens (commands) decoded */
+   long long path_count[LZ4ULTRA_DECODE_NUM_PATHS];         /**< number of literal runs or matches per decoder path (LZ4ULTRA_DECODE_xxx) */
+   long long path_bytes[LZ4ULTRA_DECODE_NUM_PATHS];         /**< number of output bytes per decoder path */
+   long long literals_histogram[LZ4ULTRA_HISTOGRAM_SIZE];   /**< literal runs by number of literals */
+   long long match_len_histogram[LZ4ULTRA_HISTOGRAM_SIZE];  /**< matches by length */
+   long long offset_histogram[LZ4ULTRA_HISTOGRAM_SIZE];     /**< matches by offset */
+} lz4ultra_decompression_stats_t;
+
+/**
+ * Estimated number of cycles that the block decoder spends on each command, on top of copying the bytes, depending on
+ * which of its paths the command takes
+ */
+typedef struct _lz4ultra_decode_cost_model_t {
+   int token;                       /**< reading a token, and the fast paths: 14 literals or less, match of 18 bytes or less with an offset of 8 or more */
+   int literals_slow;               /**< taking the slow path for 15 literals or more */
+   int length_byte;                 /**< reading each extra literals or match length byte */
+   int match_slow;                  /**< copying a match of 19 bytes or more with an offset of 16 or more, 16 bytes at a time */
+   int match_repeat;                /**< replicating a match with an offset under 8, or under 16 for matches of 19 bytes or more */
+} lz4ultra_decode_cost_model_t;
+
+/*-------------- File streams -------------- */
+
+/**
+ * Open file and create an I/O stream from it
+ *
+ * @param stream stream to fill out
+ * @param pszInFilename filename
+ * @param pszMode open mode, as with fopen()
+ *
+ * @return 0 for success, nonzero for failure
+ */
+LZ4ULTRA_API int lz4ultra_filestream_open(lz4ultra_stream_t *stream, const char *pszInFilename, const char *pszMode);
+
+/**
+ * Get size of the file behind a file stream, without moving the current position
+ *
+ * @param stream stream opened with lz4ultra_filestream_open()
+ *
+ * @return file size in bytes, or -1 if the file isn't seekable
+ */
+LZ4ULTRA_API long long lz4ultra_filestream_get_size(lz4ultra_stream_t *stream);
+
+/*-------------- Dictionaries -------------- */
+
+/**
+ * Load dictionary contents
+ *
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param ppDictionaryData pointer to returned dictionary contents, or NULL for none
+ * @param pDictionaryDataSize pointer to returned size of dictionary contents, or 0
+ *
+ * @return LZSA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API int lz4ultra_dictionary_load(const char *pszDictionaryFilename, void **ppDictionaryData, int *pDictionaryDataSize);
+
+/**
+ * Free dictionary contents
+ *
+ * @param ppDictionaryData pointer to pointer to dictionary contents
+ */
+LZ4ULTRA_API void lz4ultra_dictionary_free(void **ppDictionaryData);
+
+/**
+ * Prepare dictionary for compressing many inputs with it
+ *
+ * @param pDictionaryData dictionary contents; only the last HISTORY_SIZE bytes are used
+ * @param nDictionaryDataSize size of dictionary contents, in bytes (must be greater than 0)
+ *
+ * @return prepared dictionary, to be released with lz4ultra_dictionary_release(), or NULL for failure
+ */
+LZ4ULTRA_API lz4ultra_prepared_dictionary_t *lz4ultra_dictionary_prepare(const void *pDictionaryData, int nDictionaryDataSize);
+
+/**
+ * Load dictionary file and prepare it for compressing many inputs with it
+ *
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param ppDictionary pointer to returned prepared dictionary, or NULL for none
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API int lz4ultra_dictionary_prepare_file(const char *pszDictionaryFilename, lz4ultra_prepared_dictionary_t **ppDictionary);
+
+/**
+ * Release prepared dictionary
+ *
+ * @param pDictionary prepared dictionary, or NULL
+ */
+LZ4ULTRA_API void lz4ultra_dictionary_release(lz4ultra_prepared_dictionary_t *pDictionary);
+
+/**
+ * Build a dictionary out of samples of the data that is going to be compressed with it
+ *
+ * Substrings that are repeated across the samples are found by suffix-sorting them, and the segments of the samples that
+ * hold the most of them are picked. As only the last 64 Kb of a dictionary can be referenced, and closer matches cost
+ * less, the most valuable segments are placed at the end of the dictionary.
+ *
+ * @param pDictionaryData buffer for the dictionary
+ * @param nMaxDictionarySize capacity of the dictionary buffer; dictionaries are at most 64 Kb
+ * @param pSamplesData all samples, one after the other
+ * @param pSampleSizes size of each sample, in bytes
+ * @param nNumSamples number of samples; only the first LZ4ULTRA_TRAIN_MAX_SAMPLES_SIZE bytes of samples are used
+ *
+ * @return size of the dictionary, or -1 for error
+ */
+LZ4ULTRA_API int lz4ultra_dictionary_train(void *pDictionaryData, int nMaxDictionarySize, const void *pSamplesData, const size_t *pSampleSizes, int nNumSamples);
+
+/*-------------- Compression context API -------------- */
+
+/**
+ * Get the size of the arena required to create a compression context with lz4ultra_compressor_create()
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size to compress + 64 Kb of history)
+ *
+ * @return arena size in bytes
+ */
+LZ4ULTRA_API size_t lz4ultra_compressor_get_arena_size(const int nMaxWindowSize);
+
+/**
+ * Create long-lived compression context, that can be reused for many calls with lz4ultra_compressor_reset()
+ *
+ * When an arena is supplied, the context and all of its buffers are carved out of it and no heap allocation takes
+ * place, neither now nor during compression; the window size is then fixed. Otherwise, the buffers are allocated
+ * from the heap and grow as needed when the context is reset for a larger window.
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size to compress + 64 Kb of history)
+ * @param nFlags compression flags
+ * @param pArena caller-supplied memory to create the context in, or NULL to allocate it from the heap
+ * @param nArenaSize size of arena in bytes, at least lz4ultra_compressor_get_arena_size(nMaxWindowSize) if an arena is supplied
+ *
+ * @return compression context, or NULL for failure
+ */
+LZ4ULTRA_API lz4ultra_compressor *lz4ultra_compressor_create(const int nMaxWindowSize, const int nFlags, void *pArena, const size_t nArenaSize);
+
+/**
+ * Prepare compression context for compressing a new, unrelated input, growing its buffers if required
+ *
+ * @param pCompressor compression context
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ * @param nFlags compression flags
+ *
+ * @return 0 for success, non-zero for failure (the context must then be reset again before use, or freed)
+ */
+LZ4ULTRA_API int lz4ultra_compressor_reset(lz4ultra_compressor *pCompressor, const int nMaxWindowSize, const int nFlags);
+
+/**
+ * Free compression context created with lz4ultra_compressor_create()
+ *
+ * @param pCompressor compression context, or NULL
+ */
+LZ4ULTRA_API void lz4ultra_compressor_free(lz4ultra_compressor *pCompressor);
+
+/**
+ * Apply compression level: select the match finder (unless one is already selected through the compression flags),
+ * its search depth, how many match lengths the parser tries per position, and whether the command count is reduced
+ *
+ * @param pCompressor compression context
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ */
+LZ4ULTRA_API void lz4ultra_compressor_set_level(lz4ultra_compressor *pCompressor, int nLevel);
+
+/**
+ * Set how hard the binary tree and hash chain match finders search for each match
+ *
+ * @param pCompressor compression context
+ * @param nDepth maximum number of tree nodes or chain links visited per position, or 0 for the match finder's default
+ *                (this overrides the depth picked by lz4ultra_compressor_set_level())
+ */
+LZ4ULTRA_API void lz4ultra_compressor_set_search_depth(lz4ultra_compressor *pCompressor, const int nDepth);
+
+/**
+ * Attach prepared dictionary to compression context, until it is reset
+ *
+ * Blocks whose previously compressed bytes are exactly the dictionary are then compressed without sorting the dictionary
+ * again, when suffix-sorting. The dictionary must outlive its use by the context.
+ *
+ * @param pCompressor compression context
+ * @param pDictionary prepared dictionary, or NULL for none
+ */
+LZ4ULTRA_API void lz4ultra_compressor_set_dictionary(lz4ultra_compressor *pCompressor, const lz4ultra_prepared_dictionary_t *pDictionary);
+
+/**
+ * Split suffix sorting of each large window into tasks run concurrently with an executor
+ *
+ * This helps when there are more threads than blocks to compress at the same time, for instance for a single large
+ * block. One task runs on the calling thread, and the calling thread waits for the others, so the executor must have
+ * threads to spare for them: it must not be busy running the compression itself.
+ *
+ * @param pCompressor compression context
+ * @param nThreads number of tasks to split sorting into (1 to sort serially, at most MAX_SORT_THREADS)
+ * @param submit function to queue sorting tasks with the caller's executor, or NULL to sort serially
+ * @param pExecutor opaque executor pointer passed to submit
+ */
+LZ4ULTRA_API void lz4ultra_compressor_set_sort_threads(lz4ultra_compressor *pCompressor, int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
+
+/**
+ * Make the parser minimize the compressed size plus the estimated decoding time, weighted by nDecodeCost, instead of
+ * using the --favor-decSpeed heuristics. The setting outlives lz4ultra_compressor_reset().
+ *
+ * For instance, with a weight of 16, the parser gives up one bit of output to save one decoder cycle. A weight of 0
+ * minimizes the compressed size only, according to LZ4ULTRA_FLAG_FAVOR_RATIO.
+ *
+ * @param pCompressor compression context
+ * @param nDecodeCost weight of one decoder cycle, in 1/16ths of a bit, or 0 to turn the cost model off
+ * @param pModel decoder cycle costs, or NULL for the default estimates
+ */
+LZ4ULTRA_API void lz4ultra_compressor_set_decode_cost(lz4ultra_compressor *pCompressor, const int nDecodeCost, const lz4ultra_decode_cost_model_t *pModel);
+
+/**
+ * Enable or disable collecting statistics about each block, and accumulating them until the context is reset. The
+ * setting outlives lz4ultra_compressor_reset().
+ *
+ * Counting matches and measuring the time spent in each stage slow compression down a little, so statistics are off by default.
+ *
+ * @param pCompressor compression context
+ * @param nEnable 1 to collect statistics, 0 not to
+ */
+LZ4ULTRA_API void lz4ultra_compressor_set_stats(lz4ultra_compressor *pCompressor, const int nEnable);
+
+/**
+ * Attach cache of compressed blocks to compression context. The setting outlives lz4ultra_compressor_reset().
+ *
+ * Before compressing a block, the context looks it up in the cache, by the contents of its window and the context's
+ * settings, and emits the cached compressed bytes if it is found. Blocks that are compressed are added to the cache.
+ * Only the suffix-array match finder uses the cache: the binary tree and hash chain match finders carry state from one
+ * block to the next, which the blocks found in the cache would skip. The cache must outlive its use by the context.
+ *
+ * @param pCompressor compression context
+ * @param pCache cache (see lz4ultra_block_cache_create()), or NULL for none
+ */
+LZ4ULTRA_API void lz4ultra_compressor_set_block_cache(lz4ultra_compressor *pCompressor, lz4ultra_block_cache_t *pCache);
+
+/**
+ * Create cache of compressed blocks
+ *
+ * The cache holds the compressed bytes of the blocks compressed by the contexts it is attached to (see
+ * lz4ultra_compressor_set_block_cache()), so that byte-identical blocks, compressed with the same settings and after
+ * the same previously compressed bytes, are emitted again without running the match finder. When it is full, the
+ * least recently used blocks are evicted to make room. Any number of contexts and threads can share one cache.
+ *
+ * @param nMaxSize memory budget, in bytes, for the cached blocks and their bookkeeping
+ *
+ * @return cache, or NULL for failure
+ */
+LZ4ULTRA_API lz4ultra_block_cache_t *lz4ultra_block_cache_create(const size_t nMaxSize);
+
+/**
+ * Free cache of compressed blocks, once no context uses it anymore
+ *
+ * @param pCache cache, or NULL
+ */
+LZ4ULTRA_API void lz4ultra_block_cache_free(lz4ultra_block_cache_t *pCache);
+
+/**
+ * Compress one block of data
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param pOutData pointer to output buffer
+ * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ *
+ * @return size of compressed data in output buffer, or -1 if the data is uncompressible
+ */
+LZ4ULTRA_API int lz4ultra_compressor_shrink_block(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize);
+
+/**
+ * Get the number of compression commands issued in compressed data blocks
+ *
+ * @return number of commands
+ */
+LZ4ULTRA_API int lz4ultra_compressor_get_command_count(lz4ultra_compressor *pCompressor);
+
+/**
+ * Get the number of blocks that were found to be incompressible before running the match finder on them, and were
+ * left to be stored uncompressed
+ *
+ * @return number of blocks
+ */
+LZ4ULTRA_API int lz4ultra_compressor_get_skipped_block_count(lz4ultra_compressor *pCompressor);
+
+/**
+ * Get the statistics of the last block compressed, when statistics are enabled
+ *
+ * @param pCompressor compression context
+ *
+ * @return statistics of the last block
+ */
+LZ4ULTRA_API const lz4ultra_stats_t *lz4ultra_compressor_get_block_stats(lz4ultra_compressor *pCompressor);
+
+/**
+ * Get the statistics accumulated over all the blocks compressed since the context was last reset, when statistics are enabled
+ *
+ * @param pCompressor compression context
+ *
+ * @return accumulated statistics
+ */
+LZ4ULTRA_API const lz4ultra_stats_t *lz4ultra_compressor_get_stats(lz4ultra_compressor *pCompressor);
+
+/*-------------- In-memory compression API -------------- */
+
+/**
+ * Get maximum compressed size of input(source) data
+ *
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ *
+ * @return maximum compressed size
+ */
+LZ4ULTRA_API size_t lz4ultra_get_max_compressed_size_inmem(size_t nInputSize, unsigned int nFlags,
+   int nBlockMaxCode);
+
+/**
+ * Compress memory
+ *
+ * The dictionary, if any, prefills the history of the first block (of each block, with LZ4ULTRA_FLAG_INDEP_BLOCKS), the
+ * same way as when compressing a stream. To compress many inputs with the same dictionary, prepare it once and use
+ * lz4ultra_compress_inmem_with_dictionary() instead.
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param pDictionaryData dictionary contents, or NULL for none; only the last 64 Kb are used
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize,
+   const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, int nBlockMaxCode, int nLevel);
+
+/**
+ * Compress memory, using a long-lived compression context
+ *
+ * Once the context has grown to the largest window needed, compressing with it performs no heap allocations.
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create(); it is reset and grown as needed
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_compress_inmem_with_context(lz4ultra_compressor *pCompressor, const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize,
+   unsigned int nFlags, int nBlockMaxCode, int nLevel);
+
+/**
+ * Compress memory using a prepared dictionary, with a long-lived compression context
+ *
+ * The dictionary is sorted once when it is prepared, so that compressing many small inputs against the same dictionary
+ * doesn't process it again for each of them. The first block (every block, with LZ4ULTRA_FLAG_INDEP_BLOCKS) is assembled
+ * after the dictionary in a window owned by the context, which is allocated on first use and kept for the next calls.
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create() without an arena; it is reset and grown as needed
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_compress_inmem_with_dictionary(lz4ultra_compressor *pCompressor, const lz4ultra_prepared_dictionary_t *pDictionary, const unsigned char *pInputData, unsigned char *pOutBuffer,
+   size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags, int nBlockMaxCode, int nLevel);
+
+/**
+ * Compress memory, compressing several blocks concurrently
+ *
+ * The output is byte-for-byte identical to lz4ultra_compress_inmem() for the same flags and block size, except for
+ * dependent blocks with the binary tree match finder (levels 3 and 4, or LZ4ULTRA_FLAG_BT_MATCHFINDER): lz4ultra_compress_inmem()
+ * carries the tree over from block to block, while each concurrent block builds it from the 64 Kb in front of it, which
+ * finds slightly different matches; the output is then the same for any number of threads above one. Raw blocks and
+ * inputs that fit in a single block are compressed as one block, that the threads suffix-sort together instead.
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads maximum number of blocks compressed at the same time (one compressor context is allocated for each)
+ * @param submit function to queue block compression tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return actual compressed size, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_compress_inmem_parallel(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags,
+   int nBlockMaxCode, int nLevel, int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
+
+/** One independent input of a batch, and where to compress it to */
+typedef struct _lz4ultra_batch_item_t {
+   const unsigned char *pInputData;          /**< input(source) data to compress */
+   size_t nInputSize;                        /**< input(source) size in bytes */
+   unsigned char *pOutBuffer;                /**< buffer for compressed data */
+   size_t nMaxOutBufferSize;                 /**< maximum capacity of compression buffer */
+   size_t nCompressedSize;                   /**< set on return: actual compressed size, or -1 for error */
+} lz4ultra_batch_item_t;
+
+/**
+ * Compress many small, independent inputs in one call
+ *
+ * Each input is compressed exactly as lz4ultra_compress_inmem_with_dictionary() would, to its own output buffer. The
+ * compression contexts, one per worker, are created once for the whole batch and reused from one input to the next, so
+ * that small inputs don't pay for setting up and tearing down a context each. Workers pick the next input to compress
+ * as they become free. With LZ4ULTRA_FLAG_RAW_BLOCK, each input is emitted as a single raw block, without frame header
+ * or footer; inputs that are too large or incompressible then fail individually.
+ *
+ * @param pItems inputs to compress; nCompressedSize is set for each of them
+ * @param nNumItems number of inputs
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()) for all inputs, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads number of inputs compressed at the same time (one compressor context is allocated for each)
+ * @param submit function to queue worker tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return number of inputs that failed to compress (0 for success), or -1 if the batch couldn't be started
+ */
+LZ4ULTRA_API int lz4ultra_compress_batch(lz4ultra_batch_item_t *pItems, int nNumItems, const lz4ultra_prepared_dictionary_t *pDictionary, unsigned int nFlags, int nBlockMaxCode, int nLevel,
+   int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
+
+/*-------------- In-memory decompression API -------------- */
+
+/**
+ * Get maximum decompressed size of compressed data
+ *
+ * @param pFileData compressed data
+ * @param nFileSize compressed size in bytes
+ *
+ * @return maximum decompressed size
+ */
+LZ4ULTRA_API size_t lz4ultra_inmem_get_max_decompressed_size(const unsigned char *pFileData, size_t nFileSize);
+
+/**
+ * Decompress data in memory
+ *
+ * The dictionary, if any, virtually precedes the output buffer: it doesn't need to be copied in front of the output.
+ * Blocks that reference the dictionary are always bounds-checked, even with LZ4ULTRA_FLAG_TRUSTED_INPUT.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid)
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_decompress_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize,
+   const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags);
+
+/**
+ * Decompress data in memory, counting the decoder paths, match offsets and lengths, and literal run lengths
+ *
+ * This is slower than lz4ultra_decompress_inmem(), and meant for analyzing how compressed data decodes, for instance
+ * to check that data compressed for decompression speed takes the decoder's fast paths. All blocks are bounds-checked.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block)
+ * @param pStats decompression statistics to add to
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_decompress_inmem_with_stats(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize,
+   const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, lz4ultra_decompression_stats_t *pStats);
+
+/**
+ * Decompress data in memory, decompressing several blocks concurrently when they are independent
+ *
+ * The blocks are located by scanning the frame first, and then decompressed straight into the output buffer, each at
+ * the offset it would have if all the blocks before it were full. Frames with dependent blocks, raw blocks and data
+ * that doesn't have room for full blocks in the output buffer are decompressed serially.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data
+ * @param nFileSize compressed size in bytes
+ * @param nMaxOutBufferSize maximum capacity of decompression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid)
+ * @param nThreads maximum number of blocks decompressed at the same time
+ * @param submit function to queue decompression tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return actual decompressed size, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_decompress_inmem_parallel(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, size_t nMaxOutBufferSize, unsigned int nFlags,
+                                          int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
+
+/*-------------- File and streaming compression API -------------- */
+
+/**
+ * Compress file
+ *
+ * @param pszInFilename name of input(source) file to compress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags,
+   int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads,
+   void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/**
+ * Compress file using a prepared dictionary, with a long-lived compression context
+ *
+ * Compressing many files with the same context saves allocating and initializing one for each file. The context
+ * compresses every block when nThreads is 1; otherwise, it compresses the first block of each batch, and contexts for
+ * the other blocks are created for the duration of the call.
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create() without an arena; it is reset and grown as needed
+ * @param pszInFilename name of input(source) file to compress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t (the context must then be reset before use, or freed)
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_file_with_context(lz4ultra_compressor *pCompressor, const char *pszInFilename, const char *pszOutFilename,
+                                                                   const lz4ultra_prepared_dictionary_t *pDictionary, const unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost,
+                                                                   int nThreads, long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount, lz4ultra_stats_t *pStats);
+
+/**
+ * Compress stream
+ *
+ * @param pInStream input(source) stream to compress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, stored in the frame header if LZ4ULTRA_FLAG_CONTENT_SIZE is set and used not to compress more blocks at once than the input has, or -1 if unknown (the flag is then ignored)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags,
+   int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
+   void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/**
+ * Compress stream using a prepared dictionary
+ *
+ * The dictionary is sorted once when it is prepared, and the same prepared dictionary can be used to compress any number of
+ * streams, concurrently if needed, which is faster than passing the raw dictionary to lz4ultra_compress_stream() each time.
+ *
+ * @param pInStream input(source) stream to compress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, stored in the frame header if LZ4ULTRA_FLAG_CONTENT_SIZE is set and used not to compress more blocks at once than the input has, or -1 if unknown (the flag is then ignored)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_stream_with_dictionary(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const lz4ultra_prepared_dictionary_t *pDictionary,
+   unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
+   void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/** One file of a file batch, and where to compress it to */
+typedef struct _lz4ultra_file_item_t {
+   const char *pszInFilename;                /**< name of input(source) file to compress */
+   const char *pszOutFilename;               /**< name of output(compressed) file to generate */
+   long long nInputSize;                     /**< input(source) size in bytes, used to schedule larger files first, or 0 if unknown */
+   lz4ultra_status_t nStatus;                /**< set on return: LZ4ULTRA_OK, or the error value this file failed to compress with */
+   long long nOriginalSize;                  /**< set on return: input(source) size, if successful */
+   long long nCompressedSize;                /**< set on return: output(compressed) size, if successful */
+} lz4ultra_file_item_t;
+
+/**
+ * Compress many files in one call
+ *
+ * Each file is compressed exactly as lz4ultra_compress_file_with_context() would, to its own output file. Files are
+ * scheduled from the largest to the smallest, so that a large file isn't picked up last and left to finish alone.
+ * Files that are large enough to keep all the threads busy with their own blocks, nThreads times the maximum block
+ * size or more, are compressed first, one at a time and block-parallel. The other files are then spread over a pool
+ * of nThreads workers, each with a compression context that is created once and reused from one file to the next,
+ * and each compressing its current file serially.
+ *
+ * @param pItems files to compress; nStatus, nOriginalSize and nCompressedSize are set for each of them
+ * @param nNumItems number of files
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()) for all files, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of threads to compress with
+ * @param pBlockCache cache of compressed blocks shared by all the files and threads (see lz4ultra_block_cache_create()), or NULL for none
+ * @param progress function called after compressing each file, from the thread that compressed it, or NULL for none
+ * @param pStats pointer to returned compression statistics for all the files that were compressed successfully, or NULL not to collect them
+ *
+ * @return number of files that failed to compress (0 for success), or -1 if the batch couldn't be started
+ */
+LZ4ULTRA_API int lz4ultra_compress_files(lz4ultra_file_item_t *pItems, int nNumItems, const lz4ultra_prepared_dictionary_t *pDictionary, unsigned int nFlags, int nBlockMaxCode,
+   int nLevel, int nDecodeCost, int nThreads, lz4ultra_block_cache_t *pBlockCache, void(*progress)(const lz4ultra_file_item_t *pItem), lz4ultra_stats_t *pStats);
+
+/*-------------- Incremental compression API -------------- */
+
+/**
+ * Create incremental compression context, fed with caller-owned input spans and writing to caller-owned output spans
+ *
+ * Nothing else is allocated until the first frame is started with lz4ultra_compress_begin().
+ *
+ * @return context, to be freed with lz4ultra_incremental_compressor_free(), or NULL for failure
+ */
+LZ4ULTRA_API lz4ultra_incremental_compressor_t *lz4ultra_incremental_compressor_create(void);
+
+/**
+ * Free incremental compression context and its buffers
+ *
+ * @param pCtx context, or NULL
+ */
+LZ4ULTRA_API void lz4ultra_incremental_compressor_free(lz4ultra_incremental_compressor_t *pCtx);
+
+/**
+ * Get the output span size that lets one more block, or the end of the frame, be written out in one call
+ *
+ * @param pCtx context, after lz4ultra_compress_begin()
+ *
+ * @return output size in bytes
+ */
+LZ4ULTRA_API size_t lz4ultra_compress_get_max_output_size(const lz4ultra_incremental_compressor_t *pCtx);
+
+/**
+ * Start compressing a new frame, and write its header
+ *
+ * This is the only call that allocates memory: the context keeps its buffers from one frame to the next, and only
+ * grows them when a larger block size is used.
+ *
+ * @param pCtx context
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx; raw blocks aren't supported)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nContentSize total size of the input data, or -1 if unknown; required for LZ4ULTRA_FLAG_CONTENT_SIZE, and used to pick a smaller block size for small inputs
+ * @param pOutData output(compressed) span to write the header to, at least LZ4ULTRA_MAX_HEADER_SIZE bytes
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_begin(lz4ultra_incremental_compressor_t *pCtx, unsigned int nFlags, int nBlockMaxCode, int nLevel, long long nContentSize,
+                                                       unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Compress more input
+ *
+ * All the input is consumed as long as the output span has room for the blocks it completes: a block is only compressed
+ * when lz4ultra_compress_get_max_output_size() bytes are left in the output span, and when there isn't, this returns with
+ * the rest of the input left unconsumed. Input that doesn't make up a full block is kept until the next call.
+ *
+ * @param pCtx context
+ * @param pInData input(source) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(compressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_update(lz4ultra_incremental_compressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                                        unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Compress the last, partial block if any, and write the end of the frame
+ *
+ * @param pCtx context
+ * @param pOutData output(compressed) span
+ * @param nOutDataSize size of output span, in bytes; if it is smaller than lz4ultra_compress_get_max_output_size(), this may fail with LZ4ULTRA_ERROR_DST and can be called again with more room
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ * @param pOriginalSize pointer to returned input(source) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_end(lz4ultra_incremental_compressor_t *pCtx, unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced,
+                                                     long long *pOriginalSize, long long *pCompressedSize);
+
+/*-------------- Memory budget -------------- */
+
+/**
+ * Get the largest amount of memory that compressing a file or stream allocates, for a given configuration
+ *
+ * This counts the input, output and verification buffers, a compression context for each block compressed concurrently
+ * with all of the buffers that its match finder allocates when first needed, the thread pool, the seek table, the
+ * dictionary that the file API prepares from a dictionary file, and the read-ahead and write-behind buffers of
+ * LZ4ULTRA_FLAG_ASYNC_IO. It doesn't count thread stacks, a mapped input file, a long-lived context or a prepared
+ * dictionary passed by the caller, or a block cache. With a known input size, no more blocks are counted as compressed
+ * concurrently than the input has; without one, the seek table is counted for 256 blocks, and grows by 8 bytes per
+ * block past that.
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nDictionaryDataSize size of dictionary contents, or 0 for none
+ * @param nContentSize size of the input data, or -1 if unknown
+ *
+ * @return size in bytes
+ */
+LZ4ULTRA_API size_t lz4ultra_compress_get_memory_size(unsigned int nFlags, int nBlockMaxCode, const int nLevel, const int nThreads, const int nDictionaryDataSize, const long long nContentSize);
+
+/**
+ * Adjust a compression configuration so that compressing a file or stream stays within a memory budget
+ *
+ * The settings that cost the least are given up first: the number of threads is halved, which doesn't change the
+ * compressed output, until it is down to one, or to two for dependent blocks with the binary tree match finder, that finds
+ * slightly different matches when blocks are compressed serially; then match candidates are dropped
+ * (LZ4ULTRA_FLAG_MATCH_CANDIDATES), then the suffix array match finder is replaced with the binary tree
+ * (LZ4ULTRA_FLAG_BT_MATCHFINDER), then the maximum block size is lowered, except for raw blocks, that must hold the whole
+ * input, and legacy frames, whose blocks have a fixed size, and last, two remaining threads go down to one. The memory is
+ * counted as with lz4ultra_compress_get_memory_size().
+ *
+ * @param nMaxMemory memory budget, in bytes
+ * @param pFlags pointer to compression flags (LZ4ULTRA_FLAG_xxx), updated when this function is successful
+ * @param pBlockMaxCode pointer to maximum block size code (4..7 for 64 Kb..4 Mb), updated when this function is successful
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param pThreads pointer to number of blocks to compress concurrently, updated when this function is successful
+ * @param nDictionaryDataSize size of dictionary contents, or 0 for none
+ * @param nContentSize size of the input data, or -1 if unknown
+ *
+ * @return LZ4ULTRA_OK for success, or LZ4ULTRA_ERROR_MEMORY if no configuration fits in the budget
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_compress_fit_memory(const size_t nMaxMemory, unsigned int *pFlags, int *pBlockMaxCode, const int nLevel, int *pThreads, const int nDictionaryDataSize,
+   const long long nContentSize);
+
+/*-------------- Transcoding API -------------- */
+
+/**
+ * Recompress a file holding an LZ4 frame, without going through an intermediate decompressed copy
+ *
+ * With LZ4ULTRA_FLAG_ASYNC_IO, input is read ahead and output is written behind on background threads.
+ *
+ * @param pszInFilename name of input file holding the LZ4 frame to recompress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file that the input was compressed with, and to compress the output with, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx); LZ4ULTRA_FLAG_INDEP_BLOCKS is ignored, see nIndependentBlocks
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb), or 0 to keep the input frame's
+ * @param nIndependentBlocks 1 to compress independent blocks, 0 for dependent blocks, or -1 to keep the input frame's setting
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned decompressed size of the input frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_transcode_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename,
+   unsigned int nFlags, int nBlockMaxCode, int nIndependentBlocks, int nLevel, int nDecodeCost, int nThreads,
+   void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/**
+ * Recompress a stream holding an LZ4 frame, without going through an intermediate decompressed copy
+ *
+ * The input frame is decoded through a 64 Kb window as it is read, and the decoded bytes are fed straight to the stream
+ * compressor, which compresses nThreads blocks at a time. Unless they are overridden, the output frame keeps the input
+ * frame's block size and block independence, and its content size when the input frame records it.
+ *
+ * @param pInStream input stream holding the LZ4 frame to recompress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionary prepared dictionary that the input was compressed with, and to compress the output with (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx); LZ4ULTRA_FLAG_INDEP_BLOCKS is ignored, see nIndependentBlocks
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb), or 0 to keep the input frame's
+ * @param nIndependentBlocks 1 to compress independent blocks, 0 for dependent blocks, or -1 to keep the input frame's setting
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned decompressed size of the input frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_transcode_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const lz4ultra_prepared_dictionary_t *pDictionary,
+   unsigned int nFlags, int nBlockMaxCode, int nIndependentBlocks, int nLevel, int nDecodeCost, int nThreads,
+   void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/*-------------- File and streaming decompression API -------------- */
+
+/**
+ * Decompress file
+ *
+ * @param pszInFilename name of input(compressed) file to decompress
+ * @param pszOutFilename name of output(decompressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, LZ4ULTRA_FLAG_ASYNC_IO to overlap I/O with decompression, LZ4ULTRA_FLAG_LOW_MEMORY to decompress through a 64 Kb window, or 0)
+ * @param nThreads number of independent blocks to decompress concurrently (1 to decompress serially)
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_decompress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags, int nThreads,
+   long long *pOriginalSize, long long *pCompressedSize);
+
+/**
+ * Verify compressed file, without writing the decompressed data anywhere
+ *
+ * Frames with block checksums are verified by checking every block against its checksum, without decompressing it;
+ * other frames are decompressed and the output is thrown away.
+ *
+ * @param pszInFilename name of input(compressed) file to verify
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to verify a raw block, LZ4ULTRA_FLAG_ASYNC_IO to read ahead on a background thread, LZ4ULTRA_FLAG_LOW_MEMORY to decompress everything through a 64 Kb window, or 0)
+ * @param nThreads number of blocks to verify concurrently (1 to verify serially)
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ *        (when only checking block checksums, this is the size stored in the frame header, or 0 if there is none)
+ * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_verify_file(const char *pszInFilename, const char *pszDictionaryFilename, const unsigned int nFlags, int nThreads,
+   long long *pOriginalSize, long long *pCompressedSize);
+
+/**
+ * Decompress stream
+ *
+ * @param pInStream input(compressed) stream to decompress
+ * @param pOutStream output(decompressed) stream to write to, or NULL to only verify the input stream (see lz4ultra_verify_file())
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_RAW_BLOCK to decompress a raw block, LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, LZ4ULTRA_FLAG_LOW_MEMORY to decompress through a 64 Kb window, or 0)
+ * @param nThreads number of independent blocks to decompress concurrently (1 to decompress serially)
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_decompress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, int nThreads,
+   long long *pOriginalSize, long long *pCompressedSize);
+
+/*-------------- Incremental decompression API -------------- */
+
+/**
+ * Create incremental decompression context, fed with caller-owned input spans and writing to caller-owned output spans
+ *
+ * The buffers for a frame's block size are only allocated when its header is decoded.
+ *
+ * @return context, to be freed with lz4ultra_incremental_decompressor_free(), or NULL for failure
+ */
+LZ4ULTRA_API lz4ultra_incremental_decompressor_t *lz4ultra_incremental_decompressor_create(void);
+
+/**
+ * Free incremental decompression context and its buffers
+ *
+ * @param pCtx context, or NULL
+ */
+LZ4ULTRA_API void lz4ultra_incremental_decompressor_free(lz4ultra_incremental_decompressor_t *pCtx);
+
+/**
+ * Start decompressing a new frame
+ *
+ * @param pCtx context
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0; raw blocks aren't supported)
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_decompress_begin(lz4ultra_incremental_decompressor_t *pCtx, unsigned int nFlags);
+
+/**
+ * Decompress more input
+ *
+ * Input is consumed until the output span is full or the end of the frame is reached; anything after the frame is left
+ * unconsumed. The buffers for the frame's block size are allocated when its header is decoded, unless the context
+ * already has large enough ones from a previous frame.
+ *
+ * @param pCtx context
+ * @param pInData input(compressed) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(decompressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_decompress_update(lz4ultra_incremental_decompressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                                          unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Check that the whole frame was decompressed and handed out
+ *
+ * @param pCtx context
+ * @param pOriginalSize pointer to returned output(decompressed) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_SRC if the frame is truncated, LZ4ULTRA_ERROR_DST if decompressed data is still waiting for output room, or the error that stopped decompression
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_decompress_end(lz4ultra_incremental_decompressor_t *pCtx, long long *pOriginalSize, long long *pCompressedSize);
+
+/*-------------- Windowed decompression API -------------- */
+
+/**
+ * Create windowed decompression context, fed with caller-owned input spans of any size and writing to caller-owned output spans of any size
+ *
+ * Unlike the incremental decompression context, blocks are never gathered or decompressed as a whole: sequences are decoded
+ * as their bytes arrive, into a 64 Kb window, so that the context never holds more than that, whatever the frame's block
+ * size. As a block is handed out before all of it is received, a block checksum error is only reported after the block's data.
+ *
+ * @return context, to be freed with lz4ultra_window_decompressor_free(), or NULL for failure
+ */
+LZ4ULTRA_API lz4ultra_window_decompressor_t *lz4ultra_window_decompressor_create(void);
+
+/**
+ * Free windowed decompression context and its window
+ *
+ * @param pCtx context, or NULL
+ */
+LZ4ULTRA_API void lz4ultra_window_decompressor_free(lz4ultra_window_decompressor_t *pCtx);
+
+/**
+ * Start decompressing a new frame
+ *
+ * The window is allocated the first time a frame is started with the context, and is reused for the frames that follow.
+ *
+ * @param pCtx context
+ * @param pDictionaryData dictionary contents, that must stay valid until the frame is decompressed, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (0; raw blocks aren't supported, and the input is always checked, so that LZ4ULTRA_FLAG_TRUSTED_INPUT makes no difference)
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_window_decompress_begin(lz4ultra_window_decompressor_t *pCtx, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags);
+
+/**
+ * Decompress more input
+ *
+ * Input is consumed until it runs out, the output span is full or the end of the frame is reached; anything after the frame
+ * is left unconsumed. Everything that is decompressed is written to the output span before returning.
+ *
+ * @param pCtx context
+ * @param pInData input(compressed) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(decompressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_window_decompress_update(lz4ultra_window_decompressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                                                 unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Check whether the end of the frame was reached
+ *
+ * @param pCtx context
+ *
+ * @return nonzero if the whole frame was decompressed, 0 if more input is needed
+ */
+LZ4ULTRA_API int lz4ultra_window_decompress_done(const lz4ultra_window_decompressor_t *pCtx);
+
+/**
+ * Check that the whole frame was decompressed
+ *
+ * @param pCtx context
+ * @param pOriginalSize pointer to returned output(decompressed) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned input(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_SRC if the frame is truncated, or the error that stopped decompression
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_window_decompress_end(lz4ultra_window_decompressor_t *pCtx, long long *pOriginalSize, long long *pCompressedSize);
+
+/*-------------- Random access decompression API -------------- */
+
+/**
+ * Get decompressed size of data that ends with a seek table (see LZ4ULTRA_FLAG_SEEK_TABLE)
+ *
+ * @param pFileData compressed data
+ * @param nFileSize compressed size in bytes
+ *
+ * @return decompressed size of the frame that the seek table belongs to, or -1 if the data doesn't end with a valid seek table
+ */
+LZ4ULTRA_API long long lz4ultra_inmem_get_seekable_size(const unsigned char *pFileData, size_t nFileSize);
+
+/**
+ * Decompress a range of bytes out of data that ends with a seek table, decompressing only the blocks that cover the range
+ *
+ * The block checksums, if any, of the decompressed blocks are verified; the content checksum, which covers all blocks, isn't.
+ *
+ * @param pFileData compressed data
+ * @param pOutBuffer buffer for decompressed data, of at least nSize bytes
+ * @param nFileSize compressed size in bytes
+ * @param nOffset offset of the first decompressed byte to return
+ * @param nSize number of decompressed bytes to return
+ * @param pDictionaryData dictionary contents that the data was compressed with, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ *
+ * @return number of decompressed bytes returned, less than nSize if the range goes past the end of the data, or -1 for error
+ */
+LZ4ULTRA_API size_t lz4ultra_decompress_range_inmem(const unsigned char *pFileData, unsigned char *pOutBuffer, size_t nFileSize, unsigned long long nOffset, size_t nSize,
+                                       const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags);
+
+/**
+ * Decompress a range of bytes out of a file that ends with a seek table, decompressing only the blocks that cover the range
+ *
+ * The input file is mapped into memory. The block checksums, if any, of the decompressed blocks are verified; the content
+ * checksum, which covers all blocks, isn't.
+ *
+ * @param pszInFilename name of input(compressed) file
+ * @param pszOutFilename name of output(decompressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_TRUSTED_INPUT to skip bounds checks on data known to be valid, or 0)
+ * @param nOffset offset of the first decompressed byte to write
+ * @param nSize number of decompressed bytes to write, or -1 for all bytes up to the end
+ * @param pOriginalSize pointer to returned output(decompressed) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned size of the compressed blocks that were decompressed, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t (LZ4ULTRA_ERROR_FORMAT if the file has no seek table)
+ */
+LZ4ULTRA_API lz4ultra_status_t lz4ultra_decompress_range_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags,
+                                                 long long nOffset, long long nSize, long long *pOriginalSize, long long *pCompressedSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LZ4ULTRA_H */
@@ -0,0 +1,770 @@
+/*
+ * lz4ultra_bench.c - reproducible benchmark suite for the lz4ultra library
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/timeb.h>
+#else
+#include <sys/time.h>
+#include <dirent.h>
+#endif
+#include "lib.h"
+
+#define TOOL_VERSION "1.3.0"
+
+#define BENCH_MAX_VALUES   16
+#define BENCH_MAX_RUNS     101
+
+#define BENCH_FORMAT_CSV   0
+#define BENCH_FORMAT_JSON  1
+
+/** One list of values to sweep, parsed from a comma-separated option */
+typedef struct {
+   int nCount;
+   int nValue[BENCH_MAX_VALUES];
+} bench_sweep_t;
+
+/** One file of the corpus, loaded in memory */
+typedef struct {
+   char *pszName;
+   unsigned char *pData;
+   size_t nSize;
+} bench_file_t;
+
+/** Result of benchmarking one file with one configuration */
+typedef struct {
+   size_t nOriginalSize;
+   size_t nCompressedSize;
+   long long nCompTime;
+   long long nDecompTime;
+} bench_result_t;
+
+/*---------------------------------------------------------------------------*/
+
+#ifdef _WIN32
+LARGE_INTEGER hpc_frequency;
+BOOL hpc_available = FALSE;
+#endif
+
+static void do_init_time() {
+#ifdef _WIN32
+   hpc_frequency.QuadPart = 0;
+   hpc_available = QueryPerformanceFrequency(&hpc_frequency);
+#endif
+}
+
+static long long do_get_time() {
+   long long nTime;
+
+#ifdef _WIN32
+   if (hpc_available) {
+      LARGE_INTEGER nCurTime;
+
+      /* Use HPC hardware for best precision */
+      QueryPerformanceCounter(&nCurTime);
+      nTime = (long long)(nCurTime.QuadPart * 1000000LL / hpc_frequency.QuadPart);
+   }
+   else {
+      struct _timeb tb;
+      _ftime(&tb);
+
+      nTime = ((long long)tb.time * 1000LL + (long long)tb.millitm) * 1000LL;
+   }
+#else
+   struct timeval tm;
+   gettimeofday(&tm, NULL);
+
+   nTime = (long long)tm.tv_sec * 1000000LL + (long long)tm.tv_usec;
+#endif
+   return nTime;
+}
+
+/*---------------------------------------------------------------------------*/
+
+#ifdef __linux__
+static cpu_set_t g_processCpuSet;
+static bool g_processCpuSetValid = false;
+#endif
+
+/**
+ * Remember the processors that this process may run on, before pinning it to a subset of them
+ *
+ * @return true if threads can be pinned on this system, false if not
+ */
+static bool bench_init_affinity(void) {
+#ifdef __linux__
+   g_processCpuSetValid = (sched_getaffinity(0, sizeof(g_processCpuSet), &g_processCpuSet) == 0);
+   return g_processCpuSetValid;
+#else
+   return false;
+#endif
+}
+
+/**
+ * Pin the calling thread, and the worker threads that it creates from now on, to the first processors it may run on
+ *
+ * Threads inherit the affinity of the thread that creates them, so the pools started by the parallel APIs stay on
+ * the same processors from one run to the next, instead of being migrated by the scheduler.
+ *
+ * @param nThreads number of processors to pin to
+ *
+ * @return true if pinned, false if pinning isn't supported or failed
+ */
+static bool bench_pin_threads(int nThreads) {
+#ifdef __linux__
+   cpu_set_t cpuSet;
+   int nCpu, nPinned = 0;
+
+   if (!g_processCpuSetValid)
+      return false;
+
+   CPU_ZERO(&cpuSet);
+   for (nCpu = 0; nCpu < CPU_SETSIZE && nPinned < nThreads; nCpu++) {
+      if (CPU_ISSET(nCpu, &g_processCpuSet)) {
+         CPU_SET(nCpu, &cpuSet);
+         nPinned++;
+      }
+   }
+
+   return sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == 0;
+#else
+   return false;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ * Parse a comma-separated list of numbers
+ *
+ * @param pszList list to parse
+ * @param nMinValue smallest accepted value
+ * @param nMaxValue largest accepted value
+ * @param pSweep list to fill
+ *
+ * @return 0 for success, -1 for error
+ */
+static int bench_parse_numbers(const char *pszList, int nMinValue, int nMaxValue, bench_sweep_t *pSweep) {
+   pSweep->nCount = 0;
+
+   while (*pszList) {
+      char *pszEnd = NULL;
+      long nValue = strtol(pszList, &pszEnd, 10);
+
+      if (pszEnd == pszList || nValue < nMinValue || nValue > nMaxValue || pSweep->nCount >= BENCH_MAX_VALUES)
+         return -1;
+      pSweep->nValue[pSweep->nCount++] = (int)nValue;
+
+      if (*pszEnd == ',')
+         pszEnd++;
+      else if (*pszEnd)
+         return -1;
+      pszList = pszEnd;
+   }
+
+   return (pSweep->nCount > 0) ? 0 : -1;
+}
+
+/**
+ * Parse a comma-separated list of names, as the indices of the names in a table
+ *
+ * @param pszList list to parse
+ * @param ppszNames table of accepted names
+ * @param nNumNames number of names in the table
+ * @param pSweep list to fill
+ *
+ * @return 0 for success, -1 for error
+ */
+static int bench_parse_names(const char *pszList, const char **ppszNames, int nNumNames, bench_sweep_t *pSweep) {
+   pSweep->nCount = 0;
+
+   while (*pszList) {
+      const char *pszEnd = strchr(pszList, ',');
+      size_t nLen = pszEnd ? (size_t)(pszEnd - pszList) : strlen(pszList);
+      int i;
+
+      for (i = 0; i < nNumNames; i++) {
+         if (strlen(ppszNames[i]) == nLen && !memcmp(ppszNames[i], pszList, nLen))
+            break;
+      }
+      if (i == nNumNames || pSweep->nCount >= BENCH_MAX_VALUES)
+         return -1;
+      pSweep->nValue[pSweep->nCount++] = i;
+
+      pszList += nLen;
+      if (*pszList == ',')
+         pszList++;
+   }
+
+   return (pSweep->nCount > 0) ? 0 : -1;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ * Load one file of the corpus in memory
+ *
+ * @param pszFilename name of file to load
+ * @param pFile corpus entry to fill
+ *
+ * @return 0 for success, -1 for error
+ */
+static int bench_load_file(const char *pszFilename, bench_file_t *pFile) {
+   FILE *f_in = fopen(pszFilename, "rb");
+   long nFileSize;
+
+   if (!f_in) {
+      fprintf(stderr, "error opening '%s' for reading\n", pszFilename);
+      return -1;
+   }
+
+   fseek(f_in, 0, SEEK_END);
+   nFileSize = ftell(f_in);
+   fseek(f_in, 0, SEEK_SET);
+
+   pFile->pszName = (char*)malloc(strlen(pszFilename) + 1);
+   pFile->pData = (unsigned char*)malloc(nFileSize > 0 ? (size_t)nFileSize : 1);
+   pFile->nSize = (nFileSize > 0) ? (size_t)nFileSize : 0;
+   if (!pFile->pszName || !pFile->pData) {
+      fclose(f_in);
+      fprintf(stderr, "out of memory for reading '%s', %ld bytes needed\n", pszFilename, nFileSize);
+      return -1;
+   }
+   strcpy(pFile->pszName, pszFilename);
+
+   if (fread(pFile->pData, 1, pFile->nSize, f_in) != pFile->nSize) {
+      fclose(f_in);
+      fprintf(stderr, "I/O error while reading '%s'\n", pszFilename);
+      return -1;
+   }
+
+   fclose(f_in);
+   return 0;
+}
+
+/**
+ * Compare two corpus entries by name, for qsort()
+ */
+static int bench_compare_files(const void *p1, const void *p2) {
+   return strcmp(((const bench_file_t*)p1)->pszName, ((const bench_file_t*)p2)->pszName);
+}
+
+/**
+ * Add a file, or all the regular files of a directory, to the corpus
+ *
+ * The files of a directory are added in name order, so that the results come out in the same order every time.
+ *
+ * @param pszPath file or directory name
+ * @param ppFiles corpus, grown as needed
+ * @param pnNumFiles number of files in the corpus, updated
+ *
+ * @return 0 for success, -1 for error
+ */
+static int bench_add_path(const char *pszPath, bench_file_t **ppFiles, int *pnNumFiles) {
+   struct stat st;
+   int nFirstFile = *pnNumFiles;
+
+   if (stat(pszPath, &st) != 0) {
+      fprintf(stderr, "error opening '%s'\n", pszPath);
+      return -1;
+   }
+
+   if (!(st.st_mode & S_IFDIR)) {
+      bench_file_t *pNewFiles = (bench_file_t*)realloc(*ppFiles, (*pnNumFiles + 1) * sizeof(bench_file_t));
+      if (!pNewFiles) {
+         fprintf(stderr, "out of memory\n");
+         return -1;
+      }
+      *ppFiles = pNewFiles;
+      memset(&pNewFiles[*pnNumFiles], 0, sizeof(bench_file_t));
+      (*pnNumFiles)++;
+      return bench_load_file(pszPath, &pNewFiles[*pnNumFiles - 1]);
+   }
+
+#ifdef _WIN32
+   {
+      char szPattern[MAX_PATH];
+      WIN32_FIND_DATAA findData;
+      HANDLE hFind;
+
+      snprintf(szPattern, sizeof(szPattern), "%s\\*", pszPath);
+      hFind = FindFirstFileA(szPattern, &findData);
+      if (hFind == INVALID_HANDLE_VALUE) {
+         fprintf(stderr, "error opening directory '%s'\n", pszPath);
+         return -1;
+      }
+
+      do {
+         char szFilename[MAX_PATH];
+
+         if (findData.cFileName[0] == '.' || (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            continue;
+         snprintf(szFilename, sizeof(szFilename), "%s\\%s", pszPath, findData.cFileName);
+         if (bench_add_path(szFilename, ppFiles, pnNumFiles) != 0) {
+            FindClose(hFind);
+            return -1;
+         }
+      } while (FindNextFileA(hFind, &findData));
+
+      FindClose(hFind);
+   }
+#else
+   {
+      DIR *pDir = opendir(pszPath);
+      struct dirent *pEntry;
+
+      if (!pDir) {
+         fprintf(stderr, "error opening directory '%s'\n", pszPath);
+         return -1;
+      }
+
+      while ((pEntry = readdir(pDir)) != NULL) {
+         size_t nFilenameSize;
+         char *pszFilename;
+         int nResult = 0;
+
+         if (pEntry->d_name[0] == '.')
+            continue;
+
+         nFilenameSize = strlen(pszPath) + strlen(pEntry->d_name) + 2;
+         pszFilename = (char*)malloc(nFilenameSize);
+         if (!pszFilename) {
+            closedir(pDir);
+            fprintf(stderr, "out of memory\n");
+            return -1;
+         }
+         snprintf(pszFilename, nFilenameSize, "%s/%s", pszPath, pEntry->d_name);
+
+         /* Only add regular files; subdirectories aren't descended into */
+         if (stat(pszFilename, &st) == 0 && S_ISREG(st.st_mode))
+            nResult = bench_add_path(pszFilename, ppFiles, pnNumFiles);
+         free(pszFilename);
+
+         if (nResult != 0) {
+            closedir(pDir);
+            return -1;
+         }
+      }
+
+      closedir(pDir);
+   }
+#endif
+
+   qsort(*ppFiles + nFirstFile, *pnNumFiles - nFirstFile, sizeof(bench_file_t), bench_compare_files);
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ * Compare two times, for qsort()
+ */
+static int bench_compare_times(const void *p1, const void *p2) {
+   long long nTime1 = *(const long long*)p1;
+   long long nTime2 = *(const long long*)p2;
+
+   return (nTime1 > nTime2) - (nTime1 < nTime2);
+}
+
+/**
+ * Get the median of a set of run times
+ *
+ * @param pTimes run times, sorted in place
+ * @param nRuns number of run times
+ *
+ * @return median time
+ */
+static long long bench_get_median(long long *pTimes, int nRuns) {
+   qsort(pTimes, nRuns, sizeof(long long), bench_compare_times);
+   if (nRuns & 1)
+      return pTimes[nRuns >> 1];
+   else
+      return (pTimes[(nRuns >> 1) - 1] + pTimes[nRuns >> 1]) / 2;
+}
+
+/**
+ * Benchmark compressing and decompressing one file with one configuration
+ *
+ * All runs use the same buffers and, for single-threaded runs, the same compression context, so that the timings
+ * measure steady-state (de)compression rather than allocation. The first decompression is checked against the
+ * original data.
+ *
+ * @param pFile file to benchmark
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level
+ * @param nThreads number of threads
+ * @param nWarmupRuns number of untimed runs before the timed ones
+ * @param nRuns number of timed runs
+ * @param pResult result to fill
+ *
+ * @return 0 for success, -1 for error
+ */
+static int bench_run(const bench_file_t *pFile, const unsigned int nFlags, const int nBlockMaxCode, const int nLevel, const int nThreads,
+                     const int nWarmupRuns, const int nRuns, bench_result_t *pResult) {
+   long long nCompTimes[BENCH_MAX_RUNS];
+   long long nDecompTimes[BENCH_MAX_RUNS];
+   size_t nMaxCompressedSize = lz4ultra_get_max_compressed_size_inmem(pFile->nSize, nFlags, nBlockMaxCode);
+   unsigned char *pCompressedData = (unsigned char*)malloc(nMaxCompressedSize);
+   unsigned char *pDecompressedData = (unsigned char*)malloc(pFile->nSize ? pFile->nSize : 1);
+   lz4ultra_compressor *pCompressor = NULL;
+   size_t nCompressedSize = 0;
+   int i;
+
+   if (pCompressedData && pDecompressedData && nThreads <= 1)
+      pCompressor = lz4ultra_compressor_create(0, nFlags, NULL, 0);
+   if (!pCompressedData || !pDecompressedData || (nThreads <= 1 && !pCompressor)) {
+      if (pCompressor)
+         lz4ultra_compressor_free(pCompressor);
+      free(pDecompressedData);
+      free(pCompressedData);
+      fprintf(stderr, "out of memory for benchmarking '%s'\n", pFile->pszName);
+      return -1;
+   }
+
+   for (i = -nWarmupRuns; i < nRuns; i++) {
+      long long t0 = do_get_time();
+      if (pCompressor)
+         nCompressedSize = lz4ultra_compress_inmem_with_dictionary(pCompressor, NULL, pFile->pData, pCompressedData, pFile->nSize, nMaxCompressedSize, nFlags, nBlockMaxCode, nLevel);
+      else
+         nCompressedSize = lz4ultra_compress_inmem_parallel(pFile->pData, pCompressedData, pFile->nSize, nMaxCompressedSize, nFlags, nBlockMaxCode, nLevel, nThreads, NULL, NULL);
+      long long t1 = do_get_time();
+
+      if (nCompressedSize == -1) {
+         fprintf(stderr, "compression error for '%s'\n", pFile->pszName);
+         break;
+      }
+      if (i >= 0)
+         nCompTimes[i] = t1 - t0;
+   }
+
+   if (pCompressor)
+      lz4ultra_compressor_free(pCompressor);
+   if (nCompressedSize == -1) {
+      free(pDecompressedData);
+      free(pCompressedData);
+      return -1;
+   }
+
+   for (i = -nWarmupRuns - 1; i < nRuns; i++) {
+      long long t0 = do_get_time();
+      size_t nDecompressedSize = lz4ultra_decompress_inmem_parallel(pCompressedData, pDecompressedData, nCompressedSize, pFile->nSize, 0, nThreads, NULL, NULL);
+      long long t1 = do_get_time();
+
+      if (nDecompressedSize != pFile->nSize || (i == -nWarmupRuns - 1 && memcmp(pDecompressedData, pFile->pData, pFile->nSize))) {
+         fprintf(stderr, "verification error for '%s'\n", pFile->pszName);
+         free(pDecompressedData);
+         free(pCompressedData);
+         return -1;
+      }
+      if (i >= 0)
+         nDecompTimes[i] = t1 - t0;
+   }
+
+   free(pDecompressedData);
+   free(pCompressedData);
+
+   pResult->nOriginalSize = pFile->nSize;
+   pResult->nCompressedSize = nCompressedSize;
+   pResult->nCompTime = bench_get_median(nCompTimes, nRuns);
+   pResult->nDecompTime = bench_get_median(nDecompTimes, nRuns);
+   return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ * Write a string as a quoted CSV or JSON value
+ *
+ * @param f_out output file
+ * @param pszValue string to write
+ * @param nFormat BENCH_FORMAT_xxx
+ */
+static void bench_write_string(FILE *f_out, const char *pszValue, const int nFormat) {
+   fputc('"', f_out);
+   while (*pszValue) {
+      if (*pszValue == '"')
+         fputs((nFormat == BENCH_FORMAT_JSON) ? "\\\"" : "\"\"", f_out);
+      else if (*pszValue == '\\' && nFormat == BENCH_FORMAT_JSON)
+         fputs("\\\\", f_out);
+      else
+         fputc(*pszValue, f_out);
+      pszValue++;
+   }
+   fputc('"', f_out);
+}
+
+/**
+ * Write one result
+ *
+ * @param f_out output file
+ * @param nFormat BENCH_FORMAT_xxx
+ * @param bFirst true for the first result written
+ * @param pszName name of the file that the result is for
+ * @param nLevel compression level
+ * @param nBlockMaxCode maximum block size code
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nThreads number of threads
+ * @param pResult result to write
+ */
+static void bench_write_result(FILE *f_out, const int nFormat, const bool bFirst, const char *pszName, const int nLevel, const int nBlockMaxCode,
+                               const unsigned int nFlags, const int nThreads, const bench_result_t *pResult) {
+   const char *pszMode = (nFlags & LZ4ULTRA_FLAG_FAVOR_RATIO) ? "ratio" : "speed";
+   const char *pszBlocks = (nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) ? "indep" : "dep";
+   const char *pszPages = (nFlags & LZ4ULTRA_FLAG_HUGE_PAGES) ? "huge" : "std";
+   double fRatio = pResult->nOriginalSize ? ((double)pResult->nCompressedSize * 100.0 / (double)pResult->nOriginalSize) : 0.0;
+   double fCompSpeed = pResult->nCompTime ? ((double)pResult->nOriginalSize / (double)pResult->nCompTime) : 0.0;
+   double fDecompSpeed = pResult->nDecompTime ? ((double)pResult->nOriginalSize / (double)pResult->nDecompTime) : 0.0;
+
+   if (nFormat == BENCH_FORMAT_JSON) {
+      fprintf(f_out, "%s\n    { \"file\": ", bFirst ? "" : ",");
+      bench_write_string(f_out, pszName, nFormat);
+      fprintf(f_out, ", \"level\": %d, \"block_size\": %d, \"mode\": \"%s\", \"blocks\": \"%s\", \"threads\": %d, \"pages\": \"%s\", "
+              "\"original_size\": %zu, \"compressed_size\": %zu, \"ratio\": %.3f, "
+              "\"compress_us\": %lld, \"compress_mbs\": %.2f, \"decompress_us\": %lld, \"decompress_mbs\": %.2f }",
+              nLevel, nBlockMaxCode, pszMode, pszBlocks, nThreads, pszPages,
+              pResult->nOriginalSize, pResult->nCompressedSize, fRatio,
+              pResult->nCompTime, fCompSpeed, pResult->nDecompTime, fDecompSpeed);
+   }
+   else {
+      bench_write_string(f_out, pszName, nFormat);
+      fprintf(f_out, ",%d,%d,%s,%s,%d,%s,%zu,%zu,%.3f,%lld,%.2f,%lld,%.2f\n",
+              nLevel, nBlockMaxCode, pszMode, pszBlocks, nThreads, pszPages,
+              pResult->nOriginalSize, pResult->nCompressedSize, fRatio,
+              pResult->nCompTime, fCompSpeed, pResult->nDecompTime, fDecompSpeed);
+   }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void bench_usage(const char *pszProgName) {
+   fprintf(stderr, "lz4ultra_bench " TOOL_VERSION " - reproducible benchmark suite for the lz4ultra library\n");
+   fprintf(stderr, "usage: %s [options] <corpus directory or file> [<corpus directory or file>...]\n", pszProgName);
+   fprintf(stderr, "   --levels=<list>: compression levels to sweep, for instance 1,3,5 (default: 1,3,5)\n");
+   fprintf(stderr, "   --blocks=<list>: block size codes to sweep, 4..7 for 64 Kb..4 Mb (default: 4,5,6,7)\n");
+   fprintf(stderr, "    --modes=<list>: ratio (favor ratio) and/or speed (favor decompression speed) (default: ratio,speed)\n");
+   fprintf(stderr, "     --deps=<list>: indep (independent blocks) and/or dep (dependent blocks) (default: indep,dep)\n");
+   fprintf(stderr, "  --threads=<list>: thread counts to sweep (default: 1 and the number of processors)\n");
+   fprintf(stderr, "    --pages=<list>: std (regular pages) and/or huge (huge pages, placed on each worker's NUMA node) for the compression buffers (default: std)\n");
+   fprintf(stderr, "        --runs=<n>: number of timed runs per measurement, the median is reported (default: 5)\n");
+   fprintf(stderr, "      --warmup=<n>: number of untimed runs before the timed ones (default: 1)\n");
+   fprintf(stderr, " --format=csv|json: output format (default: csv)\n");
+   fprintf(stderr, "          --no-pin: don't pin the benchmark to the first processors it may run on\n");
+   fprintf(stderr, "     -o <filename>: write results to a file instead of stdout\n");
+   fprintf(stderr, "                -v: print progress to stderr\n");
+}
+
+int main(int argc, char **argv) {
+   static const char *g_pszModeNames[] = { "ratio", "speed" };
+   static const char *g_pszDepNames[] = { "indep", "dep" };
+   static const char *g_pszPageNames[] = { "std", "huge" };
+   bench_sweep_t levels, blocks, modes, deps, threads, pages;
+   const char *pszOutFilename = NULL;
+   bench_file_t *pFiles = NULL;
+   int nNumFiles = 0;
+   int nRuns = 5, nWarmupRuns = 1;
+   int nFormat = BENCH_FORMAT_CSV;
+   bool bPin = true;
+   bool bVerbose = false;
+   bool bArgsError = false;
+   bool bFirst = true;
+   int nResult = 0;
+   int i;
+   FILE *f_out;
+
+   levels.nCount = 3; levels.nValue[0] = 1; levels.nValue[1] = 3; levels.nValue[2] = 5;
+   blocks.nCount = 4; blocks.nValue[0] = 4; blocks.nValue[1] = 5; blocks.nValue[2] = 6; blocks.nValue[3] = 7;
+   modes.nCount = 2; modes.nValue[0] = 0; modes.nValue[1] = 1;
+   deps.nCount = 2; deps.nValue[0] = 0; deps.nValue[1] = 1;
+   pages.nCount = 1; pages.nValue[0] = 0;
+   threads.nCount = 1; threads.nValue[0] = 1;
+   if (lz4ultra_get_cpu_count() > 1) {
+      threads.nCount = 2;
+      threads.nValue[1] = lz4ultra_get_cpu_count();
+   }
+
+   do_init_time();
+
+   for (i = 1; i < argc && !bArgsError; i++) {
+      if (!strncmp(argv[i], "--levels=", 9))
+         bArgsError = bench_parse_numbers(argv[i] + 9, LZ4ULTRA_MIN_LEVEL, LZ4ULTRA_MAX_LEVEL, &levels) != 0;
+      else if (!strncmp(argv[i], "--blocks=", 9))
+         bArgsError = bench_parse_numbers(argv[i] + 9, 4, 7, &blocks) != 0;
+      else if (!strncmp(argv[i], "--modes=", 8))
+         bArgsError = bench_parse_names(argv[i] + 8, g_pszModeNames, 2, &modes) != 0;
+      else if (!strncmp(argv[i], "--deps=", 7))
+         bArgsError = bench_parse_names(argv[i] + 7, g_pszDepNames, 2, &deps) != 0;
+      else if (!strncmp(argv[i], "--pages=", 8))
+         bArgsError = bench_parse_names(argv[i] + 8, g_pszPageNames, 2, &pages) != 0;
+      else if (!strncmp(argv[i], "--threads=", 10))
+         bArgsError = bench_parse_numbers(argv[i] + 10, 1, 256, &threads) != 0;
+      else if (!strncmp(argv[i], "--runs=", 7)) {
+         nRuns = atoi(argv[i] + 7);
+         bArgsError = (nRuns < 1 || nRuns > BENCH_MAX_RUNS);
+      }
+      else if (!strncmp(argv[i], "--warmup=", 9)) {
+         nWarmupRuns = atoi(argv[i] + 9);
+         bArgsError = (nWarmupRuns < 0 || nWarmupRuns > 100);
+      }
+      else if (!strcmp(argv[i], "--format=csv"))
+         nFormat = BENCH_FORMAT_CSV;
+      else if (!strcmp(argv[i], "--format=json"))
+         nFormat = BENCH_FORMAT_JSON;
+      else if (!strcmp(argv[i], "--no-pin"))
+         bPin = false;
+      else if (!strcmp(argv[i], "-v"))
+         bVerbose = true;
+      else if (!strcmp(argv[i], "-o")) {
+         if ((i + 1) < argc && !pszOutFilename)
+            pszOutFilename = argv[++i];
+         else
+            bArgsError = true;
+      }
+      else if (argv[i][0] == '-')
+         bArgsError = true;
+      else if (bench_add_path(argv[i], &pFiles, &nNumFiles) != 0)
+         return 100;
+   }
+
+   if (bArgsError || !nNumFiles) {
+      bench_usage(argv[0]);
+      return 100;
+   }
+
+   if (bPin)
+      bPin = bench_init_affinity();
+
+   if (pszOutFilename) {
+      f_out = fopen(pszOutFilename, "w");
+      if (!f_out) {
+         fprintf(stderr, "error opening '%s' for writing\n", pszOutFilename);
+         return 100;
+      }
+   }
+   else {
+      f_out = stdout;
+   }
+
+   if (nFormat == BENCH_FORMAT_JSON) {
+      fprintf(f_out, "{\n  \"tool\": \"lz4ultra_bench\", \"version\": \"" TOOL_VERSION "\", \"runs\": %d, \"warmup\": %d, \"pinned\": %s,\n  \"results\": [",
+              nRuns, nWarmupRuns, bPin ? "true" : "false");
+   }
+   else {
+      fprintf(f_out, "file,level,block_size,mode,blocks,threads,pages,original_size,compressed_size,ratio,compress_us,compress_mbs,decompress_us,decompress_mbs\n");
+   }
+
+   int nThreadsIdx, nLevelIdx, nBlocksIdx, nModeIdx, nDepIdx, nPagesIdx;
+   for (nThreadsIdx = 0; nThreadsIdx < threads.nCount && !nResult; nThreadsIdx++) {
+      int nThreads = threads.nValue[nThreadsIdx];
+
+      if (bPin && !bench_pin_threads(nThreads)) {
+         fprintf(stderr, "error pinning to %d processor(s)\n", nThreads);
+         nResult = 100;
+         break;
+      }
+      if (bVerbose)
+         fprintf(stderr, "%d thread(s)%s\n", nThreads, bPin ? ", pinned" : "");
+
+      for (nLevelIdx = 0; nLevelIdx < levels.nCount && !nResult; nLevelIdx++) {
+         for (nBlocksIdx = 0; nBlocksIdx < blocks.nCount && !nResult; nBlocksIdx++) {
+            for (nModeIdx = 0; nModeIdx < modes.nCount && !nResult; nModeIdx++) {
+               for (nDepIdx = 0; nDepIdx < deps.nCount && !nResult; nDepIdx++) {
+                  for (nPagesIdx = 0; nPagesIdx < pages.nCount && !nResult; nPagesIdx++) {
+                     int nLevel = levels.nValue[nLevelIdx];
+                     int nBlockMaxCode = blocks.nValue[nBlocksIdx];
+                     unsigned int nFlags = 0;
+                     bench_result_t total;
+                     int nFile;
+
+                     if (modes.nValue[nModeIdx] == 0)
+                        nFlags |= LZ4ULTRA_FLAG_FAVOR_RATIO;
+                     if (deps.nValue[nDepIdx] == 0)
+                        nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
+                     if (pages.nValue[nPagesIdx] == 1)
+                        nFlags |= LZ4ULTRA_FLAG_HUGE_PAGES;
+
+                     if (bVerbose)
+                        fprintf(stderr, "  level %d, -B%d, favor %s, %s blocks, %s pages\n", nLevel, nBlockMaxCode, g_pszModeNames[modes.nValue[nModeIdx]], g_pszDepNames[deps.nValue[nDepIdx]], g_pszPageNames[pages.nValue[nPagesIdx]]);
+
+                     memset(&total, 0, sizeof(total));
+                     for (nFile = 0; nFile < nNumFiles; nFile++) {
+                        bench_result_t result;
+
+                        if (bench_run(&pFiles[nFile], nFlags, nBlockMaxCode, nLevel, nThreads, nWarmupRuns, nRuns, &result) != 0) {
+                           nResult = 100;
+                           break;
+                        }
+
+                        bench_write_result(f_out, nFormat, bFirst, pFiles[nFile].pszName, nLevel, nBlockMaxCode, nFlags, nThreads, &result);
+                        bFirst = false;
+
+                        total.nOriginalSize += result.nOriginalSize;
+                        total.nCompressedSize += result.nCompressedSize;
+                        total.nCompTime += result.nCompTime;
+                        total.nDecompTime += result.nDecompTime;
+                     }
+
+                     /* Sum of the medians over the whole corpus */
+                     if (!nResult && nNumFiles > 1)
+                        bench_write_result(f_out, nFormat, bFirst, "(total)", nLevel, nBlockMaxCode, nFlags, nThreads, &total);
+                     fflush(f_out);
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   if (nFormat == BENCH_FORMAT_JSON)
+      fprintf(f_out, "\n  ]\n}\n");
+
+   if (f_out != stdout)
+      fclose(f_out);
+
+   for (i = 0; i < nNumFiles; i++) {
+      free(pFiles[i].pData);
+      free(pFiles[i].pszName);
+   }
+   free(pFiles);
+
+   return nResult;
+}
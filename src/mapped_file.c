@@ -0,0 +1,255 @@
+/*
+ * mapped_file.c - memory-mapped file implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <string.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "mapped_file.h"
+
+#ifdef _WIN32
+
+/**
+ * Map existing regular file into memory, for reading
+ *
+ * @param pMappedFile mapped file to fill out
+ * @param pszFilename filename
+ *
+ * @return 0 for success, nonzero if the file can't be mapped (missing, empty, not a regular file, or mapping not supported)
+ */
+int lz4ultra_mapped_file_open(lz4ultra_mapped_file_t *pMappedFile, const char *pszFilename) {
+   LARGE_INTEGER nFileSize;
+
+   memset(pMappedFile, 0, sizeof(lz4ultra_mapped_file_t));
+
+   pMappedFile->hFile = CreateFileA(pszFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+   if (pMappedFile->hFile == INVALID_HANDLE_VALUE) {
+      pMappedFile->hFile = NULL;
+      return -1;
+   }
+
+   if (GetFileType(pMappedFile->hFile) != FILE_TYPE_DISK || !GetFileSizeEx(pMappedFile->hFile, &nFileSize) ||
+       nFileSize.QuadPart <= 0 || (unsigned long long)nFileSize.QuadPart > (unsigned long long)((size_t)-1)) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   pMappedFile->hMapping = CreateFileMappingA(pMappedFile->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+   if (!pMappedFile->hMapping) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   pMappedFile->pData = (unsigned char *)MapViewOfFile(pMappedFile->hMapping, FILE_MAP_READ, 0, 0, 0);
+   if (!pMappedFile->pData) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   pMappedFile->nSize = (size_t)nFileSize.QuadPart;
+   return 0;
+}
+
+/**
+ * Create file of a known size, or truncate an existing one, and map it into memory for writing
+ *
+ * @param pMappedFile mapped file to fill out
+ * @param pszFilename filename
+ * @param nSize file size, in bytes (must be greater than 0)
+ *
+ * @return 0 for success, nonzero if the file can't be created at that size or mapped
+ */
+int lz4ultra_mapped_file_create(lz4ultra_mapped_file_t *pMappedFile, const char *pszFilename, size_t nSize) {
+   unsigned long long nMappingSize = (unsigned long long)nSize;
+
+   memset(pMappedFile, 0, sizeof(lz4ultra_mapped_file_t));
+   if (!nSize)
+      return -1;
+
+   pMappedFile->hFile = CreateFileA(pszFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+   if (pMappedFile->hFile == INVALID_HANDLE_VALUE) {
+      pMappedFile->hFile = NULL;
+      return -1;
+   }
+
+   if (GetFileType(pMappedFile->hFile) != FILE_TYPE_DISK) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   /* Creating the mapping extends the file to its final size */
+   pMappedFile->hMapping = CreateFileMappingA(pMappedFile->hFile, NULL, PAGE_READWRITE, (DWORD)(nMappingSize >> 32), (DWORD)(nMappingSize & 0xffffffffULL), NULL);
+   if (!pMappedFile->hMapping) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   pMappedFile->pData = (unsigned char *)MapViewOfFile(pMappedFile->hMapping, FILE_MAP_WRITE, 0, 0, nSize);
+   if (!pMappedFile->pData) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   pMappedFile->nSize = nSize;
+   return 0;
+}
+
+/**
+ * Unmap file and close it
+ *
+ * @param pMappedFile mapped file
+ */
+void lz4ultra_mapped_file_close(lz4ultra_mapped_file_t *pMappedFile) {
+   if (pMappedFile->pData) {
+      UnmapViewOfFile(pMappedFile->pData);
+      pMappedFile->pData = NULL;
+   }
+   if (pMappedFile->hMapping) {
+      CloseHandle(pMappedFile->hMapping);
+      pMappedFile->hMapping = NULL;
+   }
+   if (pMappedFile->hFile) {
+      CloseHandle(pMappedFile->hFile);
+      pMappedFile->hFile = NULL;
+   }
+   pMappedFile->nSize = 0;
+}
+
+#else
+
+/**
+ * Map existing regular file into memory, for reading
+ *
+ * @param pMappedFile mapped file to fill out
+ * @param pszFilename filename
+ *
+ * @return 0 for success, nonzero if the file can't be mapped (missing, empty, not a regular file, or mapping not supported)
+ */
+int lz4ultra_mapped_file_open(lz4ultra_mapped_file_t *pMappedFile, const char *pszFilename) {
+   struct stat st;
+   void *pData;
+
+   memset(pMappedFile, 0, sizeof(lz4ultra_mapped_file_t));
+
+   pMappedFile->fd = open(pszFilename, O_RDONLY);
+   if (pMappedFile->fd < 0)
+      return -1;
+
+   if (fstat(pMappedFile->fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+       (unsigned long long)st.st_size > (unsigned long long)((size_t)-1)) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   pData = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, pMappedFile->fd, 0);
+   if (pData == MAP_FAILED) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+#ifdef MADV_SEQUENTIAL
+   madvise(pData, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+   pMappedFile->pData = (unsigned char *)pData;
+   pMappedFile->nSize = (size_t)st.st_size;
+   return 0;
+}
+
+/**
+ * Create file of a known size, or truncate an existing one, and map it into memory for writing
+ *
+ * @param pMappedFile mapped file to fill out
+ * @param pszFilename filename
+ * @param nSize file size, in bytes (must be greater than 0)
+ *
+ * @return 0 for success, nonzero if the file can't be created at that size or mapped
+ */
+int lz4ultra_mapped_file_create(lz4ultra_mapped_file_t *pMappedFile, const char *pszFilename, size_t nSize) {
+   struct stat st;
+   void *pData;
+
+   memset(pMappedFile, 0, sizeof(lz4ultra_mapped_file_t));
+   pMappedFile->fd = -1;
+   if (!nSize || (unsigned long long)nSize > (unsigned long long)(((unsigned long long)1 << (sizeof(off_t) * 8 - 1)) - 1))
+      return -1;
+
+   pMappedFile->fd = open(pszFilename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+   if (pMappedFile->fd < 0)
+      return -1;
+
+   if (fstat(pMappedFile->fd, &st) != 0 || !S_ISREG(st.st_mode) || ftruncate(pMappedFile->fd, (off_t)nSize) != 0) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+#ifdef __linux__
+   /* Reserve the blocks now: running out of disk space while writing through the mapping would fault instead of failing cleanly */
+   if (posix_fallocate(pMappedFile->fd, 0, (off_t)nSize) != 0) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+#endif
+
+   pData = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, pMappedFile->fd, 0);
+   if (pData == MAP_FAILED) {
+      lz4ultra_mapped_file_close(pMappedFile);
+      return -1;
+   }
+
+   pMappedFile->pData = (unsigned char *)pData;
+   pMappedFile->nSize = nSize;
+   return 0;
+}
+
+/**
+ * Unmap file and close it
+ *
+ * @param pMappedFile mapped file
+ */
+void lz4ultra_mapped_file_close(lz4ultra_mapped_file_t *pMappedFile) {
+   if (pMappedFile->pData) {
+      munmap(pMappedFile->pData, pMappedFile->nSize);
+      pMappedFile->pData = NULL;
+   }
+   if (pMappedFile->fd >= 0) {
+      close(pMappedFile->fd);
+   }
+   pMappedFile->fd = -1;
+   pMappedFile->nSize = 0;
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * mapped_file.h - memory-mapped file definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <stddef.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/** File mapped into memory */
+typedef struct _lz4ultra_mapped_file_t {
+   /** Mapped file contents */
+   unsigned char *pData;
+
+   /** Size of mapped contents, in bytes */
+   size_t nSize;
+
+#ifdef _WIN32
+   HANDLE hFile;
+   HANDLE hMapping;
+#else
+   int fd;
+#endif
+} lz4ultra_mapped_file_t;
+
+/**
+ * Map existing regular file into memory, for reading
+ *
+ * @param pMappedFile mapped file to fill out
+ * @param pszFilename filename
+ *
+ * @return 0 for success, nonzero if the file can't be mapped (missing, empty, not a regular file, or mapping not supported)
+ */
+int lz4ultra_mapped_file_open(lz4ultra_mapped_file_t *pMappedFile, const char *pszFilename);
+
+/**
+ * Create file of a known size, or truncate an existing one, and map it into memory for writing
+ *
+ * @param pMappedFile mapped file to fill out
+ * @param pszFilename filename
+ * @param nSize file size, in bytes (must be greater than 0)
+ *
+ * @return 0 for success, nonzero if the file can't be created at that size or mapped
+ */
+int lz4ultra_mapped_file_create(lz4ultra_mapped_file_t *pMappedFile, const char *pszFilename, size_t nSize);
+
+/**
+ * Unmap file and close it
+ *
+ * @param pMappedFile mapped file
+ */
+void lz4ultra_mapped_file_close(lz4ultra_mapped_file_t *pMappedFile);
+
+#endif /* _MAPPED_FILE_H */
@@ -35,45 +35,290 @@
 #include "format.h"
 #include "matchfinder.h"
 
+/* Shift of the LCP in the entries of the open intervals stack, that are wide enough for both layouts */
+#define OPEN_LCP_SHIFT 32
+
+/* Number of suffixes ahead of the current one, whose randomly scattered Phi, PLCP and window entries are prefetched */
+#define LCP_PREFETCH_DISTANCE 16
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LZ4ULTRA_PREFETCH_READ(__p)  __builtin_prefetch((__p), 0)
+#define LZ4ULTRA_PREFETCH_WRITE(__p) __builtin_prefetch((__p), 1)
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define LZ4ULTRA_FIRST_DIFF_BYTE(__x) (__builtin_ctzll(__x) >> 3)
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define LZ4ULTRA_FIRST_DIFF_BYTE(__x) (__builtin_clzll(__x) >> 3)
+#endif
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define LZ4ULTRA_PREFETCH_READ(__p)  _mm_prefetch((const char *)(__p), _MM_HINT_T0)
+#define LZ4ULTRA_PREFETCH_WRITE(__p) _mm_prefetch((const char *)(__p), _MM_HINT_T0)
+#if defined(_M_X64)
+static inline int lz4ultra_first_diff_byte(const unsigned long long nDiff) {
+   unsigned long nIndex;
+
+   _BitScanForward64(&nIndex, nDiff);
+   return (int)(nIndex >> 3);
+}
+#define LZ4ULTRA_FIRST_DIFF_BYTE(__x) lz4ultra_first_diff_byte(__x)
+#endif
+#else
+#define LZ4ULTRA_PREFETCH_READ(__p)
+#define LZ4ULTRA_PREFETCH_WRITE(__p)
+#endif
+
 /**
- * Parse input data, build suffix array and overlaid data structures to speed up match finding
+ * Get the interval reference to store for an entry of the open intervals stack, in the layout being built
+ *
+ * @param nEntry open interval (LCP << OPEN_LCP_SHIFT | interval index)
+ * @param nCompact 1 for the compact layout, 0 for the split layout
+ *
+ * @return interval reference
+ */
+static inline unsigned int lz4ultra_get_interval_ref(const unsigned long long nEntry, const int nCompact) {
+   if (nCompact)
+      return (unsigned int)(((nEntry >> OPEN_LCP_SHIFT) << LCP_SHIFT) | (nEntry & POS_MASK));
+   else
+      return (unsigned int)nEntry;
+}
+
+/**
+ * Store one suffix of the sorted input window, along with the length of its common prefix with the previous one, in
+ * the layout being built
+ *
+ * @param pCompressor compression context
+ * @param nCompact 1 for the compact layout, 0 for the split layout
+ * @param nRank rank of the suffix in sorted order
+ * @param nPos position of the suffix in the input window
+ * @param nLen length of the common prefix with the previous suffix in sorted order (0 for rank 0)
+ */
+static inline void lz4ultra_store_sorted_suffix(lz4ultra_compressor *pCompressor, const int nCompact, const int nRank, const int nPos, int nLen) {
+   if (nLen < MIN_MATCH_SIZE)
+      nLen = 0;
+   if (nLen > LCP_MAX)
+      nLen = LCP_MAX;
+   if (nCompact)
+      pCompressor->intervals[nRank] = ((unsigned int)nPos) | (((unsigned int)nLen) << LCP_SHIFT);
+   else {
+      pCompressor->intervals[nRank] = (unsigned int)nPos;
+      pCompressor->interval_lcp[nRank] = (unsigned short)nLen;
+   }
+}
+
+/**
+ * Compare two suffixes of the input window
+ *
+ * @param pInWindow pointer to input data window
+ * @param nInWindowSize total input size in bytes
+ * @param nPos1 position of the first suffix
+ * @param nPos2 position of the second suffix (different from the first)
+ *
+ * @return negative if the first suffix sorts before the second one, positive otherwise
+ */
+static inline int lz4ultra_compare_suffixes(const unsigned char *pInWindow, const int nInWindowSize, const int nPos1, const int nPos2) {
+   int nResult = memcmp(pInWindow + nPos1, pInWindow + nPos2, nInWindowSize - ((nPos1 > nPos2) ? nPos1 : nPos2));
+
+   if (nResult)
+      return nResult;
+
+   /* One suffix starts the other one: the shorter one sorts first */
+   return (nPos1 > nPos2) ? -1 : 1;
+}
+
+/**
+ * Get the length of the common prefix of two suffixes of the input window
+ *
+ * @param pInWindow pointer to input data window
+ * @param nInWindowSize total input size in bytes
+ * @param nPos1 position of the first suffix
+ * @param nPos2 position of the second suffix
+ *
+ * @return common prefix length
+ */
+static inline int lz4ultra_get_suffixes_lcp(const unsigned char *pInWindow, const int nInWindowSize, const int nPos1, const int nPos2) {
+   const int nMaxLen = nInWindowSize - ((nPos1 > nPos2) ? nPos1 : nPos2);
+   int nLen = 0;
+
+   while (nLen < nMaxLen && pInWindow[nPos1 + nLen] == pInWindow[nPos2 + nLen])
+      nLen++;
+   return nLen;
+}
+
+/**
+ * Sort the suffixes of an input window that starts with a prepared dictionary, and get their common prefix lengths
+ *
+ * Only the suffixes that start in the data following the dictionary, and the dictionary's open suffixes, are sorted;
+ * each of them is then merged into the dictionary's sorted suffixes, searching forward from where the previous one went.
+ * Common prefix lengths between dictionary suffixes that stay next to each other are reused as well. The result is the
+ * same as sorting the whole window.
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (dictionary + bytes to compress)
+ * @param nInWindowSize total input size in bytes (dictionary + bytes to compress)
+ * @param pDictionary prepared dictionary at the start of the window
+ * @param nCompact 1 for the compact layout, 0 for the split layout
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_sort_suffixes_with_dictionary(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize,
+                                                  const lz4ultra_prepared_dictionary_t *pDictionary, const int nCompact) {
+   const int nNumSorted = pDictionary->size - pDictionary->num_open_suffixes;
+   const int nNumNew = nInWindowSize - nNumSorted;
+   const int *pSorted = pDictionary->sorted_suffixes;
+   const int *pSortedLcp = pDictionary->sorted_lcp;
+   saidx_t *pNewSuffixes = (saidx_t *)pCompressor->pos_data;  /* Use temporarily */
+   int nSorted = 0, nRank = 0;
+   int nPrevPos = 0, nPrevSorted = -1;
+   int i;
+
+   if (divsufsort_build_array(&pCompressor->divsufsort_context, pInWindow + nNumSorted, pNewSuffixes, nNumNew) != 0)
+      return 100;
+
+   for (i = 0; i <= nNumNew; i++) {
+      int nNewPos = 0, nLow, nHigh;
+
+      if (i < nNumNew) {
+         int nStep = 1;
+
+         /* Gallop, then bisect, to the first dictionary suffix that sorts after the new one */
+         nNewPos = (int)pNewSuffixes[i] + nNumSorted;
+         nLow = nHigh = nSorted;
+         while (nHigh < nNumSorted && lz4ultra_compare_suffixes(pInWindow, nInWindowSize, pSorted[nHigh], nNewPos) < 0) {
+            nLow = nHigh + 1;
+            nHigh += nStep;
+            nStep <<= 1;
+         }
+         if (nHigh > nNumSorted)
+            nHigh = nNumSorted;
+         while (nLow < nHigh) {
+            int nMid = (nLow + nHigh) >> 1;
+
+            if (lz4ultra_compare_suffixes(pInWindow, nInWindowSize, pSorted[nMid], nNewPos) < 0)
+               nLow = nMid + 1;
+            else
+               nHigh = nMid;
+         }
+      }
+      else {
+         nLow = nNumSorted;
+      }
+
+      /* Copy the dictionary suffixes that sort before the new one */
+      for (; nSorted < nLow; nSorted++) {
+         int nPos = pSorted[nSorted];
+         int nLen;
+
+         if (!nRank)
+            nLen = 0;
+         else if (nPrevSorted == (nSorted - 1))
+            nLen = pSortedLcp[nSorted];
+         else
+            nLen = lz4ultra_get_suffixes_lcp(pInWindow, nInWindowSize, nPrevPos, nPos);
+         lz4ultra_store_sorted_suffix(pCompressor, nCompact, nRank, nPos, nLen);
+         nRank++;
+         nPrevPos = nPos;
+         nPrevSorted = nSorted;
+      }
+
+      if (i < nNumNew) {
+         lz4ultra_store_sorted_suffix(pCompressor, nCompact, nRank, nNewPos, nRank ? lz4ultra_get_suffixes_lcp(pInWindow, nInWindowSize, nPrevPos, nNewPos) : 0);
+         nRank++;
+         nPrevPos = nNewPos;
+         nPrevSorted = -2;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * Extend the length of the common prefix of two suffixes of the input window, comparing 8 bytes at a time once the
+ * first byte matches (most extensions stop right away)
+ *
+ * @param pA start of first suffix
+ * @param pB start of second suffix
+ * @param nLen number of bytes already known to be the same
+ * @param nMaxLen maximum length to compare up to
+ *
+ * @return length of the common prefix, up to nMaxLen
+ */
+static inline int lz4ultra_extend_common_prefix(const unsigned char *pA, const unsigned char *pB, int nLen, const int nMaxLen) {
+   if (nLen >= nMaxLen || pA[nLen] != pB[nLen])
+      return nLen;
+   nLen++;
+
+   while (nLen + 8 <= nMaxLen) {
+      unsigned long long nA, nB;
+
+      memcpy(&nA, pA + nLen, 8);
+      memcpy(&nB, pB + nLen, 8);
+      if (nA != nB) {
+#ifdef LZ4ULTRA_FIRST_DIFF_BYTE
+         return nLen + LZ4ULTRA_FIRST_DIFF_BYTE(nA ^ nB);
+#else
+         break;
+#endif
+      }
+      nLen += 8;
+   }
+
+   while (nLen < nMaxLen && pA[nLen] == pB[nLen])
+      nLen++;
+   return nLen;
+}
+
+/**
+ * Sort the suffixes of the input window, and get their common prefix lengths
  *
  * @param pCompressor compression context
  * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
  * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param nCompact 1 for the compact layout, 0 for the split layout
  *
  * @return 0 for success, non-zero for failure
  */
-int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize) {
-   unsigned long long *intervals = pCompressor->intervals;
+static int lz4ultra_sort_suffixes(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize, const int nCompact) {
+   unsigned int *intervals = pCompressor->intervals;
+   unsigned short *interval_lcp = pCompressor->interval_lcp;
+   long long nStartTime = pCompressor->collect_stats ? lz4ultra_stats_get_time() : 0LL;
+   long long nSortedTime = 0LL;
 
-   /* Build suffix array from input data */
+   /* Build suffix array from input data, in place */
    saidx_t *suffixArray = (saidx_t*)intervals;
    if (divsufsort_build_array(&pCompressor->divsufsort_context, pInWindow, suffixArray, nInWindowSize) != 0) {
       return 100;
    }
+   if (pCompressor->collect_stats)
+      nSortedTime = lz4ultra_stats_get_time();
 
    int i;
 
-   for (i = nInWindowSize - 1; i >= 0; i--) {
-      intervals[i] = suffixArray[i];
-   }
-
    int *PLCP = (int*)pCompressor->pos_data;  /* Use temporarily */
    int *Phi = PLCP;
    int nCurLen = 0;
 
-   /* Compute the permuted LCP first (Krkkinen method) */
+   /* Compute the permuted LCP first (Krkkinen method). Lengths are capped at LCP_MAX, as they are below anyway: the
+    * length at the next position is still at least the capped length minus one, so the capped lengths stay exact. */
    Phi[intervals[0]] = -1;
-   for (i = 1; i < nInWindowSize; i++)
-      Phi[intervals[i]] = (unsigned int)intervals[i - 1];
+   for (i = 1; i < nInWindowSize; i++) {
+      if (i + LCP_PREFETCH_DISTANCE < nInWindowSize)
+         LZ4ULTRA_PREFETCH_WRITE(&Phi[intervals[i + LCP_PREFETCH_DISTANCE]]);
+      Phi[intervals[i]] = (int)intervals[i - 1];
+   }
    for (i = 0; i < nInWindowSize; i++) {
-      if (Phi[i] == -1) {
+      const int nPrev = Phi[i];
+
+      if (nPrev == -1) {
          PLCP[i] = 0;
          continue;
       }
-      int nMaxLen = (i > Phi[i]) ? (nInWindowSize - i) : (nInWindowSize - Phi[i]);
-      while (nCurLen < nMaxLen && pInWindow[i + nCurLen] == pInWindow[Phi[i] + nCurLen]) nCurLen++;
+      if (i + LCP_PREFETCH_DISTANCE < nInWindowSize && Phi[i + LCP_PREFETCH_DISTANCE] >= 0)
+         LZ4ULTRA_PREFETCH_READ(pInWindow + Phi[i + LCP_PREFETCH_DISTANCE] + nCurLen);
+
+      int nMaxLen = (i > nPrev) ? (nInWindowSize - i) : (nInWindowSize - nPrev);
+      if (nMaxLen > LCP_MAX)
+         nMaxLen = LCP_MAX;
+      nCurLen = lz4ultra_extend_common_prefix(pInWindow + i, pInWindow + nPrev, nCurLen, nMaxLen);
       PLCP[i] = nCurLen;
       if (nCurLen > 0)
          nCurLen--;
@@ -82,57 +327,95 @@ int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned
    /* Rotate permuted LCP into the LCP. This has better cache locality than the direct Kasai LCP method. This also
     * saves us from having to build the inverse suffix array index, as the LCP is calculated without it using this method,
     * and the interval builder below doesn't need it either. */
-   intervals[0] &= POS_MASK;
+   if (!nCompact)
+      interval_lcp[0] = 0;
    for (i = 1; i < nInWindowSize; i++) {
-      int nIndex = (int)(intervals[i] & POS_MASK);
+      if (i + LCP_PREFETCH_DISTANCE < nInWindowSize)
+         LZ4ULTRA_PREFETCH_READ(&PLCP[intervals[i + LCP_PREFETCH_DISTANCE]]);
+
+      int nIndex = (int)intervals[i];
       int nLen = PLCP[nIndex];
       if (nLen < MIN_MATCH_SIZE)
          nLen = 0;
       if (nLen > LCP_MAX)
          nLen = LCP_MAX;
-      intervals[i] = ((unsigned long long)nIndex) | (((unsigned long long)nLen) << LCP_SHIFT);
+      if (nCompact)
+         intervals[i] = ((unsigned int)nIndex) | (((unsigned int)nLen) << LCP_SHIFT);
+      else
+         interval_lcp[i] = (unsigned short)nLen;
+   }
+
+   if (pCompressor->collect_stats) {
+      pCompressor->block_stats.sort_time += nSortedTime - nStartTime;
+      pCompressor->block_stats.lcp_time += lz4ultra_stats_get_time() - nSortedTime;
    }
 
+   return 0;
+}
+
+/**
+ * Build intervals for finding matches, over the sorted suffixes and their common prefix lengths
+ *
+ * @param pCompressor compression context
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param nCompact 1 for the compact layout, 0 for the split layout
+ */
+static void lz4ultra_build_intervals(lz4ultra_compressor *pCompressor, const int nInWindowSize, const int nCompact) {
+   unsigned int *intervals = pCompressor->intervals;
+   unsigned short *interval_lcp = pCompressor->interval_lcp;
+
    /**
-    * Build intervals for finding matches
-    *
     * Methodology and code fragment taken from wimlib (CC0 license):
     * https://wimlib.net/git/?p=wimlib;a=blob_plain;f=src/lcpit_matchfinder.c;h=a2d6a1e0cd95200d1f3a5464d8359d5736b14cbe;hb=HEAD
+    *
+    * Intervals are numbered in the order they are opened, so an interval's index never exceeds the rank being
+    * processed; this allows overwriting the suffix array and LCPs (by rank) with the intervals (by index) in place.
     */
-   unsigned long long * const SA_and_LCP = intervals;
-   unsigned long long *pos_data = pCompressor->pos_data;
+   unsigned int * const SA_and_LCP = intervals;
+   unsigned int *pos_data = pCompressor->pos_data;
    unsigned long long next_interval_idx;
    unsigned long long *top = pCompressor->open_intervals;
-   unsigned long long prev_pos = SA_and_LCP[0] & POS_MASK;
+   unsigned int prev_pos = nCompact ? (SA_and_LCP[0] & POS_MASK) : SA_and_LCP[0];
 
    *top = 0;
    intervals[0] = 0;
    next_interval_idx = 1;
 
    for (int r = 1; r < nInWindowSize; r++) {
-      const unsigned long long next_pos = SA_and_LCP[r] & POS_MASK;
-      const unsigned long long next_lcp = SA_and_LCP[r] & LCP_MASK;
-      const unsigned long long top_lcp = *top & LCP_MASK;
+      unsigned int next_pos;
+      unsigned long long next_lcp;
+      const unsigned long long top_lcp = *top >> OPEN_LCP_SHIFT;
+
+      if (nCompact) {
+         next_pos = SA_and_LCP[r] & POS_MASK;
+         next_lcp = SA_and_LCP[r] >> LCP_SHIFT;
+      }
+      else {
+         next_pos = SA_and_LCP[r];
+         next_lcp = interval_lcp[r];
+      }
 
       if (next_lcp == top_lcp) {
          /* Continuing the deepest open interval  */
-         pos_data[prev_pos] = *top;
+         pos_data[prev_pos] = lz4ultra_get_interval_ref(*top, nCompact);
       }
       else if (next_lcp > top_lcp) {
          /* Opening a new interval  */
-         *++top = next_lcp | next_interval_idx++;
-         pos_data[prev_pos] = *top;
+         if (!nCompact)
+            interval_lcp[next_interval_idx] = (unsigned short)next_lcp;
+         *++top = (next_lcp << OPEN_LCP_SHIFT) | next_interval_idx++;
+         pos_data[prev_pos] = lz4ultra_get_interval_ref(*top, nCompact);
       }
       else {
          /* Closing the deepest open interval  */
-         pos_data[prev_pos] = *top;
+         pos_data[prev_pos] = lz4ultra_get_interval_ref(*top, nCompact);
          for (;;) {
-            const unsigned long long closed_interval_idx = *top-- & POS_MASK;
-            const unsigned long long superinterval_lcp = *top & LCP_MASK;
+            const unsigned int closed_interval_idx = (unsigned int)*top--;
+            const unsigned long long superinterval_lcp = *top >> OPEN_LCP_SHIFT;
 
             if (next_lcp == superinterval_lcp) {
                /* Continuing the superinterval */
-               intervals[closed_interval_idx] = *top;
+               intervals[closed_interval_idx] = lz4ultra_get_interval_ref(*top, nCompact);
                break;
             }
             else if (next_lcp > superinterval_lcp) {
@@ -140,13 +423,15 @@ int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned
                 * superinterval of the one being
                 * closed, but still a subinterval of
                 * its superinterval  */
-               *++top = next_lcp | next_interval_idx++;
-               intervals[closed_interval_idx] = *top;
+               if (!nCompact)
+                  interval_lcp[next_interval_idx] = (unsigned short)next_lcp;
+               *++top = (next_lcp << OPEN_LCP_SHIFT) | next_interval_idx++;
+               intervals[closed_interval_idx] = lz4ultra_get_interval_ref(*top, nCompact);
                break;
             }
             else {
                /* Also closing the superinterval  */
-               intervals[closed_interval_idx] = *top;
+               intervals[closed_interval_idx] = lz4ultra_get_interval_ref(*top, nCompact);
             }
          }
       }
@@ -154,16 +439,70 @@ int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned
    }
 
    /* Close any still-open intervals.  */
-   pos_data[prev_pos] = *top;
+   pos_data[prev_pos] = lz4ultra_get_interval_ref(*top, nCompact);
    for (; top > pCompressor->open_intervals; top--)
-      intervals[*top & POS_MASK] = *(top - 1);
+      intervals[(unsigned int)*top] = lz4ultra_get_interval_ref(*(top - 1), nCompact);
+}
+
+/**
+ * Parse input data, build suffix array and overlaid data structures to speed up match finding
+ *
+ * Windows of up to COMPACT_WINDOW_SIZE bytes use the compact layout, where each 32-bit interval reference packs the LCP
+ * and the position. Larger windows use the split layout, where references only hold positions and the LCPs of the
+ * intervals are kept in interval_lcp[].
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param pDictionary prepared dictionary that the window starts with, or NULL for none
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize, const lz4ultra_prepared_dictionary_t *pDictionary) {
+   unsigned short *interval_lcp = pCompressor->interval_lcp;
+   const int nCompact = (nInWindowSize <= COMPACT_WINDOW_SIZE) ? 1 : 0;
+   long long nTime = 0LL;
+
+   if (!nCompact && !interval_lcp) {
+      /* Heap-backed contexts allocate the LCPs of the split layout the first time they sort a large window, so that contexts
+       * that only use the binary tree or hash chain match finders don't take room for them */
+      if (pCompressor->in_arena)
+         return 100;
+      interval_lcp = (unsigned short *)malloc((size_t)pCompressor->max_window_size * sizeof(unsigned short));
+      if (!interval_lcp)
+         return 100;
+      pCompressor->interval_lcp = interval_lcp;
+   }
+   pCompressor->compact_intervals = nCompact;
+
+   /* Merging into the dictionary's sorted suffixes pays off as long as there are fewer suffixes to sort than dictionary suffixes */
+   if (pDictionary && (nInWindowSize - pDictionary->size + pDictionary->num_open_suffixes) <= pDictionary->size) {
+      if (pCompressor->collect_stats)
+         nTime = lz4ultra_stats_get_time();
+      if (lz4ultra_sort_suffixes_with_dictionary(pCompressor, pInWindow, nInWindowSize, pDictionary, nCompact))
+         return 100;
+
+      /* Merging computes the common prefix lengths as it goes, count it all as sorting */
+      if (pCompressor->collect_stats)
+         pCompressor->block_stats.sort_time += lz4ultra_stats_get_time() - nTime;
+   }
+   else {
+      if (lz4ultra_sort_suffixes(pCompressor, pInWindow, nInWindowSize, nCompact))
+         return 100;
+   }
+
+   if (pCompressor->collect_stats)
+      nTime = lz4ultra_stats_get_time();
+   lz4ultra_build_intervals(pCompressor, nInWindowSize, nCompact);
+   if (pCompressor->collect_stats)
+      pCompressor->block_stats.intervals_time += lz4ultra_stats_get_time() - nTime;
 
    /* Success */
    return 0;
 }
 
 /**
- * Find matches at the specified offset in the input window
+ * Find matches at the specified offset in the input window, with the compact interval layout
  *
  * @param pCompressor compression context
  * @param nOffset offset to find matches at, in the input window
@@ -172,12 +511,12 @@ int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned
  *
  * @return number of matches
  */
-static int lz4ultra_find_matches_at(lz4ultra_compressor *pCompressor, const int nOffset, lz4ultra_match *pMatches, const int nMaxMatches) {
-   unsigned long long *intervals = pCompressor->intervals;
-   unsigned long long *pos_data = pCompressor->pos_data;
-   unsigned long long ref;
-   unsigned long long super_ref;
-   unsigned long long match_pos;
+static int lz4ultra_find_matches_at_compact(lz4ultra_compressor *pCompressor, const int nOffset, lz4ultra_match *pMatches, const int nMaxMatches) {
+   unsigned int *intervals = pCompressor->intervals;
+   unsigned int *pos_data = pCompressor->pos_data;
+   unsigned int ref;
+   unsigned int super_ref;
+   unsigned int match_pos;
    lz4ultra_match *matchptr;
 
    /**
@@ -216,7 +555,7 @@ static int lz4ultra_find_matches_at(lz4ultra_compressor *pCompressor, const int
       while ((super_ref = pos_data[match_pos]) > ref)
          match_pos = intervals[super_ref & POS_MASK] & EXCL_VISITED_MASK;
       intervals[ref & POS_MASK] = nOffset | VISITED_FLAG;
-      pos_data[match_pos] = (unsigned long long)ref;
+      pos_data[match_pos] = ref;
 
       if ((matchptr - pMatches) < nMaxMatches) {
          int nMatchOffset = (int)(nOffset - match_pos);
@@ -237,6 +576,90 @@ static int lz4ultra_find_matches_at(lz4ultra_compressor *pCompressor, const int
    return (int)(matchptr - pMatches);
 }
 
+/**
+ * Find matches at the specified offset in the input window, with the split interval layout
+ *
+ * References are plain interval indices here. As the intervals being ascended are nested and their LCPs strictly
+ * decrease, comparing LCPs gives the same order as comparing the packed references of the compact layout.
+ *
+ * @param pCompressor compression context
+ * @param nOffset offset to find matches at, in the input window
+ * @param pMatches pointer to returned matches
+ * @param nMaxMatches maximum number of matches to return (0 for none)
+ *
+ * @return number of matches
+ */
+static int lz4ultra_find_matches_at_split(lz4ultra_compressor *pCompressor, const int nOffset, lz4ultra_match *pMatches, const int nMaxMatches) {
+   unsigned int *intervals = pCompressor->intervals;
+   unsigned int *pos_data = pCompressor->pos_data;
+   const unsigned short *interval_lcp = pCompressor->interval_lcp;
+   unsigned int ref;
+   unsigned int super_ref;
+   unsigned int match_pos;
+   lz4ultra_match *matchptr;
+
+   ref = pos_data[nOffset];
+
+   pos_data[nOffset] = 0;
+
+   /* Only the root has a zero LCP, so any other reference that isn't a visited link is an unvisited interval */
+   while ((super_ref = intervals[ref]) != 0 && !(super_ref & VISITED_FLAG)) {
+      intervals[ref] = nOffset | VISITED_FLAG;
+      ref = super_ref;
+   }
+
+   if (super_ref == 0) {
+      if (ref != 0)  /* Not the root?  */
+         intervals[ref] = nOffset | VISITED_FLAG;
+      return 0;
+   }
+
+   match_pos = super_ref & EXCL_VISITED_MASK;
+   matchptr = pMatches;
+   for (;;) {
+      const unsigned int nRefLcp = interval_lcp[ref];
+
+      while (interval_lcp[(super_ref = pos_data[match_pos])] > nRefLcp)
+         match_pos = intervals[super_ref] & EXCL_VISITED_MASK;
+      intervals[ref] = nOffset | VISITED_FLAG;
+      pos_data[match_pos] = ref;
+
+      if ((matchptr - pMatches) < nMaxMatches) {
+         int nMatchOffset = (int)(nOffset - match_pos);
+
+         if (nMatchOffset <= MAX_OFFSET) {
+            matchptr->length = nRefLcp;
+            matchptr->offset = (unsigned int)nMatchOffset;
+            matchptr++;
+         }
+      }
+
+      if (super_ref == 0)
+         break;
+      ref = super_ref;
+      match_pos = intervals[ref] & EXCL_VISITED_MASK;
+   }
+
+   return (int)(matchptr - pMatches);
+}
+
+/**
+ * Find matches at the specified offset in the input window
+ *
+ * @param pCompressor compression context
+ * @param nOffset offset to find matches at, in the input window
+ * @param pMatches pointer to returned matches
+ * @param nMaxMatches maximum number of matches to return (0 for none)
+ *
+ * @return number of matches
+ */
+static inline int lz4ultra_find_matches_at(lz4ultra_compressor *pCompressor, const int nOffset, lz4ultra_match *pMatches, const int nMaxMatches) {
+   if (pCompressor->compact_intervals)
+      return lz4ultra_find_matches_at_compact(pCompressor, nOffset, pMatches, nMaxMatches);
+   else
+      return lz4ultra_find_matches_at_split(pCompressor, nOffset, pMatches, nMaxMatches);
+}
+
 /**
  * Skip previously compressed bytes
  *
@@ -264,10 +687,14 @@ void lz4ultra_skip_matches(lz4ultra_compressor *pCompressor, const int nStartOff
  */
 void lz4ultra_find_all_matches(lz4ultra_compressor *pCompressor, const int nStartOffset, const int nEndOffset) {
    lz4ultra_match *pMatch = pCompressor->match + nStartOffset;
+   lz4ultra_match_candidate *pCandidate = pCompressor->num_candidates ? (pCompressor->candidates + (size_t)nStartOffset * MAX_MATCH_CANDIDATES) : NULL;
+   const int nNumCandidates = pCompressor->num_candidates;
+   lz4ultra_match found[MAX_MATCH_CANDIDATES + 1];
    int i;
 
    for (i = nStartOffset; i < nEndOffset; i++) {
-      int nMatches = lz4ultra_find_matches_at(pCompressor, i, pMatch, 1);
+      int nMatches = lz4ultra_find_matches_at(pCompressor, i, found, 1 + nNumCandidates);
+      int nCandidates = 0;
 
       if (nMatches == 0 || i > (nEndOffset - LAST_MATCH_OFFSET)) {
          pMatch->length = 0;
@@ -277,11 +704,316 @@ void lz4ultra_find_all_matches(lz4ultra_compressor *pCompressor, const int nStar
          int nMaxLen = (nEndOffset - LAST_LITERALS) - i;
          if (nMaxLen < 0)
             nMaxLen = 0;
+         *pMatch = found[0];
          if (pMatch->length > (unsigned int)nMaxLen)
             pMatch->length = (unsigned int)nMaxLen;
+
+         if (nNumCandidates) {
+            unsigned int nLastOffset = pMatch->offset;
+            int j;
+
+            /* Shorter matches found while ascending the intervals; only keep the ones that are closer */
+            for (j = 1; j < nMatches; j++) {
+               unsigned int nLen = (found[j].length > (unsigned int)nMaxLen) ? (unsigned int)nMaxLen : found[j].length;
+
+               if (nLen < MIN_MATCH_SIZE)
+                  break;
+               if (found[j].offset < nLastOffset && nLen < pMatch->length) {
+                  pCandidate[nCandidates].length = (unsigned short)nLen;
+                  pCandidate[nCandidates].offset = (unsigned short)found[j].offset;
+                  nLastOffset = found[j].offset;
+                  nCandidates++;
+               }
+            }
+         }
+      }
+
+      if (nCandidates < nNumCandidates) {
+         pCandidate[nCandidates].length = 0;
+         pCandidate[nCandidates].offset = 0;
       }
 
       pMatch++;
+      if (pCandidate)
+         pCandidate += MAX_MATCH_CANDIDATES;
+   }
+}
+
+/**
+ * Scan part of the input window for runs of identical bytes that are at least MIN_RUN_SIZE bytes long
+ *
+ * @param pInWindow pointer to input data window
+ * @param nStartOffset offset to start scanning at
+ * @param nEndOffset offset to stop scanning at
+ * @param pRuns array to store the runs into, or NULL to stop at the first run
+ * @param nMaxRuns capacity of the array
+ *
+ * @return number of runs found
+ */
+static int lz4ultra_scan_runs(const unsigned char *pInWindow, const int nStartOffset, const int nEndOffset, lz4ultra_run *pRuns, const int nMaxRuns) {
+   int nNumRuns = 0;
+   int i = nStartOffset;
+
+   while (i < nEndOffset && nNumRuns < nMaxRuns) {
+      const unsigned char nValue = pInWindow[i];
+      int j = i + 1;
+
+      while (j < nEndOffset && pInWindow[j] == nValue)
+         j++;
+
+      if ((j - i) >= MIN_RUN_SIZE) {
+         if (!pRuns)
+            return 1;
+         pRuns[nNumRuns].start = i;
+         pRuns[nNumRuns].end = j;
+         nNumRuns++;
+      }
+
+      i = j;
+   }
+
+   return nNumRuns;
+}
+
+/**
+ * Get the amount of memory that the suffix array match finder allocates for compacting long runs, the first time it finds one
+ *
+ * @param nMaxWindowSize maximum window size (previously compressed bytes + bytes to compress)
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_get_runs_memory_size(const int nMaxWindowSize) {
+   return (size_t)nMaxWindowSize + (size_t)(nMaxWindowSize / MIN_RUN_SIZE + 2) * sizeof(lz4ultra_run);
+}
+
+/**
+ * Look for long runs of identical bytes in the input window, and remember them for finding matches around them
+ *
+ * Runs are searched separately in the previously compressed bytes and in the bytes to compress, so that none straddles
+ * the two. Arena-backed contexts never look for runs.
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ *
+ * @return number of runs found, 0 for none
+ */
+int lz4ultra_find_runs(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInWindowSize) {
+   const int nMaxRuns = pCompressor->max_window_size / MIN_RUN_SIZE + 2;
+
+   pCompressor->num_runs = 0;
+   pCompressor->num_history_runs = 0;
+   if (pCompressor->in_arena)
+      return 0;
+
+   /* Most blocks have no long runs at all; only allocate the compacted window once one is found */
+   if (!lz4ultra_scan_runs(pInWindow, 0, nPreviousBlockSize, NULL, 1) && !lz4ultra_scan_runs(pInWindow, nPreviousBlockSize, nInWindowSize, NULL, 1))
+      return 0;
+
+   if (!pCompressor->runs) {
+      pCompressor->run_window = (unsigned char *)malloc(pCompressor->max_window_size);
+      pCompressor->runs = (lz4ultra_run *)malloc(nMaxRuns * sizeof(lz4ultra_run));
+
+      if (!pCompressor->run_window || !pCompressor->runs) {
+         /* Fall back to sorting the whole window */
+         if (pCompressor->run_window) {
+            free(pCompressor->run_window);
+            pCompressor->run_window = NULL;
+         }
+         if (pCompressor->runs) {
+            free(pCompressor->runs);
+            pCompressor->runs = NULL;
+         }
+         return 0;
+      }
+   }
+
+   pCompressor->num_history_runs = lz4ultra_scan_runs(pInWindow, 0, nPreviousBlockSize, pCompressor->runs, nMaxRuns);
+   pCompressor->num_runs = pCompressor->num_history_runs +
+      lz4ultra_scan_runs(pInWindow, nPreviousBlockSize, nInWindowSize, pCompressor->runs + pCompressor->num_history_runs, nMaxRuns - pCompressor->num_history_runs);
+   return pCompressor->num_runs;
+}
+
+/**
+ * Get the piece of the compacted window that an offset falls into; piece k starts after the stub of run k-1 and ends with
+ * the stub of run k, or at the end of the window for the last piece
+ *
+ * @param pRuns runs that were cut out of the window
+ * @param nNumRuns number of runs
+ * @param nCompactedOffset offset in the compacted window
+ *
+ * @return piece index
+ */
+static int lz4ultra_get_run_piece(const lz4ultra_run *pRuns, const int nNumRuns, const int nCompactedOffset) {
+   int nLow = 0, nHigh = nNumRuns;
+
+   while (nLow < nHigh) {
+      const int nMid = (nLow + nHigh) >> 1;
+
+      if (pRuns[nMid].compacted_end <= nCompactedOffset)
+         nLow = nMid + 1;
+      else
+         nHigh = nMid;
    }
+
+   return nLow;
 }
 
+/**
+ * Find all matches for the data to be compressed, after lz4ultra_find_runs() found runs in the window
+ *
+ * Positions inside runs get a match at offset 1 up to the end of the run. The suffix array is only built over the rest of
+ * the window, with each run cut down to its first few bytes, and the matches found there are mapped back to the input
+ * window.
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param pDictionary prepared dictionary that the window starts with, or NULL for none
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_find_all_matches_around_runs(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInWindowSize,
+                                          const lz4ultra_prepared_dictionary_t *pDictionary) {
+   lz4ultra_run *pRuns = pCompressor->runs;
+   const int nNumRuns = pCompressor->num_runs;
+   const int nNumHistoryRuns = pCompressor->num_history_runs;
+   unsigned char *pCompacted = pCompressor->run_window;
+   const int nNumCandidates = pCompressor->num_candidates;
+   const int nMaxLenOffset = nInWindowSize - LAST_LITERALS;
+   lz4ultra_match found[MAX_MATCH_CANDIDATES + 1];
+   int nCompactedSize = 0, nCompactedBlockStart;
+   int nLastEnd = 0;
+   int nPiece, nPieceStart, nPieceEnd, nPieceDelta;
+   int p, r;
+
+   /* Keep the start of each run as a stub, and cut the rest out */
+   for (r = 0; r < nNumRuns; r++) {
+      const int nStubEnd = pRuns[r].start + RUN_STUB_SIZE;
+
+      memcpy(pCompacted + nCompactedSize, pInWindow + nLastEnd, nStubEnd - nLastEnd);
+      nCompactedSize += nStubEnd - nLastEnd;
+      pRuns[r].compacted_end = nCompactedSize;
+      nLastEnd = pRuns[r].end;
+   }
+   memcpy(pCompacted + nCompactedSize, pInWindow + nLastEnd, nInWindowSize - nLastEnd);
+   nCompactedSize += nInWindowSize - nLastEnd;
+
+   /* Pieces are numbered by the run whose stub they end with; the block starts in the piece after the last history run */
+   nPiece = nNumHistoryRuns;
+   nPieceStart = nPiece ? pRuns[nPiece - 1].compacted_end : 0;
+   nPieceEnd = (nPiece < nNumRuns) ? pRuns[nPiece].compacted_end : nCompactedSize;
+   nPieceDelta = nPiece ? (pRuns[nPiece - 1].end - pRuns[nPiece - 1].compacted_end) : 0;
+   nCompactedBlockStart = nPreviousBlockSize - nPieceDelta;
+
+   /* The prepared dictionary only applies if the previously compressed bytes were left untouched */
+   if (lz4ultra_build_suffix_array(pCompressor, pCompacted, nCompactedSize, nNumHistoryRuns ? NULL : pDictionary))
+      return 100;
+
+   if (nCompactedBlockStart)
+      lz4ultra_skip_matches(pCompressor, 0, nCompactedBlockStart);
+
+   for (p = nCompactedBlockStart; p < nCompactedSize; p++) {
+      int nMatches = lz4ultra_find_matches_at(pCompressor, p, found, MAX_MATCH_CANDIDATES + 1);
+      int nPos, nMaxLen, nCandidates = 0, j;
+      lz4ultra_match *pMatch;
+      lz4ultra_match_candidate *pCandidate;
+
+      while (p >= nPieceEnd) {
+         nPiece++;
+         nPieceStart = pRuns[nPiece - 1].compacted_end;
+         nPieceEnd = (nPiece < nNumRuns) ? pRuns[nPiece].compacted_end : nCompactedSize;
+         nPieceDelta = pRuns[nPiece - 1].end - pRuns[nPiece - 1].compacted_end;
+      }
+
+      nPos = p + nPieceDelta;
+      pMatch = pCompressor->match + nPos;
+      pCandidate = nNumCandidates ? (pCompressor->candidates + (size_t)nPos * MAX_MATCH_CANDIDATES) : NULL;
+      pMatch->length = 0;
+      pMatch->offset = 0;
+
+      /* A match can't extend past the end of a piece, in either the current or the referenced bytes, as the input window
+       * has the rest of a run there */
+      nMaxLen = nMaxLenOffset - nPos;
+      if (nMaxLen > (nPieceEnd - p))
+         nMaxLen = nPieceEnd - p;
+      if (nPos > (nInWindowSize - LAST_MATCH_OFFSET))
+         nMatches = 0;
+
+      for (j = 0; j < nMatches; j++) {
+         const int nRefOffset = p - (int)found[j].offset;
+         int nRefPieceEnd = nPieceEnd, nRefDelta = nPieceDelta;
+         int nLen, nMatchOffset;
+
+         if (nRefOffset < nPieceStart) {
+            const int nRefPiece = lz4ultra_get_run_piece(pRuns, nNumRuns, nRefOffset);
+
+            nRefPieceEnd = pRuns[nRefPiece].compacted_end;
+            nRefDelta = nRefPiece ? (pRuns[nRefPiece - 1].end - pRuns[nRefPiece - 1].compacted_end) : 0;
+         }
+
+         nMatchOffset = nPos - (nRefOffset + nRefDelta);
+         if (nMatchOffset > MAX_OFFSET)
+            continue;
+
+         nLen = (int)found[j].length;
+         if (nLen > nMaxLen)
+            nLen = nMaxLen;
+         if (nLen > (nRefPieceEnd - nRefOffset))
+            nLen = nRefPieceEnd - nRefOffset;
+         if (nLen < MIN_MATCH_SIZE)
+            continue;
+
+         if (pMatch->length == 0) {
+            pMatch->length = (unsigned int)nLen;
+            pMatch->offset = (unsigned int)nMatchOffset;
+         }
+         else if (nCandidates < nNumCandidates) {
+            /* Only keep the shorter matches that are closer */
+            const unsigned int nLastOffset = nCandidates ? pCandidate[nCandidates - 1].offset : pMatch->offset;
+
+            if ((unsigned int)nMatchOffset < nLastOffset && (unsigned int)nLen < pMatch->length) {
+               pCandidate[nCandidates].length = (unsigned short)nLen;
+               pCandidate[nCandidates].offset = (unsigned short)nMatchOffset;
+               nCandidates++;
+            }
+         }
+      }
+
+      if (nCandidates < nNumCandidates) {
+         pCandidate[nCandidates].length = 0;
+         pCandidate[nCandidates].offset = 0;
+      }
+   }
+
+   /* Inside runs, match the previous byte up to the end of the run */
+   for (r = nNumHistoryRuns; r < nNumRuns; r++) {
+      const int nRunEnd = (pRuns[r].end < nMaxLenOffset) ? pRuns[r].end : nMaxLenOffset;
+      int i = pRuns[r].start;
+
+      if (i == 0 || pInWindow[i - 1] != pInWindow[i])
+         i++;
+
+      for (; i < pRuns[r].end; i++) {
+         lz4ultra_match *pMatch = pCompressor->match + i;
+
+         if (i > (nInWindowSize - LAST_MATCH_OFFSET)) {
+            pMatch->length = 0;
+            pMatch->offset = 0;
+         }
+         else {
+            pMatch->length = (unsigned int)(nRunEnd - i);
+            pMatch->offset = 1;
+         }
+
+         if (nNumCandidates) {
+            pCompressor->candidates[(size_t)i * MAX_MATCH_CANDIDATES].length = 0;
+            pCompressor->candidates[(size_t)i * MAX_MATCH_CANDIDATES].offset = 0;
+         }
+      }
+   }
+
+   return 0;
+}
@@ -36,6 +36,7 @@
 /* Forward declarations */
 typedef struct _lz4ultra_match lz4ultra_match;
 typedef struct _lz4ultra_compressor lz4ultra_compressor;
+typedef struct _lz4ultra_prepared_dictionary_t lz4ultra_prepared_dictionary_t;
 
 /**
  * Parse input data, build suffix array and overlaid data structures to speed up match finding
@@ -43,10 +44,11 @@ typedef struct _lz4ultra_compressor lz4ultra_compressor;
  * @param pCompressor compression context
  * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
  * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param pDictionary prepared dictionary that the window starts with, or NULL for none
  *
  * @return 0 for success, non-zero for failure
  */
-int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize);
+int lz4ultra_build_suffix_array(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nInWindowSize, const lz4ultra_prepared_dictionary_t *pDictionary);
 
 /**
  * Skip previously compressed bytes
@@ -66,4 +68,46 @@ void lz4ultra_skip_matches(lz4ultra_compressor *pCompressor, const int nStartOff
  */
 void lz4ultra_find_all_matches(lz4ultra_compressor *pCompressor, const int nStartOffset, const int nEndOffset);
 
+/**
+ * Get the amount of memory that the suffix array match finder allocates for compacting long runs, the first time it finds one
+ *
+ * @param nMaxWindowSize maximum window size (previously compressed bytes + bytes to compress)
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_get_runs_memory_size(const int nMaxWindowSize);
+
+/**
+ * Look for long runs of identical bytes in the input window, and remember them for finding matches around them
+ *
+ * Runs are searched separately in the previously compressed bytes and in the bytes to compress, so that none straddles
+ * the two. Arena-backed contexts never look for runs.
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ *
+ * @return number of runs found, 0 for none
+ */
+int lz4ultra_find_runs(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInWindowSize);
+
+/**
+ * Find all matches for the data to be compressed, after lz4ultra_find_runs() found runs in the window
+ *
+ * Positions inside runs get a match at offset 1 up to the end of the run. The suffix array is only built over the rest of
+ * the window, with each run cut down to its first few bytes, and the matches found there are mapped back to the input
+ * window.
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInWindowSize total input size in bytes (previously compressed bytes + bytes to compress)
+ * @param pDictionary prepared dictionary that the window starts with, or NULL for none
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_find_all_matches_around_runs(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInWindowSize,
+                                          const lz4ultra_prepared_dictionary_t *pDictionary);
+
 #endif /* _MATCHFINDER_H */
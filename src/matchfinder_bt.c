@@ -0,0 +1,464 @@
+/*
+ * matchfinder_bt.c - binary tree and hash chain match finder implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "lib.h"
+#include "format.h"
+#include "matchfinder_bt.h"
+
+/** Absolute position of the first byte of a fresh window; anything below is too far back to match */
+#define BT_POS_BASE ((unsigned int)BT_WINDOW_SIZE)
+
+/** Absolute position past which the tree is restarted, before positions can wrap around */
+#define BT_POS_MAX 0xf0000000U
+
+/** Size of the hash heads, tree nodes (or chain links, using the first half) and window tail copy */
+#define BT_HEAD_BYTES (((size_t)1 << BT_HASH_BITS) * sizeof(unsigned int))
+#define BT_SON_BYTES ((size_t)BT_WINDOW_SIZE * 2 * sizeof(unsigned int))
+#define BT_HISTORY_BYTES ((size_t)HISTORY_SIZE)
+
+#if defined(__GNUC__) || defined(__clang__)
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define LZ4ULTRA_FIRST_DIFF_BYTE(__x) (__builtin_ctzll(__x) >> 3)
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define LZ4ULTRA_FIRST_DIFF_BYTE(__x) (__builtin_clzll(__x) >> 3)
+#endif
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+static inline int lz4ultra_bt_first_diff_byte(const unsigned long long nDiff) {
+   unsigned long nIndex;
+
+   _BitScanForward64(&nIndex, nDiff);
+   return (int)(nIndex >> 3);
+}
+#define LZ4ULTRA_FIRST_DIFF_BYTE(__x) lz4ultra_bt_first_diff_byte(__x)
+#endif
+
+/**
+ * Extend the length of a match candidate, comparing 8 bytes at a time; candidates in runs and repeated text match for
+ * hundreds of bytes, which a byte loop spends most of the tree and chain walks on
+ *
+ * @param pA start of the earlier occurrence
+ * @param pB start of the current position
+ * @param nLen number of bytes already known to be the same
+ * @param nMaxLen maximum length to compare up to
+ *
+ * @return length of the common prefix, up to nMaxLen
+ */
+static inline int lz4ultra_bt_extend(const unsigned char *pA, const unsigned char *pB, int nLen, const int nMaxLen) {
+   while (nLen + 8 <= nMaxLen) {
+      unsigned long long nA, nB;
+
+      memcpy(&nA, pA + nLen, 8);
+      memcpy(&nB, pB + nLen, 8);
+      if (nA != nB) {
+#ifdef LZ4ULTRA_FIRST_DIFF_BYTE
+         return nLen + LZ4ULTRA_FIRST_DIFF_BYTE(nA ^ nB);
+#else
+         break;
+#endif
+      }
+      nLen += 8;
+   }
+
+   while (nLen < nMaxLen && pA[nLen] == pB[nLen])
+      nLen++;
+   return nLen;
+}
+
+/**
+ * Hash the first MIN_MATCH_SIZE bytes at the specified position
+ *
+ * @param pCur pointer to bytes to hash
+ *
+ * @return hash bucket index
+ */
+static inline unsigned int lz4ultra_bt_hash(const unsigned char *pCur) {
+   unsigned int nValue = ((unsigned int)pCur[0]) | (((unsigned int)pCur[1]) << 8) | (((unsigned int)pCur[2]) << 16) | (((unsigned int)pCur[3]) << 24);
+   return (nValue * 2654435761U) >> (32 - BT_HASH_BITS);
+}
+
+/**
+ * Get the size of the memory used by the binary tree or hash chain match finder
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_bt_get_memory_size(void) {
+   return BT_HEAD_BYTES + BT_SON_BYTES + BT_HISTORY_BYTES;
+}
+
+/**
+ * Attach binary tree and hash chain match finder buffers to compression context
+ *
+ * @param pCompressor compression context
+ * @param pMemory memory for the buffers, of lz4ultra_bt_get_memory_size() bytes, or NULL to allocate it from the heap when first needed
+ */
+void lz4ultra_bt_init(lz4ultra_compressor *pCompressor, void *pMemory) {
+   if (pMemory) {
+      unsigned char *pCur = (unsigned char *)pMemory;
+
+      pCompressor->bt_head = (unsigned int *)pCur;
+      pCur += BT_HEAD_BYTES;
+      pCompressor->bt_son = (unsigned int *)pCur;
+      pCur += BT_SON_BYTES;
+      pCompressor->bt_history = pCur;
+   }
+   else {
+      pCompressor->bt_head = NULL;
+      pCompressor->bt_son = NULL;
+      pCompressor->bt_history = NULL;
+   }
+
+   pCompressor->bt_allocated = 0;
+   lz4ultra_bt_reset(pCompressor);
+}
+
+/**
+ * Forget any window carried over from previous blocks
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_bt_reset(lz4ultra_compressor *pCompressor) {
+   pCompressor->bt_pos = 0;
+   pCompressor->bt_history_size = 0;
+}
+
+/**
+ * Free binary tree and hash chain match finder buffers allocated from the heap
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_bt_destroy(lz4ultra_compressor *pCompressor) {
+   if (pCompressor->bt_allocated) {
+      free(pCompressor->bt_head);
+      pCompressor->bt_allocated = 0;
+   }
+
+   pCompressor->bt_head = NULL;
+   pCompressor->bt_son = NULL;
+   pCompressor->bt_history = NULL;
+   lz4ultra_bt_reset(pCompressor);
+}
+
+/**
+ * Record a longer match found while searching one position, keeping only the longest ones
+ *
+ * @param pFound matches found so far, by increasing length
+ * @param pNumFound pointer to number of matches found so far, updated
+ * @param nMaxFound maximum number of matches to keep (0 to keep none)
+ * @param nLen match length
+ * @param nOffset match offset
+ */
+static inline void lz4ultra_bt_add_found(lz4ultra_match *pFound, int *pNumFound, const int nMaxFound, const int nLen, const unsigned int nOffset) {
+   if (nLen < MIN_MATCH_SIZE || nMaxFound == 0)
+      return;
+
+   if (*pNumFound == nMaxFound) {
+      memmove(pFound, pFound + 1, (nMaxFound - 1) * sizeof(lz4ultra_match));
+      (*pNumFound)--;
+   }
+
+   pFound[*pNumFound].length = (unsigned int)nLen;
+   pFound[*pNumFound].offset = nOffset;
+   (*pNumFound)++;
+}
+
+/**
+ * Insert one position into the binary tree, and find the longest, closest match for it
+ *
+ * Methodology from the binary tree match finder in LZMA by Igor Pavlov (public domain)
+ *
+ * @param pCompressor compression context
+ * @param pCur pointer to bytes at the position to insert
+ * @param nAbsPos absolute position to insert
+ * @param nMinAbsPos lowest absolute position whose bytes are still in the current window
+ * @param nLenLimit maximum match length to look for (at least MIN_MATCH_SIZE)
+ * @param nDepth maximum number of tree nodes to visit
+ * @param pMatchOffset pointer to returned match offset
+ * @param pFound optional array that receives each longer match found, by increasing length
+ * @param nMaxFound maximum number of entries in pFound (0 to not return them)
+ * @param pNumFound pointer to returned number of entries stored in pFound
+ *
+ * @return match length, or 0 for none
+ */
+static int lz4ultra_bt_insert_at(lz4ultra_compressor *pCompressor, const unsigned char *pCur, const unsigned int nAbsPos, const unsigned int nMinAbsPos, const int nLenLimit, int nDepth, int *pMatchOffset, lz4ultra_match *pFound, const int nMaxFound, int *pNumFound) {
+   unsigned int *son = pCompressor->bt_son;
+   unsigned int nHash = lz4ultra_bt_hash(pCur);
+   unsigned int nCurMatch = pCompressor->bt_head[nHash];
+   unsigned int *ptr0 = son + ((nAbsPos & (BT_WINDOW_SIZE - 1)) << 1) + 1;
+   unsigned int *ptr1 = son + ((nAbsPos & (BT_WINDOW_SIZE - 1)) << 1);
+   int nLen0 = 0, nLen1 = 0;
+   int nBestLen = 0;
+
+   *pNumFound = 0;
+   pCompressor->bt_head[nHash] = nAbsPos;
+
+   for (;;) {
+      unsigned int nDelta = nAbsPos - nCurMatch;
+
+      if (nDepth-- == 0 || nCurMatch < nMinAbsPos || nDelta > MAX_OFFSET) {
+         /* Out of the window; all children are even older */
+         *ptr0 = *ptr1 = 0;
+         break;
+      }
+
+      unsigned int *pPair = son + ((nCurMatch & (BT_WINDOW_SIZE - 1)) << 1);
+      const unsigned char *pMatch = pCur - nDelta;
+      int nLen = (nLen0 < nLen1) ? nLen0 : nLen1;
+
+      if (pMatch[nLen] == pCur[nLen]) {
+         nLen = lz4ultra_bt_extend(pMatch, pCur, nLen + 1, nLenLimit);
+
+         if (nBestLen < nLen) {
+            nBestLen = nLen;
+            *pMatchOffset = (int)nDelta;
+            lz4ultra_bt_add_found(pFound, pNumFound, nMaxFound, nLen, nDelta);
+         }
+
+         if (nLen == nLenLimit) {
+            /* Equal as far as we can tell: take over the node's children, dropping the older position */
+            *ptr1 = pPair[0];
+            *ptr0 = pPair[1];
+            break;
+         }
+      }
+
+      if (pMatch[nLen] < pCur[nLen]) {
+         *ptr1 = nCurMatch;
+         ptr1 = pPair + 1;
+         nCurMatch = *ptr1;
+         nLen1 = nLen;
+      }
+      else {
+         *ptr0 = nCurMatch;
+         ptr0 = pPair;
+         nCurMatch = *ptr0;
+         nLen0 = nLen;
+      }
+   }
+
+   return (nBestLen >= MIN_MATCH_SIZE) ? nBestLen : 0;
+}
+
+/**
+ * Insert one position into the hash chains, and find the longest, closest match for it
+ *
+ * @param pCompressor compression context
+ * @param pCur pointer to bytes at the position to insert
+ * @param nAbsPos absolute position to insert
+ * @param nMinAbsPos lowest absolute position whose bytes are still in the current window
+ * @param nLenLimit maximum match length to look for (at least MIN_MATCH_SIZE)
+ * @param nDepth maximum number of chain links to follow
+ * @param pMatchOffset pointer to returned match offset
+ * @param pFound optional array that receives each longer match found, by increasing length
+ * @param nMaxFound maximum number of entries in pFound (0 to not return them)
+ * @param pNumFound pointer to returned number of entries stored in pFound
+ *
+ * @return match length, or 0 for none
+ */
+static int lz4ultra_hc_insert_at(lz4ultra_compressor *pCompressor, const unsigned char *pCur, const unsigned int nAbsPos, const unsigned int nMinAbsPos, const int nLenLimit, int nDepth, int *pMatchOffset, lz4ultra_match *pFound, const int nMaxFound, int *pNumFound) {
+   unsigned int *chain = pCompressor->bt_son;
+   unsigned int nHash = lz4ultra_bt_hash(pCur);
+   unsigned int nCurMatch = pCompressor->bt_head[nHash];
+   int nBestLen = MIN_MATCH_SIZE - 1;
+
+   *pNumFound = 0;
+   chain[nAbsPos & (BT_WINDOW_SIZE - 1)] = nCurMatch;
+   pCompressor->bt_head[nHash] = nAbsPos;
+
+   while (nDepth-- != 0 && nCurMatch >= nMinAbsPos && (nAbsPos - nCurMatch) <= MAX_OFFSET) {
+      unsigned int nDelta = nAbsPos - nCurMatch;
+      const unsigned char *pMatch = pCur - nDelta;
+
+      /* Only compare matches that can be longer than the best one so far */
+      if (pMatch[nBestLen] == pCur[nBestLen] && pMatch[0] == pCur[0] && pMatch[1] == pCur[1]) {
+         int nLen = lz4ultra_bt_extend(pMatch, pCur, 2, nLenLimit);
+
+         if (nBestLen < nLen) {
+            nBestLen = nLen;
+            *pMatchOffset = (int)nDelta;
+            lz4ultra_bt_add_found(pFound, pNumFound, nMaxFound, nLen, nDelta);
+            if (nLen == nLenLimit)
+               break;
+         }
+      }
+
+      nCurMatch = chain[nCurMatch & (BT_WINDOW_SIZE - 1)];
+   }
+
+   return (nBestLen >= MIN_MATCH_SIZE) ? nBestLen : 0;
+}
+
+/**
+ * Find all matches for the data to be compressed, with a binary tree or a hash chain (LZ4ULTRA_FLAG_HC_MATCHFINDER),
+ * that slides across dependent blocks
+ *
+ * If the previously compressed bytes are the same as the end of the window seen by the last call, the tree or chains
+ * are carried over and only the new bytes are inserted. Otherwise, the previously compressed bytes are inserted first.
+ * The hash chains find the same matches either way; the shape of the tree also depends on the data before the previously
+ * compressed bytes, so that it can find slightly different matches when it is carried over.
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_bt_find_all_matches(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize) {
+   const int nEndOffset = nPreviousBlockSize + nInDataSize;
+   lz4ultra_match *pMatch = pCompressor->match + nPreviousBlockSize;
+   lz4ultra_match_candidate *pCandidate = pCompressor->num_candidates ? (pCompressor->candidates + (size_t)nPreviousBlockSize * MAX_MATCH_CANDIDATES) : NULL;
+   const int nNumCandidates = pCompressor->num_candidates;
+   lz4ultra_match found[MAX_MATCH_CANDIDATES + 1];
+   unsigned int nWindowAbsPos;
+   const int nHashChain = (pCompressor->flags & LZ4ULTRA_FLAG_HC_MATCHFINDER) ? 1 : 0;
+   int nDepth = pCompressor->search_depth;
+   int nPrevLen = 0, nPrevOffset = 0;
+   int nStartOffset;
+   int i;
+
+   if (nDepth <= 0)
+      nDepth = nHashChain ? HC_DEFAULT_DEPTH : BT_DEFAULT_DEPTH;
+
+   if (!pCompressor->bt_head) {
+      pCompressor->bt_head = (unsigned int *)malloc(lz4ultra_bt_get_memory_size());
+      if (!pCompressor->bt_head)
+         return 100;
+      pCompressor->bt_son = (unsigned int *)(((unsigned char *)pCompressor->bt_head) + BT_HEAD_BYTES);
+      pCompressor->bt_history = ((unsigned char *)pCompressor->bt_son) + BT_SON_BYTES;
+      pCompressor->bt_allocated = 1;
+      lz4ultra_bt_reset(pCompressor);
+   }
+
+   if (pCompressor->bt_pos != 0 && pCompressor->bt_pos < BT_POS_MAX &&
+       nPreviousBlockSize <= pCompressor->bt_history_size &&
+       !memcmp(pCompressor->bt_history + pCompressor->bt_history_size - nPreviousBlockSize, pInWindow, nPreviousBlockSize)) {
+      /* The previously compressed bytes are the tail of the last window: keep the tree and only insert new bytes, and the
+       * last few positions of the last window, that didn't have enough bytes after them to be inserted then */
+      nWindowAbsPos = pCompressor->bt_pos - (unsigned int)nPreviousBlockSize;
+      nStartOffset = (nPreviousBlockSize > (MIN_MATCH_SIZE - 1)) ? (nPreviousBlockSize - (MIN_MATCH_SIZE - 1)) : 0;
+   }
+   else {
+      /* Start over */
+      memset(pCompressor->bt_head, 0, BT_HEAD_BYTES);
+      nWindowAbsPos = BT_POS_BASE;
+      nStartOffset = 0;
+   }
+
+   for (i = nStartOffset; i < nEndOffset; i++) {
+      int nAvail = nEndOffset - i;
+      int nLen = 0, nOffset = 0, nFound = 0;
+
+      if (nAvail >= MIN_MATCH_SIZE) {
+         int nLenLimit = (nAvail < BT_NICE_LEN) ? nAvail : BT_NICE_LEN;
+
+         if (nHashChain)
+            nLen = lz4ultra_hc_insert_at(pCompressor, pInWindow + i, nWindowAbsPos + i, nWindowAbsPos, nLenLimit, nDepth, &nOffset, found, nNumCandidates ? (1 + nNumCandidates) : 0, &nFound);
+         else
+            nLen = lz4ultra_bt_insert_at(pCompressor, pInWindow + i, nWindowAbsPos + i, nWindowAbsPos, nLenLimit, nDepth, &nOffset, found, nNumCandidates ? (1 + nNumCandidates) : 0, &nFound);
+
+         if (nLen == BT_NICE_LEN) {
+            int nMaxLen = (nAvail < LCP_MAX) ? nAvail : LCP_MAX;
+
+            if (nPrevLen > (BT_NICE_LEN + 1) && i > nPreviousBlockSize) {
+               /* Continue the previous long match, instead of comparing it again. Not across the start of the block, where
+                * only a window that is carried over would have a previous match, so that the matches are the same either way */
+               nLen = nPrevLen - 1;
+               nOffset = nPrevOffset;
+            }
+            else {
+               const unsigned char *pCur = pInWindow + i;
+
+               nLen = lz4ultra_bt_extend(pCur - nOffset, pCur, nLen, nMaxLen);
+            }
+         }
+      }
+
+      nPrevLen = nLen;
+      nPrevOffset = nOffset;
+
+      if (i >= nPreviousBlockSize) {
+         int nCandidates = 0;
+
+         if (nLen == 0 || i > (nEndOffset - LAST_MATCH_OFFSET)) {
+            pMatch->length = 0;
+            pMatch->offset = 0;
+         }
+         else {
+            int nMaxLen = (nEndOffset - LAST_LITERALS) - i;
+            if (nMaxLen < 0)
+               nMaxLen = 0;
+            pMatch->length = (unsigned int)((nLen > nMaxLen) ? nMaxLen : nLen);
+            pMatch->offset = (unsigned int)nOffset;
+
+            if (nNumCandidates) {
+               unsigned int nLastOffset = (unsigned int)nOffset;
+               int j;
+
+               /* Walk back from the longest match found, keeping the shorter ones that are closer */
+               for (j = nFound - 1; j >= 0 && nCandidates < nNumCandidates; j--) {
+                  int nCandidateLen = (found[j].length > (unsigned int)nMaxLen) ? nMaxLen : (int)found[j].length;
+
+                  if (nCandidateLen < MIN_MATCH_SIZE)
+                     break;
+                  if (found[j].offset < nLastOffset && nCandidateLen < (int)pMatch->length) {
+                     pCandidate[nCandidates].length = (unsigned short)nCandidateLen;
+                     pCandidate[nCandidates].offset = (unsigned short)found[j].offset;
+                     nLastOffset = found[j].offset;
+                     nCandidates++;
+                  }
+               }
+            }
+         }
+
+         if (nCandidates < nNumCandidates) {
+            pCandidate[nCandidates].length = 0;
+            pCandidate[nCandidates].offset = 0;
+         }
+
+         pMatch++;
+         if (pCandidate)
+            pCandidate += MAX_MATCH_CANDIDATES;
+      }
+   }
+
+   /* Remember the end of the window, to carry the tree over to the next block if it continues this one */
+   int nHistorySize = (nEndOffset < HISTORY_SIZE) ? nEndOffset : HISTORY_SIZE;
+   memcpy(pCompressor->bt_history, pInWindow + nEndOffset - nHistorySize, nHistorySize);
+   pCompressor->bt_history_size = nHistorySize;
+   pCompressor->bt_pos = nWindowAbsPos + nEndOffset;
+
+   return 0;
+}
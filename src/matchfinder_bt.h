@@ -0,0 +1,102 @@
+/*
+ * matchfinder_bt.h - binary tree and hash chain match finder definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+
+#ifndef _MATCHFINDER_BT_H
+#define _MATCHFINDER_BT_H
+
+#include <stdlib.h>
+
+/* Forward declarations */
+typedef struct _lz4ultra_compressor lz4ultra_compressor;
+
+/** Number of hash buckets for the first bytes of each position, as a power of two */
+#define BT_HASH_BITS 16
+
+/** Number of positions kept in the binary tree; matches can't be further back than this anyway */
+#define BT_WINDOW_SIZE 65536
+
+/** Match length past which tree nodes are considered equal; longer matches are extended separately */
+#define BT_NICE_LEN 256
+
+/** Default number of tree nodes visited when looking up and inserting one position */
+#define BT_DEFAULT_DEPTH 128
+
+/** Default number of hash chain links followed when looking up one position */
+#define HC_DEFAULT_DEPTH 16
+
+/**
+ * Get the size of the memory used by the binary tree or hash chain match finder
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_bt_get_memory_size(void);
+
+/**
+ * Attach binary tree and hash chain match finder buffers to compression context
+ *
+ * @param pCompressor compression context
+ * @param pMemory memory for the buffers, of lz4ultra_bt_get_memory_size() bytes, or NULL to allocate it from the heap when first needed
+ */
+void lz4ultra_bt_init(lz4ultra_compressor *pCompressor, void *pMemory);
+
+/**
+ * Forget any window carried over from previous blocks
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_bt_reset(lz4ultra_compressor *pCompressor);
+
+/**
+ * Free binary tree and hash chain match finder buffers allocated from the heap
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_bt_destroy(lz4ultra_compressor *pCompressor);
+
+/**
+ * Find all matches for the data to be compressed, with a binary tree or a hash chain (LZ4ULTRA_FLAG_HC_MATCHFINDER),
+ * that slides across dependent blocks
+ *
+ * If the previously compressed bytes are the same as the end of the window seen by the last call, the tree or chains
+ * are carried over and only the new bytes are inserted. Otherwise, the previously compressed bytes are inserted first.
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_bt_find_all_matches(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize);
+
+#endif /* _MATCHFINDER_BT_H */
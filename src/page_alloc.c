@@ -0,0 +1,197 @@
+/*
+ * page_alloc.c - large page allocation for compressor buffers
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+#include "page_alloc.h"
+
+#if defined(__linux__) && defined(SYS_mbind)
+/* From linux/mempolicy.h, that isn't always installed */
+#define LZ4ULTRA_MPOL_PREFERRED 1
+#define LZ4ULTRA_MAX_NUMA_NODES 1024
+#endif
+
+#ifdef _WIN32
+
+/**
+ * Map memory straight from the system, preferably backed by huge pages
+ *
+ * @param nSize number of bytes to map
+ * @param pMappedSize pointer to returned number of bytes actually mapped, to pass to lz4ultra_page_free()
+ *
+ * @return mapped memory, zero-filled, or NULL for failure
+ */
+void *lz4ultra_page_alloc(size_t nSize, size_t *pMappedSize) {
+   SIZE_T nLargePageSize = GetLargePageMinimum();
+   void *pData = NULL;
+
+   if (nLargePageSize) {
+      /* Fails unless the process holds SeLockMemoryPrivilege */
+      size_t nLargeSize = (nSize + (nLargePageSize - 1)) & ~((size_t)nLargePageSize - 1);
+
+      pData = VirtualAlloc(NULL, nLargeSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if (pData) {
+         *pMappedSize = nLargeSize;
+         return pData;
+      }
+   }
+
+   pData = VirtualAlloc(NULL, nSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+   *pMappedSize = pData ? nSize : 0;
+   return pData;
+}
+
+/**
+ * Unmap memory mapped with lz4ultra_page_alloc()
+ *
+ * @param pData mapped memory, or NULL
+ * @param nMappedSize number of bytes actually mapped, as returned by lz4ultra_page_alloc()
+ */
+void lz4ultra_page_free(void *pData, size_t nMappedSize) {
+   if (pData)
+      VirtualFree(pData, 0, MEM_RELEASE);
+}
+
+#else
+
+/**
+ * Map memory straight from the system, preferably backed by huge pages
+ *
+ * @param nSize number of bytes to map
+ * @param pMappedSize pointer to returned number of bytes actually mapped, to pass to lz4ultra_page_free()
+ *
+ * @return mapped memory, zero-filled, or NULL for failure
+ */
+void *lz4ultra_page_alloc(size_t nSize, size_t *pMappedSize) {
+   size_t nHugeSize = (nSize + (LZ4ULTRA_HUGE_PAGE_SIZE - 1)) & ~((size_t)LZ4ULTRA_HUGE_PAGE_SIZE - 1);
+   unsigned char *pData;
+
+   *pMappedSize = 0;
+   if (!nSize)
+      return NULL;
+
+#ifdef MAP_HUGETLB
+   /* Only succeeds if enough huge pages are reserved (vm.nr_hugepages) */
+   pData = (unsigned char *)mmap(NULL, nHugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+   if (pData != (unsigned char *)MAP_FAILED) {
+      *pMappedSize = nHugeSize;
+      return pData;
+   }
+#endif
+
+   /* Map one huge page more than needed, and trim the ends so that the mapping starts on a huge page boundary */
+   pData = (unsigned char *)mmap(NULL, nHugeSize + LZ4ULTRA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (pData == (unsigned char *)MAP_FAILED)
+      return NULL;
+   else {
+      size_t nHeadSize = (LZ4ULTRA_HUGE_PAGE_SIZE - ((size_t)pData & (LZ4ULTRA_HUGE_PAGE_SIZE - 1))) & (LZ4ULTRA_HUGE_PAGE_SIZE - 1);
+      size_t nTailSize = LZ4ULTRA_HUGE_PAGE_SIZE - nHeadSize;
+
+      if (nHeadSize)
+         munmap(pData, nHeadSize);
+      if (nTailSize)
+         munmap(pData + nHeadSize + nHugeSize, nTailSize);
+      pData += nHeadSize;
+   }
+
+#ifdef MADV_HUGEPAGE
+   /* Transparent huge pages; just a hint, ignored if they are disabled */
+   madvise(pData, nHugeSize, MADV_HUGEPAGE);
+#endif
+
+   *pMappedSize = nHugeSize;
+   return pData;
+}
+
+/**
+ * Unmap memory mapped with lz4ultra_page_alloc()
+ *
+ * @param pData mapped memory, or NULL
+ * @param nMappedSize number of bytes actually mapped, as returned by lz4ultra_page_alloc()
+ */
+void lz4ultra_page_free(void *pData, size_t nMappedSize) {
+   if (pData)
+      munmap(pData, nMappedSize);
+}
+
+#endif
+
+/**
+ * Get the NUMA node of the processor that the calling thread is running on
+ *
+ * @return node number, or -1 if unknown
+ */
+int lz4ultra_get_numa_node(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+   unsigned int nCpu = 0, nNode = 0;
+
+   if (syscall(SYS_getcpu, &nCpu, &nNode, NULL) == 0)
+      return (int)nNode;
+#endif
+   return -1;
+}
+
+/**
+ * Bind memory mapped with lz4ultra_page_alloc() to a NUMA node, so that the pages that aren't placed yet go there
+ *
+ * @param pData mapped memory
+ * @param nMappedSize number of bytes actually mapped, as returned by lz4ultra_page_alloc()
+ * @param nNode node to bind to
+ *
+ * @return 0 for success, -1 if not supported or failed
+ */
+int lz4ultra_page_bind(void *pData, size_t nMappedSize, int nNode) {
+#if defined(__linux__) && defined(SYS_mbind)
+   unsigned long nNodeMask[LZ4ULTRA_MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = { 0 };
+   const int nBitsPerWord = (int)(8 * sizeof(unsigned long));
+
+   if (nNode < 0 || nNode >= LZ4ULTRA_MAX_NUMA_NODES)
+      return -1;
+
+   nNodeMask[nNode / nBitsPerWord] = 1UL << (nNode % nBitsPerWord);
+   if (syscall(SYS_mbind, pData, nMappedSize, LZ4ULTRA_MPOL_PREFERRED, nNodeMask, (unsigned long)LZ4ULTRA_MAX_NUMA_NODES + 1, 0) == 0)
+      return 0;
+#endif
+   return -1;
+}
@@ -0,0 +1,85 @@
+/*
+ * page_alloc.h - large page allocation for compressor buffers
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _PAGE_ALLOC_H
+#define _PAGE_ALLOC_H
+
+#include <stddef.h>
+
+/** Size of a huge page on the systems that lz4ultra_page_alloc() requests them on, in bytes */
+#define LZ4ULTRA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Map memory straight from the system, preferably backed by huge pages
+ *
+ * On Linux, explicit huge pages (MAP_HUGETLB) are tried first; if none are reserved, the mapping is aligned to a huge
+ * page boundary and transparent huge pages are requested for it. On Windows, large pages are used if the process holds
+ * the privilege to lock pages in memory. Elsewhere, or if neither works, regular pages are mapped.
+ *
+ * The memory isn't touched, so that each page is only placed, on the NUMA node of the thread that first writes it.
+ *
+ * @param nSize number of bytes to map
+ * @param pMappedSize pointer to returned number of bytes actually mapped, to pass to lz4ultra_page_free()
+ *
+ * @return mapped memory, zero-filled, or NULL for failure
+ */
+void *lz4ultra_page_alloc(size_t nSize, size_t *pMappedSize);
+
+/**
+ * Unmap memory mapped with lz4ultra_page_alloc()
+ *
+ * @param pData mapped memory, or NULL
+ * @param nMappedSize number of bytes actually mapped, as returned by lz4ultra_page_alloc()
+ */
+void lz4ultra_page_free(void *pData, size_t nMappedSize);
+
+/**
+ * Get the NUMA node of the processor that the calling thread is running on
+ *
+ * @return node number, or -1 if unknown
+ */
+int lz4ultra_get_numa_node(void);
+
+/**
+ * Bind memory mapped with lz4ultra_page_alloc() to a NUMA node, so that the pages that aren't placed yet go there
+ *
+ * This is only a preference: pages go elsewhere if the node runs out of memory, and pages already placed stay where they are.
+ *
+ * @param pData mapped memory
+ * @param nMappedSize number of bytes actually mapped, as returned by lz4ultra_page_alloc()
+ * @param nNode node to bind to
+ *
+ * @return 0 for success, -1 if not supported or failed
+ */
+int lz4ultra_page_bind(void *pData, size_t nMappedSize, int nNode);
+
+#endif /* _PAGE_ALLOC_H */
@@ -0,0 +1,326 @@
+/*
+ * seek_table.c - seek table for random access to frames with independent blocks
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "seek_table.h"
+#include "frame.h"
+#include "lib.h"
+
+/**
+ * Read little-endian 32-bit value
+ *
+ * @param pData data bytes
+ *
+ * @return value
+ */
+static unsigned int lz4ultra_seek_table_read_le32(const unsigned char *pData) {
+   return ((unsigned int)pData[0]) |
+      (((unsigned int)pData[1]) << 8) |
+      (((unsigned int)pData[2]) << 16) |
+      (((unsigned int)pData[3]) << 24);
+}
+
+/**
+ * Write little-endian 32-bit value
+ *
+ * @param pData data bytes
+ * @param nValue value
+ */
+static void lz4ultra_seek_table_write_le32(unsigned char *pData, const unsigned int nValue) {
+   pData[0] = nValue & 0xff;
+   pData[1] = (nValue >> 8) & 0xff;
+   pData[2] = (nValue >> 16) & 0xff;
+   pData[3] = (nValue >> 24) & 0xff;
+}
+
+/**
+ * Check if a seek table is written out for the specified compression flags
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ *
+ * @return nonzero if LZ4ULTRA_FLAG_SEEK_TABLE is set for an lz4 frame with independent blocks, 0 otherwise
+ */
+int lz4ultra_seek_table_enabled(const unsigned int nFlags) {
+   return ((nFlags & (LZ4ULTRA_FLAG_SEEK_TABLE | LZ4ULTRA_FLAG_INDEP_BLOCKS)) == (LZ4ULTRA_FLAG_SEEK_TABLE | LZ4ULTRA_FLAG_INDEP_BLOCKS) &&
+           (nFlags & (LZ4ULTRA_FLAG_RAW_BLOCK | LZ4ULTRA_FLAG_LEGACY_FRAMES)) == 0) ? 1 : 0;
+}
+
+/**
+ * Initialize empty seek table
+ *
+ * @param pTable seek table
+ * @param nMaxBlocks number of blocks to make room for upfront, or 0 to grow as blocks are added
+ *
+ * @return 0 for success, -1 for failure (out of memory)
+ */
+int lz4ultra_seek_table_init(lz4ultra_seek_table_t *pTable, const int nMaxBlocks) {
+   pTable->entries = NULL;
+   pTable->num_blocks = 0;
+   pTable->max_blocks = 0;
+
+   if (nMaxBlocks > 0) {
+      pTable->entries = (unsigned int *)malloc((size_t)nMaxBlocks * 2 * sizeof(unsigned int));
+      if (!pTable->entries)
+         return -1;
+      pTable->max_blocks = nMaxBlocks;
+   }
+
+   return 0;
+}
+
+/**
+ * Add block to seek table
+ *
+ * @param pTable seek table
+ * @param nStoredSize size of the block in the frame, including its block frame header and checksum, in bytes
+ * @param nDecompressedSize decompressed size of the block, in bytes
+ *
+ * @return 0 for success, -1 for failure (out of memory)
+ */
+int lz4ultra_seek_table_add(lz4ultra_seek_table_t *pTable, const int nStoredSize, const int nDecompressedSize) {
+   if (pTable->num_blocks >= pTable->max_blocks) {
+      int nMaxBlocks = pTable->max_blocks ? (pTable->max_blocks * 2) : 256;
+      unsigned int *pEntries = (unsigned int *)realloc(pTable->entries, (size_t)nMaxBlocks * 2 * sizeof(unsigned int));
+
+      if (!pEntries)
+         return -1;
+      pTable->entries = pEntries;
+      pTable->max_blocks = nMaxBlocks;
+   }
+
+   pTable->entries[pTable->num_blocks * 2] = (unsigned int)nStoredSize;
+   pTable->entries[pTable->num_blocks * 2 + 1] = (unsigned int)nDecompressedSize;
+   pTable->num_blocks++;
+   return 0;
+}
+
+/**
+ * Get encoded size of a seek table
+ *
+ * @param nNumBlocks number of blocks in the table
+ *
+ * @return size of the skippable frame holding the table, in bytes
+ */
+size_t lz4ultra_get_seek_table_size(const size_t nNumBlocks) {
+   return LZ4ULTRA_SEEK_TABLE_HEADER_SIZE + nNumBlocks * LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE + LZ4ULTRA_SEEK_TABLE_FOOTER_SIZE;
+}
+
+/**
+ * Encode seek table as a skippable frame, to be written right after the EOD frame (and content checksum)
+ *
+ * @param pFrameData encoding buffer
+ * @param nMaxFrameDataSize max encoding buffer size, in bytes
+ * @param nFlags compression flags that the frame was written with
+ * @param pTable seek table with all the blocks of the frame
+ *
+ * @return number of encoded bytes, or -1 for failure
+ */
+int lz4ultra_encode_seek_table(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, const lz4ultra_seek_table_t *pTable) {
+   size_t nTableSize = lz4ultra_get_seek_table_size(pTable->num_blocks);
+   unsigned char *pCurData = pFrameData;
+   int i;
+
+   if (nMaxFrameDataSize < 0 || nTableSize > (size_t)nMaxFrameDataSize)
+      return LZ4ULTRA_ENCODE_ERR;
+
+   lz4ultra_seek_table_write_le32(pCurData, LZ4ULTRA_SEEK_TABLE_FRAME_MAGIC);
+   lz4ultra_seek_table_write_le32(pCurData + 4, (unsigned int)(nTableSize - LZ4ULTRA_SEEK_TABLE_HEADER_SIZE));
+   pCurData += LZ4ULTRA_SEEK_TABLE_HEADER_SIZE;
+
+   for (i = 0; i < pTable->num_blocks; i++) {
+      lz4ultra_seek_table_write_le32(pCurData, pTable->entries[i * 2]);
+      lz4ultra_seek_table_write_le32(pCurData + 4, pTable->entries[i * 2 + 1]);
+      pCurData += LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE;
+   }
+
+   lz4ultra_seek_table_write_le32(pCurData, (unsigned int)pTable->num_blocks);
+   pCurData[4] = (nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) ? 15 : 7;                                                         /* Frame header */
+   pCurData[5] = LZ4ULTRA_FRAME_SIZE + ((nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? LZ4ULTRA_CONTENT_CHECKSUM_SIZE : 0);  /* EOD frame and content checksum */
+   lz4ultra_seek_table_write_le32(pCurData + 6, LZ4ULTRA_SEEK_TABLE_MAGIC);
+
+   return (int)nTableSize;
+}
+
+/**
+ * Free seek table
+ *
+ * @param pTable seek table
+ */
+void lz4ultra_seek_table_destroy(lz4ultra_seek_table_t *pTable) {
+   if (pTable->entries) {
+      free(pTable->entries);
+      pTable->entries = NULL;
+   }
+   pTable->num_blocks = 0;
+   pTable->max_blocks = 0;
+}
+
+/**
+ * Locate the frame that ends compressed data, through the seek table after it
+ *
+ * @param pFrame seekable frame to fill out
+ * @param pFileData compressed data
+ * @param nFileSize compressed size in bytes
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_FORMAT if the data doesn't end with a valid seek table and frame with independent blocks,
+ *         LZ4ULTRA_ERROR_CHECKSUM for a bad frame header checksum, or LZ4ULTRA_ERROR_MEMORY
+ */
+int lz4ultra_seekable_frame_open(lz4ultra_seekable_frame_t *pFrame, const unsigned char *pFileData, const size_t nFileSize) {
+   const unsigned char *pFooter, *pEntries;
+   unsigned long long nTableSize, nBlocksSize = 0, nFrameSize;
+   unsigned long long nContentSize = 0;
+   unsigned int nNumBlocks;
+   int nHeaderSize, nFooterSize, nBlockMaxCode = 0;
+   int nMaxStoredSize;
+   unsigned int i;
+
+   memset(pFrame, 0, sizeof(lz4ultra_seekable_frame_t));
+
+   if (nFileSize < LZ4ULTRA_SEEK_TABLE_HEADER_SIZE + LZ4ULTRA_SEEK_TABLE_FOOTER_SIZE)
+      return LZ4ULTRA_ERROR_FORMAT;
+
+   pFooter = pFileData + nFileSize - LZ4ULTRA_SEEK_TABLE_FOOTER_SIZE;
+   if (lz4ultra_seek_table_read_le32(pFooter + 6) != LZ4ULTRA_SEEK_TABLE_MAGIC)
+      return LZ4ULTRA_ERROR_FORMAT;
+
+   nNumBlocks = lz4ultra_seek_table_read_le32(pFooter);
+   nHeaderSize = pFooter[4];
+   nFooterSize = pFooter[5];
+   if ((nHeaderSize != 7 && nHeaderSize != 15) ||
+       (nFooterSize != LZ4ULTRA_FRAME_SIZE && nFooterSize != (LZ4ULTRA_FRAME_SIZE + LZ4ULTRA_CONTENT_CHECKSUM_SIZE)) ||
+       nNumBlocks > 0x7ffffffeU || nNumBlocks > nFileSize / LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE)
+      return LZ4ULTRA_ERROR_FORMAT;
+
+   /* Check the skippable frame that holds the table */
+   nTableSize = lz4ultra_get_seek_table_size(nNumBlocks);
+   if (nTableSize > nFileSize)
+      return LZ4ULTRA_ERROR_FORMAT;
+   pEntries = pFooter - (size_t)nNumBlocks * LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE;
+   if (lz4ultra_seek_table_read_le32(pEntries - LZ4ULTRA_SEEK_TABLE_HEADER_SIZE) != LZ4ULTRA_SEEK_TABLE_FRAME_MAGIC ||
+       lz4ultra_seek_table_read_le32(pEntries - 4) != (unsigned int)(nTableSize - LZ4ULTRA_SEEK_TABLE_HEADER_SIZE))
+      return LZ4ULTRA_ERROR_FORMAT;
+
+   for (i = 0; i < nNumBlocks; i++)
+      nBlocksSize += lz4ultra_seek_table_read_le32(pEntries + i * LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE);
+
+   /* The frame ends right before the table */
+   nFrameSize = (unsigned long long)nHeaderSize + nBlocksSize + (unsigned long long)nFooterSize;
+   if (nFrameSize > nFileSize - nTableSize)
+      return LZ4ULTRA_ERROR_FORMAT;
+   pFrame->frame_data = pEntries - LZ4ULTRA_SEEK_TABLE_HEADER_SIZE - nFrameSize;
+
+   int nSuccess = lz4ultra_decode_header(pFrame->frame_data, nHeaderSize, &nBlockMaxCode, &pFrame->flags, &nContentSize);
+   if (nSuccess == LZ4ULTRA_DECODE_ERR_SUM)
+      return LZ4ULTRA_ERROR_CHECKSUM;
+   if (nSuccess != LZ4ULTRA_DECODE_OK ||
+       (pFrame->flags & (LZ4ULTRA_FLAG_INDEP_BLOCKS | LZ4ULTRA_FLAG_LEGACY_FRAMES)) != LZ4ULTRA_FLAG_INDEP_BLOCKS ||
+       nBlockMaxCode < 4 || nBlockMaxCode > 7 ||
+       ((pFrame->flags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? (LZ4ULTRA_FRAME_SIZE + LZ4ULTRA_CONTENT_CHECKSUM_SIZE) : LZ4ULTRA_FRAME_SIZE) != nFooterSize ||
+       lz4ultra_seek_table_read_le32(pFrame->frame_data + nHeaderSize + nBlocksSize) != 0 /* EOD frame */)
+      return LZ4ULTRA_ERROR_FORMAT;
+
+   pFrame->block_max_size = 1 << (8 + (nBlockMaxCode << 1));
+   nMaxStoredSize = LZ4ULTRA_FRAME_SIZE + pFrame->block_max_size + ((pFrame->flags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? LZ4ULTRA_BLOCK_CHECKSUM_SIZE : 0);
+
+   pFrame->block_offset = (long long *)malloc(((size_t)nNumBlocks + 1) * sizeof(long long));
+   pFrame->data_offset = (long long *)malloc(((size_t)nNumBlocks + 1) * sizeof(long long));
+   if (!pFrame->block_offset || !pFrame->data_offset) {
+      lz4ultra_seekable_frame_close(pFrame);
+      return LZ4ULTRA_ERROR_MEMORY;
+   }
+
+   pFrame->block_offset[0] = nHeaderSize;
+   pFrame->data_offset[0] = 0;
+   for (i = 0; i < nNumBlocks; i++) {
+      unsigned int nStoredSize = lz4ultra_seek_table_read_le32(pEntries + i * LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE);
+      unsigned int nDecompressedSize = lz4ultra_seek_table_read_le32(pEntries + i * LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE + 4);
+
+      if (nStoredSize <= LZ4ULTRA_FRAME_SIZE || nStoredSize > (unsigned int)nMaxStoredSize ||
+          nDecompressedSize == 0 || nDecompressedSize > (unsigned int)pFrame->block_max_size) {
+         lz4ultra_seekable_frame_close(pFrame);
+         return LZ4ULTRA_ERROR_FORMAT;
+      }
+
+      pFrame->block_offset[i + 1] = pFrame->block_offset[i] + nStoredSize;
+      pFrame->data_offset[i + 1] = pFrame->data_offset[i] + nDecompressedSize;
+   }
+   pFrame->num_blocks = (int)nNumBlocks;
+
+   if ((pFrame->flags & LZ4ULTRA_FLAG_CONTENT_SIZE) && nContentSize != (unsigned long long)pFrame->data_offset[nNumBlocks]) {
+      lz4ultra_seekable_frame_close(pFrame);
+      return LZ4ULTRA_ERROR_FORMAT;
+   }
+
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Find the block that holds a decompressed byte
+ *
+ * @param pFrame seekable frame
+ * @param nOffset offset of the decompressed byte, less than the total decompressed size
+ *
+ * @return block index
+ */
+int lz4ultra_seekable_frame_find_block(const lz4ultra_seekable_frame_t *pFrame, const unsigned long long nOffset) {
+   int nLow = 0, nHigh = pFrame->num_blocks - 1;
+
+   /* Last block that starts at or before the offset */
+   while (nLow < nHigh) {
+      int nMid = nLow + ((nHigh - nLow + 1) >> 1);
+
+      if ((unsigned long long)pFrame->data_offset[nMid] <= nOffset)
+         nLow = nMid;
+      else
+         nHigh = nMid - 1;
+   }
+
+   return nLow;
+}
+
+/**
+ * Free seekable frame
+ *
+ * @param pFrame seekable frame
+ */
+void lz4ultra_seekable_frame_close(lz4ultra_seekable_frame_t *pFrame) {
+   if (pFrame->data_offset) {
+      free(pFrame->data_offset);
+      pFrame->data_offset = NULL;
+   }
+   if (pFrame->block_offset) {
+      free(pFrame->block_offset);
+      pFrame->block_offset = NULL;
+   }
+   pFrame->num_blocks = 0;
+}
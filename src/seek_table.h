@@ -0,0 +1,171 @@
+/*
+ * seek_table.h - seek table definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _SEEK_TABLE_H
+#define _SEEK_TABLE_H
+
+#include <stddef.h>
+
+/* Seek table, appended after the EOD frame (and content checksum) in an lz4 skippable frame:
+ *
+ *    skippable frame magic (4 bytes), size of the rest of the skippable frame (4 bytes)
+ *    for each block: stored size of the block, including its block frame header and checksum (4 bytes), decompressed size (4 bytes)
+ *    number of blocks (4 bytes), size of the frame header (1 byte), size of the EOD frame and content checksum (1 byte), seek table magic (4 bytes)
+ *
+ * All values are little-endian. The fixed-size end lets readers find the table, and the frame it belongs to, from the end of the data. */
+#define LZ4ULTRA_SEEK_TABLE_FRAME_MAGIC   0x184D2A5BU    /**< lz4 skippable frame magic number (0x184D2A50-0x184D2A5F), ignored by other lz4 decoders */
+#define LZ4ULTRA_SEEK_TABLE_MAGIC         0x8A62F4C1U    /**< seek table magic number, at the very end */
+#define LZ4ULTRA_SEEK_TABLE_HEADER_SIZE   8
+#define LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE    8
+#define LZ4ULTRA_SEEK_TABLE_FOOTER_SIZE   10
+
+/** Seek table under construction, while compressing */
+typedef struct _lz4ultra_seek_table_t {
+   /** Stored size and decompressed size of each block, interleaved */
+   unsigned int *entries;
+
+   /** Number of blocks in the table */
+   int num_blocks;
+
+   /** Number of blocks that entries has room for */
+   int max_blocks;
+} lz4ultra_seek_table_t;
+
+/** Frame located through its seek table, for random access */
+typedef struct _lz4ultra_seekable_frame_t {
+   /** Start of the frame (its header) */
+   const unsigned char *frame_data;
+
+   /** Compression flags, as decoded from the frame header */
+   unsigned int flags;
+
+   /** Maximum decompressed size of each block, in bytes */
+   int block_max_size;
+
+   /** Number of blocks in the frame */
+   int num_blocks;
+
+   /** Offset of each block frame header from frame_data, then of the EOD frame (num_blocks + 1 entries) */
+   long long *block_offset;
+
+   /** Offset of the decompressed data of each block, then the total decompressed size (num_blocks + 1 entries) */
+   long long *data_offset;
+} lz4ultra_seekable_frame_t;
+
+/**
+ * Check if a seek table is written out for the specified compression flags
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ *
+ * @return nonzero if LZ4ULTRA_FLAG_SEEK_TABLE is set for an lz4 frame with independent blocks, 0 otherwise
+ */
+int lz4ultra_seek_table_enabled(const unsigned int nFlags);
+
+/**
+ * Initialize empty seek table
+ *
+ * @param pTable seek table
+ * @param nMaxBlocks number of blocks to make room for upfront, or 0 to grow as blocks are added
+ *
+ * @return 0 for success, -1 for failure (out of memory)
+ */
+int lz4ultra_seek_table_init(lz4ultra_seek_table_t *pTable, const int nMaxBlocks);
+
+/**
+ * Add block to seek table
+ *
+ * @param pTable seek table
+ * @param nStoredSize size of the block in the frame, including its block frame header and checksum, in bytes
+ * @param nDecompressedSize decompressed size of the block, in bytes
+ *
+ * @return 0 for success, -1 for failure (out of memory)
+ */
+int lz4ultra_seek_table_add(lz4ultra_seek_table_t *pTable, const int nStoredSize, const int nDecompressedSize);
+
+/**
+ * Get encoded size of a seek table
+ *
+ * @param nNumBlocks number of blocks in the table
+ *
+ * @return size of the skippable frame holding the table, in bytes
+ */
+size_t lz4ultra_get_seek_table_size(const size_t nNumBlocks);
+
+/**
+ * Encode seek table as a skippable frame, to be written right after the EOD frame (and content checksum)
+ *
+ * @param pFrameData encoding buffer
+ * @param nMaxFrameDataSize max encoding buffer size, in bytes
+ * @param nFlags compression flags that the frame was written with
+ * @param pTable seek table with all the blocks of the frame
+ *
+ * @return number of encoded bytes, or -1 for failure
+ */
+int lz4ultra_encode_seek_table(unsigned char *pFrameData, const int nMaxFrameDataSize, const unsigned int nFlags, const lz4ultra_seek_table_t *pTable);
+
+/**
+ * Free seek table
+ *
+ * @param pTable seek table
+ */
+void lz4ultra_seek_table_destroy(lz4ultra_seek_table_t *pTable);
+
+/**
+ * Locate the frame that ends compressed data, through the seek table after it
+ *
+ * @param pFrame seekable frame to fill out
+ * @param pFileData compressed data
+ * @param nFileSize compressed size in bytes
+ *
+ * @return LZ4ULTRA_OK for success, LZ4ULTRA_ERROR_FORMAT if the data doesn't end with a valid seek table and frame with independent blocks,
+ *         LZ4ULTRA_ERROR_CHECKSUM for a bad frame header checksum, or LZ4ULTRA_ERROR_MEMORY
+ */
+int lz4ultra_seekable_frame_open(lz4ultra_seekable_frame_t *pFrame, const unsigned char *pFileData, const size_t nFileSize);
+
+/**
+ * Find the block that holds a decompressed byte
+ *
+ * @param pFrame seekable frame
+ * @param nOffset offset of the decompressed byte, less than the total decompressed size
+ *
+ * @return block index
+ */
+int lz4ultra_seekable_frame_find_block(const lz4ultra_seekable_frame_t *pFrame, const unsigned long long nOffset);
+
+/**
+ * Free seekable frame
+ *
+ * @param pFrame seekable frame
+ */
+void lz4ultra_seekable_frame_close(lz4ultra_seekable_frame_t *pFrame);
+
+#endif /* _SEEK_TABLE_H */
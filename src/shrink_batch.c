@@ -0,0 +1,216 @@
+/*
+ * shrink_batch.c - batch compression implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shrink_batch.h"
+#include "shrink_context.h"
+#include "shrink_inmem.h"
+#include "format.h"
+#include "lib.h"
+#include "threadpool.h"
+
+/** Shared state of one batch compression call */
+typedef struct _lz4ultra_batch_t {
+   lz4ultra_mutex_t lock;
+   lz4ultra_cond_t cond;
+   lz4ultra_batch_item_t *pItems;
+   int nNumItems;
+   int nNextItem;
+   int nNumFailed;
+   int nActiveWorkers;
+   const lz4ultra_prepared_dictionary_t *pDictionary;
+   unsigned int nFlags;
+   int nBlockMaxCode;
+   int nLevel;
+} lz4ultra_batch_t;
+
+/** One worker, compressing inputs with its own context until the batch runs out */
+typedef struct _lz4ultra_batch_worker_t {
+   lz4ultra_batch_t *pBatch;
+   lz4ultra_compressor *pCompressor;
+} lz4ultra_batch_worker_t;
+
+/**
+ * Compress inputs of the batch, one at a time, until there are none left
+ *
+ * @param pTaskArg worker (lz4ultra_batch_worker_t)
+ */
+static void lz4ultra_compress_batch_worker(void *pTaskArg) {
+   lz4ultra_batch_worker_t *pWorker = (lz4ultra_batch_worker_t *)pTaskArg;
+   lz4ultra_batch_t *pBatch = pWorker->pBatch;
+   int nNumFailed = 0;
+
+   do {
+      lz4ultra_batch_item_t *pItem;
+      int nItem;
+
+      lz4ultra_mutex_lock(&pBatch->lock);
+      nItem = pBatch->nNextItem;
+      if (nItem < pBatch->nNumItems)
+         pBatch->nNextItem++;
+      lz4ultra_mutex_unlock(&pBatch->lock);
+
+      if (nItem >= pBatch->nNumItems)
+         break;
+
+      pItem = &pBatch->pItems[nItem];
+      pItem->nCompressedSize = lz4ultra_compress_inmem_with_dictionary(pWorker->pCompressor, pBatch->pDictionary, pItem->pInputData, pItem->pOutBuffer,
+                                                                       pItem->nInputSize, pItem->nMaxOutBufferSize, pBatch->nFlags, pBatch->nBlockMaxCode, pBatch->nLevel);
+      if (pItem->nCompressedSize == (size_t)-1)
+         nNumFailed++;
+   } while (1);
+
+   lz4ultra_mutex_lock(&pBatch->lock);
+   pBatch->nNumFailed += nNumFailed;
+   pBatch->nActiveWorkers--;
+   lz4ultra_cond_broadcast(&pBatch->cond);
+   lz4ultra_mutex_unlock(&pBatch->lock);
+}
+
+/**
+ * Submit task to the internal thread pool
+ *
+ * @param pExecutor thread pool (lz4ultra_thread_pool_t)
+ * @param task task function
+ * @param pTaskArg argument passed to task function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_batch_submit_to_thread_pool(void *pExecutor, lz4ultra_task_fn task, void *pTaskArg) {
+   return lz4ultra_thread_pool_submit((lz4ultra_thread_pool_t *)pExecutor, task, pTaskArg);
+}
+
+/**
+ * Compress many small, independent inputs in one call
+ *
+ * @param pItems inputs to compress; nCompressedSize is set for each of them
+ * @param nNumItems number of inputs
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()) for all inputs, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads number of inputs compressed at the same time (one compressor context is allocated for each)
+ * @param submit function to queue worker tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return number of inputs that failed to compress (0 for success), or -1 if the batch couldn't be started
+ */
+int lz4ultra_compress_batch(lz4ultra_batch_item_t *pItems, int nNumItems, const lz4ultra_prepared_dictionary_t *pDictionary, unsigned int nFlags, int nBlockMaxCode, int nLevel,
+                            int nThreads, lz4ultra_submit_fn submit, void *pExecutor) {
+   lz4ultra_batch_t batch;
+   lz4ultra_batch_worker_t *pWorkers;
+   lz4ultra_thread_pool_t pool;
+   int nNumWorkers = 0;
+   int nError = 0;
+   int i;
+
+   if (nNumItems <= 0)
+      return 0;
+   if (nThreads > nNumItems)
+      nThreads = nNumItems;
+   if (nThreads < 1)
+      nThreads = 1;
+
+   batch.pItems = pItems;
+   batch.nNumItems = nNumItems;
+   batch.nNextItem = 0;
+   batch.nNumFailed = 0;
+   batch.nActiveWorkers = 0;
+   batch.pDictionary = pDictionary;
+   batch.nFlags = nFlags;
+   batch.nBlockMaxCode = nBlockMaxCode;
+   batch.nLevel = nLevel;
+
+   pWorkers = (lz4ultra_batch_worker_t *)malloc(nThreads * sizeof(lz4ultra_batch_worker_t));
+   if (!pWorkers)
+      return -1;
+
+   for (i = 0; i < nThreads; i++) {
+      /* Start with the window for the smallest (64 Kb) block size; contexts grow on their own for larger inputs */
+      pWorkers[i].pBatch = &batch;
+      pWorkers[i].pCompressor = lz4ultra_compressor_create((1 << 16) + HISTORY_SIZE, nFlags, NULL, 0);
+      if (!pWorkers[i].pCompressor) {
+         nError = LZ4ULTRA_ERROR_MEMORY;
+         break;
+      }
+      nNumWorkers++;
+   }
+
+   pool.threads = NULL;
+   if (!nError && nNumWorkers > 1 && !submit) {
+      if (lz4ultra_thread_pool_init(&pool, nNumWorkers) != 0)
+         nError = LZ4ULTRA_ERROR_MEMORY;
+      else {
+         submit = lz4ultra_batch_submit_to_thread_pool;
+         pExecutor = &pool;
+      }
+   }
+
+   if (!nError) {
+      lz4ultra_mutex_init(&batch.lock);
+      lz4ultra_cond_init(&batch.cond);
+
+      if (nNumWorkers == 1) {
+         /* Nothing to parallelize */
+         batch.nActiveWorkers = 1;
+         lz4ultra_compress_batch_worker(&pWorkers[0]);
+      }
+      else {
+         batch.nActiveWorkers = nNumWorkers;
+         for (i = 0; i < nNumWorkers; i++) {
+            if (submit(pExecutor, lz4ultra_compress_batch_worker, &pWorkers[i]) != 0)
+               lz4ultra_compress_batch_worker(&pWorkers[i]);
+         }
+      }
+
+      lz4ultra_mutex_lock(&batch.lock);
+      while (batch.nActiveWorkers)
+         lz4ultra_cond_wait(&batch.cond, &batch.lock);
+      lz4ultra_mutex_unlock(&batch.lock);
+
+      lz4ultra_cond_destroy(&batch.cond);
+      lz4ultra_mutex_destroy(&batch.lock);
+   }
+
+   if (pool.threads)
+      lz4ultra_thread_pool_destroy(&pool);
+
+   for (i = 0; i < nNumWorkers; i++)
+      lz4ultra_compressor_free(pWorkers[i].pCompressor);
+   free(pWorkers);
+
+   if (nError)
+      return -1;
+   else
+      return batch.nNumFailed;
+}
@@ -0,0 +1,63 @@
+/*
+ * shrink_batch.h - batch compression definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _SHRINK_BATCH_H
+#define _SHRINK_BATCH_H
+
+#include <stdlib.h>
+#include "threadpool.h"
+
+/**
+ * Compress many small, independent inputs in one call
+ *
+ * Each input is compressed exactly as lz4ultra_compress_inmem_with_dictionary() would, to its own output buffer. The
+ * compression contexts, one per worker, are created once for the whole batch and reused from one input to the next, so
+ * that small inputs don't pay for setting up and tearing down a context each. Workers pick the next input to compress
+ * as they become free. With LZ4ULTRA_FLAG_RAW_BLOCK, each input is emitted as a single raw block, without frame header
+ * or footer; inputs that are too large or incompressible then fail individually.
+ *
+ * @param pItems inputs to compress; nCompressedSize is set for each of them
+ * @param nNumItems number of inputs
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()) for all inputs, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads number of inputs compressed at the same time (one compressor context is allocated for each)
+ * @param submit function to queue worker tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return number of inputs that failed to compress (0 for success), or -1 if the batch couldn't be started
+ */
+int lz4ultra_compress_batch(lz4ultra_batch_item_t *pItems, int nNumItems, const lz4ultra_prepared_dictionary_t *pDictionary, unsigned int nFlags, int nBlockMaxCode, int nLevel,
+   int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
+
+#endif /* _SHRINK_BATCH_H */
@@ -100,9 +100,110 @@ static inline int lz4ultra_write_match_varlen(unsigned char *pOutData, int nOutO
    return nOutOffset;
 }
 
+/* Match lengths from MATCH_SEGMENT_MIN_LEN upwards are split in segments of MATCH_SEGMENT_SIZE lengths, that all cost the
+ * same number of extra match length bytes */
+#define MATCH_SEGMENT_MIN_LEN (MATCH_RUN_LEN + MIN_MATCH_SIZE)
+#define MATCH_SEGMENT_SIZE 255
+
+/* Number of segments for the lengths that the parser tries one by one (below LEAVE_ALONE_MATCH_SIZE) */
+#define NUM_MATCH_SEGMENTS ((LEAVE_ALONE_MATCH_SIZE - MATCH_SEGMENT_MIN_LEN + MATCH_SEGMENT_SIZE - 1) / MATCH_SEGMENT_SIZE)
+
+/* Size of the ring buffer of each segment's queue (a power of two, larger than MATCH_SEGMENT_SIZE) */
+#define MATCH_QUEUE_SIZE 256
+
+/**
+ * Queue of the positions that a match with a length in one segment can end at, best first, as the parser moves back
+ * through the block
+ *
+ * Only positions that no position closer to the parser beats are kept; going from the front (closest) to the back, the
+ * (cost, score) keys never get worse. The best place to end a match in the segment, restricted to the lengths up to
+ * the longest match available, is then the furthest position kept that such a match reaches.
+ */
+typedef struct _lz4ultra_match_queue_t {
+   unsigned long long key[MATCH_QUEUE_SIZE];    /**< cost << 32 | score of ending a match at each position */
+   int pos[MATCH_QUEUE_SIZE];                   /**< positions, increasing from front to back */
+   int front;                                   /**< index of the front entry in the ring buffer */
+   int count;                                   /**< number of entries */
+} lz4ultra_match_queue_t;
+
+/**
+ * Add the position closest to the parser to the front of a match queue, and expire positions that are now too far
+ * back for the segment
+ *
+ * @param pQueue match queue
+ * @param nPos position to add
+ * @param nKey cost << 32 | score of ending a match at that position
+ * @param nMaxPos furthest position that a match with a length in the segment can end at
+ */
+static inline void lz4ultra_match_queue_push(lz4ultra_match_queue_t *pQueue, const int nPos, const unsigned long long nKey, const int nMaxPos) {
+   while (pQueue->count && pQueue->pos[(pQueue->front + pQueue->count - 1) & (MATCH_QUEUE_SIZE - 1)] > nMaxPos)
+      pQueue->count--;
+
+   /* Positions further back are only kept if they are at least as good; they win ties, as longer matches */
+   while (pQueue->count && pQueue->key[pQueue->front] > nKey) {
+      pQueue->front = (pQueue->front + 1) & (MATCH_QUEUE_SIZE - 1);
+      pQueue->count--;
+   }
+
+   pQueue->front = (pQueue->front - 1) & (MATCH_QUEUE_SIZE - 1);
+   pQueue->key[pQueue->front] = nKey;
+   pQueue->pos[pQueue->front] = nPos;
+   pQueue->count++;
+}
+
+/**
+ * Get the best position to end a match at, among the positions of a match queue up to a given one
+ *
+ * @param pQueue match queue, whose front position must not be further than nMaxPos
+ * @param nMaxPos furthest position that the match can end at
+ *
+ * @return index of the entry in the ring buffer
+ */
+static inline int lz4ultra_match_queue_find(const lz4ultra_match_queue_t *pQueue, const int nMaxPos) {
+   int nLow = 0, nHigh = pQueue->count - 1;
+
+   /* Find the furthest entry back that isn't past nMaxPos */
+   while (nLow < nHigh) {
+      int nMid = (nLow + nHigh + 1) >> 1;
+
+      if (pQueue->pos[(pQueue->front + nMid) & (MATCH_QUEUE_SIZE - 1)] <= nMaxPos)
+         nLow = nMid;
+      else
+         nHigh = nMid - 1;
+   }
+
+   return (pQueue->front + nLow) & (MATCH_QUEUE_SIZE - 1);
+}
+
+/**
+ * Get the cost of a match command, without its extra match length bytes
+ *
+ * @param pCompressor compression context
+ * @param nCostScale cost of one bit of output
+ * @param nMatchLen match length
+ * @param nMatchOffset match offset
+ *
+ * @return cost of token and offset, plus the weighted decoder cycles of the path that the match takes
+ */
+static inline int lz4ultra_get_match_command_cost(const lz4ultra_compressor *pCompressor, const int nCostScale, const int nMatchLen, const int nMatchOffset) {
+   const lz4ultra_decode_cost_model_t *pModel = &pCompressor->decode_cost_model;
+   int nCycles = pModel->token;
+
+   if (nMatchLen >= MATCH_SEGMENT_MIN_LEN)
+      nCycles += (nMatchOffset >= 16) ? pModel->match_slow : pModel->match_repeat;
+   else if (nMatchOffset < 8)
+      nCycles += pModel->match_repeat;
+
+   return (8 + 16) * nCostScale + nCycles * pCompressor->decode_cost;
+}
+
 /**
  * Attempt to pick optimal matches, so as to produce the smallest possible output that decompresses to the same input
  *
+ * When a decode cost is set, the cost of each choice is instead its size in bits, scaled up, plus the decoder cycles
+ * that it is estimated to take, weighted by the decode cost; cycles spent copying bytes are left out, as they are the
+ * same for any parse.
+ *
  * @param pCompressor compression context
  * @param nStartOffset current offset in input window (typically the number of previously compressed bytes)
  * @param nEndOffset offset to end finding matches at (typically the size of the total input window in bytes
@@ -110,24 +211,55 @@ static inline int lz4ultra_write_match_varlen(unsigned char *pOutData, int nOutO
 static void lz4ultra_optimize_matches_lz4(lz4ultra_compressor *pCompressor, const int nStartOffset, const int nEndOffset) {
    int *cost = (int*)pCompressor->pos_data;  /* Reuse */
    int *score = (int*)pCompressor->intervals;  /* Reuse */
-   int nExtraMatchScore = (pCompressor->flags & LZ4ULTRA_FLAG_FAVOR_RATIO) ? 1 : 5;
+   const int nDecodeCost = pCompressor->decode_cost;
+   const int nCostScale = nDecodeCost ? 16 : 1;
+   const int nLengthByteCost = 8 * nCostScale + pCompressor->decode_cost_model.length_byte * nDecodeCost;
+   const int nSlowLiteralsCost = pCompressor->decode_cost_model.literals_slow * nDecodeCost;
+   const int nShortenMatches = (nDecodeCost == 0 && (pCompressor->flags & LZ4ULTRA_FLAG_FAVOR_RATIO) == 0) ? 1 : 0;
+   int nExtraMatchScore = nShortenMatches ? 5 : 1;
+   lz4ultra_match_queue_t queue[NUM_MATCH_SEGMENTS];
+   int nUseQueues;
    int nLastLiteralsOffset;
-   int i;
+   int i, t;
 
-   cost[nEndOffset - 1] = 8;
+   cost[nEndOffset - 1] = 8 * nCostScale;
    score[nEndOffset - 1] = 0;
    nLastLiteralsOffset = nEndOffset;
 
+   /* Unless only a few lengths are tried, or the offset changes with the length, find the best length of each segment with
+    * its queue, instead of trying all lengths of the segment one by one. The outcome is the same. */
+   nUseQueues = (pCompressor->max_len_tries == 0 && !pCompressor->num_candidates) ? 1 : 0;
+   for (t = 0; t < NUM_MATCH_SEGMENTS; t++) {
+      queue[t].front = 0;
+      queue[t].count = 0;
+   }
+
    for (i = nEndOffset - 2; i != (nStartOffset - 1); i--) {
       int nBestCost, nBestScore, nBestMatchLen, nBestMatchOffset;
 
+      if (nUseQueues) {
+         for (t = 0; t < NUM_MATCH_SEGMENTS; t++) {
+            int nPos = i + MATCH_SEGMENT_MIN_LEN + t * MATCH_SEGMENT_SIZE;
+
+            if (nPos < nEndOffset) {
+               unsigned long long nCost = cost[nPos];
+
+               if (pCompressor->match[nPos].length >= MIN_MATCH_SIZE)
+                  nCost += MODESWITCH_PENALTY;
+               lz4ultra_match_queue_push(&queue[t], nPos, (nCost << 32) | (unsigned int)score[nPos], nPos + MATCH_SEGMENT_SIZE - 1);
+            }
+         }
+      }
+
       int nLiteralsLen = nLastLiteralsOffset - i;
-      nBestCost = 8 + cost[i + 1];
+      nBestCost = 8 * nCostScale + cost[i + 1];
       nBestScore = 1 + score[i + 1];
       if (nLiteralsLen >= LITERALS_RUN_LEN && ((nLiteralsLen - LITERALS_RUN_LEN) % 255) == 0) {
          /* Add to the cost of encoding literals as their number crosses a variable length encoding boundary.
           * The cost automatically accumulates down the chain. */
-         nBestCost += 8;
+         nBestCost += nLengthByteCost;
+         if (nLiteralsLen == LITERALS_RUN_LEN)
+            nBestCost += nSlowLiteralsCost;
       }
       if (pCompressor->match[i + 1].length >= MIN_MATCH_SIZE)
          nBestCost += MODESWITCH_PENALTY;
@@ -144,7 +276,8 @@ static void lz4ultra_optimize_matches_lz4(lz4ultra_compressor *pCompressor, cons
             if ((i + nMatchLen) > (nEndOffset - LAST_LITERALS))
                nMatchLen = nEndOffset - LAST_LITERALS - i;
 
-            nCurCost = 8 + 16 + lz4ultra_get_match_varlen_size(nMatchLen - MIN_MATCH_SIZE);
+            nCurCost = lz4ultra_get_match_command_cost(pCompressor, nCostScale, nMatchLen, pMatch->offset);
+            nCurCost += (lz4ultra_get_match_varlen_size(nMatchLen - MIN_MATCH_SIZE) >> 3) * nLengthByteCost;
             nCurCost += cost[i + nMatchLen];
             if (pCompressor->match[i + nMatchLen].length >= MIN_MATCH_SIZE)
                nCurCost += MODESWITCH_PENALTY;
@@ -164,44 +297,96 @@ static void lz4ultra_optimize_matches_lz4(lz4ultra_compressor *pCompressor, cons
             if ((i + nMatchLen) > (nEndOffset - LAST_LITERALS))
                nMatchLen = nEndOffset - LAST_LITERALS - i;
 
-            if ((pCompressor->flags & LZ4ULTRA_FLAG_FAVOR_RATIO) == 0) {
+            if (nShortenMatches) {
                /* If the match is just above the size where it would use the fast decompression path, shorten it so it does use it,
                 * giving up some ratio for extra decompression speed */
                if (nMatchLen > (MATCH_RUN_LEN + MIN_MATCH_SIZE - 1) && nMatchLen <= (2 * (MATCH_RUN_LEN + MIN_MATCH_SIZE - 1)))
                   nMatchLen = MATCH_RUN_LEN + MIN_MATCH_SIZE - 1;
             }
 
-            for (k = nMatchLen; k >= (MATCH_RUN_LEN + MIN_MATCH_SIZE); k--) {
+            int nMinMatchLen = MIN_MATCH_SIZE;
+
+            if (pCompressor->max_len_tries > 0 && nMinMatchLen < (nMatchLen - pCompressor->max_len_tries + 1))
+               nMinMatchLen = nMatchLen - pCompressor->max_len_tries + 1;
+
+            if (nUseQueues && nMatchLen >= MATCH_SEGMENT_MIN_LEN) {
+               const int nCommandCost = lz4ultra_get_match_command_cost(pCompressor, nCostScale, MATCH_SEGMENT_MIN_LEN, pMatch->offset);
+
+               /* Longest lengths first, so that ties go to the longest match, as when trying them one by one */
+               for (t = (nMatchLen - MATCH_SEGMENT_MIN_LEN) / MATCH_SEGMENT_SIZE; t >= 0; t--) {
+                  const lz4ultra_match_queue_t *pQueue = &queue[t];
+                  int nSegmentMaxLen = MATCH_SEGMENT_MIN_LEN + (t + 1) * MATCH_SEGMENT_SIZE - 1;
+                  int nEntry = lz4ultra_match_queue_find(pQueue, i + ((nMatchLen < nSegmentMaxLen) ? nMatchLen : nSegmentMaxLen));
+                  int nCurCost, nCurScore;
+
+                  nCurCost = nCommandCost + (t + 1) * nLengthByteCost + (int)(pQueue->key[nEntry] >> 32);
+                  nCurScore = nExtraMatchScore + (int)(pQueue->key[nEntry] & 0xffffffffU);
+
+                  if (nBestCost > nCurCost || (nBestCost == nCurCost && nBestScore > nCurScore)) {
+                     nBestCost = nCurCost;
+                     nBestScore = nCurScore;
+                     nBestMatchLen = pQueue->pos[nEntry] - i;
+                     nBestMatchOffset = pMatch->offset;
+                  }
+               }
+
+               /* Try the remaining, shorter lengths one by one */
+               nMatchLen = MATCH_SEGMENT_MIN_LEN - 1;
+            }
+
+            /* Shorter, closer candidates (if any) take over the offset as soon as they are long enough for the length being tried */
+            const lz4ultra_match_candidate *pCandidate = pCompressor->num_candidates ? (pCompressor->candidates + (size_t)i * MAX_MATCH_CANDIDATES) : NULL;
+            const lz4ultra_match_candidate *pCandidateEnd = pCandidate ? (pCandidate + pCompressor->num_candidates) : NULL;
+            int nMatchOffset = pMatch->offset;
+            int nCommandCost = lz4ultra_get_match_command_cost(pCompressor, nCostScale, MATCH_SEGMENT_MIN_LEN, nMatchOffset);
+
+            for (k = nMatchLen; k >= (MATCH_RUN_LEN + MIN_MATCH_SIZE) && k >= nMinMatchLen; k--) {
                int nCurCost, nCurScore;
 
-               nCurCost = 8 + 16 + lz4ultra_get_match_varlen_size(k - MIN_MATCH_SIZE);
+               while (pCandidate != pCandidateEnd && pCandidate->length >= k) {
+                  nMatchOffset = pCandidate->offset;
+                  nCommandCost = lz4ultra_get_match_command_cost(pCompressor, nCostScale, MATCH_SEGMENT_MIN_LEN, nMatchOffset);
+                  pCandidate++;
+               }
+
+               nCurCost = nCommandCost + (lz4ultra_get_match_varlen_size(k - MIN_MATCH_SIZE) >> 3) * nLengthByteCost;
                nCurCost += cost[i + k];
                if (pCompressor->match[i + k].length >= MIN_MATCH_SIZE)
                   nCurCost += MODESWITCH_PENALTY;
                nCurScore = nExtraMatchScore + score[i + k];
 
-               if (nBestCost > nCurCost || (nBestCost == nCurCost && nBestScore > nCurScore)) {
+               if (nBestCost > nCurCost || (nBestCost == nCurCost && nBestScore > nCurScore) ||
+                  (nBestCost == nCurCost && nBestScore == nCurScore && nBestMatchLen >= MIN_MATCH_SIZE && nMatchOffset < nBestMatchOffset)) {
                   nBestCost = nCurCost;
                   nBestScore = nCurScore;
                   nBestMatchLen = k;
-                  nBestMatchOffset = pMatch->offset;
+                  nBestMatchOffset = nMatchOffset;
                }
             }
 
-            for (;  k >= MIN_MATCH_SIZE; k--) {
+            nCommandCost = lz4ultra_get_match_command_cost(pCompressor, nCostScale, MIN_MATCH_SIZE, nMatchOffset);
+
+            for (;  k >= nMinMatchLen; k--) {
                int nCurCost, nCurScore;
 
-               nCurCost = 8 + 16 /* no extra match len bytes */;
+               while (pCandidate != pCandidateEnd && pCandidate->length >= k) {
+                  nMatchOffset = pCandidate->offset;
+                  nCommandCost = lz4ultra_get_match_command_cost(pCompressor, nCostScale, MIN_MATCH_SIZE, nMatchOffset);
+                  pCandidate++;
+               }
+
+               nCurCost = nCommandCost /* no extra match len bytes */;
                nCurCost += cost[i + k];
                if (pCompressor->match[i + k].length >= MIN_MATCH_SIZE)
                   nCurCost += MODESWITCH_PENALTY;
                nCurScore = nExtraMatchScore + score[i + k];
 
-               if (nBestCost > nCurCost || (nBestCost == nCurCost && nBestScore > nCurScore)) {
+               if (nBestCost > nCurCost || (nBestCost == nCurCost && nBestScore > nCurScore) ||
+                  (nBestCost == nCurCost && nBestScore == nCurScore && nBestMatchLen >= MIN_MATCH_SIZE && nMatchOffset < nBestMatchOffset)) {
                   nBestCost = nCurCost;
                   nBestScore = nCurScore;
                   nBestMatchLen = k;
-                  nBestMatchOffset = pMatch->offset;
+                  nBestMatchOffset = nMatchOffset;
                }
             }
          }
@@ -229,6 +414,7 @@ static void lz4ultra_optimize_matches_lz4(lz4ultra_compressor *pCompressor, cons
 static void lz4ultra_optimize_command_count_lz4(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nStartOffset, const int nEndOffset) {
    int i;
    int nNumLiterals = 0;
+   int nNumJoined = 0, nNumReduced = 0;
 
    for (i = nStartOffset; i < nEndOffset; ) {
       lz4ultra_match *pMatch = pCompressor->match + i;
@@ -275,6 +461,7 @@ static void lz4ultra_optimize_command_count_lz4(lz4ultra_compressor *pCompressor
             }
             nNumLiterals += nMatchLen;
             i += nMatchLen;
+            nNumReduced++;
          }
          else {
             if ((i + nMatchLen) < nEndOffset && pMatch->offset > 0 && nMatchLen >= 2 &&
@@ -294,6 +481,7 @@ static void lz4ultra_optimize_command_count_lz4(lz4ultra_compressor *pCompressor
                pMatch->length += pCompressor->match[i + nMatchLen].length;
                pCompressor->match[i + nMatchLen].offset = 0;
                pCompressor->match[i + nMatchLen].length = -1;
+               nNumJoined++;
                continue;
             }
 
@@ -306,6 +494,11 @@ static void lz4ultra_optimize_command_count_lz4(lz4ultra_compressor *pCompressor
          i++;
       }
    }
+
+   if (pCompressor->collect_stats) {
+      pCompressor->block_stats.num_joined_matches += nNumJoined;
+      pCompressor->block_stats.num_reduced_commands += nNumReduced;
+   }
 }
 
 /**
@@ -325,6 +518,7 @@ static int lz4ultra_write_block_lz4(lz4ultra_compressor *pCompressor, const unsi
    int nNumLiterals = 0;
    int nInFirstLiteralOffset = 0;
    int nOutOffset = 0;
+   int nMatchedBytes = 0;
 
    for (i = nStartOffset; i < nEndOffset; ) {
       lz4ultra_match *pMatch = pCompressor->match + i;
@@ -355,6 +549,7 @@ static int lz4ultra_write_block_lz4(lz4ultra_compressor *pCompressor, const unsi
          pOutData[nOutOffset++] = nMatchOffset >> 8;
          nOutOffset = lz4ultra_write_match_varlen(pOutData, nOutOffset, nEncodedMatchLen);
          i += nMatchLen;
+         nMatchedBytes += nMatchLen;
 
          pCompressor->num_commands++;
       }
@@ -394,6 +589,9 @@ static int lz4ultra_write_block_lz4(lz4ultra_compressor *pCompressor, const unsi
       pCompressor->num_commands++;
    }
 
+   if (pCompressor->collect_stats)
+      pCompressor->block_stats.num_literals += (nEndOffset - nStartOffset) - nMatchedBytes;
+
    return nOutOffset;
 }
 
@@ -410,8 +608,39 @@ static int lz4ultra_write_block_lz4(lz4ultra_compressor *pCompressor, const unsi
  * @return size of compressed data in output buffer, or -1 if the data is uncompressible
  */
 int lz4ultra_optimize_and_write_block(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize) {
+   lz4ultra_stats_t *pStats = pCompressor->collect_stats ? &pCompressor->block_stats : NULL;
+   long long nTime = 0LL, nCurTime;
+   int nResult;
+
+   if (pStats) {
+      int i;
+
+      for (i = nPreviousBlockSize; i < nPreviousBlockSize + nInDataSize; i++) {
+         if (pCompressor->match[i].length >= MIN_MATCH_SIZE)
+            pStats->num_matches++;
+      }
+      nTime = lz4ultra_stats_get_time();
+   }
+
    lz4ultra_optimize_matches_lz4(pCompressor, nPreviousBlockSize, nPreviousBlockSize + nInDataSize);
-   lz4ultra_optimize_command_count_lz4(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize);
+   if (pStats) {
+      nCurTime = lz4ultra_stats_get_time();
+      pStats->parse_time += nCurTime - nTime;
+      nTime = nCurTime;
+   }
+
+   if (pCompressor->optimize_command_count) {
+      lz4ultra_optimize_command_count_lz4(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize);
+      if (pStats) {
+         nCurTime = lz4ultra_stats_get_time();
+         pStats->reduce_time += nCurTime - nTime;
+         nTime = nCurTime;
+      }
+   }
+
+   nResult = lz4ultra_write_block_lz4(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize, pOutData, nMaxOutDataSize);
+   if (pStats)
+      pStats->write_time += lz4ultra_stats_get_time() - nTime;
 
-   return lz4ultra_write_block_lz4(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize, pOutData, nMaxOutDataSize);
+   return nResult;
 }
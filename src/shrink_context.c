@@ -32,9 +32,200 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "lib.h"
 #include "shrink_context.h"
 #include "shrink_block.h"
 #include "matchfinder.h"
+#include "matchfinder_bt.h"
+#include "block_split.h"
+#include "page_alloc.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
+/** Parameters for one compression level */
+typedef struct _lz4ultra_level_params_t {
+   int match_finder_flags;          /**< LZ4ULTRA_FLAG_xx_MATCHFINDER, or 0 for the suffix array */
+   int search_depth;                /**< maximum tree nodes or chain links visited per position (0 for the finder default) */
+   int max_len_tries;               /**< maximum number of match lengths tried by the parser per position (0 for all) */
+   int optimize_command_count;      /**< 1 to run the command count reduction pass, 0 to skip it */
+} lz4ultra_level_params_t;
+
+static const lz4ultra_level_params_t g_levelParams[LZ4ULTRA_MAX_LEVEL - LZ4ULTRA_MIN_LEVEL + 1] = {
+   { LZ4ULTRA_FLAG_HC_MATCHFINDER, 4, 1, 0 },
+   { LZ4ULTRA_FLAG_HC_MATCHFINDER, 8, 2, 0 },
+   { LZ4ULTRA_FLAG_BT_MATCHFINDER, 8, 4, 1 },
+   { LZ4ULTRA_FLAG_BT_MATCHFINDER, 32, 16, 1 },
+   { 0, 0, 0, 1 },
+};
+
+/** Default decoder cycle costs, for lz4ultra_decompressor_expand_block() on a recent out-of-order core */
+static const lz4ultra_decode_cost_model_t g_defaultDecodeCostModel = {
+   6,    /* token */
+   10,   /* literals_slow */
+   2,    /* length_byte */
+   8,    /* match_slow */
+   12,   /* match_repeat */
+};
+
+/* Size of the divsufsort buckets, carved out of the arena for arena-backed contexts */
+#define DIVSUFSORT_BUCKET_A_BYTES (256 * sizeof(saidx_t))
+#define DIVSUFSORT_BUCKET_B_BYTES (256 * 256 * sizeof(saidx_t))
+
+/* Alignment of each buffer carved out of an arena */
+#define ARENA_ALIGNMENT 64
+#define ARENA_ALIGN(__n) (((__n) + (ARENA_ALIGNMENT - 1)) & ~((size_t)(ARENA_ALIGNMENT - 1)))
+
+/**
+ * Get the size of the region that the window-sized buffers and divsufsort buckets are mapped from, with LZ4ULTRA_FLAG_HUGE_PAGES
+ *
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ *
+ * @return size in bytes, before rounding up to whole pages
+ */
+static size_t lz4ultra_compressor_get_mapped_size(const int nMaxWindowSize) {
+   return ARENA_ALIGN(DIVSUFSORT_BUCKET_A_BYTES) +
+      ARENA_ALIGN(DIVSUFSORT_BUCKET_B_BYTES) +
+      ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned int)) * 2 +
+      ((nMaxWindowSize > COMPACT_WINDOW_SIZE) ? ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned short)) : 0) +
+      ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(lz4ultra_match));
+}
+
+/**
+ * Map window-sized buffers and divsufsort buckets for compression context, all from one region of huge pages
+ *
+ * @param pCompressor compression context
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_compressor_map_buffers(lz4ultra_compressor *pCompressor, const int nMaxWindowSize) {
+   size_t nSize = lz4ultra_compressor_get_mapped_size(nMaxWindowSize);
+   unsigned char *pCur;
+
+   pCur = (unsigned char *)lz4ultra_page_alloc(nSize, &pCompressor->page_buffers_size);
+   if (!pCur)
+      return 100;
+   pCompressor->page_buffers = pCur;
+   pCompressor->numa_node = -1;
+
+   pCompressor->divsufsort_context.bucket_A = (saidx_t *)pCur;
+   pCur += ARENA_ALIGN(DIVSUFSORT_BUCKET_A_BYTES);
+   pCompressor->divsufsort_context.bucket_B = (saidx_t *)pCur;
+   pCur += ARENA_ALIGN(DIVSUFSORT_BUCKET_B_BYTES);
+   pCompressor->intervals = (unsigned int *)pCur;
+   pCur += ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned int));
+   pCompressor->pos_data = (unsigned int *)pCur;
+   pCur += ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned int));
+   if (nMaxWindowSize > COMPACT_WINDOW_SIZE) {
+      pCompressor->interval_lcp = (unsigned short *)pCur;
+      pCur += ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned short));
+   }
+   pCompressor->match = (lz4ultra_match *)pCur;
+
+   pCompressor->max_window_size = nMaxWindowSize;
+   return 0;
+}
+
+/**
+ * Allocate window-sized buffers for compression context
+ *
+ * @param pCompressor compression context
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_compressor_alloc_buffers(lz4ultra_compressor *pCompressor, const int nMaxWindowSize) {
+   if (nMaxWindowSize == 0) {
+      /* Allocate on first reset */
+      pCompressor->max_window_size = 0;
+      return 0;
+   }
+
+   if (pCompressor->huge_pages)
+      return lz4ultra_compressor_map_buffers(pCompressor, nMaxWindowSize);
+
+   pCompressor->intervals = (unsigned int *)malloc(nMaxWindowSize * sizeof(unsigned int));
+
+   if (pCompressor->intervals) {
+      pCompressor->pos_data = (unsigned int *)malloc(nMaxWindowSize * sizeof(unsigned int));
+
+      if (pCompressor->pos_data) {
+         pCompressor->match = (lz4ultra_match *)malloc(nMaxWindowSize * sizeof(lz4ultra_match));
+
+         if (pCompressor->match) {
+            /* The LCPs of the split interval layout, for windows larger than COMPACT_WINDOW_SIZE, are allocated by the suffix
+             * array match finder when it first needs them */
+            pCompressor->max_window_size = nMaxWindowSize;
+            return 0;
+         }
+      }
+   }
+
+   return 100;
+}
+
+/**
+ * Free window-sized buffers of compression context
+ *
+ * @param pCompressor compression context
+ */
+static void lz4ultra_compressor_free_buffers(lz4ultra_compressor *pCompressor) {
+   if (pCompressor->dictionary_window) {
+      free(pCompressor->dictionary_window);
+      pCompressor->dictionary_window = NULL;
+   }
+
+   if (pCompressor->run_window) {
+      free(pCompressor->run_window);
+      pCompressor->run_window = NULL;
+   }
+
+   if (pCompressor->runs) {
+      free(pCompressor->runs);
+      pCompressor->runs = NULL;
+   }
+
+   if (pCompressor->candidates) {
+      free(pCompressor->candidates);
+      pCompressor->candidates = NULL;
+   }
+
+   if (pCompressor->page_buffers) {
+      /* Window-sized buffers and divsufsort buckets all point into the mapped region */
+      lz4ultra_page_free(pCompressor->page_buffers, pCompressor->page_buffers_size);
+      pCompressor->page_buffers = NULL;
+      pCompressor->page_buffers_size = 0;
+      pCompressor->numa_node = -1;
+      pCompressor->divsufsort_context.bucket_A = NULL;
+      pCompressor->divsufsort_context.bucket_B = NULL;
+      pCompressor->interval_lcp = NULL;
+      pCompressor->match = NULL;
+      pCompressor->pos_data = NULL;
+      pCompressor->intervals = NULL;
+   }
+
+   if (pCompressor->interval_lcp) {
+      free(pCompressor->interval_lcp);
+      pCompressor->interval_lcp = NULL;
+   }
+
+   if (pCompressor->match) {
+      free(pCompressor->match);
+      pCompressor->match = NULL;
+   }
+
+   if (pCompressor->pos_data) {
+      free(pCompressor->pos_data);
+      pCompressor->pos_data = NULL;
+   }
+
+   if (pCompressor->intervals) {
+      free(pCompressor->intervals);
+      pCompressor->intervals = NULL;
+   }
+
+   pCompressor->max_window_size = 0;
+}
 
 /**
  * Initialize compression context
@@ -48,30 +239,61 @@
 int lz4ultra_compressor_init(lz4ultra_compressor *pCompressor, const int nMaxWindowSize, const int nFlags) {
    int nResult;
 
-   nResult = divsufsort_init(&pCompressor->divsufsort_context);
+   if (nFlags & LZ4ULTRA_FLAG_HUGE_PAGES) {
+      /* The buckets are mapped along with the window-sized buffers */
+      pCompressor->divsufsort_context.bucket_A = NULL;
+      pCompressor->divsufsort_context.bucket_B = NULL;
+      pCompressor->divsufsort_context.parallel = NULL;
+      pCompressor->divsufsort_context.parallel_user = NULL;
+      pCompressor->divsufsort_context.num_threads = 1;
+      nResult = 0;
+   }
+   else {
+      nResult = divsufsort_init(&pCompressor->divsufsort_context);
+   }
    pCompressor->intervals = NULL;
    pCompressor->pos_data = NULL;
+   pCompressor->interval_lcp = NULL;
    pCompressor->open_intervals = NULL;
+   pCompressor->compact_intervals = 0;
    pCompressor->match = NULL;
    pCompressor->flags = nFlags;
    pCompressor->num_commands = 0;
+   pCompressor->num_skipped_blocks = 0;
+   pCompressor->max_window_size = 0;
+   pCompressor->in_arena = 0;
+   pCompressor->allocated = 0;
+   pCompressor->page_buffers = NULL;
+   pCompressor->page_buffers_size = 0;
+   pCompressor->huge_pages = (nFlags & LZ4ULTRA_FLAG_HUGE_PAGES) ? 1 : 0;
+   pCompressor->numa_node = -1;
+   pCompressor->search_depth = 0;
+   pCompressor->max_len_tries = 0;
+   pCompressor->optimize_command_count = 1;
+   pCompressor->candidates = NULL;
+   pCompressor->num_candidates = 0;
+   pCompressor->dictionary = NULL;
+   pCompressor->dictionary_window = NULL;
+   pCompressor->run_window = NULL;
+   pCompressor->runs = NULL;
+   pCompressor->num_runs = 0;
+   pCompressor->num_history_runs = 0;
+   pCompressor->block_cache = NULL;
+   pCompressor->sort_submit = NULL;
+   pCompressor->sort_executor = NULL;
+   pCompressor->decode_cost = 0;
+   pCompressor->decode_cost_model = g_defaultDecodeCostModel;
+   pCompressor->collect_stats = 0;
+   memset(&pCompressor->block_stats, 0, sizeof(lz4ultra_stats_t));
+   memset(&pCompressor->stats, 0, sizeof(lz4ultra_stats_t));
+   lz4ultra_bt_init(pCompressor, NULL);
 
    if (!nResult) {
-      pCompressor->intervals = (unsigned long long *)malloc(nMaxWindowSize * sizeof(unsigned long long));
-
-      if (pCompressor->intervals) {
-         pCompressor->pos_data = (unsigned long long *)malloc(nMaxWindowSize * sizeof(unsigned long long));
-
-         if (pCompressor->pos_data) {
-            pCompressor->open_intervals = (unsigned long long *)malloc((LCP_MAX + 1) * sizeof(unsigned long long));
+      pCompressor->open_intervals = (unsigned long long *)malloc((LCP_MAX + 1) * sizeof(unsigned long long));
 
-            if (pCompressor->open_intervals) {
-               pCompressor->match = (lz4ultra_match *)malloc(nMaxWindowSize * sizeof(lz4ultra_match));
-
-               if (pCompressor->match)
-                  return 0;
-            }
-         }
+      if (pCompressor->open_intervals) {
+         if (!lz4ultra_compressor_alloc_buffers(pCompressor, nMaxWindowSize))
+            return 0;
       }
    }
 
@@ -85,31 +307,517 @@ int lz4ultra_compressor_init(lz4ultra_compressor *pCompressor, const int nMaxWin
  * @param pCompressor compression context to clean up
  */
 void lz4ultra_compressor_destroy(lz4ultra_compressor *pCompressor) {
-   divsufsort_destroy(&pCompressor->divsufsort_context);
-
-   if (pCompressor->match) {
-      free(pCompressor->match);
-      pCompressor->match = NULL;
+   if (pCompressor->in_arena) {
+      /* Buffers belong to the caller's arena */
+      return;
    }
 
+   /* Frees the buckets too, if they were mapped along with the window-sized buffers */
+   lz4ultra_compressor_free_buffers(pCompressor);
+   divsufsort_destroy(&pCompressor->divsufsort_context);
+   lz4ultra_bt_destroy(pCompressor);
+
    if (pCompressor->open_intervals) {
       free(pCompressor->open_intervals);
       pCompressor->open_intervals = NULL;
    }
+}
 
-   if (pCompressor->pos_data) {
-      free(pCompressor->pos_data);
-      pCompressor->pos_data = NULL;
+/**
+ * Place the buffers of a context initialized with LZ4ULTRA_FLAG_HUGE_PAGES on the NUMA node of the calling thread, if
+ * this is the first thread to compress with it; call before compressing from a worker thread
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_compressor_bind_local(lz4ultra_compressor *pCompressor) {
+   if (pCompressor->page_buffers && pCompressor->numa_node < 0) {
+      int nNode = lz4ultra_get_numa_node();
+
+      if (nNode >= 0) {
+         /* Nothing is placed yet, as the mapping hasn't been written to; where mbind() isn't available, the pages still
+          * go to this node when this thread first touches them */
+         lz4ultra_page_bind(pCompressor->page_buffers, pCompressor->page_buffers_size, nNode);
+         pCompressor->numa_node = nNode;
+      }
    }
+}
 
-   if (pCompressor->intervals) {
-      free(pCompressor->intervals);
-      pCompressor->intervals = NULL;
+/**
+ * Get the size of the arena required to create a compression context with lz4ultra_compressor_create()
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size to compress + 64 Kb of history)
+ *
+ * @return arena size in bytes
+ */
+size_t lz4ultra_compressor_get_arena_size(const int nMaxWindowSize) {
+   return ARENA_ALIGN(sizeof(lz4ultra_compressor)) +
+      ARENA_ALIGN(DIVSUFSORT_BUCKET_A_BYTES) +
+      ARENA_ALIGN(DIVSUFSORT_BUCKET_B_BYTES) +
+      ARENA_ALIGN((LCP_MAX + 1) * sizeof(unsigned long long)) +
+      ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned int)) * 2 +
+      ((nMaxWindowSize > COMPACT_WINDOW_SIZE) ? ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned short)) : 0) +
+      ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(lz4ultra_match)) +
+      ARENA_ALIGN(lz4ultra_bt_get_memory_size()) +
+      ARENA_ALIGNMENT /* for aligning the arena itself */;
+}
+
+/**
+ * Create long-lived compression context, that can be reused for many calls with lz4ultra_compressor_reset()
+ *
+ * When an arena is supplied, the context and all of its buffers are carved out of it and no heap allocation takes
+ * place, neither now nor during compression; the window size is then fixed. Otherwise, the buffers are allocated
+ * from the heap and grow as needed when the context is reset for a larger window.
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size to compress + 64 Kb of history)
+ * @param nFlags compression flags
+ * @param pArena caller-supplied memory to create the context in, or NULL to allocate it from the heap
+ * @param nArenaSize size of arena in bytes, at least lz4ultra_compressor_get_arena_size(nMaxWindowSize) if an arena is supplied
+ *
+ * @return compression context, or NULL for failure
+ */
+lz4ultra_compressor *lz4ultra_compressor_create(const int nMaxWindowSize, const int nFlags, void *pArena, const size_t nArenaSize) {
+   lz4ultra_compressor *pCompressor;
+
+   if (nMaxWindowSize < 0)
+      return NULL;
+
+   if (pArena) {
+      unsigned char *pCur;
+
+      if (nArenaSize < lz4ultra_compressor_get_arena_size(nMaxWindowSize))
+         return NULL;
+
+      pCur = (unsigned char *)pArena;
+      pCur += (ARENA_ALIGNMENT - ((size_t)pCur & (ARENA_ALIGNMENT - 1))) & (ARENA_ALIGNMENT - 1);
+
+      pCompressor = (lz4ultra_compressor *)pCur;
+      pCur += ARENA_ALIGN(sizeof(lz4ultra_compressor));
+      pCompressor->divsufsort_context.bucket_A = (saidx_t *)pCur;
+      pCur += ARENA_ALIGN(DIVSUFSORT_BUCKET_A_BYTES);
+      pCompressor->divsufsort_context.bucket_B = (saidx_t *)pCur;
+      pCur += ARENA_ALIGN(DIVSUFSORT_BUCKET_B_BYTES);
+      pCompressor->divsufsort_context.parallel = NULL;
+      pCompressor->divsufsort_context.parallel_user = NULL;
+      pCompressor->divsufsort_context.num_threads = 1;
+      pCompressor->open_intervals = (unsigned long long *)pCur;
+      pCur += ARENA_ALIGN((LCP_MAX + 1) * sizeof(unsigned long long));
+      pCompressor->intervals = (unsigned int *)pCur;
+      pCur += ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned int));
+      pCompressor->pos_data = (unsigned int *)pCur;
+      pCur += ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned int));
+      if (nMaxWindowSize > COMPACT_WINDOW_SIZE) {
+         pCompressor->interval_lcp = (unsigned short *)pCur;
+         pCur += ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(unsigned short));
+      }
+      else {
+         pCompressor->interval_lcp = NULL;
+      }
+      pCompressor->compact_intervals = 0;
+      pCompressor->match = (lz4ultra_match *)pCur;
+      pCur += ARENA_ALIGN((size_t)nMaxWindowSize * sizeof(lz4ultra_match));
+      lz4ultra_bt_init(pCompressor, pCur);
+
+      pCompressor->flags = nFlags;
+      pCompressor->num_commands = 0;
+      pCompressor->num_skipped_blocks = 0;
+      pCompressor->max_window_size = nMaxWindowSize;
+      pCompressor->in_arena = 1;
+      pCompressor->allocated = 0;
+      pCompressor->page_buffers = NULL;
+      pCompressor->page_buffers_size = 0;
+      pCompressor->huge_pages = 0;
+      pCompressor->numa_node = -1;
+      pCompressor->search_depth = 0;
+      pCompressor->max_len_tries = 0;
+      pCompressor->optimize_command_count = 1;
+      pCompressor->candidates = NULL;
+      pCompressor->num_candidates = 0;
+      pCompressor->dictionary = NULL;
+      pCompressor->dictionary_window = NULL;
+      pCompressor->run_window = NULL;
+      pCompressor->runs = NULL;
+      pCompressor->num_runs = 0;
+      pCompressor->num_history_runs = 0;
+      pCompressor->block_cache = NULL;
+      pCompressor->sort_submit = NULL;
+      pCompressor->sort_executor = NULL;
+      pCompressor->decode_cost = 0;
+      pCompressor->decode_cost_model = g_defaultDecodeCostModel;
+      pCompressor->collect_stats = 0;
+      memset(&pCompressor->block_stats, 0, sizeof(lz4ultra_stats_t));
+      memset(&pCompressor->stats, 0, sizeof(lz4ultra_stats_t));
+      return pCompressor;
+   }
+
+   pCompressor = (lz4ultra_compressor *)malloc(sizeof(lz4ultra_compressor));
+   if (!pCompressor)
+      return NULL;
+
+   if (lz4ultra_compressor_init(pCompressor, nMaxWindowSize, nFlags) != 0) {
+      free(pCompressor);
+      return NULL;
    }
+
+   pCompressor->allocated = 1;
+   return pCompressor;
 }
 
 /**
- * Compress one block of data
+ * Prepare compression context for compressing a new, unrelated input, growing its buffers if required
+ *
+ * @param pCompressor compression context
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ * @param nFlags compression flags
+ *
+ * @return 0 for success, non-zero for failure (the context must then be reset again before use, or freed)
+ */
+int lz4ultra_compressor_reset(lz4ultra_compressor *pCompressor, const int nMaxWindowSize, const int nFlags) {
+   if (nMaxWindowSize > pCompressor->max_window_size) {
+      if (pCompressor->in_arena)
+         return 100;
+
+      lz4ultra_compressor_free_buffers(pCompressor);
+      if (lz4ultra_compressor_alloc_buffers(pCompressor, nMaxWindowSize)) {
+         lz4ultra_compressor_free_buffers(pCompressor);
+         return 100;
+      }
+   }
+
+   pCompressor->flags = nFlags;
+   pCompressor->num_commands = 0;
+   pCompressor->num_skipped_blocks = 0;
+   pCompressor->dictionary = NULL;
+   memset(&pCompressor->block_stats, 0, sizeof(lz4ultra_stats_t));
+   memset(&pCompressor->stats, 0, sizeof(lz4ultra_stats_t));
+   lz4ultra_bt_reset(pCompressor);
+   return 0;
+}
+
+/**
+ * Free compression context created with lz4ultra_compressor_create()
+ *
+ * @param pCompressor compression context, or NULL
+ */
+void lz4ultra_compressor_free(lz4ultra_compressor *pCompressor) {
+   if (pCompressor) {
+      int nAllocated = pCompressor->allocated;
+
+      lz4ultra_compressor_destroy(pCompressor);
+      if (nAllocated)
+         free(pCompressor);
+   }
+}
+
+/**
+ * Look up the parameters of a compression level
+ *
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return level parameters
+ */
+static const lz4ultra_level_params_t *lz4ultra_get_level_params(int nLevel) {
+   if (nLevel <= 0 || nLevel > LZ4ULTRA_MAX_LEVEL)
+      nLevel = LZ4ULTRA_MAX_LEVEL;
+   if (nLevel < LZ4ULTRA_MIN_LEVEL)
+      nLevel = LZ4ULTRA_MIN_LEVEL;
+   return &g_levelParams[nLevel - LZ4ULTRA_MIN_LEVEL];
+}
+
+/**
+ * Check whether compression contexts set up with the given flags and level find matches by suffix-sorting each block
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return 1 for the suffix array match finder, 0 for the binary tree or hash chain match finders
+ */
+int lz4ultra_compressor_uses_suffix_array(const unsigned int nFlags, const int nLevel) {
+   if (nFlags & (LZ4ULTRA_FLAG_BT_MATCHFINDER | LZ4ULTRA_FLAG_HC_MATCHFINDER))
+      return 0;
+   return lz4ultra_get_level_params(nLevel)->match_finder_flags ? 0 : 1;
+}
+
+/**
+ * Check whether compression contexts set up with the given flags and level find matches with the binary tree
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return 1 for the binary tree match finder, 0 for the hash chain or suffix array match finders
+ */
+int lz4ultra_compressor_uses_binary_tree(const unsigned int nFlags, const int nLevel) {
+   if (nFlags & LZ4ULTRA_FLAG_HC_MATCHFINDER)
+      return 0;
+   if (nFlags & LZ4ULTRA_FLAG_BT_MATCHFINDER)
+      return 1;
+   return (lz4ultra_get_level_params(nLevel)->match_finder_flags & LZ4ULTRA_FLAG_BT_MATCHFINDER) ? 1 : 0;
+}
+
+/**
+ * Get the largest amount of memory that a heap-backed compression context allocates while compressing blocks, besides the context itself
+ *
+ * This counts the buffers allocated when the context is initialized, and those allocated when first needed: the LCPs of
+ * large windows and the compacted runs for the suffix array match finder, the buffers of the binary tree and hash chain
+ * match finders, and the match candidates. It doesn't count the window that some in-memory compression assembles the
+ * dictionary and a block in.
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size + history)
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_compressor_get_memory_size(const int nMaxWindowSize, const unsigned int nFlags, const int nLevel) {
+   const int nSuffixArray = lz4ultra_compressor_uses_suffix_array(nFlags, nLevel);
+   size_t nSize = (LCP_MAX + 1) * sizeof(unsigned long long);
+
+   if (nFlags & LZ4ULTRA_FLAG_HUGE_PAGES) {
+      /* Mapped at once, in whole huge pages, along with the LCPs whether they are used or not */
+      nSize += (lz4ultra_compressor_get_mapped_size(nMaxWindowSize) + (LZ4ULTRA_HUGE_PAGE_SIZE - 1)) & ~((size_t)LZ4ULTRA_HUGE_PAGE_SIZE - 1);
+   }
+   else {
+      nSize += DIVSUFSORT_BUCKET_A_BYTES + DIVSUFSORT_BUCKET_B_BYTES;
+      nSize += (size_t)nMaxWindowSize * (2 * sizeof(unsigned int) + sizeof(lz4ultra_match));
+      if (nSuffixArray && nMaxWindowSize > COMPACT_WINDOW_SIZE)
+         nSize += (size_t)nMaxWindowSize * sizeof(unsigned short);
+   }
+
+   if (nSuffixArray)
+      nSize += lz4ultra_get_runs_memory_size(nMaxWindowSize);
+   else
+      nSize += lz4ultra_bt_get_memory_size();
+
+   if (nFlags & LZ4ULTRA_FLAG_MATCH_CANDIDATES)
+      nSize += (size_t)nMaxWindowSize * MAX_MATCH_CANDIDATES * sizeof(lz4ultra_match_candidate);
+
+   return nSize;
+}
+
+/**
+ * Apply compression level: select the match finder (unless one is already selected through the compression flags),
+ * its search depth, how many match lengths the parser tries per position, and whether the command count is reduced
+ *
+ * @param pCompressor compression context
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ */
+void lz4ultra_compressor_set_level(lz4ultra_compressor *pCompressor, int nLevel) {
+   const lz4ultra_level_params_t *pParams = lz4ultra_get_level_params(nLevel);
+
+   if ((pCompressor->flags & (LZ4ULTRA_FLAG_BT_MATCHFINDER | LZ4ULTRA_FLAG_HC_MATCHFINDER)) == 0)
+      pCompressor->flags |= pParams->match_finder_flags;
+   pCompressor->search_depth = pParams->search_depth;
+   pCompressor->max_len_tries = pParams->max_len_tries;
+   pCompressor->optimize_command_count = pParams->optimize_command_count;
+}
+
+/**
+ * Set how hard the binary tree and hash chain match finders search for each match
+ *
+ * @param pCompressor compression context
+ * @param nDepth maximum number of tree nodes or chain links visited per position, or 0 for the match finder's default
+ *                (this overrides the depth picked by lz4ultra_compressor_set_level())
+ */
+void lz4ultra_compressor_set_search_depth(lz4ultra_compressor *pCompressor, const int nDepth) {
+   pCompressor->search_depth = nDepth;
+}
+
+/**
+ * Attach prepared dictionary to compression context, until it is reset
+ *
+ * Blocks whose previously compressed bytes are exactly the dictionary are then compressed without sorting the dictionary
+ * again, when suffix-sorting. The dictionary must outlive its use by the context.
+ *
+ * @param pCompressor compression context
+ * @param pDictionary prepared dictionary, or NULL for none
+ */
+void lz4ultra_compressor_set_dictionary(lz4ultra_compressor *pCompressor, const lz4ultra_prepared_dictionary_t *pDictionary) {
+   pCompressor->dictionary = pDictionary;
+}
+
+/** Shared state of one concurrent suffix sorting pass */
+typedef struct _lz4ultra_sort_tasks_t {
+   lz4ultra_mutex_t lock;
+   lz4ultra_cond_t cond;
+   divsufsort_task_fn task;
+   void *arg;
+   int nPending;
+} lz4ultra_sort_tasks_t;
+
+/** One suffix sorting task */
+typedef struct _lz4ultra_sort_task_t {
+   lz4ultra_sort_tasks_t *pTasks;
+   int nIndex;
+} lz4ultra_sort_task_t;
+
+/**
+ * Run one suffix sorting task, and signal its completion
+ *
+ * @param pTaskArg sorting task (lz4ultra_sort_task_t)
+ */
+static void lz4ultra_compressor_sort_task(void *pTaskArg) {
+   lz4ultra_sort_task_t *pTask = (lz4ultra_sort_task_t *)pTaskArg;
+   lz4ultra_sort_tasks_t *pTasks = pTask->pTasks;
+
+   pTasks->task(pTasks->arg, pTask->nIndex);
+
+   lz4ultra_mutex_lock(&pTasks->lock);
+   pTasks->nPending--;
+   lz4ultra_cond_broadcast(&pTasks->cond);
+   lz4ultra_mutex_unlock(&pTasks->lock);
+}
+
+/**
+ * Run suffix sorting tasks concurrently, with the compression context's executor (divsufsort executor hook)
+ *
+ * @param pUser compression context
+ * @param task sorting task function
+ * @param pArg argument passed to task function
+ * @param nCount number of tasks
+ */
+static void lz4ultra_compressor_run_sort_tasks(void *pUser, divsufsort_task_fn task, void *pArg, int nCount) {
+   lz4ultra_compressor *pCompressor = (lz4ultra_compressor *)pUser;
+   lz4ultra_sort_task_t sortTask[MAX_SORT_THREADS];
+   lz4ultra_sort_tasks_t tasks;
+   int i;
+
+   lz4ultra_mutex_init(&tasks.lock);
+   lz4ultra_cond_init(&tasks.cond);
+   tasks.task = task;
+   tasks.arg = pArg;
+   tasks.nPending = nCount;
+
+   for (i = 0; i < nCount; i++) {
+      sortTask[i].pTasks = &tasks;
+      sortTask[i].nIndex = i;
+   }
+
+   /* Queue all tasks but the first one, that runs on this thread */
+   for (i = 1; i < nCount; i++) {
+      if (pCompressor->sort_submit(pCompressor->sort_executor, lz4ultra_compressor_sort_task, &sortTask[i]) != 0)
+         lz4ultra_compressor_sort_task(&sortTask[i]);
+   }
+   lz4ultra_compressor_sort_task(&sortTask[0]);
+
+   lz4ultra_mutex_lock(&tasks.lock);
+   while (tasks.nPending)
+      lz4ultra_cond_wait(&tasks.cond, &tasks.lock);
+   lz4ultra_mutex_unlock(&tasks.lock);
+
+   lz4ultra_cond_destroy(&tasks.cond);
+   lz4ultra_mutex_destroy(&tasks.lock);
+}
+
+/**
+ * Split suffix sorting of each large window into tasks run concurrently with an executor
+ *
+ * @param pCompressor compression context
+ * @param nThreads number of tasks to split sorting into (1 to sort serially, at most MAX_SORT_THREADS)
+ * @param submit function to queue sorting tasks with the caller's executor, or NULL to sort serially
+ * @param pExecutor opaque executor pointer passed to submit
+ */
+void lz4ultra_compressor_set_sort_threads(lz4ultra_compressor *pCompressor, int nThreads, lz4ultra_submit_fn submit, void *pExecutor) {
+   if (nThreads > MAX_SORT_THREADS)
+      nThreads = MAX_SORT_THREADS;
+
+   if (nThreads > 1 && submit) {
+      pCompressor->sort_submit = submit;
+      pCompressor->sort_executor = pExecutor;
+      pCompressor->divsufsort_context.parallel = lz4ultra_compressor_run_sort_tasks;
+      pCompressor->divsufsort_context.parallel_user = pCompressor;
+      pCompressor->divsufsort_context.num_threads = nThreads;
+   }
+   else {
+      pCompressor->sort_submit = NULL;
+      pCompressor->sort_executor = NULL;
+      pCompressor->divsufsort_context.parallel = NULL;
+      pCompressor->divsufsort_context.parallel_user = NULL;
+      pCompressor->divsufsort_context.num_threads = 1;
+   }
+}
+
+/**
+ * Make the parser minimize the compressed size plus the estimated decoding time, weighted by nDecodeCost, instead of
+ * using the --favor-decSpeed heuristics. The setting outlives lz4ultra_compressor_reset().
+ *
+ * @param pCompressor compression context
+ * @param nDecodeCost weight of one decoder cycle, in 1/16ths of a bit, or 0 to turn the cost model off
+ * @param pModel decoder cycle costs, or NULL for the default estimates
+ */
+void lz4ultra_compressor_set_decode_cost(lz4ultra_compressor *pCompressor, const int nDecodeCost, const lz4ultra_decode_cost_model_t *pModel) {
+   pCompressor->decode_cost = (nDecodeCost > 0) ? nDecodeCost : 0;
+   pCompressor->decode_cost_model = pModel ? *pModel : g_defaultDecodeCostModel;
+}
+
+/**
+ * Enable or disable collecting statistics about each block, and accumulating them until the context is reset. The
+ * setting outlives lz4ultra_compressor_reset().
+ *
+ * @param pCompressor compression context
+ * @param nEnable 1 to collect statistics, 0 not to
+ */
+void lz4ultra_compressor_set_stats(lz4ultra_compressor *pCompressor, const int nEnable) {
+   pCompressor->collect_stats = nEnable ? 1 : 0;
+}
+
+/**
+ * Attach cache of compressed blocks to compression context. The setting outlives lz4ultra_compressor_reset().
+ *
+ * @param pCompressor compression context
+ * @param pCache cache (see lz4ultra_block_cache_create()), or NULL for none
+ */
+void lz4ultra_compressor_set_block_cache(lz4ultra_compressor *pCompressor, lz4ultra_block_cache_t *pCache) {
+   pCompressor->block_cache = pCache;
+}
+
+/**
+ * Get the cache of compressed blocks attached to a compression context
+ *
+ * @param pCompressor compression context
+ *
+ * @return cache, or NULL for none
+ */
+lz4ultra_block_cache_t *lz4ultra_compressor_get_block_cache(lz4ultra_compressor *pCompressor) {
+   return pCompressor->block_cache;
+}
+
+/**
+ * Hash the settings of a compression context that its compressed blocks depend on, for looking blocks up in a cache
+ *
+ * @param pCompressor compression context
+ *
+ * @return hash of settings
+ */
+static unsigned long long lz4ultra_compressor_hash_settings(const lz4ultra_compressor *pCompressor) {
+   int nSettings[6 + sizeof(lz4ultra_decode_cost_model_t) / sizeof(int)];
+
+   nSettings[0] = pCompressor->flags;
+   nSettings[1] = pCompressor->search_depth;
+   nSettings[2] = pCompressor->max_len_tries;
+   nSettings[3] = pCompressor->optimize_command_count;
+   nSettings[4] = pCompressor->decode_cost;
+   nSettings[5] = pCompressor->in_arena;       /* Arena-backed contexts don't look for closer offsets */
+   memcpy(nSettings + 6, &pCompressor->decode_cost_model, sizeof(lz4ultra_decode_cost_model_t));
+   return XXH64(nSettings, sizeof(nSettings), 0);
+}
+
+/**
+ * Get a window of the context's maximum size, for assembling the dictionary and a block to compress after it, when they
+ * are not next to each other in memory
+ *
+ * The window is allocated the first time it is needed, and is not available for arena-backed contexts.
+ *
+ * @param pCompressor compression context
+ *
+ * @return window, or NULL for failure
+ */
+unsigned char *lz4ultra_compressor_get_dictionary_window(lz4ultra_compressor *pCompressor) {
+   if (!pCompressor->dictionary_window && !pCompressor->in_arena)
+      pCompressor->dictionary_window = (unsigned char *)malloc(pCompressor->max_window_size);
+   return pCompressor->dictionary_window;
+}
+
+/**
+ * Find matches for one block of data and compress it, measuring the time spent in each stage if requested
  *
  * @param pCompressor compression context
  * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
@@ -117,19 +825,187 @@ void lz4ultra_compressor_destroy(lz4ultra_compressor *pCompressor) {
  * @param nInDataSize number of input bytes to compress
  * @param pOutData pointer to output buffer
  * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ * @param pStats statistics of the block, to update with stage times and counters, or NULL for none
  *
  * @return size of compressed data in output buffer, or -1 if the data is uncompressible
  */
-int lz4ultra_compressor_shrink_block(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize) {
-   if (lz4ultra_build_suffix_array(pCompressor, pInWindow, nPreviousBlockSize + nInDataSize))
+static int lz4ultra_compressor_compress_block(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize,
+                                              lz4ultra_stats_t *pStats) {
+   long long nTime = pStats ? lz4ultra_stats_get_time() : 0LL;
+   long long nCurTime;
+
+   pCompressor->num_candidates = 0;
+   if ((pCompressor->flags & LZ4ULTRA_FLAG_MATCH_CANDIDATES) && !pCompressor->in_arena) {
+      /* Allocate the candidates the first time they are needed, as they take more room than the matches themselves */
+      if (!pCompressor->candidates) {
+         pCompressor->candidates = (lz4ultra_match_candidate *)malloc((size_t)pCompressor->max_window_size * MAX_MATCH_CANDIDATES * sizeof(lz4ultra_match_candidate));
+         if (!pCompressor->candidates)
+            return -1;
+      }
+      pCompressor->num_candidates = MAX_MATCH_CANDIDATES;
+   }
+
+   /* Don't spend a full match search on data such as compressed media or encrypted data; raw blocks and legacy frames
+    * can't store blocks uncompressed, so they are always compressed */
+   if ((pCompressor->flags & (LZ4ULTRA_FLAG_RAW_BLOCK | LZ4ULTRA_FLAG_LEGACY_FRAMES)) == 0 && lz4ultra_block_is_incompressible(pInWindow, nPreviousBlockSize, nInDataSize)) {
+      pCompressor->num_skipped_blocks++;
+      if (pStats) {
+         pStats->check_time = lz4ultra_stats_get_time() - nTime;
+         pStats->num_skipped_blocks = 1;
+      }
       return -1;
-   if (nPreviousBlockSize) {
-      lz4ultra_skip_matches(pCompressor, 0, nPreviousBlockSize);
    }
-   lz4ultra_find_all_matches(pCompressor, nPreviousBlockSize, nPreviousBlockSize + nInDataSize);
+
+   if (pStats) {
+      nCurTime = lz4ultra_stats_get_time();
+      pStats->check_time = nCurTime - nTime;
+      nTime = nCurTime;
+   }
+
+   if (pCompressor->flags & (LZ4ULTRA_FLAG_BT_MATCHFINDER | LZ4ULTRA_FLAG_HC_MATCHFINDER)) {
+      if (lz4ultra_bt_find_all_matches(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize))
+         return -1;
+
+      if (pStats)
+         pStats->find_time = lz4ultra_stats_get_time() - nTime;
+   }
+   else {
+      const lz4ultra_prepared_dictionary_t *pDictionary = pCompressor->dictionary;
+
+      if (pDictionary && (nPreviousBlockSize != pDictionary->size || memcmp(pInWindow, pDictionary->data, nPreviousBlockSize)))
+         pDictionary = NULL;
+
+      if (lz4ultra_find_runs(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize) > 0) {
+         /* Long runs of identical bytes are matched directly, and only the rest of the window goes through the suffix
+          * array, which would otherwise spend most of its time ascending the deeply nested intervals of each run */
+         long long nSortTime = pStats ? (pStats->sort_time + pStats->intervals_time) : 0LL;
+
+         if (lz4ultra_find_all_matches_around_runs(pCompressor, pInWindow, nPreviousBlockSize, nPreviousBlockSize + nInDataSize, pDictionary))
+            return -1;
+
+         if (pStats)
+            pStats->find_time = lz4ultra_stats_get_time() - nTime - (pStats->sort_time + pStats->intervals_time - nSortTime);
+      }
+      else {
+         /* The suffix array builder measures its own stages */
+         if (lz4ultra_build_suffix_array(pCompressor, pInWindow, nPreviousBlockSize + nInDataSize, pDictionary))
+            return -1;
+
+         if (pStats)
+            nTime = lz4ultra_stats_get_time();
+         if (nPreviousBlockSize) {
+            lz4ultra_skip_matches(pCompressor, 0, nPreviousBlockSize);
+         }
+         if (pStats) {
+            nCurTime = lz4ultra_stats_get_time();
+            pStats->skip_time = nCurTime - nTime;
+            nTime = nCurTime;
+         }
+
+         lz4ultra_find_all_matches(pCompressor, nPreviousBlockSize, nPreviousBlockSize + nInDataSize);
+         if (pStats)
+            pStats->find_time = lz4ultra_stats_get_time() - nTime;
+      }
+   }
+
    return lz4ultra_optimize_and_write_block(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, pOutData, nMaxOutDataSize);
 }
 
+/**
+ * Compress one block of data
+ *
+ * @param pCompressor compression context
+ * @param pInWindow pointer to input data window (previously compressed bytes + bytes to compress)
+ * @param nPreviousBlockSize number of previously compressed bytes (or 0 for none)
+ * @param nInDataSize number of input bytes to compress
+ * @param pOutData pointer to output buffer
+ * @param nMaxOutDataSize maximum size of output buffer, in bytes
+ *
+ * @return size of compressed data in output buffer, or -1 if the data is uncompressible
+ */
+int lz4ultra_compressor_shrink_block(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize) {
+   lz4ultra_stats_t *pStats = &pCompressor->block_stats;
+   lz4ultra_block_cache_t *pCache = pCompressor->block_cache;
+   lz4ultra_block_cache_key_t key;
+   int nPrevCommands = pCompressor->num_commands;
+   int nPrevSkippedBlocks = pCompressor->num_skipped_blocks;
+   int nCached = 0;
+   int nResult = -1;
+
+   if (pCache && (pCompressor->flags & (LZ4ULTRA_FLAG_BT_MATCHFINDER | LZ4ULTRA_FLAG_HC_MATCHFINDER)) != 0)
+      pCache = NULL;
+
+   if (pCompressor->collect_stats) {
+      memset(pStats, 0, sizeof(lz4ultra_stats_t));
+      pStats->num_blocks = 1;
+      pStats->num_input_bytes = nInDataSize;
+   }
+
+   if (pCache) {
+      int nNumCommands = 0;
+
+      lz4ultra_block_cache_make_key(pInWindow, nPreviousBlockSize, nInDataSize, lz4ultra_compressor_hash_settings(pCompressor), &key);
+      nResult = lz4ultra_block_cache_get(pCache, &key, pOutData, nMaxOutDataSize, &nNumCommands);
+      if (nResult >= 0) {
+         pCompressor->num_commands += nNumCommands;
+         nCached = 1;
+      }
+   }
+
+   if (!nCached) {
+      nResult = lz4ultra_compressor_compress_block(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, pOutData, nMaxOutDataSize,
+                                                   pCompressor->collect_stats ? pStats : NULL);
+
+      /* Blocks found incompressible before running the match finder are cheap to find again, and aren't worth the room */
+      if (pCache && nResult >= 0 && pCompressor->num_skipped_blocks == nPrevSkippedBlocks)
+         lz4ultra_block_cache_put(pCache, &key, pOutData, nResult, pCompressor->num_commands - nPrevCommands);
+   }
+
+   if (pCompressor->collect_stats) {
+      pStats->num_commands = pCompressor->num_commands - nPrevCommands;
+      pStats->num_cached_blocks = nCached;
+      if (nResult < 0)
+         pStats->num_uncompressed_blocks = 1;
+      else
+         pStats->num_output_bytes = nResult;
+      lz4ultra_stats_add(&pCompressor->stats, pStats);
+   }
+
+   return nResult;
+}
+
+/**
+ * Account for a block that the caller stores uncompressed without handing it to lz4ultra_compressor_shrink_block(),
+ * because it already knows that the block is incompressible
+ *
+ * @param pCompressor compression context
+ * @param nInDataSize number of input bytes in the block
+ */
+void lz4ultra_compressor_skip_block(lz4ultra_compressor *pCompressor, const int nInDataSize) {
+   pCompressor->num_skipped_blocks++;
+
+   if (pCompressor->collect_stats) {
+      lz4ultra_stats_t *pStats = &pCompressor->block_stats;
+
+      memset(pStats, 0, sizeof(lz4ultra_stats_t));
+      pStats->num_blocks = 1;
+      pStats->num_input_bytes = nInDataSize;
+      pStats->num_uncompressed_blocks = 1;
+      pStats->num_skipped_blocks = 1;
+      lz4ultra_stats_add(&pCompressor->stats, pStats);
+   }
+}
+
+/**
+ * Forget the match finder window carried over from the last block, so that the next block is compressed from the bytes in
+ * front of it only, and comes out the same whichever context compressed the blocks before it
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_compressor_reset_window(lz4ultra_compressor *pCompressor) {
+   lz4ultra_bt_reset(pCompressor);
+}
+
 /**
  * Get the number of compression commands issued in compressed data blocks
  *
@@ -138,3 +1014,35 @@ int lz4ultra_compressor_shrink_block(lz4ultra_compressor *pCompressor, const uns
 int lz4ultra_compressor_get_command_count(lz4ultra_compressor *pCompressor) {
    return pCompressor->num_commands;
 }
+
+/**
+ * Get the number of blocks that were found to be incompressible before running the match finder on them, and were
+ * left to be stored uncompressed
+ *
+ * @return number of blocks
+ */
+int lz4ultra_compressor_get_skipped_block_count(lz4ultra_compressor *pCompressor) {
+   return pCompressor->num_skipped_blocks;
+}
+
+/**
+ * Get the statistics of the last block compressed, when statistics are enabled
+ *
+ * @param pCompressor compression context
+ *
+ * @return statistics of the last block
+ */
+const lz4ultra_stats_t *lz4ultra_compressor_get_block_stats(lz4ultra_compressor *pCompressor) {
+   return &pCompressor->block_stats;
+}
+
+/**
+ * Get the statistics accumulated over all the blocks compressed since the context was last reset, when statistics are enabled
+ *
+ * @param pCompressor compression context
+ *
+ * @return accumulated statistics
+ */
+const lz4ultra_stats_t *lz4ultra_compressor_get_stats(lz4ultra_compressor *pCompressor) {
+   return &pCompressor->stats;
+}
@@ -33,15 +33,25 @@
 #ifndef _SHRINK_CONTEXT_H
 #define _SHRINK_CONTEXT_H
 
+#include <stdlib.h>
 #include "divsufsort.h"
+#include "dictionary.h"
+#include "threadpool.h"
+#include "stats.h"
+#include "block_cache.h"
 
 #define LCP_BITS 15
 #define LCP_MAX (1LL<<(LCP_BITS - 1))
-#define LCP_SHIFT (39-LCP_BITS)
-#define LCP_MASK (((1ULL<<LCP_BITS) - 1) << LCP_SHIFT)
-#define POS_MASK ((1ULL<<LCP_SHIFT) - 1)
-#define VISITED_FLAG 0x8000000000ULL
-#define EXCL_VISITED_MASK  0x7fffffffffULL
+#define VISITED_FLAG 0x80000000U
+#define EXCL_VISITED_MASK  0x7fffffffU
+
+/* Compact layout, for windows up to COMPACT_WINDOW_SIZE bytes: each interval reference packs the LCP above a 16-bit position */
+#define COMPACT_WINDOW_SIZE 65536
+#define LCP_SHIFT 16
+#define LCP_MASK (((1U<<LCP_BITS) - 1) << LCP_SHIFT)
+#define POS_MASK ((1U<<LCP_SHIFT) - 1)
+
+/* Split layout, for larger windows: interval references only hold positions, and the LCP of each interval is in interval_lcp[] */
 
 #define LEAVE_ALONE_MATCH_SIZE 1100
 
@@ -50,21 +60,81 @@
 
 #define MODESWITCH_PENALTY 1
 
+/** Maximum number of tasks that suffix sorting is split into */
+#define MAX_SORT_THREADS 64
+
 /** One match */
 typedef struct _lz4ultra_match {
    unsigned int length;
    unsigned int offset;
 } lz4ultra_match;
 
+/** Maximum number of shorter, closer match candidates kept per position, in addition to the longest match */
+#define MAX_MATCH_CANDIDATES 3
+
+/** One shorter, closer match candidate */
+typedef struct _lz4ultra_match_candidate {
+   unsigned short length;
+   unsigned short offset;
+} lz4ultra_match_candidate;
+
+/** Runs of identical bytes at least this long are coded directly, and left out of the suffix array */
+#define MIN_RUN_SIZE 1024
+
+/** Number of bytes at the start of each run that stay in the suffix array, so that other data can still match into the run */
+#define RUN_STUB_SIZE 64
+
+/** One run of identical bytes in the input window */
+typedef struct _lz4ultra_run {
+   int start;
+   int end;
+   int compacted_end;   /**< offset in the window that the suffix array is built over, where this run's stub ends */
+} lz4ultra_run;
+
 /** Compression context */
 typedef struct _lz4ultra_compressor {
    divsufsort_ctx_t divsufsort_context;
-   unsigned long long *intervals;
-   unsigned long long *pos_data;
+   unsigned int *intervals;
+   unsigned int *pos_data;
+   unsigned short *interval_lcp;
    unsigned long long *open_intervals;
+   int compact_intervals;
    lz4ultra_match *match;
    int flags;
    int num_commands;
+   int num_skipped_blocks;
+   int max_window_size;
+   int in_arena;
+   int allocated;
+   void *page_buffers;
+   size_t page_buffers_size;
+   int huge_pages;
+   int numa_node;
+   unsigned int *bt_head;
+   unsigned int *bt_son;
+   unsigned char *bt_history;
+   unsigned int bt_pos;
+   int bt_history_size;
+   int bt_allocated;
+   int search_depth;
+   int max_len_tries;
+   int optimize_command_count;
+   lz4ultra_match_candidate *candidates;
+   int num_candidates;
+   const lz4ultra_prepared_dictionary_t *dictionary;
+   unsigned char *dictionary_window;
+   unsigned char *run_window;
+   lz4ultra_run *runs;
+   int num_runs;
+   int num_history_runs;
+   lz4ultra_block_cache_t *block_cache;
+   lz4ultra_submit_fn sort_submit;
+   void *sort_executor;
+   int decode_cost;
+   lz4ultra_decode_cost_model_t decode_cost_model;
+   int collect_stats;
+   lz4ultra_stats_t block_stats;
+   lz4ultra_stats_t stats;
 } lz4ultra_compressor;
 
 /**
@@ -85,6 +155,194 @@ int lz4ultra_compressor_init(lz4ultra_compressor *pCompressor, const int nMaxWin
  */
 void lz4ultra_compressor_destroy(lz4ultra_compressor *pCompressor);
 
+/**
+ * Place the buffers of a context initialized with LZ4ULTRA_FLAG_HUGE_PAGES on the NUMA node of the calling thread, if
+ * this is the first thread to compress with it; call before compressing from a worker thread
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_compressor_bind_local(lz4ultra_compressor *pCompressor);
+
+/**
+ * Get the size of the arena required to create a compression context with lz4ultra_compressor_create()
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size to compress + 64 Kb of history)
+ *
+ * @return arena size in bytes
+ */
+size_t lz4ultra_compressor_get_arena_size(const int nMaxWindowSize);
+
+/**
+ * Create long-lived compression context, that can be reused for many calls with lz4ultra_compressor_reset()
+ *
+ * When an arena is supplied, the context and all of its buffers are carved out of it and no heap allocation takes
+ * place, neither now nor during compression; the window size is then fixed. Otherwise, the buffers are allocated
+ * from the heap and grow as needed when the context is reset for a larger window.
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size to compress + 64 Kb of history)
+ * @param nFlags compression flags
+ * @param pArena caller-supplied memory to create the context in, or NULL to allocate it from the heap
+ * @param nArenaSize size of arena in bytes, at least lz4ultra_compressor_get_arena_size(nMaxWindowSize) if an arena is supplied
+ *
+ * @return compression context, or NULL for failure
+ */
+lz4ultra_compressor *lz4ultra_compressor_create(const int nMaxWindowSize, const int nFlags, void *pArena, const size_t nArenaSize);
+
+/**
+ * Prepare compression context for compressing a new, unrelated input, growing its buffers if required
+ *
+ * @param pCompressor compression context
+ * @param nMaxWindowSize maximum size of input data window (previously compressed bytes + bytes to compress)
+ * @param nFlags compression flags
+ *
+ * @return 0 for success, non-zero for failure (the context must then be reset again before use, or freed)
+ */
+int lz4ultra_compressor_reset(lz4ultra_compressor *pCompressor, const int nMaxWindowSize, const int nFlags);
+
+/**
+ * Free compression context created with lz4ultra_compressor_create()
+ *
+ * @param pCompressor compression context, or NULL
+ */
+void lz4ultra_compressor_free(lz4ultra_compressor *pCompressor);
+
+/**
+ * Apply compression level: select the match finder (unless one is already selected through the compression flags),
+ * its search depth, how many match lengths the parser tries per position, and whether the command count is reduced
+ *
+ * @param pCompressor compression context
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ */
+void lz4ultra_compressor_set_level(lz4ultra_compressor *pCompressor, int nLevel);
+
+/**
+ * Check whether compression contexts set up with the given flags and level find matches by suffix-sorting each block
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return 1 for the suffix array match finder, 0 for the binary tree or hash chain match finders
+ */
+int lz4ultra_compressor_uses_suffix_array(const unsigned int nFlags, const int nLevel);
+
+/**
+ * Check whether compression contexts set up with the given flags and level find matches with the binary tree
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return 1 for the binary tree match finder, 0 for the hash chain or suffix array match finders
+ */
+int lz4ultra_compressor_uses_binary_tree(const unsigned int nFlags, const int nLevel);
+
+/**
+ * Get the largest amount of memory that a heap-backed compression context allocates while compressing blocks, besides the context itself
+ *
+ * This counts the buffers allocated when the context is initialized, and those allocated when first needed: the LCPs of
+ * large windows and the compacted runs for the suffix array match finder, the buffers of the binary tree and hash chain
+ * match finders, and the match candidates. It doesn't count the window that some in-memory compression assembles the
+ * dictionary and a block in.
+ *
+ * @param nMaxWindowSize maximum size of input data window (largest block size + history)
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_compressor_get_memory_size(const int nMaxWindowSize, const unsigned int nFlags, const int nLevel);
+
+/**
+ * Set how hard the binary tree and hash chain match finders search for each match
+ *
+ * @param pCompressor compression context
+ * @param nDepth maximum number of tree nodes or chain links visited per position, or 0 for the match finder's default
+ *                (this overrides the depth picked by lz4ultra_compressor_set_level())
+ */
+void lz4ultra_compressor_set_search_depth(lz4ultra_compressor *pCompressor, const int nDepth);
+
+/**
+ * Attach prepared dictionary to compression context, until it is reset
+ *
+ * Blocks whose previously compressed bytes are exactly the dictionary are then compressed without sorting the dictionary
+ * again, when suffix-sorting. The dictionary must outlive its use by the context.
+ *
+ * @param pCompressor compression context
+ * @param pDictionary prepared dictionary, or NULL for none
+ */
+void lz4ultra_compressor_set_dictionary(lz4ultra_compressor *pCompressor, const lz4ultra_prepared_dictionary_t *pDictionary);
+
+/**
+ * Split suffix sorting of each large window into tasks run concurrently with an executor
+ *
+ * This helps when there are more threads than blocks to compress at the same time, for instance for a single large
+ * block. One task runs on the calling thread, and the calling thread waits for the others, so the executor must have
+ * threads to spare for them: it must not be busy running the compression itself.
+ *
+ * @param pCompressor compression context
+ * @param nThreads number of tasks to split sorting into (1 to sort serially, at most MAX_SORT_THREADS)
+ * @param submit function to queue sorting tasks with the caller's executor, or NULL to sort serially
+ * @param pExecutor opaque executor pointer passed to submit
+ */
+void lz4ultra_compressor_set_sort_threads(lz4ultra_compressor *pCompressor, int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
+
+/**
+ * Make the parser minimize the compressed size plus the estimated decoding time, weighted by nDecodeCost, instead of
+ * using the --favor-decSpeed heuristics. The setting outlives lz4ultra_compressor_reset().
+ *
+ * For instance, with a weight of 16, the parser gives up one bit of output to save one decoder cycle. A weight of 0
+ * minimizes the compressed size only, according to LZ4ULTRA_FLAG_FAVOR_RATIO.
+ *
+ * @param pCompressor compression context
+ * @param nDecodeCost weight of one decoder cycle, in 1/16ths of a bit, or 0 to turn the cost model off
+ * @param pModel decoder cycle costs, or NULL for the default estimates
+ */
+void lz4ultra_compressor_set_decode_cost(lz4ultra_compressor *pCompressor, const int nDecodeCost, const lz4ultra_decode_cost_model_t *pModel);
+
+/**
+ * Enable or disable collecting statistics about each block, and accumulating them until the context is reset. The
+ * setting outlives lz4ultra_compressor_reset().
+ *
+ * Counting matches and measuring the time spent in each stage slow compression down a little, so statistics are off by default.
+ *
+ * @param pCompressor compression context
+ * @param nEnable 1 to collect statistics, 0 not to
+ */
+void lz4ultra_compressor_set_stats(lz4ultra_compressor *pCompressor, const int nEnable);
+
+/**
+ * Attach cache of compressed blocks to compression context. The setting outlives lz4ultra_compressor_reset().
+ *
+ * Before compressing a block, the context looks it up in the cache, by the contents of its window and the context's
+ * settings, and emits the cached compressed bytes if it is found. Blocks that are compressed are added to the cache.
+ * Only the suffix-array match finder uses the cache: the binary tree and hash chain match finders carry state from one
+ * block to the next, which the blocks found in the cache would skip. The cache must outlive its use by the context.
+ *
+ * @param pCompressor compression context
+ * @param pCache cache (see lz4ultra_block_cache_create()), or NULL for none
+ */
+void lz4ultra_compressor_set_block_cache(lz4ultra_compressor *pCompressor, lz4ultra_block_cache_t *pCache);
+
+/**
+ * Get the cache of compressed blocks attached to a compression context
+ *
+ * @param pCompressor compression context
+ *
+ * @return cache, or NULL for none
+ */
+lz4ultra_block_cache_t *lz4ultra_compressor_get_block_cache(lz4ultra_compressor *pCompressor);
+
+/**
+ * Get a window of the context's maximum size, for assembling the dictionary and a block to compress after it, when they
+ * are not next to each other in memory
+ *
+ * The window is allocated the first time it is needed, and is not available for arena-backed contexts.
+ *
+ * @param pCompressor compression context
+ *
+ * @return window, or NULL for failure
+ */
+unsigned char *lz4ultra_compressor_get_dictionary_window(lz4ultra_compressor *pCompressor);
+
 /**
  * Compress one block of data
  *
@@ -99,6 +357,23 @@ void lz4ultra_compressor_destroy(lz4ultra_compressor *pCompressor);
  */
 int lz4ultra_compressor_shrink_block(lz4ultra_compressor *pCompressor, const unsigned char *pInWindow, const int nPreviousBlockSize, const int nInDataSize, unsigned char *pOutData, const int nMaxOutDataSize);
 
+/**
+ * Account for a block that the caller stores uncompressed without handing it to lz4ultra_compressor_shrink_block(),
+ * because it already knows that the block is incompressible
+ *
+ * @param pCompressor compression context
+ * @param nInDataSize number of input bytes in the block
+ */
+void lz4ultra_compressor_skip_block(lz4ultra_compressor *pCompressor, const int nInDataSize);
+
+/**
+ * Forget the match finder window carried over from the last block, so that the next block is compressed from the bytes in
+ * front of it only, and comes out the same whichever context compressed the blocks before it
+ *
+ * @param pCompressor compression context
+ */
+void lz4ultra_compressor_reset_window(lz4ultra_compressor *pCompressor);
+
 /**
  * Get the number of compression commands issued in compressed data blocks
  *
@@ -106,4 +381,30 @@ int lz4ultra_compressor_shrink_block(lz4ultra_compressor *pCompressor, const uns
  */
 int lz4ultra_compressor_get_command_count(lz4ultra_compressor *pCompressor);
 
+/**
+ * Get the number of blocks that were found to be incompressible before running the match finder on them, and were
+ * left to be stored uncompressed
+ *
+ * @return number of blocks
+ */
+int lz4ultra_compressor_get_skipped_block_count(lz4ultra_compressor *pCompressor);
+
+/**
+ * Get the statistics of the last block compressed, when statistics are enabled
+ *
+ * @param pCompressor compression context
+ *
+ * @return statistics of the last block
+ */
+const lz4ultra_stats_t *lz4ultra_compressor_get_block_stats(lz4ultra_compressor *pCompressor);
+
+/**
+ * Get the statistics accumulated over all the blocks compressed since the context was last reset, when statistics are enabled
+ *
+ * @param pCompressor compression context
+ *
+ * @return accumulated statistics
+ */
+const lz4ultra_stats_t *lz4ultra_compressor_get_stats(lz4ultra_compressor *pCompressor);
+
 #endif /* _SHRINK_CONTEXT_H */
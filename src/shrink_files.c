@@ -0,0 +1,295 @@
+/*
+ * shrink_files.c - file batch compression implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shrink_files.h"
+#include "shrink_context.h"
+#include "shrink_streaming.h"
+#include "format.h"
+#include "lib.h"
+#include "threadpool.h"
+
+/** Shared state of one file batch compression call */
+typedef struct _lz4ultra_files_t {
+   lz4ultra_mutex_t lock;
+   lz4ultra_cond_t cond;
+   lz4ultra_file_item_t **ppOrder;
+   int nNumItems;
+   int nNextItem;
+   int nNumFailed;
+   int nActiveWorkers;
+   const lz4ultra_prepared_dictionary_t *pDictionary;
+   unsigned int nFlags;
+   int nBlockMaxCode;
+   int nLevel;
+   int nDecodeCost;
+   void(*progress)(const lz4ultra_file_item_t *pItem);
+} lz4ultra_files_t;
+
+/** One worker, compressing files with its own context until the batch runs out */
+typedef struct _lz4ultra_files_worker_t {
+   lz4ultra_files_t *pFiles;
+   lz4ultra_compressor *pCompressor;
+   lz4ultra_stats_t stats;
+   int nCollectStats;
+} lz4ultra_files_worker_t;
+
+/**
+ * Compare two files of the batch, for sorting them from the largest to the smallest
+ *
+ * @param pLeft pointer to first file (lz4ultra_file_item_t *)
+ * @param pRight pointer to second file (lz4ultra_file_item_t *)
+ *
+ * @return comparison result, as expected by qsort()
+ */
+static int lz4ultra_files_compare_size(const void *pLeft, const void *pRight) {
+   const lz4ultra_file_item_t *pLeftItem = *(const lz4ultra_file_item_t * const *)pLeft;
+   const lz4ultra_file_item_t *pRightItem = *(const lz4ultra_file_item_t * const *)pRight;
+
+   if (pLeftItem->nInputSize > pRightItem->nInputSize)
+      return -1;
+   else if (pLeftItem->nInputSize < pRightItem->nInputSize)
+      return 1;
+   else
+      return (pLeftItem < pRightItem) ? -1 : ((pLeftItem > pRightItem) ? 1 : 0);
+}
+
+/**
+ * Compress one file of the batch with a worker's context
+ *
+ * @param pWorker worker compressing this file
+ * @param pItem file to compress
+ * @param nThreads number of blocks of this file to compress concurrently
+ *
+ * @return 0 for success, -1 for error
+ */
+static int lz4ultra_files_compress_one(lz4ultra_files_worker_t *pWorker, lz4ultra_file_item_t *pItem, int nThreads) {
+   lz4ultra_files_t *pFiles = pWorker->pFiles;
+   lz4ultra_stats_t stats;
+   int nCommandCount = 0;
+
+   pItem->nOriginalSize = 0;
+   pItem->nCompressedSize = 0;
+   pItem->nStatus = lz4ultra_compress_file_with_context(pWorker->pCompressor, pItem->pszInFilename, pItem->pszOutFilename, pFiles->pDictionary, pFiles->nFlags,
+                                                        pFiles->nBlockMaxCode, pFiles->nLevel, pFiles->nDecodeCost, nThreads,
+                                                        &pItem->nOriginalSize, &pItem->nCompressedSize, &nCommandCount, pWorker->nCollectStats ? &stats : NULL);
+   if (pItem->nStatus == LZ4ULTRA_OK && pWorker->nCollectStats)
+      lz4ultra_stats_add(&pWorker->stats, &stats);
+
+   if (pFiles->progress)
+      pFiles->progress(pItem);
+
+   return (pItem->nStatus == LZ4ULTRA_OK) ? 0 : -1;
+}
+
+/**
+ * Compress files of the batch, one at a time, until there are none left
+ *
+ * @param pTaskArg worker (lz4ultra_files_worker_t)
+ */
+static void lz4ultra_compress_files_worker(void *pTaskArg) {
+   lz4ultra_files_worker_t *pWorker = (lz4ultra_files_worker_t *)pTaskArg;
+   lz4ultra_files_t *pFiles = pWorker->pFiles;
+   int nNumFailed = 0;
+
+   do {
+      int nItem;
+
+      lz4ultra_mutex_lock(&pFiles->lock);
+      nItem = pFiles->nNextItem;
+      if (nItem < pFiles->nNumItems)
+         pFiles->nNextItem++;
+      lz4ultra_mutex_unlock(&pFiles->lock);
+
+      if (nItem >= pFiles->nNumItems)
+         break;
+
+      if (lz4ultra_files_compress_one(pWorker, pFiles->ppOrder[nItem], 1) != 0)
+         nNumFailed++;
+   } while (1);
+
+   lz4ultra_mutex_lock(&pFiles->lock);
+   pFiles->nNumFailed += nNumFailed;
+   pFiles->nActiveWorkers--;
+   lz4ultra_cond_broadcast(&pFiles->cond);
+   lz4ultra_mutex_unlock(&pFiles->lock);
+}
+
+/**
+ * Compress many files in one call
+ *
+ * @param pItems files to compress; nStatus, nOriginalSize and nCompressedSize are set for each of them
+ * @param nNumItems number of files
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()) for all files, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of threads to compress with
+ * @param pBlockCache cache of compressed blocks shared by all the files and threads (see lz4ultra_block_cache_create()), or NULL for none
+ * @param progress function called after compressing each file, from the thread that compressed it, or NULL for none
+ * @param pStats pointer to returned compression statistics for all the files that were compressed successfully, or NULL not to collect them
+ *
+ * @return number of files that failed to compress (0 for success), or -1 if the batch couldn't be started
+ */
+int lz4ultra_compress_files(lz4ultra_file_item_t *pItems, int nNumItems, const lz4ultra_prepared_dictionary_t *pDictionary, unsigned int nFlags, int nBlockMaxCode,
+                            int nLevel, int nDecodeCost, int nThreads, lz4ultra_block_cache_t *pBlockCache, void(*progress)(const lz4ultra_file_item_t *pItem), lz4ultra_stats_t *pStats) {
+   lz4ultra_files_t files;
+   lz4ultra_files_worker_t *pWorkers;
+   lz4ultra_thread_pool_t pool;
+   long long nSplitSize;
+   int nNumWorkers = 0;
+   int nNumSplit = 0;
+   int nError = 0;
+   int i;
+
+   if (pStats)
+      memset(pStats, 0, sizeof(lz4ultra_stats_t));
+   if (nNumItems <= 0)
+      return 0;
+   if (nThreads < 1)
+      nThreads = 1;
+   if (nBlockMaxCode < 4 || nBlockMaxCode > 7)
+      nBlockMaxCode = 7;
+
+   /* Raw blocks are a single block, and can't be split; a file is otherwise worth splitting if it has a block for each thread */
+   if (nThreads > 1 && (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0)
+      nSplitSize = (long long)nThreads << (8 + (nBlockMaxCode << 1));
+   else
+      nSplitSize = -1;
+
+   files.ppOrder = (lz4ultra_file_item_t **)malloc(nNumItems * sizeof(lz4ultra_file_item_t *));
+   if (!files.ppOrder)
+      return -1;
+   for (i = 0; i < nNumItems; i++) {
+      pItems[i].nStatus = LZ4ULTRA_OK;
+      pItems[i].nOriginalSize = 0;
+      pItems[i].nCompressedSize = 0;
+      files.ppOrder[i] = &pItems[i];
+   }
+   qsort(files.ppOrder, nNumItems, sizeof(lz4ultra_file_item_t *), lz4ultra_files_compare_size);
+
+   if (nSplitSize > 0) {
+      while (nNumSplit < nNumItems && files.ppOrder[nNumSplit]->nInputSize >= nSplitSize)
+         nNumSplit++;
+   }
+
+   /* Only start as many workers as there are files left for them once the split files are done */
+   if (nThreads > nNumItems - nNumSplit)
+      nThreads = (nNumItems - nNumSplit) > 0 ? (nNumItems - nNumSplit) : 1;
+
+   files.nNumItems = nNumItems;
+   files.nNextItem = nNumSplit;
+   files.nNumFailed = 0;
+   files.nActiveWorkers = 0;
+   files.pDictionary = pDictionary;
+   files.nFlags = nFlags;
+   files.nBlockMaxCode = nBlockMaxCode;
+   files.nLevel = nLevel;
+   files.nDecodeCost = nDecodeCost;
+   files.progress = progress;
+
+   pWorkers = (lz4ultra_files_worker_t *)malloc(nThreads * sizeof(lz4ultra_files_worker_t));
+   if (!pWorkers) {
+      free(files.ppOrder);
+      return -1;
+   }
+
+   for (i = 0; i < nThreads; i++) {
+      /* Contexts are allocated for the block size of the first file they compress, and grow on their own after that */
+      pWorkers[i].pFiles = &files;
+      pWorkers[i].nCollectStats = pStats ? 1 : 0;
+      memset(&pWorkers[i].stats, 0, sizeof(lz4ultra_stats_t));
+      pWorkers[i].pCompressor = lz4ultra_compressor_create(0, nFlags, NULL, 0);
+      if (!pWorkers[i].pCompressor) {
+         nError = LZ4ULTRA_ERROR_MEMORY;
+         break;
+      }
+      lz4ultra_compressor_set_block_cache(pWorkers[i].pCompressor, pBlockCache);
+      nNumWorkers++;
+   }
+
+   pool.threads = NULL;
+   if (!nError && nNumWorkers > 1) {
+      if (lz4ultra_thread_pool_init(&pool, nNumWorkers) != 0)
+         nError = LZ4ULTRA_ERROR_MEMORY;
+   }
+
+   if (!nError) {
+      /* Large files first, each using all the threads for its blocks, with the first worker's context */
+      for (i = 0; i < nNumSplit; i++) {
+         if (lz4ultra_files_compress_one(&pWorkers[0], files.ppOrder[i], (int)(nSplitSize >> (8 + (nBlockMaxCode << 1)))) != 0)
+            files.nNumFailed++;
+      }
+
+      lz4ultra_mutex_init(&files.lock);
+      lz4ultra_cond_init(&files.cond);
+
+      if (nNumWorkers == 1) {
+         /* Nothing to parallelize */
+         files.nActiveWorkers = 1;
+         lz4ultra_compress_files_worker(&pWorkers[0]);
+      }
+      else {
+         files.nActiveWorkers = nNumWorkers;
+         for (i = 0; i < nNumWorkers; i++) {
+            if (lz4ultra_thread_pool_submit(&pool, lz4ultra_compress_files_worker, &pWorkers[i]) != 0)
+               lz4ultra_compress_files_worker(&pWorkers[i]);
+         }
+      }
+
+      lz4ultra_mutex_lock(&files.lock);
+      while (files.nActiveWorkers)
+         lz4ultra_cond_wait(&files.cond, &files.lock);
+      lz4ultra_mutex_unlock(&files.lock);
+
+      lz4ultra_cond_destroy(&files.cond);
+      lz4ultra_mutex_destroy(&files.lock);
+   }
+
+   if (pool.threads)
+      lz4ultra_thread_pool_destroy(&pool);
+
+   for (i = 0; i < nNumWorkers; i++) {
+      if (pStats)
+         lz4ultra_stats_add(pStats, &pWorkers[i].stats);
+      lz4ultra_compressor_free(pWorkers[i].pCompressor);
+   }
+   free(pWorkers);
+   free(files.ppOrder);
+
+   if (nError)
+      return -1;
+   else
+      return files.nNumFailed;
+}
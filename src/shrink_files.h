@@ -0,0 +1,65 @@
+/*
+ * shrink_files.h - file batch compression definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _SHRINK_FILES_H
+#define _SHRINK_FILES_H
+
+#include "lz4ultra.h"
+
+/**
+ * Compress many files in one call
+ *
+ * Each file is compressed exactly as lz4ultra_compress_file_with_context() would, to its own output file. Files are
+ * scheduled from the largest to the smallest, so that a large file isn't picked up last and left to finish alone.
+ * Files that are large enough to keep all the threads busy with their own blocks, nThreads times the maximum block
+ * size or more, are compressed first, one at a time and block-parallel. The other files are then spread over a pool
+ * of nThreads workers, each with a compression context that is created once and reused from one file to the next,
+ * and each compressing its current file serially.
+ *
+ * @param pItems files to compress; nStatus, nOriginalSize and nCompressedSize are set for each of them
+ * @param nNumItems number of files
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()) for all files, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of threads to compress with
+ * @param pBlockCache cache of compressed blocks shared by all the files and threads (see lz4ultra_block_cache_create()), or NULL for none
+ * @param progress function called after compressing each file, from the thread that compressed it, or NULL for none
+ * @param pStats pointer to returned compression statistics for all the files that were compressed successfully, or NULL not to collect them
+ *
+ * @return number of files that failed to compress (0 for success), or -1 if the batch couldn't be started
+ */
+int lz4ultra_compress_files(lz4ultra_file_item_t *pItems, int nNumItems, const lz4ultra_prepared_dictionary_t *pDictionary, unsigned int nFlags, int nBlockMaxCode,
+   int nLevel, int nDecodeCost, int nThreads, lz4ultra_block_cache_t *pBlockCache, void(*progress)(const lz4ultra_file_item_t *pItem), lz4ultra_stats_t *pStats);
+
+#endif /* _SHRINK_FILES_H */
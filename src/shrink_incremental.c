@@ -0,0 +1,464 @@
+/*
+ * shrink_incremental.c - incremental compression implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shrink_incremental.h"
+#include "shrink_context.h"
+#include "format.h"
+#include "frame.h"
+#include "lib.h"
+
+/**
+ * Initialize incremental compression context, without allocating anything yet
+ *
+ * @param pCtx context to initialize
+ */
+void lz4ultra_incremental_compressor_init(lz4ultra_incremental_compressor_t *pCtx) {
+   memset(pCtx, 0, sizeof(lz4ultra_incremental_compressor_t));
+   pCtx->nFinished = 1;
+}
+
+/**
+ * Free incremental compression context buffers
+ *
+ * @param pCtx context
+ */
+void lz4ultra_incremental_compressor_destroy(lz4ultra_incremental_compressor_t *pCtx) {
+   if (pCtx->pCompressor) {
+      lz4ultra_compressor_free(pCtx->pCompressor);
+      pCtx->pCompressor = NULL;
+   }
+
+   if (pCtx->pInWindow) {
+      free(pCtx->pInWindow);
+      pCtx->pInWindow = NULL;
+   }
+
+   pCtx->nWindowSize = 0;
+}
+
+/**
+ * Create incremental compression context, without allocating anything else yet
+ *
+ * @return context, to be freed with lz4ultra_incremental_compressor_free(), or NULL for failure
+ */
+lz4ultra_incremental_compressor_t *lz4ultra_incremental_compressor_create(void) {
+   lz4ultra_incremental_compressor_t *pCtx = (lz4ultra_incremental_compressor_t *)malloc(sizeof(lz4ultra_incremental_compressor_t));
+
+   if (pCtx)
+      lz4ultra_incremental_compressor_init(pCtx);
+   return pCtx;
+}
+
+/**
+ * Free incremental compression context and its buffers
+ *
+ * @param pCtx context, or NULL
+ */
+void lz4ultra_incremental_compressor_free(lz4ultra_incremental_compressor_t *pCtx) {
+   if (pCtx) {
+      lz4ultra_incremental_compressor_destroy(pCtx);
+      free(pCtx);
+   }
+}
+
+/**
+ * Get the output span size that lets one more block, or the end of the frame, be written out in one call
+ *
+ * @param pCtx context, after lz4ultra_compress_begin()
+ *
+ * @return output size in bytes
+ */
+size_t lz4ultra_compress_get_max_output_size(const lz4ultra_incremental_compressor_t *pCtx) {
+   size_t nMaxBlockSize = LZ4ULTRA_FRAME_SIZE + (size_t)pCtx->nBlockMaxSize + ((pCtx->nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? LZ4ULTRA_BLOCK_CHECKSUM_SIZE : 0);
+
+   return nMaxBlockSize + LZ4ULTRA_FRAME_SIZE /* footer */ + ((pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? LZ4ULTRA_CONTENT_CHECKSUM_SIZE : 0);
+}
+
+/**
+ * Move the history and the input gathered so far for the next block into the context's window, if they are still in caller memory
+ *
+ * @param pCtx context
+ */
+static void lz4ultra_compress_keep_pending_data(lz4ultra_incremental_compressor_t *pCtx) {
+   if (!pCtx->nHistoryInWindow) {
+      if (pCtx->nPreviousBlockSize)
+         memcpy(pCtx->pInWindow + HISTORY_SIZE - pCtx->nPreviousBlockSize, pCtx->pBlockStart - pCtx->nPreviousBlockSize, pCtx->nPreviousBlockSize);
+      pCtx->nHistoryInWindow = 1;
+   }
+
+   if (!pCtx->nPendingInWindow) {
+      if (pCtx->nPendingInDataSize)
+         memcpy(pCtx->pInWindow + HISTORY_SIZE, pCtx->pBlockStart, pCtx->nPendingInDataSize);
+      pCtx->nPendingInWindow = 1;
+   }
+}
+
+/**
+ * Compress one block and write it out, with its frame header and checksum
+ *
+ * @param pCtx context
+ * @param pInWindow pointer to history, immediately followed by the block data
+ * @param nInDataSize size of block data, in bytes
+ * @param pOutData output buffer, with room for the largest possible block
+ * @param pOutDataSize pointer to returned number of bytes written
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_compress_write_block(lz4ultra_incremental_compressor_t *pCtx, const unsigned char *pInWindow, const int nInDataSize,
+                                                       unsigned char *pOutData, size_t *pOutDataSize) {
+   const unsigned char *pInData = pInWindow + pCtx->nPreviousBlockSize;
+   int nMaxOutDataSize = (nInDataSize >= pCtx->nBlockMaxSize) ? pCtx->nBlockMaxSize : nInDataSize;
+   int nFrameHeaderSize;
+   int nChecksumSize;
+   int nOutDataSize;
+
+   nOutDataSize = lz4ultra_compressor_shrink_block(pCtx->pCompressor, pInWindow, pCtx->nPreviousBlockSize, nInDataSize, pOutData + LZ4ULTRA_FRAME_SIZE, nMaxOutDataSize);
+   if (nOutDataSize >= 0) {
+      /* Compressed block */
+      nFrameHeaderSize = lz4ultra_encode_compressed_block_frame(pOutData, LZ4ULTRA_FRAME_SIZE, pCtx->nFlags, nOutDataSize);
+   }
+   else {
+      /* Uncompressible, literal block */
+      nFrameHeaderSize = lz4ultra_encode_uncompressed_block_frame(pOutData, LZ4ULTRA_FRAME_SIZE, pCtx->nFlags, nInDataSize);
+      memcpy(pOutData + LZ4ULTRA_FRAME_SIZE, pInData, nInDataSize);
+      nOutDataSize = nInDataSize;
+   }
+   if (nFrameHeaderSize < 0)
+      return LZ4ULTRA_ERROR_COMPRESSION;
+
+   nChecksumSize = lz4ultra_encode_block_checksum(pOutData + nFrameHeaderSize + nOutDataSize, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, pCtx->nFlags, pOutData + nFrameHeaderSize, nOutDataSize);
+   if (nChecksumSize < 0)
+      return LZ4ULTRA_ERROR_COMPRESSION;
+
+   if (pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+      XXH32_update(&pCtx->contentChecksum, pInData, nInDataSize);
+
+   if (!(pCtx->nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS)) {
+      pCtx->nPreviousBlockSize = nInDataSize;
+      if (pCtx->nPreviousBlockSize > HISTORY_SIZE)
+         pCtx->nPreviousBlockSize = HISTORY_SIZE;
+   }
+   else {
+      pCtx->nPreviousBlockSize = 0;
+   }
+
+   *pOutDataSize = (size_t)(nFrameHeaderSize + nOutDataSize + nChecksumSize);
+   pCtx->nOriginalSize += (long long)nInDataSize;
+   pCtx->nCompressedSize += (long long)(*pOutDataSize);
+   pCtx->nNumBlocks++;
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Start compressing a new frame, and write its header
+ *
+ * This is the only call that allocates memory: the context keeps its buffers from one frame to the next, and only
+ * grows them when a larger block size is used.
+ *
+ * @param pCtx context
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx; raw blocks aren't supported)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nContentSize total size of the input data, or -1 if unknown; required for LZ4ULTRA_FLAG_CONTENT_SIZE, and used to pick a smaller block size for small inputs
+ * @param pOutData output(compressed) span to write the header to, at least LZ4ULTRA_MAX_HEADER_SIZE bytes
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_begin(lz4ultra_incremental_compressor_t *pCtx, unsigned int nFlags, int nBlockMaxCode, int nLevel, long long nContentSize,
+                                          unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced) {
+   int nBlockMaxBits;
+   int nWindowSize;
+   int nHeaderSize;
+
+   *pOutProduced = 0;
+   pCtx->nFinished = 1;
+
+   if (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK)
+      return LZ4ULTRA_ERROR_COMPRESSION;
+
+   if (nContentSize < 0)
+      nFlags &= ~LZ4ULTRA_FLAG_CONTENT_SIZE;
+
+   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) {
+      nBlockMaxBits = 23;
+      nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
+   }
+   else {
+      nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+
+      if (nContentSize >= 0 && nContentSize < (1LL << nBlockMaxBits)) {
+         /* If the entire input data is shorter than the specified block size, use the smallest block size that fits it */
+         while (nBlockMaxCode > 4 && (1LL << (8 + ((nBlockMaxCode - 1) << 1))) > nContentSize)
+            nBlockMaxCode--;
+         nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+      }
+   }
+
+   nWindowSize = HISTORY_SIZE + (1 << nBlockMaxBits);
+   if (nWindowSize > pCtx->nWindowSize) {
+      if (pCtx->pInWindow)
+         free(pCtx->pInWindow);
+      pCtx->nWindowSize = 0;
+
+      pCtx->pInWindow = (unsigned char*)malloc(nWindowSize);
+      if (!pCtx->pInWindow)
+         return LZ4ULTRA_ERROR_MEMORY;
+      pCtx->nWindowSize = nWindowSize;
+   }
+
+   if (!pCtx->pCompressor) {
+      pCtx->pCompressor = lz4ultra_compressor_create(nWindowSize, nFlags, NULL, 0);
+      if (!pCtx->pCompressor)
+         return LZ4ULTRA_ERROR_MEMORY;
+   }
+   else {
+      if (lz4ultra_compressor_reset(pCtx->pCompressor, nWindowSize, nFlags) != 0)
+         return LZ4ULTRA_ERROR_MEMORY;
+   }
+   lz4ultra_compressor_set_level(pCtx->pCompressor, nLevel);
+
+   nHeaderSize = lz4ultra_encode_header(pOutData, (nOutDataSize < LZ4ULTRA_MAX_HEADER_SIZE) ? (int)nOutDataSize : LZ4ULTRA_MAX_HEADER_SIZE, nFlags, nBlockMaxCode,
+                                        (nContentSize >= 0) ? (unsigned long long)nContentSize : 0ULL);
+   if (nHeaderSize < 0)
+      return LZ4ULTRA_ERROR_DST;
+
+   pCtx->nFlags = nFlags;
+   pCtx->nBlockMaxSize = 1 << nBlockMaxBits;
+   pCtx->nPendingInDataSize = 0;
+   pCtx->nPendingInWindow = 0;
+   pCtx->nPreviousBlockSize = 0;
+   pCtx->nHistoryInWindow = 1;
+   pCtx->pBlockStart = NULL;
+   pCtx->pLastInData = NULL;
+   pCtx->nContentSize = nContentSize;
+   pCtx->nOriginalSize = 0;
+   pCtx->nCompressedSize = (long long)nHeaderSize;
+   pCtx->nNumBlocks = 0;
+   pCtx->nFinished = 0;
+   XXH32_reset(&pCtx->contentChecksum, 0);
+
+   *pOutProduced = (size_t)nHeaderSize;
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Compress more input
+ *
+ * All the input is consumed as long as the output span has room for the blocks it completes: a block is only compressed
+ * when lz4ultra_compress_get_max_output_size() bytes are left in the output span, and when there isn't, this returns with
+ * the rest of the input left unconsumed. Input that doesn't make up a full block is kept until the next call.
+ *
+ * @param pCtx context
+ * @param pInData input(source) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(compressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_update(lz4ultra_incremental_compressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                           unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced) {
+   const size_t nMaxOutputSize = lz4ultra_compress_get_max_output_size(pCtx);
+   const int nBlockMaxSize = pCtx->nBlockMaxSize;
+   size_t nInConsumed = 0, nOutProduced = 0;
+   lz4ultra_status_t nStatus = LZ4ULTRA_OK;
+
+   *pInConsumed = 0;
+   *pOutProduced = 0;
+   if (pCtx->nFinished)
+      return LZ4ULTRA_ERROR_COMPRESSION;
+
+   /* Input that was left in caller memory can only be used in place if this span carries on right after it */
+   if (!(pCtx->nFlags & LZ4ULTRA_FLAG_STABLE_INPUT) || pInData != pCtx->pLastInData)
+      lz4ultra_compress_keep_pending_data(pCtx);
+
+   while (!nStatus) {
+      size_t nInLeft = nInDataSize - nInConsumed;
+      size_t nBlockOutSize = 0;
+
+      if (pCtx->nPendingInWindow || (pCtx->nPreviousBlockSize && pCtx->nHistoryInWindow)) {
+         /* Put the block together in the window, right after its history */
+         int nCopySize = nBlockMaxSize - pCtx->nPendingInDataSize;
+         if ((size_t)nCopySize > nInLeft)
+            nCopySize = (int)nInLeft;
+
+         if (!pCtx->nPendingInWindow) {
+            lz4ultra_compress_keep_pending_data(pCtx);
+         }
+         if (nCopySize) {
+            memcpy(pCtx->pInWindow + HISTORY_SIZE + pCtx->nPendingInDataSize, pInData + nInConsumed, nCopySize);
+            pCtx->nPendingInDataSize += nCopySize;
+            nInConsumed += nCopySize;
+         }
+
+         if (pCtx->nPendingInDataSize < nBlockMaxSize || (nOutDataSize - nOutProduced) < nMaxOutputSize)
+            break;
+
+         nStatus = lz4ultra_compress_write_block(pCtx, pCtx->pInWindow + HISTORY_SIZE - pCtx->nPreviousBlockSize, nBlockMaxSize, pOutData + nOutProduced, &nBlockOutSize);
+         nOutProduced += nBlockOutSize;
+
+         /* Keep the end of the block as history for the next one */
+         if (pCtx->nPreviousBlockSize)
+            memcpy(pCtx->pInWindow + HISTORY_SIZE - pCtx->nPreviousBlockSize, pCtx->pInWindow + HISTORY_SIZE + nBlockMaxSize - pCtx->nPreviousBlockSize, pCtx->nPreviousBlockSize);
+         pCtx->nHistoryInWindow = 1;
+         pCtx->nPendingInWindow = 0;
+         pCtx->nPendingInDataSize = 0;
+      }
+      else {
+         /* The history, if any, and the input gathered so far are right in front of the input: compress in place */
+         int nTakeSize = nBlockMaxSize - pCtx->nPendingInDataSize;
+         if ((size_t)nTakeSize > nInLeft)
+            nTakeSize = (int)nInLeft;
+
+         if (!pCtx->nPendingInDataSize)
+            pCtx->pBlockStart = pInData + nInConsumed;
+
+         if ((pCtx->nPendingInDataSize + nTakeSize) < nBlockMaxSize) {
+            if (pCtx->nFlags & LZ4ULTRA_FLAG_STABLE_INPUT) {
+               /* The caller keeps this input where it is, so it doesn't need to be copied */
+               pCtx->nPendingInDataSize += nTakeSize;
+               nInConsumed += nTakeSize;
+            }
+            else {
+               /* Keep the partial block until the next call */
+               lz4ultra_compress_keep_pending_data(pCtx);
+               memcpy(pCtx->pInWindow + HISTORY_SIZE + pCtx->nPendingInDataSize, pInData + nInConsumed, nTakeSize);
+               pCtx->nPendingInDataSize += nTakeSize;
+               nInConsumed += nTakeSize;
+            }
+            break;
+         }
+
+         if ((nOutDataSize - nOutProduced) < nMaxOutputSize)
+            break;
+         nInConsumed += nTakeSize;
+
+         nStatus = lz4ultra_compress_write_block(pCtx, pCtx->pBlockStart - pCtx->nPreviousBlockSize, nBlockMaxSize, pOutData + nOutProduced, &nBlockOutSize);
+         nOutProduced += nBlockOutSize;
+
+         pCtx->pBlockStart += nBlockMaxSize;
+         pCtx->nHistoryInWindow = 0;
+         pCtx->nPendingInDataSize = 0;
+      }
+   }
+
+   if (nStatus) {
+      pCtx->nFinished = 1;
+      return nStatus;
+   }
+
+   pCtx->pLastInData = pInData + nInConsumed;
+   if (!(pCtx->nFlags & LZ4ULTRA_FLAG_STABLE_INPUT)) {
+      /* This span goes back to the caller: save what is still needed from it */
+      lz4ultra_compress_keep_pending_data(pCtx);
+   }
+
+   *pInConsumed = nInConsumed;
+   *pOutProduced = nOutProduced;
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Compress the last, partial block if any, and write the end of the frame
+ *
+ * @param pCtx context
+ * @param pOutData output(compressed) span
+ * @param nOutDataSize size of output span, in bytes; if it is smaller than lz4ultra_compress_get_max_output_size(), this may fail with LZ4ULTRA_ERROR_DST and can be called again with more room
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ * @param pOriginalSize pointer to returned input(source) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_end(lz4ultra_incremental_compressor_t *pCtx, unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced,
+                                        long long *pOriginalSize, long long *pCompressedSize) {
+   size_t nOutProduced = 0;
+   size_t nNeededSize = 0;
+   int nFooterSize;
+
+   *pOutProduced = 0;
+   if (pCtx->nFinished)
+      return LZ4ULTRA_ERROR_COMPRESSION;
+
+   /* Check for room first, so that nothing is written if this needs to be called again */
+   if (pCtx->nPendingInDataSize)
+      nNeededSize += LZ4ULTRA_FRAME_SIZE + (size_t)pCtx->nPendingInDataSize + ((pCtx->nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? LZ4ULTRA_BLOCK_CHECKSUM_SIZE : 0);
+   if (!(pCtx->nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES))
+      nNeededSize += LZ4ULTRA_FRAME_SIZE + ((pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? LZ4ULTRA_CONTENT_CHECKSUM_SIZE : 0);
+   if (nOutDataSize < nNeededSize)
+      return LZ4ULTRA_ERROR_DST;
+
+   pCtx->nFinished = 1;
+
+   if (pCtx->nPendingInDataSize) {
+      const unsigned char *pInWindow;
+      size_t nBlockOutSize = 0;
+      lz4ultra_status_t nStatus;
+
+      if (!pCtx->nPendingInWindow && (!pCtx->nPreviousBlockSize || !pCtx->nHistoryInWindow)) {
+         pInWindow = pCtx->pBlockStart - pCtx->nPreviousBlockSize;
+      }
+      else {
+         lz4ultra_compress_keep_pending_data(pCtx);
+         pInWindow = pCtx->pInWindow + HISTORY_SIZE - pCtx->nPreviousBlockSize;
+      }
+
+      nStatus = lz4ultra_compress_write_block(pCtx, pInWindow, pCtx->nPendingInDataSize, pOutData, &nBlockOutSize);
+      if (nStatus)
+         return nStatus;
+      nOutProduced += nBlockOutSize;
+      pCtx->nPendingInDataSize = 0;
+   }
+
+   /* The header promised a size; don't produce a frame that contradicts it */
+   if ((pCtx->nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) && (pCtx->nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) == 0 && pCtx->nOriginalSize != pCtx->nContentSize)
+      return LZ4ULTRA_ERROR_SRC;
+
+   nFooterSize = lz4ultra_encode_footer_frame(pOutData + nOutProduced, LZ4ULTRA_FRAME_SIZE + LZ4ULTRA_CONTENT_CHECKSUM_SIZE, pCtx->nFlags, XXH32_digest(&pCtx->contentChecksum));
+   if (nFooterSize < 0)
+      return LZ4ULTRA_ERROR_COMPRESSION;
+   nOutProduced += nFooterSize;
+   pCtx->nCompressedSize += (long long)nFooterSize;
+
+   *pOutProduced = nOutProduced;
+   if (pOriginalSize)
+      *pOriginalSize = pCtx->nOriginalSize;
+   if (pCompressedSize)
+      *pCompressedSize = pCtx->nCompressedSize;
+   return LZ4ULTRA_OK;
+}
@@ -0,0 +1,167 @@
+/*
+ * shrink_incremental.h - incremental compression definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _SHRINK_INCREMENTAL_H
+#define _SHRINK_INCREMENTAL_H
+
+#include <stddef.h>
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
+/* Forward declarations */
+typedef enum _lz4ultra_status_t lz4ultra_status_t;
+typedef struct _lz4ultra_compressor lz4ultra_compressor;
+
+/**
+ * Incremental compression context, fed with caller-owned input spans and writing to caller-owned output spans
+ *
+ * Full blocks are compressed straight from the input span when the bytes in front of them in memory are their history:
+ * always with independent blocks, for the first block of a frame, and for each block that follows another one in the
+ * same span. Otherwise, and for blocks that straddle spans, the block is put together after a copy of its history.
+ * With LZ4ULTRA_FLAG_STABLE_INPUT, the caller keeps all the spans intact until the end of the frame, and spans that
+ * follow each other in memory are compressed in place across calls, without copying any input. Compressed blocks are
+ * always written straight to the output span.
+ */
+typedef struct _lz4ultra_incremental_compressor_t {
+   lz4ultra_compressor *pCompressor;
+   unsigned char *pInWindow;
+   int nWindowSize;
+   unsigned int nFlags;
+   int nLevel;
+   int nBlockMaxSize;
+   int nPendingInDataSize;
+   int nPendingInWindow;
+   int nPreviousBlockSize;
+   int nHistoryInWindow;
+   const unsigned char *pBlockStart;
+   const unsigned char *pLastInData;
+   long long nContentSize;
+   long long nOriginalSize;
+   long long nCompressedSize;
+   int nNumBlocks;
+   int nFinished;
+   XXH32_state_t contentChecksum;
+} lz4ultra_incremental_compressor_t;
+
+/**
+ * Initialize incremental compression context, without allocating anything yet
+ *
+ * @param pCtx context to initialize
+ */
+void lz4ultra_incremental_compressor_init(lz4ultra_incremental_compressor_t *pCtx);
+
+/**
+ * Free incremental compression context buffers
+ *
+ * @param pCtx context
+ */
+void lz4ultra_incremental_compressor_destroy(lz4ultra_incremental_compressor_t *pCtx);
+
+/**
+ * Create incremental compression context, without allocating anything else yet
+ *
+ * @return context, to be freed with lz4ultra_incremental_compressor_free(), or NULL for failure
+ */
+lz4ultra_incremental_compressor_t *lz4ultra_incremental_compressor_create(void);
+
+/**
+ * Free incremental compression context and its buffers
+ *
+ * @param pCtx context, or NULL
+ */
+void lz4ultra_incremental_compressor_free(lz4ultra_incremental_compressor_t *pCtx);
+
+/**
+ * Get the output span size that lets one more block, or the end of the frame, be written out in one call
+ *
+ * @param pCtx context, after lz4ultra_compress_begin()
+ *
+ * @return output size in bytes
+ */
+size_t lz4ultra_compress_get_max_output_size(const lz4ultra_incremental_compressor_t *pCtx);
+
+/**
+ * Start compressing a new frame, and write its header
+ *
+ * This is the only call that allocates memory: the context keeps its buffers from one frame to the next, and only
+ * grows them when a larger block size is used.
+ *
+ * @param pCtx context
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx; raw blocks aren't supported)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nContentSize total size of the input data, or -1 if unknown; required for LZ4ULTRA_FLAG_CONTENT_SIZE, and used to pick a smaller block size for small inputs
+ * @param pOutData output(compressed) span to write the header to, at least LZ4ULTRA_MAX_HEADER_SIZE bytes
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_begin(lz4ultra_incremental_compressor_t *pCtx, unsigned int nFlags, int nBlockMaxCode, int nLevel, long long nContentSize,
+                                          unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Compress more input
+ *
+ * All the input is consumed as long as the output span has room for the blocks it completes: a block is only compressed
+ * when lz4ultra_compress_get_max_output_size() bytes are left in the output span, and when there isn't, this returns with
+ * the rest of the input left unconsumed. Input that doesn't make up a full block is kept until the next call.
+ *
+ * @param pCtx context
+ * @param pInData input(source) span
+ * @param nInDataSize size of input span, in bytes
+ * @param pInConsumed pointer to returned number of input bytes consumed
+ * @param pOutData output(compressed) span
+ * @param nOutDataSize size of output span, in bytes
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_update(lz4ultra_incremental_compressor_t *pCtx, const unsigned char *pInData, size_t nInDataSize, size_t *pInConsumed,
+                                           unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced);
+
+/**
+ * Compress the last, partial block if any, and write the end of the frame
+ *
+ * @param pCtx context
+ * @param pOutData output(compressed) span
+ * @param nOutDataSize size of output span, in bytes; if it is smaller than lz4ultra_compress_get_max_output_size(), this may fail with LZ4ULTRA_ERROR_DST and can be called again with more room
+ * @param pOutProduced pointer to returned number of bytes written to the output span
+ * @param pOriginalSize pointer to returned input(source) size of the frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size of the frame, updated when this function is successful
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_end(lz4ultra_incremental_compressor_t *pCtx, unsigned char *pOutData, size_t nOutDataSize, size_t *pOutProduced,
+                                        long long *pOriginalSize, long long *pCompressedSize);
+
+#endif /* _SHRINK_INCREMENTAL_H */
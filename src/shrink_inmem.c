@@ -34,19 +34,24 @@
 #include <string.h>
 #include "shrink_inmem.h"
 #include "frame.h"
+#include "seek_table.h"
+#include "page_alloc.h"
 #include "format.h"
 #include "lib.h"
+#include "threadpool.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
 
 /**
- * Get maximum compressed size of input(source) data
+ * Get the block size to compress input(source) data with
  *
  * @param nInputSize input(source) size in bytes
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
- * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nBlockMaxCode pointer to maximum block size code (4..7 for 64 Kb..4 Mb), reduced if the whole input fits in a smaller block
  *
- * @return maximum compressed size
+ * @return number of bits of maximum block size
  */
-size_t lz4ultra_get_max_compressed_size_inmem(size_t nInputSize, unsigned int nFlags, int nBlockMaxCode) {
+static int lz4ultra_get_block_max_bits_inmem(size_t nInputSize, unsigned int nFlags, int *nBlockMaxCode) {
    int nBlockMaxBits;
    int nBlockMaxSize;
 
@@ -54,7 +59,7 @@ size_t lz4ultra_get_max_compressed_size_inmem(size_t nInputSize, unsigned int nF
       nBlockMaxBits = 23;
    }
    else {
-      nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+      nBlockMaxBits = 8 + ((*nBlockMaxCode) << 1);
    }
    nBlockMaxSize = 1 << nBlockMaxBits;
 
@@ -63,77 +68,104 @@ size_t lz4ultra_get_max_compressed_size_inmem(size_t nInputSize, unsigned int nF
        * block size until is the smallest one that can fit the data */
 
       do {
-         nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+         nBlockMaxBits = 8 + ((*nBlockMaxCode) << 1);
          nBlockMaxSize = 1 << nBlockMaxBits;
 
-         int nPrevBlockMaxBits = 8 + ((nBlockMaxCode - 1) << 1);
+         int nPrevBlockMaxBits = 8 + (((*nBlockMaxCode) - 1) << 1);
          int nPrevBlockMaxSize = 1 << nPrevBlockMaxBits;
-         if (nBlockMaxCode > 4 && nPrevBlockMaxSize > nInputSize) {
-            nBlockMaxCode--;
+         if ((*nBlockMaxCode) > 4 && nPrevBlockMaxSize > nInputSize) {
+            (*nBlockMaxCode)--;
          }
          else
             break;
       } while (1);
    }
 
-   return LZ4ULTRA_MAX_HEADER_SIZE + ((nInputSize + (nBlockMaxSize - 1)) >> nBlockMaxBits) * LZ4ULTRA_FRAME_SIZE + nInputSize + LZ4ULTRA_FRAME_SIZE /* footer */;
+   return nBlockMaxBits;
 }
 
 /**
- * Compress memory
+ * Get maximum compressed size of input(source) data
+ *
+ * @param nInputSize input(source) size in bytes
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ *
+ * @return maximum compressed size
+ */
+size_t lz4ultra_get_max_compressed_size_inmem(size_t nInputSize, unsigned int nFlags, int nBlockMaxCode) {
+   int nBlockMaxBits = lz4ultra_get_block_max_bits_inmem(nInputSize, nFlags, &nBlockMaxCode);
+   int nBlockMaxSize = 1 << nBlockMaxBits;
+
+   int nBlockOverhead = LZ4ULTRA_FRAME_SIZE + ((nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM) ? LZ4ULTRA_BLOCK_CHECKSUM_SIZE : 0);
+
+   size_t nNumBlocks = (nInputSize + (nBlockMaxSize - 1)) >> nBlockMaxBits;
+
+   return LZ4ULTRA_MAX_HEADER_SIZE + nNumBlocks * nBlockOverhead + nInputSize + LZ4ULTRA_FRAME_SIZE /* footer */ +
+      ((nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM) ? LZ4ULTRA_CONTENT_CHECKSUM_SIZE : 0) +
+      (lz4ultra_seek_table_enabled(nFlags) ? lz4ultra_get_seek_table_size(nNumBlocks) : 0);
+}
+
+/**
+ * Compress memory, using a long-lived compression context and optionally a prepared dictionary
  *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create(); it is reset and grown as needed
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param pDictionary prepared dictionary, or NULL for none; used instead of pDictionaryData and nDictionaryDataSize when set
  * @param pInputData pointer to input(source) data to compress
  * @param pOutBuffer buffer for compressed data
  * @param nInputSize input(source) size in bytes
  * @param nMaxOutBufferSize maximum capacity of compression buffer
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
  *
  * @return actual compressed size, or -1 for error
  */
-size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags, int nBlockMaxCode) {
-   lz4ultra_compressor compressor;
+static size_t lz4ultra_compress_inmem_data(lz4ultra_compressor *pCompressor, const void *pDictionaryData, int nDictionaryDataSize, const lz4ultra_prepared_dictionary_t *pDictionary,
+                                           const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags, int nBlockMaxCode, int nLevel) {
    size_t nOriginalSize = 0L;
    size_t nCompressedSize = 0L;
+   XXH32_state_t contentChecksum;
+   lz4ultra_seek_table_t seekTable;
    int nBlockMaxBits;
    int nBlockMaxSize;
    int nResult;
    int nError = 0;
 
-   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) {
-      nBlockMaxBits = 23;
+   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
       nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
-   }
-   else {
-      nBlockMaxBits = 8 + (nBlockMaxCode << 1);
-   }
+   nBlockMaxBits = lz4ultra_get_block_max_bits_inmem(nInputSize, nFlags, &nBlockMaxCode);
    nBlockMaxSize = 1 << nBlockMaxBits;
 
-   if (nInputSize < nBlockMaxSize && (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) == 0) {
-      /* If the entire input data is shorter than the specified block size, try to reduce the
-       * block size until is the smallest one that can fit the data */
-
-      do {
-         nBlockMaxBits = 8 + (nBlockMaxCode << 1);
-         nBlockMaxSize = 1 << nBlockMaxBits;
-
-         int nPrevBlockMaxBits = 8 + ((nBlockMaxCode - 1) << 1);
-         int nPrevBlockMaxSize = 1 << nPrevBlockMaxBits;
-         if (nBlockMaxCode > 4 && nPrevBlockMaxSize > nInputSize) {
-            nBlockMaxCode--;
-         }
-         else
-            break;
-      } while (1);
+   if (pDictionary) {
+      pDictionaryData = pDictionary->data;
+      nDictionaryDataSize = pDictionary->size;
+   }
+   else if (!pDictionaryData || nDictionaryDataSize <= 0) {
+      pDictionaryData = NULL;
+      nDictionaryDataSize = 0;
+   }
+   else if (nDictionaryDataSize > HISTORY_SIZE) {
+      /* Use the last HISTORY_SIZE bytes of the dictionary */
+      pDictionaryData = (const unsigned char *)pDictionaryData + nDictionaryDataSize - HISTORY_SIZE;
+      nDictionaryDataSize = HISTORY_SIZE;
    }
 
-   nResult = lz4ultra_compressor_init(&compressor, nBlockMaxSize + HISTORY_SIZE, nFlags);
+   nResult = lz4ultra_compressor_reset(pCompressor, nBlockMaxSize + HISTORY_SIZE, nFlags);
    if (nResult != 0) {
-      return LZ4ULTRA_ERROR_MEMORY;
+      return -1;
    }
+   lz4ultra_compressor_set_level(pCompressor, nLevel);
+   lz4ultra_compressor_set_dictionary(pCompressor, pDictionary);
+   XXH32_reset(&contentChecksum, 0);
+
+   if (lz4ultra_seek_table_init(&seekTable, lz4ultra_seek_table_enabled(nFlags) ? (int)((nInputSize + (nBlockMaxSize - 1)) >> nBlockMaxBits) : 0) != 0)
+      return -1;
 
    if ((nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0) {
-      int nHeaderSize = lz4ultra_encode_header(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, nBlockMaxCode);
+      int nHeaderSize = lz4ultra_encode_header(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, nBlockMaxCode, nInputSize);
       if (nHeaderSize < 0)
          nError = LZ4ULTRA_ERROR_COMPRESSION;
       else {
@@ -157,9 +189,29 @@ size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *p
             break;
          }
 
+         const unsigned char *pInWindow = pInputData + nOriginalSize - nPreviousBlockSize;
+
+         if (!nPreviousBlockSize && pDictionaryData) {
+            /* The input can't have the dictionary in front of it: assemble both in the context's window instead */
+            unsigned char *pDictionaryWindow = lz4ultra_compressor_get_dictionary_window(pCompressor);
+            if (!pDictionaryWindow) {
+               nError = LZ4ULTRA_ERROR_MEMORY;
+               break;
+            }
+
+            memcpy(pDictionaryWindow, pDictionaryData, nDictionaryDataSize);
+            memcpy(pDictionaryWindow + nDictionaryDataSize, pInputData + nOriginalSize, nInDataSize);
+            pInWindow = pDictionaryWindow;
+            nPreviousBlockSize = nDictionaryDataSize;
+         }
+
          int nOutDataSize;
          int nOutDataEnd = (int)(nMaxOutBufferSize - LZ4ULTRA_FRAME_SIZE - LZ4ULTRA_FRAME_SIZE /* footer */ - nCompressedSize);
          int nHeaderOffset = LZ4ULTRA_FRAME_SIZE;
+         size_t nBlockOffset = nCompressedSize;
+
+         if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM)
+            nOutDataEnd -= LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
 
          if ((nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) != 0) {
             nHeaderOffset = 0;
@@ -169,7 +221,7 @@ size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *p
          if (nOutDataEnd > nBlockMaxSize)
             nOutDataEnd = nBlockMaxSize;
 
-         nOutDataSize = lz4ultra_compressor_shrink_block(&compressor, pInputData + nOriginalSize - nPreviousBlockSize, nPreviousBlockSize, nInDataSize, pOutBuffer + nHeaderOffset + nCompressedSize, nOutDataEnd);
+         nOutDataSize = lz4ultra_compressor_shrink_block(pCompressor, pInWindow, nPreviousBlockSize, nInDataSize, pOutBuffer + nHeaderOffset + nCompressedSize, nOutDataEnd);
          if (nOutDataSize >= 0) {
             int nFrameHeaderSize = 0;
 
@@ -211,6 +263,22 @@ size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *p
             }
          }
 
+         if (!nError && (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0) {
+            /* Checksum the block data right after the frame header */
+            int nChecksumSize = lz4ultra_encode_block_checksum(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags,
+                                                               pOutBuffer + nBlockOffset + LZ4ULTRA_FRAME_SIZE, (int)(nCompressedSize - nBlockOffset - LZ4ULTRA_FRAME_SIZE));
+            if (nChecksumSize < 0)
+               nError = LZ4ULTRA_ERROR_COMPRESSION;
+            else
+               nCompressedSize += nChecksumSize;
+         }
+
+         if (!nError && lz4ultra_seek_table_enabled(nFlags) && lz4ultra_seek_table_add(&seekTable, (int)(nCompressedSize - nBlockOffset), nInDataSize) != 0)
+            nError = LZ4ULTRA_ERROR_MEMORY;
+
+         if (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM)
+            XXH32_update(&contentChecksum, pInputData + nOriginalSize - nInDataSize, nInDataSize);
+
          if (!(nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS)) {
             nPreviousBlockSize = nInDataSize;
             if (nPreviousBlockSize > HISTORY_SIZE)
@@ -230,7 +298,7 @@ size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *p
       nFooterSize = 0;
    }
    else {
-      nFooterSize = lz4ultra_encode_footer_frame(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags);
+      nFooterSize = lz4ultra_encode_footer_frame(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, XXH32_digest(&contentChecksum));
       if (nFooterSize < 0)
          nError = LZ4ULTRA_ERROR_COMPRESSION;
    }
@@ -239,8 +307,477 @@ size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *p
       nCompressedSize += nFooterSize;
    }
 
+   if (!nError && lz4ultra_seek_table_enabled(nFlags)) {
+      int nTableSize = lz4ultra_encode_seek_table(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, &seekTable);
+      if (nTableSize < 0)
+         nError = LZ4ULTRA_ERROR_COMPRESSION;
+      else
+         nCompressedSize += nTableSize;
+   }
+   lz4ultra_seek_table_destroy(&seekTable);
+
+   if (nError) {
+      return -1;
+   }
+   else {
+      return nCompressedSize;
+   }
+}
+
+/**
+ * Compress memory, using a long-lived compression context
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create(); it is reset and grown as needed
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t lz4ultra_compress_inmem_with_context(lz4ultra_compressor *pCompressor, const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize,
+                                            unsigned int nFlags, int nBlockMaxCode, int nLevel) {
+   return lz4ultra_compress_inmem_data(pCompressor, NULL, 0, NULL, pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nBlockMaxCode, nLevel);
+}
+
+/**
+ * Compress memory using a prepared dictionary, with a long-lived compression context
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create() without an arena; it is reset and grown as needed
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t lz4ultra_compress_inmem_with_dictionary(lz4ultra_compressor *pCompressor, const lz4ultra_prepared_dictionary_t *pDictionary, const unsigned char *pInputData, unsigned char *pOutBuffer,
+                                               size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags, int nBlockMaxCode, int nLevel) {
+   return lz4ultra_compress_inmem_data(pCompressor, NULL, 0, pDictionary, pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nBlockMaxCode, nLevel);
+}
+
+/**
+ * Compress memory
+ *
+ * The dictionary, if any, prefills the history of the first block (of each block, with LZ4ULTRA_FLAG_INDEP_BLOCKS).
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize,
+                               const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, int nBlockMaxCode, int nLevel) {
+   lz4ultra_compressor compressor;
+   size_t nCompressedSize;
+   int nBlockMaxBits;
+   int nResult;
+
+   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
+      nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
+   nBlockMaxBits = lz4ultra_get_block_max_bits_inmem(nInputSize, nFlags, &nBlockMaxCode);
+
+   nResult = lz4ultra_compressor_init(&compressor, (1 << nBlockMaxBits) + HISTORY_SIZE, nFlags);
+   if (nResult != 0) {
+      return LZ4ULTRA_ERROR_MEMORY;
+   }
+
+   nCompressedSize = lz4ultra_compress_inmem_data(&compressor, pDictionaryData, nDictionaryDataSize, NULL, pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nBlockMaxCode, nLevel);
 
    lz4ultra_compressor_destroy(&compressor);
+   return nCompressedSize;
+}
+
+/** Shared state of one parallel in-memory compression call */
+typedef struct _lz4ultra_inmem_parallel_t {
+   lz4ultra_mutex_t lock;
+   lz4ultra_cond_t cond;
+   lz4ultra_compressor *pCompressors;
+   lz4ultra_compressor **pFreeCompressors;
+   int nNumFreeCompressors;
+   int nInFlight;
+} lz4ultra_inmem_parallel_t;
+
+/** One block to compress into its own scratch slot */
+typedef struct _lz4ultra_inmem_block_job_t {
+   lz4ultra_inmem_parallel_t *pState;
+   const unsigned char *pInWindow;
+   int nPreviousBlockSize;
+   int nInDataSize;
+   unsigned char *pOutSlot;
+   int nMaxOutDataSize;
+   int nOutDataSize;
+   int nDone;
+} lz4ultra_inmem_block_job_t;
+
+/**
+ * Compress one block into its scratch slot, with an available compressor context; contexts whose buffers are placed
+ * on the NUMA node of the calling thread are preferred, then contexts that aren't placed yet
+ *
+ * @param pTaskArg block job (lz4ultra_inmem_block_job_t)
+ */
+static void lz4ultra_compress_inmem_block_job(void *pTaskArg) {
+   lz4ultra_inmem_block_job_t *pJob = (lz4ultra_inmem_block_job_t *)pTaskArg;
+   lz4ultra_inmem_parallel_t *pState = pJob->pState;
+   lz4ultra_compressor *pCompressor;
+   int nNode = (pState->pCompressors[0].huge_pages) ? lz4ultra_get_numa_node() : -1;
+   int nPick;
+
+   lz4ultra_mutex_lock(&pState->lock);
+   nPick = pState->nNumFreeCompressors - 1;
+   if (nNode >= 0) {
+      int i;
+
+      for (i = 0; i < pState->nNumFreeCompressors; i++) {
+         int nFreeNode = pState->pFreeCompressors[i]->numa_node;
+
+         if (nFreeNode == nNode) {
+            nPick = i;
+            break;
+         }
+         if (nFreeNode < 0 && pState->pFreeCompressors[nPick]->numa_node >= 0)
+            nPick = i;
+      }
+   }
+   pCompressor = pState->pFreeCompressors[nPick];
+   pState->pFreeCompressors[nPick] = pState->pFreeCompressors[--pState->nNumFreeCompressors];
+   lz4ultra_mutex_unlock(&pState->lock);
+
+   lz4ultra_compressor_bind_local(pCompressor);
+
+   /* Any free context can get any block: don't carry a window over from the block it compressed last, if that happens to
+    * be the previous one, so that the output doesn't depend on the order that the blocks were picked up in */
+   lz4ultra_compressor_reset_window(pCompressor);
+   pJob->nOutDataSize = lz4ultra_compressor_shrink_block(pCompressor, pJob->pInWindow, pJob->nPreviousBlockSize, pJob->nInDataSize, pJob->pOutSlot, pJob->nMaxOutDataSize);
+
+   lz4ultra_mutex_lock(&pState->lock);
+   pState->pFreeCompressors[pState->nNumFreeCompressors++] = pCompressor;
+   pState->nInFlight--;
+   pJob->nDone = 1;
+   lz4ultra_cond_broadcast(&pState->cond);
+   lz4ultra_mutex_unlock(&pState->lock);
+}
+
+/**
+ * Submit task to the internal thread pool
+ *
+ * @param pExecutor thread pool (lz4ultra_thread_pool_t)
+ * @param task task function
+ * @param pTaskArg argument passed to task function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_submit_to_thread_pool(void *pExecutor, lz4ultra_task_fn task, void *pTaskArg) {
+   return lz4ultra_thread_pool_submit((lz4ultra_thread_pool_t *)pExecutor, task, pTaskArg);
+}
+
+/**
+ * Compress memory that fits in a single block, splitting suffix sorting of the block over several threads
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads number of sorting tasks
+ * @param submit function to queue sorting tasks with the caller's executor, or NULL to use an internal pool of nThreads - 1 threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return actual compressed size, or -1 for error
+ */
+static size_t lz4ultra_compress_inmem_sort_parallel(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags,
+                                                    int nBlockMaxCode, int nLevel, int nThreads, lz4ultra_submit_fn submit, void *pExecutor) {
+   lz4ultra_compressor compressor;
+   lz4ultra_thread_pool_t pool;
+   size_t nCompressedSize;
+   int nBlockMaxBits;
+
+   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
+      nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
+   nBlockMaxBits = lz4ultra_get_block_max_bits_inmem(nInputSize, nFlags, &nBlockMaxCode);
+
+   pool.threads = NULL;
+   if (!submit) {
+      /* The calling thread sorts its own share */
+      if (lz4ultra_thread_pool_init(&pool, nThreads - 1) != 0)
+         return -1;
+      submit = lz4ultra_submit_to_thread_pool;
+      pExecutor = &pool;
+   }
+
+   if (lz4ultra_compressor_init(&compressor, (1 << nBlockMaxBits) + HISTORY_SIZE, nFlags) != 0) {
+      if (pool.threads)
+         lz4ultra_thread_pool_destroy(&pool);
+      return -1;
+   }
+
+   lz4ultra_compressor_set_sort_threads(&compressor, nThreads, submit, pExecutor);
+   nCompressedSize = lz4ultra_compress_inmem_with_context(&compressor, pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nBlockMaxCode, nLevel);
+
+   lz4ultra_compressor_destroy(&compressor);
+   if (pool.threads)
+      lz4ultra_thread_pool_destroy(&pool);
+   return nCompressedSize;
+}
+
+/**
+ * Compress memory, compressing several blocks concurrently
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads maximum number of blocks compressed at the same time (one compressor context is allocated for each)
+ * @param submit function to queue block compression tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t lz4ultra_compress_inmem_parallel(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags,
+                                        int nBlockMaxCode, int nLevel, int nThreads, lz4ultra_submit_fn submit, void *pExecutor) {
+   lz4ultra_inmem_parallel_t state;
+   lz4ultra_inmem_block_job_t *pJobs;
+   unsigned char *pOutSlots;
+   lz4ultra_thread_pool_t pool;
+   lz4ultra_seek_table_t seekTable;
+   XXH32_state_t contentChecksum;
+   size_t nOriginalSize = 0L;
+   size_t nCompressedSize = 0L;
+   size_t nNumBlocks;
+   size_t nSubmittedBlocks = 0, nWrittenBlocks = 0;
+   int nBlockMaxBits;
+   int nBlockMaxSize;
+   int nNumSlots;
+   int nNumCompressors = 0;
+   int nError = 0;
+   int i;
+
+   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES)
+      nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
+   nBlockMaxBits = lz4ultra_get_block_max_bits_inmem(nInputSize, nFlags, &nBlockMaxCode);
+   nBlockMaxSize = 1 << nBlockMaxBits;
+   nNumBlocks = (nInputSize + (nBlockMaxSize - 1)) >> nBlockMaxBits;
+
+   if (nThreads > 1 && (nNumBlocks <= 1 || (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) != 0)) {
+      /* A single block: suffix-sort it with all threads instead */
+      return lz4ultra_compress_inmem_sort_parallel(pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, nFlags, nBlockMaxCode, nLevel, nThreads, submit, pExecutor);
+   }
+   if (nThreads > nNumBlocks)
+      nThreads = (int)nNumBlocks;
+   if (nThreads <= 1) {
+      /* Nothing to parallelize */
+      return lz4ultra_compress_inmem(pInputData, pOutBuffer, nInputSize, nMaxOutBufferSize, NULL, 0, nFlags, nBlockMaxCode, nLevel);
+   }
+
+   /* Use two scratch slots per worker, so that workers can keep going while finished blocks are concatenated in order */
+   nNumSlots = nThreads * 2;
+
+   pJobs = (lz4ultra_inmem_block_job_t *)malloc(nNumSlots * sizeof(lz4ultra_inmem_block_job_t));
+   pOutSlots = (unsigned char *)malloc((size_t)nNumSlots * nBlockMaxSize);
+   state.pCompressors = (lz4ultra_compressor *)malloc(nThreads * sizeof(lz4ultra_compressor));
+   state.pFreeCompressors = (lz4ultra_compressor **)malloc(nThreads * sizeof(lz4ultra_compressor *));
+   if (lz4ultra_seek_table_init(&seekTable, lz4ultra_seek_table_enabled(nFlags) ? (int)nNumBlocks : 0) != 0 ||
+       !pJobs || !pOutSlots || !state.pCompressors || !state.pFreeCompressors)
+      nError = LZ4ULTRA_ERROR_MEMORY;
+
+   for (i = 0; i < nThreads && !nError; i++) {
+      if (lz4ultra_compressor_init(&state.pCompressors[i], nBlockMaxSize + HISTORY_SIZE, nFlags) != 0)
+         nError = LZ4ULTRA_ERROR_MEMORY;
+      else {
+         lz4ultra_compressor_set_level(&state.pCompressors[i], nLevel);
+         state.pFreeCompressors[i] = &state.pCompressors[i];
+         nNumCompressors++;
+      }
+   }
+   state.nNumFreeCompressors = nNumCompressors;
+   state.nInFlight = 0;
+
+   if (!nError && !submit) {
+      if (lz4ultra_thread_pool_init(&pool, nThreads) != 0)
+         nError = LZ4ULTRA_ERROR_MEMORY;
+      else {
+         submit = lz4ultra_submit_to_thread_pool;
+         pExecutor = &pool;
+      }
+   }
+   else {
+      pool.threads = NULL;
+   }
+
+   XXH32_reset(&contentChecksum, 0);
+
+   if (!nError) {
+      int nHeaderSize = lz4ultra_encode_header(pOutBuffer, (int)nMaxOutBufferSize, nFlags, nBlockMaxCode, nInputSize);
+      if (nHeaderSize < 0)
+         nError = LZ4ULTRA_ERROR_COMPRESSION;
+      else
+         nCompressedSize += nHeaderSize;
+   }
+
+   lz4ultra_mutex_init(&state.lock);
+   lz4ultra_cond_init(&state.cond);
+   lz4ultra_mutex_lock(&state.lock);
+
+   while (nWrittenBlocks < nNumBlocks && !nError) {
+      if (nSubmittedBlocks < nNumBlocks && (nSubmittedBlocks - nWrittenBlocks) < nNumSlots && state.nInFlight < nThreads) {
+         /* Queue next block */
+         lz4ultra_inmem_block_job_t *pJob = &pJobs[nSubmittedBlocks % nNumSlots];
+         size_t nInDataOffset = nSubmittedBlocks << nBlockMaxBits;
+         int nInDataSize = (int)(nInputSize - nInDataOffset);
+         int nPreviousBlockSize = 0;
+
+         if (nInDataSize > nBlockMaxSize)
+            nInDataSize = nBlockMaxSize;
+         if (nSubmittedBlocks && !(nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS))
+            nPreviousBlockSize = (nBlockMaxSize > HISTORY_SIZE) ? HISTORY_SIZE : nBlockMaxSize;
+
+         pJob->pState = &state;
+         pJob->pInWindow = pInputData + nInDataOffset - nPreviousBlockSize;
+         pJob->nPreviousBlockSize = nPreviousBlockSize;
+         pJob->nInDataSize = nInDataSize;
+         pJob->pOutSlot = pOutSlots + (size_t)(nSubmittedBlocks % nNumSlots) * nBlockMaxSize;
+         pJob->nMaxOutDataSize = nBlockMaxSize;
+         pJob->nOutDataSize = -1;
+         pJob->nDone = 0;
+         state.nInFlight++;
+         nSubmittedBlocks++;
+
+         lz4ultra_mutex_unlock(&state.lock);
+         if (submit(pExecutor, lz4ultra_compress_inmem_block_job, pJob) != 0)
+            lz4ultra_compress_inmem_block_job(pJob);
+         lz4ultra_mutex_lock(&state.lock);
+         continue;
+      }
+
+      lz4ultra_inmem_block_job_t *pJob = &pJobs[nWrittenBlocks % nNumSlots];
+      if (!pJob->nDone) {
+         lz4ultra_cond_wait(&state.cond, &state.lock);
+         continue;
+      }
+      lz4ultra_mutex_unlock(&state.lock);
+
+      /* Concatenate the next finished block, in order */
+      int nInDataSize = pJob->nInDataSize;
+      int nOutDataSize = pJob->nOutDataSize;
+      int nOutDataEnd = (int)(nMaxOutBufferSize - LZ4ULTRA_FRAME_SIZE - LZ4ULTRA_FRAME_SIZE /* footer */ - nCompressedSize);
+      size_t nBlockOffset = nCompressedSize;
+
+      if (nFlags & LZ4ULTRA_FLAG_BLOCK_CHECKSUM)
+         nOutDataEnd -= LZ4ULTRA_BLOCK_CHECKSUM_SIZE;
+
+      if (nOutDataEnd > nBlockMaxSize)
+         nOutDataEnd = nBlockMaxSize;
+
+      if (nOutDataSize >= 0 && nOutDataSize <= nOutDataEnd) {
+         int nFrameHeaderSize;
+
+         /* Compressed block */
+
+         nFrameHeaderSize = lz4ultra_encode_compressed_block_frame(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, nOutDataSize);
+         if (nFrameHeaderSize < 0)
+            nError = LZ4ULTRA_ERROR_COMPRESSION;
+         else {
+            memcpy(pOutBuffer + nCompressedSize + nFrameHeaderSize, pJob->pOutSlot, nOutDataSize);
+            nOriginalSize += nInDataSize;
+            nCompressedSize += nFrameHeaderSize + nOutDataSize;
+         }
+      }
+      else {
+         int nFrameHeaderSize;
+
+         /* Uncompressible, literal block */
+
+         nFrameHeaderSize = lz4ultra_encode_uncompressed_block_frame(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, nInDataSize);
+         if (nFrameHeaderSize < 0)
+            nError = LZ4ULTRA_ERROR_COMPRESSION;
+         else {
+            if (nInDataSize > (nMaxOutBufferSize - (nCompressedSize + nFrameHeaderSize)))
+               nError = LZ4ULTRA_ERROR_DST;
+            else {
+               memcpy(pOutBuffer + nFrameHeaderSize + nCompressedSize, pInputData + nOriginalSize, nInDataSize);
+               nOriginalSize += nInDataSize;
+               nCompressedSize += nFrameHeaderSize + (long long)nInDataSize;
+            }
+         }
+      }
+
+      if (!nError) {
+         int nChecksumSize = lz4ultra_encode_block_checksum(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags,
+                                                            pOutBuffer + nBlockOffset + LZ4ULTRA_FRAME_SIZE, (int)(nCompressedSize - nBlockOffset - LZ4ULTRA_FRAME_SIZE));
+         if (nChecksumSize < 0)
+            nError = LZ4ULTRA_ERROR_COMPRESSION;
+         else
+            nCompressedSize += nChecksumSize;
+      }
+
+      if (!nError && lz4ultra_seek_table_enabled(nFlags) && lz4ultra_seek_table_add(&seekTable, (int)(nCompressedSize - nBlockOffset), nInDataSize) != 0)
+         nError = LZ4ULTRA_ERROR_MEMORY;
+
+      /* Checksum the block while the workers keep compressing the next ones */
+      if (!nError && (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM))
+         XXH32_update(&contentChecksum, pInputData + nOriginalSize - nInDataSize, nInDataSize);
+
+      lz4ultra_mutex_lock(&state.lock);
+      nWrittenBlocks++;
+   }
+
+   /* Wait for any blocks still being compressed before tearing down */
+   while (state.nInFlight)
+      lz4ultra_cond_wait(&state.cond, &state.lock);
+   lz4ultra_mutex_unlock(&state.lock);
+   lz4ultra_cond_destroy(&state.cond);
+   lz4ultra_mutex_destroy(&state.lock);
+
+   if (!nError) {
+      int nFooterSize = lz4ultra_encode_footer_frame(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, XXH32_digest(&contentChecksum));
+      if (nFooterSize < 0)
+         nError = LZ4ULTRA_ERROR_COMPRESSION;
+      else
+         nCompressedSize += nFooterSize;
+   }
+
+   if (!nError && lz4ultra_seek_table_enabled(nFlags)) {
+      int nTableSize = lz4ultra_encode_seek_table(pOutBuffer + nCompressedSize, (int)(nMaxOutBufferSize - nCompressedSize), nFlags, &seekTable);
+      if (nTableSize < 0)
+         nError = LZ4ULTRA_ERROR_COMPRESSION;
+      else
+         nCompressedSize += nTableSize;
+   }
+   lz4ultra_seek_table_destroy(&seekTable);
+
+   if (pool.threads)
+      lz4ultra_thread_pool_destroy(&pool);
+
+   for (i = 0; i < nNumCompressors; i++)
+      lz4ultra_compressor_destroy(&state.pCompressors[i]);
+
+   if (state.pFreeCompressors)
+      free(state.pFreeCompressors);
+   if (state.pCompressors)
+      free(state.pCompressors);
+   if (pOutSlots)
+      free(pOutSlots);
+   if (pJobs)
+      free(pJobs);
 
    if (nError) {
       return -1;
@@ -34,6 +34,7 @@
 #define _SHRINK_INMEM_H
 
 #include <stdlib.h>
+#include "lz4ultra.h"
 
 /**
  * Get maximum compressed size of input(source) data
@@ -50,16 +51,89 @@ size_t lz4ultra_get_max_compressed_size_inmem(size_t nInputSize, unsigned int nF
 /**
  * Compress memory
  *
+ * The dictionary, if any, prefills the history of the first block (of each block, with LZ4ULTRA_FLAG_INDEP_BLOCKS), the
+ * same way as when compressing a stream. To compress many inputs with the same dictionary, prepare it once and use
+ * lz4ultra_compress_inmem_with_dictionary() instead.
+ *
  * @param pInputData pointer to input(source) data to compress
  * @param pOutBuffer buffer for compressed data
  * @param nInputSize input(source) size in bytes
  * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param pDictionaryData dictionary contents, or NULL for none; only the last 64 Kb are used
+ * @param nDictionaryDataSize size of dictionary contents, or 0
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
  *
  * @return actual compressed size, or -1 for error
  */
-size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags,
-   int nBlockMaxCode);
+size_t lz4ultra_compress_inmem(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize,
+   const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags, int nBlockMaxCode, int nLevel);
+
+/**
+ * Compress memory, using a long-lived compression context
+ *
+ * Once the context has grown to the largest window needed, compressing with it performs no heap allocations.
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create(); it is reset and grown as needed
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t lz4ultra_compress_inmem_with_context(lz4ultra_compressor *pCompressor, const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize,
+   unsigned int nFlags, int nBlockMaxCode, int nLevel);
+
+/**
+ * Compress memory using a prepared dictionary, with a long-lived compression context
+ *
+ * The dictionary is sorted once when it is prepared, so that compressing many small inputs against the same dictionary
+ * doesn't process it again for each of them. The first block (every block, with LZ4ULTRA_FLAG_INDEP_BLOCKS) is assembled
+ * after the dictionary in a window owned by the context, which is allocated on first use and kept for the next calls.
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create() without an arena; it is reset and grown as needed
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t lz4ultra_compress_inmem_with_dictionary(lz4ultra_compressor *pCompressor, const lz4ultra_prepared_dictionary_t *pDictionary, const unsigned char *pInputData, unsigned char *pOutBuffer,
+   size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags, int nBlockMaxCode, int nLevel);
+
+/**
+ * Compress memory, compressing several blocks concurrently
+ *
+ * The output is byte-for-byte identical to lz4ultra_compress_inmem() for the same flags and block size, except for
+ * dependent blocks with the binary tree match finder (levels 3 and 4, or LZ4ULTRA_FLAG_BT_MATCHFINDER): lz4ultra_compress_inmem()
+ * carries the tree over from block to block, while each concurrent block builds it from the 64 Kb in front of it, which
+ * finds slightly different matches; the output is then the same for any number of threads above one. Raw blocks and
+ * inputs that fit in a single block are compressed as one block, that the threads suffix-sort together instead.
+ *
+ * @param pInputData pointer to input(source) data to compress
+ * @param pOutBuffer buffer for compressed data
+ * @param nInputSize input(source) size in bytes
+ * @param nMaxOutBufferSize maximum capacity of compression buffer
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads maximum number of blocks compressed at the same time (one compressor context is allocated for each)
+ * @param submit function to queue block compression tasks with the caller's executor, or NULL to use an internal pool of nThreads threads
+ * @param pExecutor opaque executor pointer passed to submit
+ *
+ * @return actual compressed size, or -1 for error
+ */
+size_t lz4ultra_compress_inmem_parallel(const unsigned char *pInputData, unsigned char *pOutBuffer, size_t nInputSize, size_t nMaxOutBufferSize, unsigned int nFlags,
+   int nBlockMaxCode, int nLevel, int nThreads, lz4ultra_submit_fn submit, void *pExecutor);
 
 #endif /* _SHRINK_INMEM_H */
@@ -36,93 +36,414 @@
 #include "format.h"
 #include "frame.h"
 #include "lib.h"
+#include "async_stream.h"
+#include "mapped_file.h"
+#include "seek_table.h"
+#include "block_split.h"
+#include "threadpool.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "xxhash.h"
+
+static lz4ultra_status_t lz4ultra_compress_stream_data(lz4ultra_compressor *pContext, lz4ultra_stream_t *pInStream, const unsigned char *pInMappedData, size_t nInMappedSize, lz4ultra_stream_t *pOutStream,
+                                                       const void *pDictionaryData, int nDictionaryDataSize, const lz4ultra_prepared_dictionary_t *pPreparedDictionary,
+                                                       unsigned int nFlags,
+                                                       int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
+                                                       void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                                       void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                                       lz4ultra_stats_t *pStats);
 
 /*-------------- File API -------------- */
 
 /**
  * Compress file
  *
+ * Regular files are mapped into memory and compressed in place when no dictionary is used; other inputs are read as a stream.
+ * With LZ4ULTRA_FLAG_ASYNC_IO, streamed input is read ahead and output is written behind on background threads.
+ *
+ * @param pContext long-lived compression context to compress the first block of each batch with, or NULL to create one
  * @param pszInFilename name of input(source) file to compress
  * @param pszOutFilename name of output(compressed) file to generate
  * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param pPreparedDictionary prepared dictionary, or NULL for none; used instead of pszDictionaryFilename when set
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
  * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
  * @param progress progress function, called after compressing each block, or NULL for none
  * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
  * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
  * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
-lz4ultra_status_t lz4ultra_compress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename,
-                                         const unsigned int nFlags, int nBlockMaxCode,
-                                         void(*start)(int nBlockMaxCode, const unsigned int nFlags),
-                                         void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount) {
+static lz4ultra_status_t lz4ultra_compress_file_data(lz4ultra_compressor *pContext, const char *pszInFilename, const char *pszOutFilename,
+                                                     const char *pszDictionaryFilename, const lz4ultra_prepared_dictionary_t *pPreparedDictionary,
+                                                     const unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads,
+                                                     void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                                     void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                                     lz4ultra_stats_t *pStats) {
    lz4ultra_stream_t inStream, outStream;
-   void *pDictionaryData = NULL;
-   int nDictionaryDataSize = 0;
+   lz4ultra_mapped_file_t inMappedFile;
+   lz4ultra_prepared_dictionary_t *pDictionary = NULL;
+   long long nContentSize = -1;
+   /* Read one batch of blocks ahead, and let a whole batch be written behind */
+   int nAsyncBufferCount = 4 * ((nThreads > 1) ? nThreads : 1) + 4;
    lz4ultra_status_t nStatus;
 
+   if (!pszDictionaryFilename && !pPreparedDictionary && lz4ultra_mapped_file_open(&inMappedFile, pszInFilename) == 0) {
+      if (lz4ultra_filestream_open(&outStream, pszOutFilename, "wb") < 0) {
+         lz4ultra_mapped_file_close(&inMappedFile);
+         return LZ4ULTRA_ERROR_DST;
+      }
+
+      if (nFlags & LZ4ULTRA_FLAG_ASYNC_IO)
+         lz4ultra_asyncstream_open(&outStream, 1, nAsyncBufferCount);
+
+      nStatus = lz4ultra_compress_stream_data(pContext, NULL, inMappedFile.pData, inMappedFile.nSize, &outStream, NULL, 0, NULL, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads, (long long)inMappedFile.nSize,
+                                              start, progress, pOriginalSize, pCompressedSize, pCommandCount, pStats);
+      if (!nStatus && lz4ultra_asyncstream_flush(&outStream) != 0)
+         nStatus = LZ4ULTRA_ERROR_DST;
+
+      outStream.close(&outStream);
+      lz4ultra_mapped_file_close(&inMappedFile);
+      return nStatus;
+   }
+
    if (lz4ultra_filestream_open(&inStream, pszInFilename, "rb") < 0) {
       return LZ4ULTRA_ERROR_SRC;
    }
 
+   /* Stored in the header with LZ4ULTRA_FLAG_CONTENT_SIZE, and keeps batches to the number of blocks in the file otherwise */
+   nContentSize = lz4ultra_filestream_get_size(&inStream);
+
    if (lz4ultra_filestream_open(&outStream, pszOutFilename, "wb") < 0) {
       inStream.close(&inStream);
       return LZ4ULTRA_ERROR_DST;
    }
 
-   nStatus = lz4ultra_dictionary_load(pszDictionaryFilename, &pDictionaryData, &nDictionaryDataSize);
-   if (nStatus) {
-      outStream.close(&outStream);
-      inStream.close(&inStream);
+   if (!pPreparedDictionary) {
+      nStatus = lz4ultra_dictionary_prepare_file(pszDictionaryFilename, &pDictionary);
+      if (nStatus) {
+         outStream.close(&outStream);
+         inStream.close(&inStream);
 
-      return nStatus;
+         return nStatus;
+      }
+      pPreparedDictionary = pDictionary;
+   }
+
+   if (nFlags & LZ4ULTRA_FLAG_ASYNC_IO) {
+      lz4ultra_asyncstream_open(&inStream, 0, nAsyncBufferCount);
+      lz4ultra_asyncstream_open(&outStream, 1, nAsyncBufferCount);
    }
 
-   nStatus = lz4ultra_compress_stream(&inStream, &outStream, pDictionaryData, nDictionaryDataSize, nFlags, nBlockMaxCode, start, progress, pOriginalSize, pCompressedSize, pCommandCount);
-   
-   lz4ultra_dictionary_free(&pDictionaryData);
+   nStatus = lz4ultra_compress_stream_data(pContext, &inStream, NULL, 0, &outStream, NULL, 0, pPreparedDictionary, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads, nContentSize,
+                                           start, progress, pOriginalSize, pCompressedSize, pCommandCount, pStats);
+   if (!nStatus && lz4ultra_asyncstream_flush(&outStream) != 0)
+      nStatus = LZ4ULTRA_ERROR_DST;
+
+   if (pDictionary)
+      lz4ultra_dictionary_release(pDictionary);
    outStream.close(&outStream);
    inStream.close(&inStream);
    return nStatus;
 }
 
+/**
+ * Compress file
+ *
+ * Regular files are mapped into memory and compressed in place when no dictionary is used; other inputs are read as a stream.
+ * With LZ4ULTRA_FLAG_ASYNC_IO, streamed input is read ahead and output is written behind on background threads.
+ *
+ * @param pszInFilename name of input(source) file to compress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename,
+                                         const unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads,
+                                         void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                         void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                         lz4ultra_stats_t *pStats) {
+   return lz4ultra_compress_file_data(NULL, pszInFilename, pszOutFilename, pszDictionaryFilename, NULL, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads,
+                                      start, progress, pOriginalSize, pCompressedSize, pCommandCount, pStats);
+}
+
+/**
+ * Compress file using a prepared dictionary, with a long-lived compression context
+ *
+ * Compressing many files with the same context saves allocating and initializing one for each file. The context
+ * compresses every block when nThreads is 1; otherwise, it compresses the first block of each batch, and contexts for
+ * the other blocks are created for the duration of the call.
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create() without an arena; it is reset and grown as needed
+ * @param pszInFilename name of input(source) file to compress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t (the context must then be reset before use, or freed)
+ */
+lz4ultra_status_t lz4ultra_compress_file_with_context(lz4ultra_compressor *pCompressor, const char *pszInFilename, const char *pszOutFilename,
+                                                      const lz4ultra_prepared_dictionary_t *pDictionary, const unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost,
+                                                      int nThreads, long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount, lz4ultra_stats_t *pStats) {
+   return lz4ultra_compress_file_data(pCompressor, pszInFilename, pszOutFilename, NULL, pDictionary, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads,
+                                      NULL, NULL, pOriginalSize, pCompressedSize, pCommandCount, pStats);
+}
+
 /*-------------- Streaming API -------------- */
 
+/** One block to compress, possibly on a worker thread */
+typedef struct _lz4ultra_block_job_t {
+   lz4ultra_compressor *pCompressor;
+   const unsigned char *pInWindow;
+   int nPreviousBlockSize;
+   int nInDataSize;
+   unsigned char *pOutData;
+   int nMaxOutDataSize;
+   int nOutDataSize;
+   int nIncompressible;
+   unsigned char *pVerifyData;
+   int nVerifyError;
+} lz4ultra_block_job_t;
+
 /**
- * Compress stream
+ * Decompress a block that was just compressed, and compare it with its input
+ *
+ * @param pJob block job, with the compressed block
+ *
+ * @return 0 if the block decompresses back to its input, -1 if it doesn't
+ */
+static int lz4ultra_verify_block(const lz4ultra_block_job_t *pJob) {
+   const unsigned char *pInData = pJob->pInWindow + pJob->nPreviousBlockSize;
+   unsigned char *pVerifyData = pJob->pVerifyData + HISTORY_SIZE - pJob->nPreviousBlockSize;
+   int nBlockSize = pJob->nOutDataSize;
+   int nDecompressedSize;
+
+   /* Raw blocks end with an EOD marker that isn't decompressed */
+   if (pJob->pCompressor->flags & LZ4ULTRA_FLAG_RAW_BLOCK)
+      nBlockSize -= 2;
+   if (nBlockSize < 0)
+      return -1;
+
+   /* The history of this block is its input's; the bytes in front of it were compared with the input already */
+   memcpy(pVerifyData, pJob->pInWindow, pJob->nPreviousBlockSize);
+   nDecompressedSize = lz4ultra_decompressor_expand_block(pJob->pOutData, nBlockSize, pVerifyData, pJob->nPreviousBlockSize, pJob->nInDataSize);
+   if (nDecompressedSize != pJob->nInDataSize || memcmp(pVerifyData + pJob->nPreviousBlockSize, pInData, pJob->nInDataSize))
+      return -1;
+
+   return 0;
+}
+
+/**
+ * Compress one queued block
+ *
+ * @param pTaskArg block job (lz4ultra_block_job_t)
+ */
+static void lz4ultra_compress_block_job(void *pTaskArg) {
+   lz4ultra_block_job_t *pJob = (lz4ultra_block_job_t *)pTaskArg;
+
+   /* Blocks found to be incompressible while splitting the input are stored without even trying */
+   if (pJob->nIncompressible) {
+      lz4ultra_compressor_skip_block(pJob->pCompressor, pJob->nInDataSize);
+      pJob->nOutDataSize = -1;
+      return;
+   }
+
+   lz4ultra_compressor_bind_local(pJob->pCompressor);
+   pJob->nOutDataSize = lz4ultra_compressor_shrink_block(pJob->pCompressor, pJob->pInWindow, pJob->nPreviousBlockSize, pJob->nInDataSize, pJob->pOutData, pJob->nMaxOutDataSize);
+
+   /* Check the block on the same thread, while its input and output are still in cache */
+   if (pJob->pVerifyData && pJob->nOutDataSize >= 0)
+      pJob->nVerifyError = lz4ultra_verify_block(pJob);
+}
+
+/**
+ * Submit task to the block compression thread pool
+ *
+ * @param pExecutor thread pool (lz4ultra_thread_pool_t)
+ * @param task task function
+ * @param pTaskArg argument passed to task function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_submit_to_stream_pool(void *pExecutor, lz4ultra_task_fn task, void *pTaskArg) {
+   return lz4ultra_thread_pool_submit((lz4ultra_thread_pool_t *)pExecutor, task, pTaskArg);
+}
+
+/**
+ * Write checksum of a block that was just written out, if the frame has block checksums
  *
- * @param pInStream input(source) stream to compress
  * @param pOutStream output(compressed) stream to write to
- * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nFlags compression flags
+ * @param pBlockData block data, as written to the stream
+ * @param nBlockDataSize block data size, in bytes
+ * @param pCompressedSize pointer to output(compressed) size, updated with the bytes written
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+static lz4ultra_status_t lz4ultra_write_block_checksum(lz4ultra_stream_t *pOutStream, const unsigned int nFlags, const unsigned char *pBlockData, const int nBlockDataSize, long long *pCompressedSize) {
+   unsigned char cChecksumData[LZ4ULTRA_BLOCK_CHECKSUM_SIZE];
+   int nChecksumSize = lz4ultra_encode_block_checksum(cChecksumData, LZ4ULTRA_BLOCK_CHECKSUM_SIZE, nFlags, pBlockData, nBlockDataSize);
+
+   if (nChecksumSize < 0)
+      return LZ4ULTRA_ERROR_COMPRESSION;
+   if (nChecksumSize > 0) {
+      if (pOutStream->write(pOutStream, cChecksumData, nChecksumSize) != (size_t)nChecksumSize)
+         return LZ4ULTRA_ERROR_DST;
+      *pCompressedSize += (long long)nChecksumSize;
+   }
+
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Prepare a compression context for compressing one stream
+ *
+ * @param pCompressor compression context
+ * @param nReuse 1 to reset a long-lived context, 0 to initialize a new one
+ * @param nMaxWindowSize maximum size of input data window (largest block size + history)
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, or 0 to only minimize the size
+ * @param nCollectStats 1 to collect compression statistics, 0 not to
+ * @param pDictionary prepared dictionary, or NULL for none
+ *
+ * @return 0 for success, non-zero for failure
+ */
+static int lz4ultra_stream_compressor_setup(lz4ultra_compressor *pCompressor, const int nReuse, const int nMaxWindowSize, const unsigned int nFlags, const int nLevel,
+                                            const int nDecodeCost, const int nCollectStats, const lz4ultra_prepared_dictionary_t *pDictionary) {
+   if (nReuse) {
+      if (lz4ultra_compressor_reset(pCompressor, nMaxWindowSize, nFlags) != 0)
+         return 100;
+   }
+   else {
+      if (lz4ultra_compressor_init(pCompressor, nMaxWindowSize, nFlags) != 0)
+         return 100;
+   }
+
+   lz4ultra_compressor_set_level(pCompressor, nLevel);
+   lz4ultra_compressor_set_decode_cost(pCompressor, nDecodeCost, NULL);
+   lz4ultra_compressor_set_stats(pCompressor, nCollectStats);
+   lz4ultra_compressor_set_dictionary(pCompressor, pDictionary);
+   return 0;
+}
+
+/**
+ * Get the number of blocks read and compressed together in each batch
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxSize maximum block size, in bytes
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, or -1 if unknown
+ *
+ * @return number of blocks
+ */
+static int lz4ultra_get_max_batch_blocks(const unsigned int nFlags, const int nBlockMaxSize, const int nThreads, const long long nContentSize) {
+   int nMaxBatchBlocks = (nThreads > 1 && (nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0) ? nThreads : 1;
+
+   if (nContentSize >= 0 && nMaxBatchBlocks > 1) {
+      long long nNumBlocks = (nContentSize + nBlockMaxSize - 1) / nBlockMaxSize;
+
+      if (nNumBlocks < nMaxBatchBlocks)
+         nMaxBatchBlocks = (nNumBlocks > 1) ? (int)nNumBlocks : 1;
+   }
+
+   return nMaxBatchBlocks;
+}
+
+/**
+ * Compress stream, or input data that is already in memory
+ *
+ * @param pContext long-lived compression context to compress the first block of each batch with, or NULL to create one
+ * @param pInStream input(source) stream to compress, or NULL to compress pInMappedData
+ * @param pInMappedData input(source) data to compress when pInStream is NULL, for instance a mapped file; blocks are compressed in place
+ * @param nInMappedSize size of pInMappedData, in bytes
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionaryData dictionary contents, or NULL for none; only supported for streams
  * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param pPreparedDictionary prepared dictionary, or NULL for none; used instead of pDictionaryData and nDictionaryDataSize when set
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, stored in the frame header if LZ4ULTRA_FLAG_CONTENT_SIZE is set and used not to compress more blocks at once than the input has, or -1 if unknown (the flag is then ignored)
  * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
  * @param progress progress function, called after compressing each block, or NULL for none
  * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
  * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
  * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
-lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags,
-                                           int nBlockMaxCode,
-                                           void(*start)(int nBlockMaxCode, const unsigned int nFlags),
-                                           void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount) {
-   unsigned char *pInData, *pOutData;
-   lz4ultra_compressor compressor;
+static lz4ultra_status_t lz4ultra_compress_stream_data(lz4ultra_compressor *pContext, lz4ultra_stream_t *pInStream, const unsigned char *pInMappedData, size_t nInMappedSize, lz4ultra_stream_t *pOutStream,
+                                                       const void *pDictionaryData, int nDictionaryDataSize, const lz4ultra_prepared_dictionary_t *pPreparedDictionary,
+                                                       unsigned int nFlags,
+                                                       int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
+                                                       void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                                       void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                                       lz4ultra_stats_t *pStats) {
+   unsigned char *pInData, *pOutData, *pVerifyData = NULL;
+   lz4ultra_compressor *pCompressors;
+   lz4ultra_compressor **ppCompressors;
+   lz4ultra_block_job_t *pJobs;
+   lz4ultra_thread_pool_t pool;
+   lz4ultra_seek_table_t seekTable;
+   XXH32_state_t contentChecksum;
    long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   size_t nMappedOffset = 0;
    int nBlockMaxBits;
    int nBlockMaxSize;
+   int nMaxBatchBlocks;
+   int nBlockGap;
    int nPreloadedInDataSize;
-   int nResult;
+   int nPendingInDataSize = 0, nPendingInDataOffset = 0;
+   int nAdaptive;
+   int nNumCompressors = 0;
+   int nPoolStarted = 0;
    unsigned char cFrameData[16];
    int nError = 0;
+   int i;
 
    memset(cFrameData, 0, 16);
+   XXH32_reset(&contentChecksum, 0);
+
+   if (nContentSize < 0)
+      nFlags &= ~LZ4ULTRA_FLAG_CONTENT_SIZE;
+   if (pPreparedDictionary) {
+      pDictionaryData = pPreparedDictionary->data;
+      nDictionaryDataSize = pPreparedDictionary->size;
+   }
+   if (!pInStream) {
+      pDictionaryData = NULL;
+      nDictionaryDataSize = 0;
+      pPreparedDictionary = NULL;
+   }
 
    if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) {
       nBlockMaxBits = 23;
@@ -133,23 +454,30 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
    }
    nBlockMaxSize = 1 << nBlockMaxBits;
 
-   pInData = (unsigned char*)malloc(nBlockMaxSize + HISTORY_SIZE);
-   if (!pInData) {
-      return LZ4ULTRA_ERROR_MEMORY;
-   }
-   memset(pInData, 0, nBlockMaxSize + HISTORY_SIZE);
+   /* Raw blocks are single blocks, and legacy frames have fixed-size blocks */
+   nAdaptive = ((nFlags & LZ4ULTRA_FLAG_ADAPTIVE_BLOCKS) && (nFlags & (LZ4ULTRA_FLAG_RAW_BLOCK | LZ4ULTRA_FLAG_LEGACY_FRAMES)) == 0) ? 1 : 0;
 
-   pOutData = (unsigned char*)malloc(nBlockMaxSize);
-   if (!pOutData) {
-      free(pInData);
-      pInData = NULL;
+   /* Each batch holds one block per thread, but no more blocks than the input has when its size is known. Blocks are read back to back after
+    * the history, so that the previous input bytes of a dependent block are already in front of it. Independent blocks that use a
+    * dictionary need their own copy of it in front, so leave room for one. */
+   nMaxBatchBlocks = lz4ultra_get_max_batch_blocks(nFlags, nBlockMaxSize, nThreads, nContentSize);
+   nBlockGap = ((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) && nDictionaryDataSize && pDictionaryData) ? HISTORY_SIZE : 0;
 
-      return LZ4ULTRA_ERROR_MEMORY;
-   }
-   memset(pInData, 0, nBlockMaxSize);
+   if (pInStream) {
+      pInData = (unsigned char*)malloc(HISTORY_SIZE + (size_t)nMaxBatchBlocks * (nBlockMaxSize + nBlockGap));
+      if (!pInData) {
+         return LZ4ULTRA_ERROR_MEMORY;
+      }
+      memset(pInData, 0, HISTORY_SIZE + (size_t)nMaxBatchBlocks * (nBlockMaxSize + nBlockGap));
 
-   /* Load first block of input data */
-   nPreloadedInDataSize = (int)pInStream->read(pInStream, pInData + HISTORY_SIZE, nBlockMaxSize);
+      /* Load first block of input data */
+      nPreloadedInDataSize = (int)pInStream->read(pInStream, pInData + HISTORY_SIZE, nBlockMaxSize);
+   }
+   else {
+      /* The input is already in memory, with each block right after the one before it: compress it where it is */
+      pInData = NULL;
+      nPreloadedInDataSize = (nInMappedSize < (size_t)nBlockMaxSize) ? (int)nInMappedSize : nBlockMaxSize;
+   }
    if (nPreloadedInDataSize < nBlockMaxSize && (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) == 0) {
       /* If the entire input data is shorter than the specified block size, try to reduce the
        * block size until is the smallest one that can fit the data */
@@ -168,19 +496,48 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
       } while (1);
    }
 
-   nResult = lz4ultra_compressor_init(&compressor, nBlockMaxSize + HISTORY_SIZE, nFlags);
-   if (nResult != 0) {
+   pOutData = (unsigned char*)malloc((size_t)nMaxBatchBlocks * nBlockMaxSize);
+   if (!pOutData) {
+      if (pInData)
+         free(pInData);
+      pInData = NULL;
+
+      return LZ4ULTRA_ERROR_MEMORY;
+   }
+
+   if (nFlags & LZ4ULTRA_FLAG_VERIFY) {
+      /* Room to decompress each block of a batch after its history */
+      pVerifyData = (unsigned char*)malloc((size_t)nMaxBatchBlocks * (HISTORY_SIZE + nBlockMaxSize));
+   }
+
+   pCompressors = (lz4ultra_compressor *)malloc(nMaxBatchBlocks * sizeof(lz4ultra_compressor));
+   ppCompressors = (lz4ultra_compressor **)malloc(nMaxBatchBlocks * sizeof(lz4ultra_compressor *));
+   pJobs = (lz4ultra_block_job_t *)malloc(nMaxBatchBlocks * sizeof(lz4ultra_block_job_t));
+   if (!pCompressors || !ppCompressors || !pJobs || ((nFlags & LZ4ULTRA_FLAG_VERIFY) && !pVerifyData) ||
+       lz4ultra_stream_compressor_setup(pContext ? pContext : &pCompressors[0], pContext ? 1 : 0, nBlockMaxSize + HISTORY_SIZE, nFlags, nLevel, nDecodeCost, pStats ? 1 : 0, pPreparedDictionary) != 0) {
+      if (pVerifyData)
+         free(pVerifyData);
+      if (pJobs)
+         free(pJobs);
+      if (ppCompressors)
+         free(ppCompressors);
+      if (pCompressors)
+         free(pCompressors);
+
       free(pOutData);
       pOutData = NULL;
 
-      free(pInData);
+      if (pInData)
+         free(pInData);
       pInData = NULL;
 
       return LZ4ULTRA_ERROR_MEMORY;
    }
+   ppCompressors[0] = pContext ? pContext : &pCompressors[0];
+   nNumCompressors = 1;
 
    if ((nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) == 0) {
-      int nHeaderSize = lz4ultra_encode_header(cFrameData, 16, nFlags, nBlockMaxCode);
+      int nHeaderSize = lz4ultra_encode_header(cFrameData, 16, nFlags, nBlockMaxCode, nContentSize);
       if (nHeaderSize < 0)
          nError = LZ4ULTRA_ERROR_COMPRESSION;
       else {
@@ -193,39 +550,158 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
    if (start)
       start(nBlockMaxCode, nFlags);
 
+   lz4ultra_seek_table_init(&seekTable, 0);
+
    int nPreviousBlockSize = 0;
    int nNumBlocks = 0;
 
-   while ((nPreloadedInDataSize > 0 || (!pInStream->eof(pInStream))) && !nError) {
-      int nInDataSize;
+   while (!nError) {
+      int nBatchBlocks = 0;
+      int nInDataOffset = HISTORY_SIZE;
+
+      /* Read as many blocks as there are workers */
+      while (nBatchBlocks < nMaxBatchBlocks) {
+         lz4ultra_block_job_t *pJob = &pJobs[nBatchBlocks];
+         int nInDataSize;
+         int nIncompressible = 0;
+
+         if (nBatchBlocks)
+            nInDataOffset += nBlockGap;
+
+         if (!pInStream) {
+            nInDataSize = ((nInMappedSize - nMappedOffset) < (size_t)nBlockMaxSize) ? (int)(nInMappedSize - nMappedOffset) : nBlockMaxSize;
+            if (nInDataSize <= 0)
+               break;
+         }
+         else if (nPreloadedInDataSize > 0) {
+            nInDataSize = nPreloadedInDataSize;
+            nPreloadedInDataSize = 0;
+         }
+         else {
+            /* Input left over from splitting the previous block starts this one */
+            if (nPendingInDataSize && nPendingInDataOffset != nInDataOffset)
+               memmove(pInData + nInDataOffset, pInData + nPendingInDataOffset, nPendingInDataSize);
+            nInDataSize = nPendingInDataSize;
+            nPendingInDataSize = 0;
 
-      if (nPreviousBlockSize) {
-         memcpy(pInData + HISTORY_SIZE - nPreviousBlockSize, pInData + HISTORY_SIZE + (nBlockMaxSize - nPreviousBlockSize), nPreviousBlockSize);
+            if (nInDataSize < nBlockMaxSize && !pInStream->eof(pInStream))
+               nInDataSize += (int)pInStream->read(pInStream, pInData + nInDataOffset + nInDataSize, nBlockMaxSize - nInDataSize);
+         }
+
+         if (nInDataSize <= 0)
+            break;
+
+         if (!nPreviousBlockSize && nDictionaryDataSize && pDictionaryData) {
+            memcpy(pInData + nInDataOffset - nDictionaryDataSize, pDictionaryData, nDictionaryDataSize);
+            nPreviousBlockSize = nDictionaryDataSize;
+         }
+         if (!(nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS))
+            nDictionaryDataSize = 0;
+
+         if (nAdaptive) {
+            /* Split with the same history in front as the block is compressed with, so that repeats of it are seen */
+            const unsigned char *pSplitWindow = (pInStream ? (pInData + nInDataOffset) : (pInMappedData + nMappedOffset)) - nPreviousBlockSize;
+            int nSplitSize = lz4ultra_split_block(pSplitWindow, nPreviousBlockSize, nInDataSize, &nIncompressible);
+
+            if (pInStream && nSplitSize < nInDataSize) {
+               nPendingInDataSize = nInDataSize - nSplitSize;
+               nPendingInDataOffset = nInDataOffset + nSplitSize;
+            }
+            nInDataSize = nSplitSize;
+         }
+
+         if (nBatchBlocks >= nNumCompressors) {
+            ppCompressors[nBatchBlocks] = &pCompressors[nBatchBlocks];
+            if (lz4ultra_stream_compressor_setup(ppCompressors[nBatchBlocks], 0, nBlockMaxSize + HISTORY_SIZE, nFlags, nLevel, nDecodeCost, pStats ? 1 : 0, pPreparedDictionary) != 0) {
+               nError = LZ4ULTRA_ERROR_MEMORY;
+               break;
+            }
+            /* Contexts for the other blocks of a batch share the block cache of the caller's context, if any */
+            lz4ultra_compressor_set_block_cache(ppCompressors[nBatchBlocks], ppCompressors[0]->block_cache);
+            nNumCompressors++;
+         }
+
+         pJob->pCompressor = ppCompressors[nBatchBlocks];
+         if (nMaxBatchBlocks > 1) {
+            /* Concurrent blocks can't carry the match finder window over from the previous block: compress each one from
+             * the bytes in front of it only, even if its context's last window looks the same, so that the output is the
+             * same for any number of threads above one */
+            lz4ultra_compressor_reset_window(pJob->pCompressor);
+         }
+         if (pInStream)
+            pJob->pInWindow = pInData + nInDataOffset - nPreviousBlockSize;
+         else
+            pJob->pInWindow = pInMappedData + nMappedOffset - nPreviousBlockSize;
+         pJob->nPreviousBlockSize = nPreviousBlockSize;
+         pJob->nInDataSize = nInDataSize;
+         pJob->pOutData = pOutData + (size_t)nBatchBlocks * nBlockMaxSize;
+         pJob->nMaxOutDataSize = (nInDataSize >= nBlockMaxSize) ? nBlockMaxSize : nInDataSize;
+         pJob->nOutDataSize = -1;
+         pJob->nIncompressible = nIncompressible;
+         pJob->pVerifyData = pVerifyData ? (pVerifyData + (size_t)nBatchBlocks * (HISTORY_SIZE + nBlockMaxSize)) : NULL;
+         pJob->nVerifyError = 0;
+         nBatchBlocks++;
+
+         if (!(nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS)) {
+            nPreviousBlockSize = nInDataSize;
+            if (nPreviousBlockSize > HISTORY_SIZE)
+               nPreviousBlockSize = HISTORY_SIZE;
+         }
+         else {
+            nPreviousBlockSize = 0;
+         }
+
+         nInDataOffset += nInDataSize;
+         nMappedOffset += nInDataSize;
       }
-      else if (nDictionaryDataSize && pDictionaryData) {
-         memcpy(pInData + HISTORY_SIZE - nDictionaryDataSize, pDictionaryData, nDictionaryDataSize);
-         nPreviousBlockSize = nDictionaryDataSize;
+
+      if (!nBatchBlocks || nError)
+         break;
+
+      /* Compress the whole batch */
+      if (nThreads > 1 && !nPoolStarted) {
+         if (lz4ultra_thread_pool_init(&pool, nThreads) != 0) {
+            nError = LZ4ULTRA_ERROR_MEMORY;
+            break;
+         }
+         nPoolStarted = 1;
       }
 
-      if (nPreloadedInDataSize > 0) {
-         nInDataSize = nPreloadedInDataSize;
-         nPreloadedInDataSize = 0;
+      if (nBatchBlocks > 1) {
+         for (i = 0; i < nBatchBlocks; i++) {
+            if (lz4ultra_thread_pool_submit(&pool, lz4ultra_compress_block_job, &pJobs[i]) != 0)
+               lz4ultra_compress_block_job(&pJobs[i]);
+         }
+         lz4ultra_thread_pool_wait(&pool);
+      }
+      else if (nPoolStarted) {
+         /* A lone block (a single-block input, the last block, or a raw block) can't be spread over the workers: have them
+          * suffix-sort it together instead */
+         lz4ultra_compressor_set_sort_threads(ppCompressors[0], nThreads, lz4ultra_submit_to_stream_pool, &pool);
+         lz4ultra_compress_block_job(&pJobs[0]);
+         lz4ultra_compressor_set_sort_threads(ppCompressors[0], 1, NULL, NULL);
       }
       else {
-         nInDataSize = (int)pInStream->read(pInStream, pInData + HISTORY_SIZE, nBlockMaxSize);
+         lz4ultra_compress_block_job(&pJobs[0]);
       }
 
-      if (nInDataSize > 0) {
+      /* Write blocks out in order */
+      for (i = 0; i < nBatchBlocks && !nError; i++) {
+         lz4ultra_block_job_t *pJob = &pJobs[i];
+         int nInDataSize = pJob->nInDataSize;
+         int nOutDataSize = pJob->nOutDataSize;
+         long long nBlockOffset = nCompressedSize;
+
          if ((nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) != 0 && (nNumBlocks || nInDataSize > 0x400000)) {
             nError = LZ4ULTRA_ERROR_RAW_TOOLARGE;
             break;
          }
-         if (!(nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS))
-            nDictionaryDataSize = 0;
 
-         int nOutDataSize;
+         if (pJob->nVerifyError) {
+            nError = LZ4ULTRA_ERROR_VERIFY;
+            break;
+         }
 
-         nOutDataSize = lz4ultra_compressor_shrink_block(&compressor, pInData + HISTORY_SIZE - nPreviousBlockSize, nPreviousBlockSize, nInDataSize, pOutData, (nInDataSize >= nBlockMaxSize) ? nBlockMaxSize : nInDataSize);
          if (nOutDataSize >= 0) {
             int nFrameHeaderSize = 0;
 
@@ -243,7 +719,7 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
             }
 
             if (!nError) {
-               if (pOutStream->write(pOutStream, pOutData, (size_t)nOutDataSize) != (size_t)nOutDataSize) {
+               if (pOutStream->write(pOutStream, pJob->pOutData, (size_t)nOutDataSize) != (size_t)nOutDataSize) {
                   nError = LZ4ULTRA_ERROR_DST;
                }
                else {
@@ -251,6 +727,9 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
                   nCompressedSize += (long long)nFrameHeaderSize + (long long)nOutDataSize;
                }
             }
+
+            if (!nError)
+               nError = lz4ultra_write_block_checksum(pOutStream, nFlags, pJob->pOutData, nOutDataSize, &nCompressedSize);
          }
          else {
             /* Write uncompressible, literal block */
@@ -271,42 +750,52 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
                   nError = LZ4ULTRA_ERROR_DST;
                }
                else {
-                  if (pOutStream->write(pOutStream, pInData + HISTORY_SIZE, (size_t)nInDataSize) != (size_t)nInDataSize) {
+                  if (pOutStream->write(pOutStream, (void*)(pJob->pInWindow + pJob->nPreviousBlockSize), (size_t)nInDataSize) != (size_t)nInDataSize) {
                      nError = LZ4ULTRA_ERROR_DST;
                   }
                   else {
                      nOriginalSize += (long long)nInDataSize;
                      nCompressedSize += (long long)nFrameHeaderSize + (long long)nInDataSize;
+                     nError = lz4ultra_write_block_checksum(pOutStream, nFlags, pJob->pInWindow + pJob->nPreviousBlockSize, nInDataSize, &nCompressedSize);
                   }
                }
             }
          }
 
-         if (!(nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS)) {
-            nPreviousBlockSize = nInDataSize;
-            if (nPreviousBlockSize > HISTORY_SIZE)
-               nPreviousBlockSize = HISTORY_SIZE;
-         }
-         else {
-            nPreviousBlockSize = 0;
+         if (!nError && (nFlags & LZ4ULTRA_FLAG_CONTENT_CHECKSUM))
+            XXH32_update(&contentChecksum, pJob->pInWindow + pJob->nPreviousBlockSize, nInDataSize);
+
+         if (!nError && lz4ultra_seek_table_enabled(nFlags)) {
+            if (lz4ultra_seek_table_add(&seekTable, (int)(nCompressedSize - nBlockOffset), nInDataSize) != 0)
+               nError = LZ4ULTRA_ERROR_MEMORY;
          }
 
          nNumBlocks++;
+
+         if (!nError && (i < (nBatchBlocks - 1) || (pInStream ? (nPendingInDataSize || !pInStream->eof(pInStream)) : (nMappedOffset < nInMappedSize)))) {
+            if (progress)
+               progress(nOriginalSize, nCompressedSize);
+         }
       }
 
-      if (!nError && !pInStream->eof(pInStream)) {
-         if (progress)
-            progress(nOriginalSize, nCompressedSize);
+      /* Keep the end of the last block as history for the next batch */
+      if (nPreviousBlockSize && pInStream) {
+         const unsigned char *pLastInData = pJobs[nBatchBlocks - 1].pInWindow + pJobs[nBatchBlocks - 1].nPreviousBlockSize;
+         memcpy(pInData + HISTORY_SIZE - nPreviousBlockSize, pLastInData + pJobs[nBatchBlocks - 1].nInDataSize - nPreviousBlockSize, nPreviousBlockSize);
       }
    }
 
+   /* The header promised a size; don't produce a frame that contradicts it if the input changed under us */
+   if (!nError && (nFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) && (nFlags & (LZ4ULTRA_FLAG_RAW_BLOCK | LZ4ULTRA_FLAG_LEGACY_FRAMES)) == 0 && nOriginalSize != nContentSize)
+      nError = LZ4ULTRA_ERROR_SRC;
+
    int nFooterSize;
 
    if ((nFlags & LZ4ULTRA_FLAG_RAW_BLOCK) != 0) {
       nFooterSize = 0;
    }
    else {
-      nFooterSize = lz4ultra_encode_footer_frame(cFrameData, 16, nFlags);
+      nFooterSize = lz4ultra_encode_footer_frame(cFrameData, 16, nFlags, XXH32_digest(&contentChecksum));
       if (nFooterSize < 0)
          nError = LZ4ULTRA_ERROR_COMPRESSION;
    }
@@ -317,16 +806,58 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
    }
    nCompressedSize += (long long)nFooterSize;
 
+   if (!nError && lz4ultra_seek_table_enabled(nFlags)) {
+      /* Append the block index in a skippable frame, that other lz4 decoders ignore */
+      size_t nTableSize = lz4ultra_get_seek_table_size(seekTable.num_blocks);
+      unsigned char *pTableData = (nTableSize <= 0x7fffffff) ? (unsigned char *)malloc(nTableSize) : NULL;
+
+      if (!pTableData)
+         nError = LZ4ULTRA_ERROR_MEMORY;
+      else {
+         if (lz4ultra_encode_seek_table(pTableData, (int)nTableSize, nFlags, &seekTable) < 0)
+            nError = LZ4ULTRA_ERROR_COMPRESSION;
+         else if (pOutStream->write(pOutStream, pTableData, nTableSize) != nTableSize)
+            nError = LZ4ULTRA_ERROR_DST;
+         nCompressedSize += (long long)nTableSize;
+         free(pTableData);
+      }
+   }
+   lz4ultra_seek_table_destroy(&seekTable);
+
    if (progress)
       progress(nOriginalSize, nCompressedSize);
 
-   int nCommandCount = lz4ultra_compressor_get_command_count(&compressor);
-   lz4ultra_compressor_destroy(&compressor);
+   if (nPoolStarted)
+      lz4ultra_thread_pool_destroy(&pool);
+
+   int nCommandCount = 0;
+   lz4ultra_stats_t stats;
+   memset(&stats, 0, sizeof(stats));
+   for (i = 0; i < nNumCompressors; i++) {
+      nCommandCount += lz4ultra_compressor_get_command_count(ppCompressors[i]);
+      lz4ultra_stats_add(&stats, lz4ultra_compressor_get_stats(ppCompressors[i]));
+      if (ppCompressors[i] != pContext)
+         lz4ultra_compressor_destroy(ppCompressors[i]);
+   }
+
+   free(pJobs);
+   pJobs = NULL;
+
+   free(ppCompressors);
+   ppCompressors = NULL;
+
+   free(pCompressors);
+   pCompressors = NULL;
 
    free(pOutData);
    pOutData = NULL;
 
-   free(pInData);
+   if (pVerifyData)
+      free(pVerifyData);
+   pVerifyData = NULL;
+
+   if (pInData)
+      free(pInData);
    pInData = NULL;
 
    if (nError) {
@@ -339,6 +870,214 @@ lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultr
          *pCompressedSize = nCompressedSize;
       if (pCommandCount)
          *pCommandCount = nCommandCount;
+      if (pStats)
+         *pStats = stats;
       return LZ4ULTRA_OK;
    }
 }
+
+/**
+ * Compress stream
+ *
+ * @param pInStream input(source) stream to compress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionaryData dictionary contents, or NULL for none
+ * @param nDictionaryDataSize size of dictionary contents, or 0
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, stored in the frame header if LZ4ULTRA_FLAG_CONTENT_SIZE is set and used not to compress more blocks at once than the input has, or -1 if unknown (the flag is then ignored)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags,
+                                           int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
+                                           void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                           void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                           lz4ultra_stats_t *pStats) {
+   return lz4ultra_compress_stream_data(NULL, pInStream, NULL, 0, pOutStream, pDictionaryData, nDictionaryDataSize, NULL, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads, nContentSize,
+                                        start, progress, pOriginalSize, pCompressedSize, pCommandCount, pStats);
+}
+
+/**
+ * Compress stream using a prepared dictionary
+ *
+ * The dictionary is sorted once when it is prepared, and the same prepared dictionary can be used to compress any number of
+ * streams, concurrently if needed, which is faster than passing the raw dictionary to lz4ultra_compress_stream() each time.
+ *
+ * @param pInStream input(source) stream to compress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, stored in the frame header if LZ4ULTRA_FLAG_CONTENT_SIZE is set and used not to compress more blocks at once than the input has, or -1 if unknown (the flag is then ignored)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_stream_with_dictionary(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const lz4ultra_prepared_dictionary_t *pDictionary,
+                                                           unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
+                                                           void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                                           void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                                           lz4ultra_stats_t *pStats) {
+   return lz4ultra_compress_stream_data(NULL, pInStream, NULL, 0, pOutStream, NULL, 0, pDictionary, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads, nContentSize,
+                                        start, progress, pOriginalSize, pCompressedSize, pCommandCount, pStats);
+}
+
+/*-------------- Memory budget -------------- */
+
+/**
+ * Get the largest amount of memory that compressing a file or stream allocates, for a given configuration
+ *
+ * This counts the input, output and verification buffers, a compression context for each block compressed concurrently
+ * with all of the buffers that its match finder allocates when first needed, the thread pool, the seek table, the
+ * dictionary that the file API prepares from a dictionary file, and the read-ahead and write-behind buffers of
+ * LZ4ULTRA_FLAG_ASYNC_IO. It doesn't count thread stacks, a mapped input file, a long-lived context or a prepared
+ * dictionary passed by the caller, or a block cache. With a known input size, no more blocks are counted as compressed
+ * concurrently than the input has; without one, the seek table is counted for 256 blocks, and grows by 8 bytes per
+ * block past that.
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nDictionaryDataSize size of dictionary contents, or 0 for none
+ * @param nContentSize size of the input data, or -1 if unknown
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_compress_get_memory_size(unsigned int nFlags, int nBlockMaxCode, const int nLevel, const int nThreads, const int nDictionaryDataSize, const long long nContentSize) {
+   int nBlockMaxBits;
+   int nBlockMaxSize;
+   int nMaxBatchBlocks;
+   int nBlockGap;
+   size_t nSize = 0;
+
+   /* Mirrors the allocations of lz4ultra_compress_stream_data() */
+   if (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) {
+      nBlockMaxBits = 23;
+      nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
+   }
+   else {
+      nBlockMaxBits = 8 + (nBlockMaxCode << 1);
+   }
+   nBlockMaxSize = 1 << nBlockMaxBits;
+
+   nMaxBatchBlocks = lz4ultra_get_max_batch_blocks(nFlags, nBlockMaxSize, nThreads, nContentSize);
+   nBlockGap = ((nFlags & LZ4ULTRA_FLAG_INDEP_BLOCKS) && nDictionaryDataSize > 0) ? HISTORY_SIZE : 0;
+
+   /* The input buffer is sized before the block size is fitted to the input */
+   nSize += HISTORY_SIZE + (size_t)nMaxBatchBlocks * (nBlockMaxSize + nBlockGap);
+
+   if (nContentSize >= 0 && nContentSize < nBlockMaxSize && (nFlags & LZ4ULTRA_FLAG_LEGACY_FRAMES) == 0) {
+      while (nBlockMaxCode > 4 && (1 << (8 + ((nBlockMaxCode - 1) << 1))) > nContentSize)
+         nBlockMaxCode--;
+      nBlockMaxSize = 1 << (8 + (nBlockMaxCode << 1));
+   }
+
+   nSize += (size_t)nMaxBatchBlocks * nBlockMaxSize;
+   if (nFlags & LZ4ULTRA_FLAG_VERIFY)
+      nSize += (size_t)nMaxBatchBlocks * (HISTORY_SIZE + nBlockMaxSize);
+   nSize += (size_t)nMaxBatchBlocks * (sizeof(lz4ultra_compressor) + sizeof(lz4ultra_compressor *) + sizeof(lz4ultra_block_job_t));
+   nSize += (size_t)nMaxBatchBlocks * lz4ultra_compressor_get_memory_size(nBlockMaxSize + HISTORY_SIZE, nFlags, nLevel);
+
+   if (nThreads > 1)
+      nSize += lz4ultra_thread_pool_get_memory_size(nThreads);
+
+   if (lz4ultra_seek_table_enabled(nFlags)) {
+      long long nNumBlocks = 256;
+      long long nMaxBlocks = 256;
+
+      if (nContentSize >= 0) {
+         nNumBlocks = (nContentSize + nBlockMaxSize - 1) / nBlockMaxSize;
+         if (nNumBlocks < 1)
+            nNumBlocks = 1;
+      }
+      while (nMaxBlocks < nNumBlocks)
+         nMaxBlocks <<= 1;
+
+      /* Entries, and the encoded table written out at the end */
+      nSize += (size_t)nMaxBlocks * LZ4ULTRA_SEEK_TABLE_ENTRY_SIZE + lz4ultra_get_seek_table_size((size_t)nNumBlocks);
+   }
+
+   nSize += lz4ultra_dictionary_get_memory_size(nDictionaryDataSize);
+
+   if (nFlags & LZ4ULTRA_FLAG_ASYNC_IO) {
+      /* Streamed input is read ahead as well as written behind, with the buffer count used by lz4ultra_compress_file_data() */
+      nSize += 2 * lz4ultra_asyncstream_get_memory_size(4 * ((nThreads > 1) ? nThreads : 1) + 4);
+   }
+
+   return nSize;
+}
+
+/**
+ * Adjust a compression configuration so that compressing a file or stream stays within a memory budget
+ *
+ * The settings that cost the least are given up first: the number of threads is halved, which doesn't change the
+ * compressed output, until it is down to one, or to two for dependent blocks with the binary tree match finder, that finds
+ * slightly different matches when blocks are compressed serially; then match candidates are dropped
+ * (LZ4ULTRA_FLAG_MATCH_CANDIDATES), then the suffix array match finder is replaced with the binary tree
+ * (LZ4ULTRA_FLAG_BT_MATCHFINDER), then the maximum block size is lowered, except for raw blocks, that must hold the whole
+ * input, and legacy frames, whose blocks have a fixed size, and last, two remaining threads go down to one. The memory is
+ * counted as with lz4ultra_compress_get_memory_size().
+ *
+ * @param nMaxMemory memory budget, in bytes
+ * @param pFlags pointer to compression flags (LZ4ULTRA_FLAG_xxx), updated when this function is successful
+ * @param pBlockMaxCode pointer to maximum block size code (4..7 for 64 Kb..4 Mb), updated when this function is successful
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param pThreads pointer to number of blocks to compress concurrently, updated when this function is successful
+ * @param nDictionaryDataSize size of dictionary contents, or 0 for none
+ * @param nContentSize size of the input data, or -1 if unknown
+ *
+ * @return LZ4ULTRA_OK for success, or LZ4ULTRA_ERROR_MEMORY if no configuration fits in the budget
+ */
+lz4ultra_status_t lz4ultra_compress_fit_memory(const size_t nMaxMemory, unsigned int *pFlags, int *pBlockMaxCode, const int nLevel, int *pThreads, const int nDictionaryDataSize,
+                                              const long long nContentSize) {
+   unsigned int nFlags = *pFlags;
+   int nBlockMaxCode = *pBlockMaxCode;
+   int nThreads = *pThreads;
+
+   while (lz4ultra_compress_get_memory_size(nFlags, nBlockMaxCode, nLevel, nThreads, nDictionaryDataSize, nContentSize) > nMaxMemory) {
+      int nMinThreads = 1;
+
+      /* Serially compressed dependent blocks carry the binary tree over from block to block, while concurrent ones each build
+       * it from the bytes in front of them: keep compressing concurrently for as long as possible, so as not to change the output */
+      if (lz4ultra_compressor_uses_binary_tree(nFlags, nLevel) && (nFlags & (LZ4ULTRA_FLAG_INDEP_BLOCKS | LZ4ULTRA_FLAG_LEGACY_FRAMES)) == 0 &&
+          lz4ultra_get_max_batch_blocks(nFlags, 1 << (8 + (nBlockMaxCode << 1)), nThreads, nContentSize) > 1)
+         nMinThreads = 2;
+
+      if (nThreads > nMinThreads)
+         nThreads = ((nThreads >> 1) > nMinThreads) ? (nThreads >> 1) : nMinThreads;
+      else if (nFlags & LZ4ULTRA_FLAG_MATCH_CANDIDATES)
+         nFlags &= ~LZ4ULTRA_FLAG_MATCH_CANDIDATES;
+      else if (lz4ultra_compressor_uses_suffix_array(nFlags, nLevel))
+         nFlags |= LZ4ULTRA_FLAG_BT_MATCHFINDER;
+      else if (nBlockMaxCode > 4 && (nFlags & (LZ4ULTRA_FLAG_RAW_BLOCK | LZ4ULTRA_FLAG_LEGACY_FRAMES)) == 0)
+         nBlockMaxCode--;
+      else if (nThreads > 1)
+         nThreads = 1;
+      else
+         return LZ4ULTRA_ERROR_MEMORY;
+   }
+
+   *pFlags = nFlags;
+   *pBlockMaxCode = nBlockMaxCode;
+   *pThreads = nThreads;
+   return LZ4ULTRA_OK;
+}
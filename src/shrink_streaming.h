@@ -35,9 +35,6 @@
 
 #include "stream.h"
 
-/* Forward declaration */
-typedef enum _lz4ultra_status_t lz4ultra_status_t;
-
 /*-------------- File API -------------- */
 
 /**
@@ -48,18 +45,50 @@ typedef enum _lz4ultra_status_t lz4ultra_status_t;
  * @param pszDictionaryFilename name of dictionary file, or NULL for none
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
  * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
  * @param progress progress function, called after compressing each block, or NULL for none
  * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
  * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
  * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
 lz4ultra_status_t lz4ultra_compress_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename, const unsigned int nFlags,
-   int nBlockMaxCode,
+   int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads,
    void(*start)(int nBlockMaxCode, const unsigned int nFlags),
-   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount);
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/**
+ * Compress file using a prepared dictionary, with a long-lived compression context
+ *
+ * Compressing many files with the same context saves allocating and initializing one for each file. The context
+ * compresses every block when nThreads is 1; otherwise, it compresses the first block of each batch, and contexts for
+ * the other blocks are created for the duration of the call.
+ *
+ * @param pCompressor compression context, created with lz4ultra_compressor_create() without an arena; it is reset and grown as needed
+ * @param pszInFilename name of input(source) file to compress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t (the context must then be reset before use, or freed)
+ */
+lz4ultra_status_t lz4ultra_compress_file_with_context(lz4ultra_compressor *pCompressor, const char *pszInFilename, const char *pszOutFilename,
+                                                      const lz4ultra_prepared_dictionary_t *pDictionary, const unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost,
+                                                      int nThreads, long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount, lz4ultra_stats_t *pStats);
 
 /*-------------- Streaming API -------------- */
 
@@ -72,17 +101,99 @@ lz4ultra_status_t lz4ultra_compress_file(const char *pszInFilename, const char *
  * @param nDictionaryDataSize size of dictionary contents, or 0
  * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
  * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, stored in the frame header if LZ4ULTRA_FLAG_CONTENT_SIZE is set and used not to compress more blocks at once than the input has, or -1 if unknown (the flag is then ignored)
  * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
  * @param progress progress function, called after compressing each block, or NULL for none
  * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
  * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
  * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
  *
  * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
  */
 lz4ultra_status_t lz4ultra_compress_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const void *pDictionaryData, int nDictionaryDataSize, unsigned int nFlags,
-   int nBlockMaxCode,
+   int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
    void(*start)(int nBlockMaxCode, const unsigned int nFlags),
-   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount);
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/**
+ * Compress stream using a prepared dictionary
+ *
+ * The dictionary is sorted once when it is prepared, and the same prepared dictionary can be used to compress any number of
+ * streams, concurrently if needed, which is faster than passing the raw dictionary to lz4ultra_compress_stream() each time.
+ *
+ * @param pInStream input(source) stream to compress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionary prepared dictionary (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nContentSize size of the input data, stored in the frame header if LZ4ULTRA_FLAG_CONTENT_SIZE is set and used not to compress more blocks at once than the input has, or -1 if unknown (the flag is then ignored)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned input(source) size, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_compress_stream_with_dictionary(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const lz4ultra_prepared_dictionary_t *pDictionary,
+   unsigned int nFlags, int nBlockMaxCode, int nLevel, int nDecodeCost, int nThreads, long long nContentSize,
+   void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+   void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+   lz4ultra_stats_t *pStats);
+
+/**
+ * Get the largest amount of memory that compressing a file or stream allocates, for a given configuration
+ *
+ * This counts the input, output and verification buffers, a compression context for each block compressed concurrently
+ * with all of the buffers that its match finder allocates when first needed, the thread pool, the seek table, the
+ * dictionary that the file API prepares from a dictionary file, and the read-ahead and write-behind buffers of
+ * LZ4ULTRA_FLAG_ASYNC_IO. It doesn't count thread stacks, a mapped input file, a long-lived context or a prepared
+ * dictionary passed by the caller, or a block cache. With a known input size, no more blocks are counted as compressed
+ * concurrently than the input has; without one, the seek table is counted for 256 blocks, and grows by 8 bytes per
+ * block past that.
+ *
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx)
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb)
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param nDictionaryDataSize size of dictionary contents, or 0 for none
+ * @param nContentSize size of the input data, or -1 if unknown
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_compress_get_memory_size(unsigned int nFlags, int nBlockMaxCode, const int nLevel, const int nThreads, const int nDictionaryDataSize, const long long nContentSize);
+
+/**
+ * Adjust a compression configuration so that compressing a file or stream stays within a memory budget
+ *
+ * The settings that cost the least are given up first: the number of threads is halved, which doesn't change the
+ * compressed output, until it is down to one, or to two for dependent blocks with the binary tree match finder, that finds
+ * slightly different matches when blocks are compressed serially; then match candidates are dropped
+ * (LZ4ULTRA_FLAG_MATCH_CANDIDATES), then the suffix array match finder is replaced with the binary tree
+ * (LZ4ULTRA_FLAG_BT_MATCHFINDER), then the maximum block size is lowered, except for raw blocks, that must hold the whole
+ * input, and legacy frames, whose blocks have a fixed size, and last, two remaining threads go down to one. The memory is
+ * counted as with lz4ultra_compress_get_memory_size().
+ *
+ * @param nMaxMemory memory budget, in bytes
+ * @param pFlags pointer to compression flags (LZ4ULTRA_FLAG_xxx), updated when this function is successful
+ * @param pBlockMaxCode pointer to maximum block size code (4..7 for 64 Kb..4 Mb), updated when this function is successful
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param pThreads pointer to number of blocks to compress concurrently, updated when this function is successful
+ * @param nDictionaryDataSize size of dictionary contents, or 0 for none
+ * @param nContentSize size of the input data, or -1 if unknown
+ *
+ * @return LZ4ULTRA_OK for success, or LZ4ULTRA_ERROR_MEMORY if no configuration fits in the budget
+ */
+lz4ultra_status_t lz4ultra_compress_fit_memory(const size_t nMaxMemory, unsigned int *pFlags, int *pBlockMaxCode, const int nLevel, int *pThreads, const int nDictionaryDataSize,
+   const long long nContentSize);
 
 #endif /* _SHRINK_STREAMING_H */
@@ -0,0 +1,92 @@
+/*
+ * stats.c - compression statistics
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "stats.h"
+
+/**
+ * Get the current time from a monotonic clock, for measuring stage times
+ *
+ * @return time in nanoseconds
+ */
+long long lz4ultra_stats_get_time(void) {
+#ifdef _WIN32
+   static LARGE_INTEGER nFrequency;
+   LARGE_INTEGER nCurTime;
+
+   if (!nFrequency.QuadPart)
+      QueryPerformanceFrequency(&nFrequency);
+   QueryPerformanceCounter(&nCurTime);
+
+   /* Split the conversion so that it doesn't overflow for high frequency counters */
+   return (long long)((nCurTime.QuadPart / nFrequency.QuadPart) * 1000000000LL + ((nCurTime.QuadPart % nFrequency.QuadPart) * 1000000000LL) / nFrequency.QuadPart);
+#else
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000000LL + (long long)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Add statistics to a total
+ *
+ * @param pTotal statistics to add to
+ * @param pStats statistics to add
+ */
+void lz4ultra_stats_add(lz4ultra_stats_t *pTotal, const lz4ultra_stats_t *pStats) {
+   pTotal->check_time += pStats->check_time;
+   pTotal->sort_time += pStats->sort_time;
+   pTotal->lcp_time += pStats->lcp_time;
+   pTotal->intervals_time += pStats->intervals_time;
+   pTotal->skip_time += pStats->skip_time;
+   pTotal->find_time += pStats->find_time;
+   pTotal->parse_time += pStats->parse_time;
+   pTotal->reduce_time += pStats->reduce_time;
+   pTotal->write_time += pStats->write_time;
+
+   pTotal->num_blocks += pStats->num_blocks;
+   pTotal->num_input_bytes += pStats->num_input_bytes;
+   pTotal->num_output_bytes += pStats->num_output_bytes;
+   pTotal->num_matches += pStats->num_matches;
+   pTotal->num_joined_matches += pStats->num_joined_matches;
+   pTotal->num_reduced_commands += pStats->num_reduced_commands;
+   pTotal->num_commands += pStats->num_commands;
+   pTotal->num_literals += pStats->num_literals;
+   pTotal->num_uncompressed_blocks += pStats->num_uncompressed_blocks;
+   pTotal->num_skipped_blocks += pStats->num_skipped_blocks;
+   pTotal->num_cached_blocks += pStats->num_cached_blocks;
+}
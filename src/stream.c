@@ -109,3 +109,24 @@ int lz4ultra_filestream_open(lz4ultra_stream_t *stream, const char *pszInFilenam
    else
       return -1;
 }
+
+/**
+ * Get size of the file behind a file stream, without moving the current position
+ *
+ * @param stream stream opened with lz4ultra_filestream_open()
+ *
+ * @return file size in bytes, or -1 if the file isn't seekable
+ */
+long long lz4ultra_filestream_get_size(lz4ultra_stream_t *stream) {
+   FILE *f = (FILE*)stream->obj;
+   long nCurPos, nSize;
+
+   nCurPos = ftell(f);
+   if (nCurPos < 0 || fseek(f, 0, SEEK_END) != 0)
+      return -1;
+   nSize = ftell(f);
+   if (fseek(f, nCurPos, SEEK_SET) != 0)
+      return -1;
+
+   return (long long)nSize;
+}
@@ -33,53 +33,7 @@
 #ifndef _STREAM_H
 #define _STREAM_H
 
-/* Forward declaration */
-typedef struct _lz4ultra_stream_t lz4ultra_stream_t;
-
-/* I/O stream */
-typedef struct _lz4ultra_stream_t {
-   /** Opaque stream-specific pointer */
-   void *obj;
-
-   /**
-    * Read from stream
-    *
-    * @param stream stream
-    * @param ptr buffer to read into
-    * @param size number of bytes to read
-    *
-    * @return number of bytes read
-    */
-   size_t(*read)(lz4ultra_stream_t *stream, void *ptr, size_t size);
-
-   /**
-    * Write to stream
-    *
-    * @param stream stream
-    * @param ptr buffer to write from
-    * @param size number of bytes to write
-    *
-    * @return number of bytes written
-    */
-   size_t(*write)(lz4ultra_stream_t *stream, void *ptr, size_t size);
-
-
-   /**
-    * Check if stream has reached the end of the data
-    *
-    * @param stream stream
-    *
-    * @return nonzero if the end of the data has been reached, 0 if there is more data
-    */
-   int(*eof)(lz4ultra_stream_t *stream);
-
-   /**
-    * Close stream
-    *
-    * @param stream stream
-    */
-   void(*close)(lz4ultra_stream_t *stream);
-} lz4ultra_stream_t;
+#include "lz4ultra.h"
 
 /**
  * Open file and create an I/O stream from it
@@ -92,4 +46,13 @@ typedef struct _lz4ultra_stream_t {
  */
 int lz4ultra_filestream_open(lz4ultra_stream_t *stream, const char *pszInFilename, const char *pszMode);
 
+/**
+ * Get size of the file behind a file stream, without moving the current position
+ *
+ * @param stream stream opened with lz4ultra_filestream_open()
+ *
+ * @return file size in bytes, or -1 if the file isn't seekable
+ */
+long long lz4ultra_filestream_get_size(lz4ultra_stream_t *stream);
+
 #endif /* _STREAM_H */
@@ -0,0 +1,369 @@
+/*
+ * threadpool.c - thread pool implementation
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "threadpool.h"
+
+/*-------------- Synchronization primitives -------------- */
+
+/**
+ * Initialize mutex
+ *
+ * @param pMutex mutex to initialize
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_mutex_init(lz4ultra_mutex_t *pMutex) {
+#ifdef _WIN32
+   InitializeCriticalSection(pMutex);
+   return 0;
+#else
+   return pthread_mutex_init(pMutex, NULL);
+#endif
+}
+
+/**
+ * Lock mutex
+ *
+ * @param pMutex mutex to lock
+ */
+void lz4ultra_mutex_lock(lz4ultra_mutex_t *pMutex) {
+#ifdef _WIN32
+   EnterCriticalSection(pMutex);
+#else
+   pthread_mutex_lock(pMutex);
+#endif
+}
+
+/**
+ * Unlock mutex
+ *
+ * @param pMutex mutex to unlock
+ */
+void lz4ultra_mutex_unlock(lz4ultra_mutex_t *pMutex) {
+#ifdef _WIN32
+   LeaveCriticalSection(pMutex);
+#else
+   pthread_mutex_unlock(pMutex);
+#endif
+}
+
+/**
+ * Clean up mutex
+ *
+ * @param pMutex mutex to clean up
+ */
+void lz4ultra_mutex_destroy(lz4ultra_mutex_t *pMutex) {
+#ifdef _WIN32
+   DeleteCriticalSection(pMutex);
+#else
+   pthread_mutex_destroy(pMutex);
+#endif
+}
+
+/**
+ * Initialize condition variable
+ *
+ * @param pCond condition variable to initialize
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_cond_init(lz4ultra_cond_t *pCond) {
+#ifdef _WIN32
+   InitializeConditionVariable(pCond);
+   return 0;
+#else
+   return pthread_cond_init(pCond, NULL);
+#endif
+}
+
+/**
+ * Wait on condition variable
+ *
+ * @param pCond condition variable to wait on
+ * @param pMutex mutex, locked by the caller, released while waiting
+ */
+void lz4ultra_cond_wait(lz4ultra_cond_t *pCond, lz4ultra_mutex_t *pMutex) {
+#ifdef _WIN32
+   SleepConditionVariableCS(pCond, pMutex, INFINITE);
+#else
+   pthread_cond_wait(pCond, pMutex);
+#endif
+}
+
+/**
+ * Wake up all threads waiting on condition variable
+ *
+ * @param pCond condition variable to signal
+ */
+void lz4ultra_cond_broadcast(lz4ultra_cond_t *pCond) {
+#ifdef _WIN32
+   WakeAllConditionVariable(pCond);
+#else
+   pthread_cond_broadcast(pCond);
+#endif
+}
+
+/**
+ * Clean up condition variable
+ *
+ * @param pCond condition variable to clean up
+ */
+void lz4ultra_cond_destroy(lz4ultra_cond_t *pCond) {
+#ifndef _WIN32
+   pthread_cond_destroy(pCond);
+#endif
+}
+
+/**
+ * Get number of logical processors available to this process
+ *
+ * @return number of processors (at least 1)
+ */
+int lz4ultra_get_cpu_count(void) {
+   int nCount;
+
+#ifdef _WIN32
+   SYSTEM_INFO sysInfo;
+   GetSystemInfo(&sysInfo);
+   nCount = (int)sysInfo.dwNumberOfProcessors;
+#else
+   nCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   if (nCount < 1)
+      nCount = 1;
+   return nCount;
+}
+
+/*-------------- Thread pool -------------- */
+
+/**
+ * Worker thread main loop: run queued tasks until the pool is shut down
+ *
+ * @param pPool thread pool
+ */
+static void lz4ultra_thread_pool_worker(lz4ultra_thread_pool_t *pPool) {
+   lz4ultra_mutex_lock(&pPool->lock);
+
+   for (;;) {
+      while (!pPool->num_queued && !pPool->shutdown)
+         lz4ultra_cond_wait(&pPool->work_cond, &pPool->lock);
+      if (!pPool->num_queued)
+         break;
+
+      lz4ultra_pool_task_t curTask = pPool->tasks[pPool->first_task];
+      pPool->first_task = (pPool->first_task + 1) % pPool->max_tasks;
+      pPool->num_queued--;
+
+      lz4ultra_mutex_unlock(&pPool->lock);
+      curTask.task(curTask.arg);
+      lz4ultra_mutex_lock(&pPool->lock);
+
+      pPool->num_pending--;
+      if (!pPool->num_pending)
+         lz4ultra_cond_broadcast(&pPool->done_cond);
+   }
+
+   lz4ultra_mutex_unlock(&pPool->lock);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI lz4ultra_thread_pool_thread_main(LPVOID pArg) {
+   lz4ultra_thread_pool_worker((lz4ultra_thread_pool_t *)pArg);
+   return 0;
+}
+#else
+static void *lz4ultra_thread_pool_thread_main(void *pArg) {
+   lz4ultra_thread_pool_worker((lz4ultra_thread_pool_t *)pArg);
+   return NULL;
+}
+#endif
+
+/**
+ * Get the amount of memory that a thread pool allocates when it is initialized, excluding the thread stacks
+ *
+ * @param nThreads number of worker threads
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_thread_pool_get_memory_size(const int nThreads) {
+   if (nThreads < 1)
+      return 0;
+   return (size_t)nThreads * sizeof(lz4ultra_thread_t) + (size_t)nThreads * 2 * sizeof(lz4ultra_pool_task_t);
+}
+
+/**
+ * Initialize thread pool and start worker threads
+ *
+ * @param pPool thread pool to initialize
+ * @param nThreads number of worker threads to start
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_thread_pool_init(lz4ultra_thread_pool_t *pPool, const int nThreads) {
+   int i;
+
+   memset(pPool, 0, sizeof(lz4ultra_thread_pool_t));
+   if (nThreads < 1)
+      return 100;
+
+   pPool->threads = (lz4ultra_thread_t *)malloc(nThreads * sizeof(lz4ultra_thread_t));
+   if (!pPool->threads)
+      return 100;
+
+   pPool->max_tasks = nThreads * 2;
+   pPool->tasks = (lz4ultra_pool_task_t *)malloc(pPool->max_tasks * sizeof(lz4ultra_pool_task_t));
+   if (!pPool->tasks) {
+      free(pPool->threads);
+      pPool->threads = NULL;
+      return 100;
+   }
+
+   lz4ultra_mutex_init(&pPool->lock);
+   lz4ultra_cond_init(&pPool->work_cond);
+   lz4ultra_cond_init(&pPool->done_cond);
+
+   for (i = 0; i < nThreads; i++) {
+#ifdef _WIN32
+      pPool->threads[i] = CreateThread(NULL, 0, lz4ultra_thread_pool_thread_main, pPool, 0, NULL);
+      if (!pPool->threads[i])
+         break;
+#else
+      if (pthread_create(&pPool->threads[i], NULL, lz4ultra_thread_pool_thread_main, pPool) != 0)
+         break;
+#endif
+      pPool->num_threads++;
+   }
+
+   if (pPool->num_threads != nThreads) {
+      lz4ultra_thread_pool_destroy(pPool);
+      return 100;
+   }
+
+   return 0;
+}
+
+/**
+ * Queue task for execution by a worker thread
+ *
+ * @param pPool thread pool
+ * @param task task function
+ * @param pTaskArg argument passed to task function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_thread_pool_submit(lz4ultra_thread_pool_t *pPool, lz4ultra_task_fn task, void *pTaskArg) {
+   lz4ultra_mutex_lock(&pPool->lock);
+
+   if (pPool->num_queued == pPool->max_tasks) {
+      /* Grow task queue, unwrapping it in the process */
+      int nNewMaxTasks = pPool->max_tasks * 2;
+      lz4ultra_pool_task_t *pNewTasks = (lz4ultra_pool_task_t *)malloc(nNewMaxTasks * sizeof(lz4ultra_pool_task_t));
+      int i;
+
+      if (!pNewTasks) {
+         lz4ultra_mutex_unlock(&pPool->lock);
+         return 100;
+      }
+
+      for (i = 0; i < pPool->num_queued; i++)
+         pNewTasks[i] = pPool->tasks[(pPool->first_task + i) % pPool->max_tasks];
+
+      free(pPool->tasks);
+      pPool->tasks = pNewTasks;
+      pPool->max_tasks = nNewMaxTasks;
+      pPool->first_task = 0;
+   }
+
+   lz4ultra_pool_task_t *pNewTask = &pPool->tasks[(pPool->first_task + pPool->num_queued) % pPool->max_tasks];
+   pNewTask->task = task;
+   pNewTask->arg = pTaskArg;
+   pPool->num_queued++;
+   pPool->num_pending++;
+
+   lz4ultra_cond_broadcast(&pPool->work_cond);
+   lz4ultra_mutex_unlock(&pPool->lock);
+   return 0;
+}
+
+/**
+ * Wait until all queued tasks have completed
+ *
+ * @param pPool thread pool
+ */
+void lz4ultra_thread_pool_wait(lz4ultra_thread_pool_t *pPool) {
+   lz4ultra_mutex_lock(&pPool->lock);
+   while (pPool->num_pending)
+      lz4ultra_cond_wait(&pPool->done_cond, &pPool->lock);
+   lz4ultra_mutex_unlock(&pPool->lock);
+}
+
+/**
+ * Stop worker threads and free up any resources associated with thread pool
+ *
+ * @param pPool thread pool to clean up
+ */
+void lz4ultra_thread_pool_destroy(lz4ultra_thread_pool_t *pPool) {
+   int i;
+
+   if (!pPool->threads)
+      return;
+
+   lz4ultra_mutex_lock(&pPool->lock);
+   pPool->shutdown = 1;
+   lz4ultra_cond_broadcast(&pPool->work_cond);
+   lz4ultra_mutex_unlock(&pPool->lock);
+
+   for (i = 0; i < pPool->num_threads; i++) {
+#ifdef _WIN32
+      WaitForSingleObject(pPool->threads[i], INFINITE);
+      CloseHandle(pPool->threads[i]);
+#else
+      pthread_join(pPool->threads[i], NULL);
+#endif
+   }
+
+   lz4ultra_cond_destroy(&pPool->done_cond);
+   lz4ultra_cond_destroy(&pPool->work_cond);
+   lz4ultra_mutex_destroy(&pPool->lock);
+
+   free(pPool->tasks);
+   pPool->tasks = NULL;
+
+   free(pPool->threads);
+   pPool->threads = NULL;
+   pPool->num_threads = 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * threadpool.h - thread pool definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#include "lz4ultra.h"
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION lz4ultra_mutex_t;
+typedef CONDITION_VARIABLE lz4ultra_cond_t;
+typedef HANDLE lz4ultra_thread_t;
+#else
+typedef pthread_mutex_t lz4ultra_mutex_t;
+typedef pthread_cond_t lz4ultra_cond_t;
+typedef pthread_t lz4ultra_thread_t;
+#endif
+
+/** One queued task */
+typedef struct _lz4ultra_pool_task_t {
+   lz4ultra_task_fn task;
+   void *arg;
+} lz4ultra_pool_task_t;
+
+/** Fixed-size pool of worker threads, running queued tasks */
+typedef struct _lz4ultra_thread_pool_t {
+   lz4ultra_mutex_t lock;
+   lz4ultra_cond_t work_cond;
+   lz4ultra_cond_t done_cond;
+   lz4ultra_thread_t *threads;
+   lz4ultra_pool_task_t *tasks;
+   int num_threads;
+   int max_tasks;
+   int first_task;
+   int num_queued;
+   int num_pending;
+   int shutdown;
+} lz4ultra_thread_pool_t;
+
+/**
+ * Initialize mutex
+ *
+ * @param pMutex mutex to initialize
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_mutex_init(lz4ultra_mutex_t *pMutex);
+
+/**
+ * Lock mutex
+ *
+ * @param pMutex mutex to lock
+ */
+void lz4ultra_mutex_lock(lz4ultra_mutex_t *pMutex);
+
+/**
+ * Unlock mutex
+ *
+ * @param pMutex mutex to unlock
+ */
+void lz4ultra_mutex_unlock(lz4ultra_mutex_t *pMutex);
+
+/**
+ * Clean up mutex
+ *
+ * @param pMutex mutex to clean up
+ */
+void lz4ultra_mutex_destroy(lz4ultra_mutex_t *pMutex);
+
+/**
+ * Initialize condition variable
+ *
+ * @param pCond condition variable to initialize
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_cond_init(lz4ultra_cond_t *pCond);
+
+/**
+ * Wait on condition variable
+ *
+ * @param pCond condition variable to wait on
+ * @param pMutex mutex, locked by the caller, released while waiting
+ */
+void lz4ultra_cond_wait(lz4ultra_cond_t *pCond, lz4ultra_mutex_t *pMutex);
+
+/**
+ * Wake up all threads waiting on condition variable
+ *
+ * @param pCond condition variable to signal
+ */
+void lz4ultra_cond_broadcast(lz4ultra_cond_t *pCond);
+
+/**
+ * Clean up condition variable
+ *
+ * @param pCond condition variable to clean up
+ */
+void lz4ultra_cond_destroy(lz4ultra_cond_t *pCond);
+
+/**
+ * Get number of logical processors available to this process
+ *
+ * @return number of processors (at least 1)
+ */
+int lz4ultra_get_cpu_count(void);
+
+/**
+ * Get the amount of memory that a thread pool allocates when it is initialized, excluding the thread stacks
+ *
+ * @param nThreads number of worker threads
+ *
+ * @return size in bytes
+ */
+size_t lz4ultra_thread_pool_get_memory_size(const int nThreads);
+
+/**
+ * Initialize thread pool and start worker threads
+ *
+ * @param pPool thread pool to initialize
+ * @param nThreads number of worker threads to start
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_thread_pool_init(lz4ultra_thread_pool_t *pPool, const int nThreads);
+
+/**
+ * Queue task for execution by a worker thread
+ *
+ * @param pPool thread pool
+ * @param task task function
+ * @param pTaskArg argument passed to task function
+ *
+ * @return 0 for success, non-zero for failure
+ */
+int lz4ultra_thread_pool_submit(lz4ultra_thread_pool_t *pPool, lz4ultra_task_fn task, void *pTaskArg);
+
+/**
+ * Wait until all queued tasks have completed
+ *
+ * @param pPool thread pool
+ */
+void lz4ultra_thread_pool_wait(lz4ultra_thread_pool_t *pPool);
+
+/**
+ * Stop worker threads and free up any resources associated with thread pool
+ *
+ * @param pPool thread pool to clean up
+ */
+void lz4ultra_thread_pool_destroy(lz4ultra_thread_pool_t *pPool);
+
+#endif /* _THREADPOOL_H */
@@ -0,0 +1,300 @@
+/*
+ * transcode.c - recompress LZ4 frames without an intermediate decompressed copy
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "transcode.h"
+#include "expand_window.h"
+#include "format.h"
+#include "lib.h"
+
+/** Size of each read from the input stream */
+#define TRANSCODE_IO_SIZE 65536
+
+/** Input stream that hands out the decompressed contents of an LZ4 frame read from another stream */
+typedef struct _lz4ultra_decoding_stream_t {
+   lz4ultra_stream_t *pInStream;
+   lz4ultra_window_decompressor_t ctx;
+   unsigned char *pInData;
+   size_t nInDataOffset;
+   size_t nInDataSize;
+   int nInputEnded;
+   lz4ultra_status_t nStatus;
+} lz4ultra_decoding_stream_t;
+
+/**
+ * Make sure that there is compressed input to decode, reading more if all of it was consumed
+ *
+ * @param pDecoder decoding stream
+ *
+ * @return nonzero if there is input, 0 if the input stream has ended
+ */
+static int lz4ultra_decoding_stream_fill(lz4ultra_decoding_stream_t *pDecoder) {
+   if (pDecoder->nInDataOffset == pDecoder->nInDataSize && !pDecoder->nInputEnded) {
+      pDecoder->nInDataOffset = 0;
+      pDecoder->nInDataSize = pDecoder->pInStream->eof(pDecoder->pInStream) ? 0 : pDecoder->pInStream->read(pDecoder->pInStream, pDecoder->pInData, TRANSCODE_IO_SIZE);
+      if (pDecoder->nInDataSize == 0)
+         pDecoder->nInputEnded = 1;
+   }
+
+   return (pDecoder->nInDataOffset < pDecoder->nInDataSize) ? 1 : 0;
+}
+
+/**
+ * Decode compressed input into a span
+ *
+ * @param pDecoder decoding stream
+ * @param pOutData output(decompressed) span
+ * @param nOutDataSize size of output span, in bytes (0 to only decode the frame header)
+ *
+ * @return number of bytes written to the output span
+ */
+static size_t lz4ultra_decoding_stream_decode(lz4ultra_decoding_stream_t *pDecoder, unsigned char *pOutData, size_t nOutDataSize) {
+   size_t nOutProduced = 0;
+
+   while (!pDecoder->nStatus && !lz4ultra_window_decompress_done(&pDecoder->ctx) && lz4ultra_decoding_stream_fill(pDecoder)) {
+      size_t nInConsumed = 0, nCurOutProduced = 0;
+
+      pDecoder->nStatus = lz4ultra_window_decompress_update(&pDecoder->ctx, pDecoder->pInData + pDecoder->nInDataOffset, pDecoder->nInDataSize - pDecoder->nInDataOffset, &nInConsumed,
+                                                            pOutData + nOutProduced, nOutDataSize - nOutProduced, &nCurOutProduced);
+      pDecoder->nInDataOffset += nInConsumed;
+      nOutProduced += nCurOutProduced;
+
+      if (nOutProduced == nOutDataSize && (nOutDataSize || pDecoder->ctx.nBlockMaxSize))
+         break;
+   }
+
+   return nOutProduced;
+}
+
+/**
+ * Read decompressed bytes from decoding stream
+ *
+ * @param stream stream
+ * @param ptr buffer to read into
+ * @param size number of bytes to read
+ *
+ * @return number of bytes read
+ */
+static size_t lz4ultra_decoding_stream_read(lz4ultra_stream_t *stream, void *ptr, size_t size) {
+   return lz4ultra_decoding_stream_decode((lz4ultra_decoding_stream_t *)stream->obj, (unsigned char *)ptr, size);
+}
+
+/**
+ * Check if decoding stream has reached the end of the frame, or can't go any further
+ *
+ * @param stream stream
+ *
+ * @return nonzero if the end of the data has been reached, 0 if there is more data
+ */
+static int lz4ultra_decoding_stream_eof(lz4ultra_stream_t *stream) {
+   lz4ultra_decoding_stream_t *pDecoder = (lz4ultra_decoding_stream_t *)stream->obj;
+
+   if (pDecoder->nStatus || lz4ultra_window_decompress_done(&pDecoder->ctx))
+      return 1;
+   return lz4ultra_decoding_stream_fill(pDecoder) ? 0 : 1;
+}
+
+/**
+ * Recompress a stream holding an LZ4 frame, without going through an intermediate decompressed copy
+ *
+ * The input frame is decoded through a 64 Kb window as it is read, and the decoded bytes are fed straight to the stream
+ * compressor, which compresses nThreads blocks at a time. Unless they are overridden, the output frame keeps the input
+ * frame's block size and block independence, and its content size when the input frame records it.
+ *
+ * @param pInStream input stream holding the LZ4 frame to recompress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionary prepared dictionary that the input was compressed with, and to compress the output with (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx); LZ4ULTRA_FLAG_INDEP_BLOCKS is ignored, see nIndependentBlocks
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb), or 0 to keep the input frame's
+ * @param nIndependentBlocks 1 to compress independent blocks, 0 for dependent blocks, or -1 to keep the input frame's setting
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned decompressed size of the input frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_transcode_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const lz4ultra_prepared_dictionary_t *pDictionary,
+                                            unsigned int nFlags, int nBlockMaxCode, int nIndependentBlocks, int nLevel, int nDecodeCost, int nThreads,
+                                            void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                            void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                            lz4ultra_stats_t *pStats) {
+   lz4ultra_decoding_stream_t decoder;
+   lz4ultra_stream_t decodedStream;
+   unsigned char cNoOutput = 0;
+   long long nContentSize = -1;
+   long long nOriginalSize = 0LL, nCompressedSize = 0LL;
+   int nCommandCount = 0;
+   lz4ultra_status_t nStatus;
+
+   memset(&decoder, 0, sizeof(decoder));
+   decoder.pInStream = pInStream;
+   decoder.pInData = (unsigned char *)malloc(TRANSCODE_IO_SIZE);
+   if (!decoder.pInData)
+      return LZ4ULTRA_ERROR_MEMORY;
+
+   lz4ultra_window_decompressor_init(&decoder.ctx);
+   decoder.nStatus = lz4ultra_window_decompress_begin(&decoder.ctx, pDictionary ? pDictionary->data : NULL, pDictionary ? pDictionary->size : 0, 0);
+
+   /* Decode the input frame's header first, for the settings to keep */
+   lz4ultra_decoding_stream_decode(&decoder, &cNoOutput, 0);
+   if (!decoder.nStatus && !decoder.ctx.nBlockMaxSize)
+      decoder.nStatus = LZ4ULTRA_ERROR_SRC;
+   nStatus = decoder.nStatus;
+
+   if (!nStatus) {
+      const unsigned int nInFlags = decoder.ctx.nFlags;
+
+      if (!nBlockMaxCode) {
+         /* Legacy frames have 8 Mb blocks, compress them with the largest block size of the frame format */
+         nBlockMaxCode = 4;
+         while (nBlockMaxCode < 7 && (1 << (8 + (nBlockMaxCode << 1))) < decoder.ctx.nBlockMaxSize)
+            nBlockMaxCode++;
+      }
+
+      /* Legacy frames always have independent blocks */
+      if (nIndependentBlocks < 0)
+         nIndependentBlocks = (nInFlags & (LZ4ULTRA_FLAG_INDEP_BLOCKS | LZ4ULTRA_FLAG_LEGACY_FRAMES)) ? 1 : 0;
+      if (nIndependentBlocks)
+         nFlags |= LZ4ULTRA_FLAG_INDEP_BLOCKS;
+      else
+         nFlags &= ~LZ4ULTRA_FLAG_INDEP_BLOCKS;
+
+      if (nInFlags & LZ4ULTRA_FLAG_CONTENT_SIZE) {
+         nFlags |= LZ4ULTRA_FLAG_CONTENT_SIZE;
+         nContentSize = (long long)decoder.ctx.nContentSize;
+      }
+
+      decodedStream.obj = &decoder;
+      decodedStream.read = lz4ultra_decoding_stream_read;
+      decodedStream.write = NULL;
+      decodedStream.eof = lz4ultra_decoding_stream_eof;
+      decodedStream.close = NULL;
+
+      nStatus = lz4ultra_compress_stream_with_dictionary(&decodedStream, pOutStream, pDictionary, nFlags, nBlockMaxCode, nLevel, nDecodeCost, nThreads, nContentSize,
+                                                         start, progress, &nOriginalSize, &nCompressedSize, &nCommandCount, pStats);
+
+      /* The compressor sees a decoding error as the end of its input: report it rather than the shortened output */
+      if (decoder.nStatus)
+         nStatus = decoder.nStatus;
+      else if (!nStatus)
+         nStatus = lz4ultra_window_decompress_end(&decoder.ctx, NULL, NULL);
+   }
+
+   lz4ultra_window_decompressor_destroy(&decoder.ctx);
+   free(decoder.pInData);
+
+   if (nStatus)
+      return nStatus;
+
+   if (pOriginalSize)
+      *pOriginalSize = nOriginalSize;
+   if (pCompressedSize)
+      *pCompressedSize = nCompressedSize;
+   if (pCommandCount)
+      *pCommandCount = nCommandCount;
+   return LZ4ULTRA_OK;
+}
+
+/**
+ * Recompress a file holding an LZ4 frame, without going through an intermediate decompressed copy
+ *
+ * With LZ4ULTRA_FLAG_ASYNC_IO, input is read ahead and output is written behind on background threads.
+ *
+ * @param pszInFilename name of input file holding the LZ4 frame to recompress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file that the input was compressed with, and to compress the output with, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx); LZ4ULTRA_FLAG_INDEP_BLOCKS is ignored, see nIndependentBlocks
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb), or 0 to keep the input frame's
+ * @param nIndependentBlocks 1 to compress independent blocks, 0 for dependent blocks, or -1 to keep the input frame's setting
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned decompressed size of the input frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_transcode_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename,
+                                          unsigned int nFlags, int nBlockMaxCode, int nIndependentBlocks, int nLevel, int nDecodeCost, int nThreads,
+                                          void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                          void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                          lz4ultra_stats_t *pStats) {
+   lz4ultra_stream_t inStream, outStream;
+   lz4ultra_prepared_dictionary_t *pDictionary = NULL;
+   /* Read one batch of blocks ahead, and let a whole batch be written behind */
+   int nAsyncBufferCount = 4 * ((nThreads > 1) ? nThreads : 1) + 4;
+   lz4ultra_status_t nStatus;
+
+   if (lz4ultra_filestream_open(&inStream, pszInFilename, "rb") < 0) {
+      return LZ4ULTRA_ERROR_SRC;
+   }
+
+   if (lz4ultra_filestream_open(&outStream, pszOutFilename, "wb") < 0) {
+      inStream.close(&inStream);
+      return LZ4ULTRA_ERROR_DST;
+   }
+
+   nStatus = lz4ultra_dictionary_prepare_file(pszDictionaryFilename, &pDictionary);
+   if (nStatus) {
+      outStream.close(&outStream);
+      inStream.close(&inStream);
+
+      return nStatus;
+   }
+
+   if (nFlags & LZ4ULTRA_FLAG_ASYNC_IO) {
+      lz4ultra_asyncstream_open(&inStream, 0, nAsyncBufferCount);
+      lz4ultra_asyncstream_open(&outStream, 1, nAsyncBufferCount);
+   }
+
+   nStatus = lz4ultra_transcode_stream(&inStream, &outStream, pDictionary, nFlags, nBlockMaxCode, nIndependentBlocks, nLevel, nDecodeCost, nThreads,
+                                       start, progress, pOriginalSize, pCompressedSize, pCommandCount, pStats);
+   if (!nStatus && lz4ultra_asyncstream_flush(&outStream) != 0)
+      nStatus = LZ4ULTRA_ERROR_DST;
+
+   if (pDictionary)
+      lz4ultra_dictionary_release(pDictionary);
+   outStream.close(&outStream);
+   inStream.close(&inStream);
+   return nStatus;
+}
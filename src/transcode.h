@@ -0,0 +1,98 @@
+/*
+ * transcode.h - transcoder definitions
+ *
+ * Copyright (C) 2019 Emmanuel Marty
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty.  In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+/*
+ * Uses the libdivsufsort library Copyright (c) 2003-2008 Yuta Mori
+ *
+ * Inspired by LZ4 by Yann Collet. https://github.com/lz4/lz4
+ * With help, ideas, optimizations and speed measurements by spke <zxintrospec@gmail.com>
+ * With ideas from Lizard by Przemyslaw Skibinski and Yann Collet. https://github.com/inikep/lizard
+ * Also with ideas from smallz4 by Stephan Brumme. https://create.stephan-brumme.com/smallz4/
+ *
+ */
+
+#ifndef _TRANSCODE_H
+#define _TRANSCODE_H
+
+#include "lz4ultra.h"
+
+/**
+ * Recompress a stream holding an LZ4 frame, without going through an intermediate decompressed copy
+ *
+ * The input frame is decoded through a 64 Kb window as it is read, and the decoded bytes are fed straight to the stream
+ * compressor, which compresses nThreads blocks at a time. Unless they are overridden, the output frame keeps the input
+ * frame's block size and block independence, and its content size when the input frame records it.
+ *
+ * @param pInStream input stream holding the LZ4 frame to recompress
+ * @param pOutStream output(compressed) stream to write to
+ * @param pDictionary prepared dictionary that the input was compressed with, and to compress the output with (see lz4ultra_dictionary_prepare()), or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx); LZ4ULTRA_FLAG_INDEP_BLOCKS is ignored, see nIndependentBlocks
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb), or 0 to keep the input frame's
+ * @param nIndependentBlocks 1 to compress independent blocks, 0 for dependent blocks, or -1 to keep the input frame's setting
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned decompressed size of the input frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_transcode_stream(lz4ultra_stream_t *pInStream, lz4ultra_stream_t *pOutStream, const lz4ultra_prepared_dictionary_t *pDictionary,
+                                            unsigned int nFlags, int nBlockMaxCode, int nIndependentBlocks, int nLevel, int nDecodeCost, int nThreads,
+                                            void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                            void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                            lz4ultra_stats_t *pStats);
+
+/**
+ * Recompress a file holding an LZ4 frame, without going through an intermediate decompressed copy
+ *
+ * With LZ4ULTRA_FLAG_ASYNC_IO, input is read ahead and output is written behind on background threads.
+ *
+ * @param pszInFilename name of input file holding the LZ4 frame to recompress
+ * @param pszOutFilename name of output(compressed) file to generate
+ * @param pszDictionaryFilename name of dictionary file that the input was compressed with, and to compress the output with, or NULL for none
+ * @param nFlags compression flags (LZ4ULTRA_FLAG_xxx); LZ4ULTRA_FLAG_INDEP_BLOCKS is ignored, see nIndependentBlocks
+ * @param nBlockMaxCode maximum block size code (4..7 for 64 Kb..4 Mb), or 0 to keep the input frame's
+ * @param nIndependentBlocks 1 to compress independent blocks, 0 for dependent blocks, or -1 to keep the input frame's setting
+ * @param nLevel compression level (LZ4ULTRA_MIN_LEVEL..LZ4ULTRA_MAX_LEVEL, or 0 for LZ4ULTRA_MAX_LEVEL)
+ * @param nDecodeCost weight of estimated decoder cycles against compressed size, in 1/16ths of a bit per cycle, or 0 to only minimize the size
+ * @param nThreads number of blocks to compress concurrently (1 to compress serially)
+ * @param start start function, called when the max block size is finalized and compression is about to start, or NULL for none
+ * @param progress progress function, called after compressing each block, or NULL for none
+ * @param pOriginalSize pointer to returned decompressed size of the input frame, updated when this function is successful
+ * @param pCompressedSize pointer to returned output(compressed) size, updated when this function is successful
+ * @param pCommandCount pointer to returned token(compression commands) count, updated when this function is successful
+ * @param pStats pointer to returned compression statistics, updated when this function is successful, or NULL not to collect them
+ *
+ * @return LZ4ULTRA_OK for success, or an error value from lz4ultra_status_t
+ */
+lz4ultra_status_t lz4ultra_transcode_file(const char *pszInFilename, const char *pszOutFilename, const char *pszDictionaryFilename,
+                                          unsigned int nFlags, int nBlockMaxCode, int nIndependentBlocks, int nLevel, int nDecodeCost, int nThreads,
+                                          void(*start)(int nBlockMaxCode, const unsigned int nFlags),
+                                          void(*progress)(long long nOriginalSize, long long nCompressedSize), long long *pOriginalSize, long long *pCompressedSize, int *pCommandCount,
+                                          lz4ultra_stats_t *pStats);
+
+#endif /* _TRANSCODE_H */